@@ -0,0 +1,54 @@
+/*
+ * Copyright (C) 2009-2012 the libgit2 contributors
+ *
+ * This file is part of libgit2, distributed under the GNU GPL v2 with
+ * a Linking Exception. For full terms see the included COPYING file.
+ */
+#ifndef INCLUDE_bench_h__
+#define INCLUDE_bench_h__
+
+#include <git2.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#ifdef _WIN32
+#	include <windows.h>
+#else
+#	include <sys/time.h>
+#endif
+
+/* Wall-clock time in seconds */
+static double bench_now(void)
+{
+#ifdef _WIN32
+	LARGE_INTEGER freq, now;
+	QueryPerformanceFrequency(&freq);
+	QueryPerformanceCounter(&now);
+	return (double)now.QuadPart / (double)freq.QuadPart;
+#else
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	return (double)tv.tv_sec + (double)tv.tv_usec / 1000000.0;
+#endif
+}
+
+static void bench_check(int error, const char *action)
+{
+	const git_error *err;
+
+	if (!error)
+		return;
+
+	err = giterr_last();
+	fprintf(stderr, "error %d while %s: %s\n",
+		error, action, err ? err->message : "unknown error");
+	exit(1);
+}
+
+static void bench_report(const char *name, double seconds, int runs)
+{
+	printf("%-32s %10.3f ms/run (%d runs)\n",
+		name, seconds * 1000.0 / runs, runs);
+}
+
+#endif
@@ -0,0 +1,104 @@
+/*
+ * Copyright (C) 2009-2012 the libgit2 contributors
+ *
+ * This file is part of libgit2, distributed under the GNU GPL v2 with
+ * a Linking Exception. For full terms see the included COPYING file.
+ */
+
+/*
+ * Time counting the added and removed lines of a tree to tree diff,
+ * first through the line callback of git_diff_foreach and then with
+ * git_diff_stats.
+ *
+ *     bench-diff-stats <repository> <old-tree> <new-tree>
+ *
+ * Trees are given as revision specs, such as `HEAD~1000` or `v1.0^{tree}`.
+ */
+#include "bench.h"
+#include <string.h>
+
+#define RUNS 5
+
+typedef struct {
+	size_t insertions;
+	size_t deletions;
+} line_counts;
+
+static int count_line(
+	void *cb_data,
+	git_diff_delta *delta,
+	git_diff_range *range,
+	char line_origin,
+	const char *content,
+	size_t content_len)
+{
+	line_counts *counts = cb_data;
+
+	(void)delta; (void)range; (void)content; (void)content_len;
+	if (line_origin == GIT_DIFF_LINE_ADDITION)
+		counts->insertions++;
+	else if (line_origin == GIT_DIFF_LINE_DELETION)
+		counts->deletions++;
+	return 0;
+}
+
+static git_tree *lookup_tree(git_repository *repo, const char *spec)
+{
+	git_object *obj, *tree;
+
+	bench_check(git_revparse_single(&obj, repo, spec), "looking up a tree");
+	bench_check(git_object_peel(&tree, obj, GIT_OBJ_TREE), "peeling to a tree");
+	git_object_free(obj);
+
+	return (git_tree *)tree;
+}
+
+int main(int argc, char **argv)
+{
+	git_repository *repo;
+	git_tree *old_tree, *new_tree;
+	git_diff_list *diff;
+	line_counts counts;
+	double start;
+	int i;
+
+	if (argc != 4) {
+		fprintf(stderr,
+			"usage: %s <repository> <old-tree> <new-tree>\n", argv[0]);
+		return 1;
+	}
+
+	bench_check(git_repository_open(&repo, argv[1]), "opening the repository");
+	old_tree = lookup_tree(repo, argv[2]);
+	new_tree = lookup_tree(repo, argv[3]);
+
+	bench_check(git_diff_tree_to_tree(repo, NULL, old_tree, new_tree, &diff),
+		"diffing the trees");
+	printf("%-32s %10d files\n", "", git_diff_entrycount(diff, -1));
+
+	start = bench_now();
+	for (i = 0; i < RUNS; ++i) {
+		memset(&counts, 0, sizeof(counts));
+		bench_check(git_diff_foreach(diff, &counts, NULL, NULL, count_line),
+			"counting the lines");
+	}
+	bench_report("foreach line callback", bench_now() - start, RUNS);
+	printf("%-32s %10u insertions %10u deletions\n", "",
+		(unsigned int)counts.insertions, (unsigned int)counts.deletions);
+
+	start = bench_now();
+	for (i = 0; i < RUNS; ++i) {
+		memset(&counts, 0, sizeof(counts));
+		bench_check(git_diff_stats(&counts.insertions, &counts.deletions,
+			diff, NULL, NULL), "computing the stats");
+	}
+	bench_report("git_diff_stats", bench_now() - start, RUNS);
+	printf("%-32s %10u insertions %10u deletions\n", "",
+		(unsigned int)counts.insertions, (unsigned int)counts.deletions);
+
+	git_diff_list_free(diff);
+	git_tree_free(old_tree);
+	git_tree_free(new_tree);
+	git_repository_free(repo);
+	return 0;
+}
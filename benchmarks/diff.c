@@ -0,0 +1,124 @@
+/*
+ * Copyright (C) 2009-2012 the libgit2 contributors
+ *
+ * This file is part of libgit2, distributed under the GNU GPL v2 with
+ * a Linking Exception. For full terms see the included COPYING file.
+ */
+
+/*
+ * Time diffing pairs of blobs with the Myers, patience and histogram
+ * algorithms.
+ *
+ *     bench-diff <repository> <old-blob> <new-blob> [<old-blob> <new-blob>...]
+ *
+ * Blobs are given as revision specs, such as `HEAD~100:path/to/file`
+ * and `HEAD:path/to/file`.  Pick large files that changed a lot.
+ */
+#include "bench.h"
+#include <string.h>
+
+#define RUNS 5
+
+typedef struct {
+	int hunks;
+	int lines;
+} diff_counts;
+
+static int count_hunk(
+	void *cb_data,
+	git_diff_delta *delta,
+	git_diff_range *range,
+	const char *header,
+	size_t header_len)
+{
+	(void)delta; (void)range; (void)header; (void)header_len;
+	((diff_counts *)cb_data)->hunks++;
+	return 0;
+}
+
+static int count_line(
+	void *cb_data,
+	git_diff_delta *delta,
+	git_diff_range *range,
+	char line_origin,
+	const char *content,
+	size_t content_len)
+{
+	(void)delta; (void)range; (void)content; (void)content_len;
+	if (line_origin == GIT_DIFF_LINE_ADDITION ||
+		line_origin == GIT_DIFF_LINE_DELETION)
+		((diff_counts *)cb_data)->lines++;
+	return 0;
+}
+
+static git_blob *lookup_blob(git_repository *repo, const char *spec)
+{
+	git_object *obj;
+
+	bench_check(git_revparse_single(&obj, repo, spec), "looking up a blob");
+	if (git_object_type(obj) != GIT_OBJ_BLOB) {
+		fprintf(stderr, "%s is not a blob\n", spec);
+		exit(1);
+	}
+
+	return (git_blob *)obj;
+}
+
+static void run(
+	const char *name, uint32_t flags,
+	git_blob **blobs, int nblobs)
+{
+	git_diff_options opts;
+	diff_counts counts;
+	double start;
+	int i, j;
+
+	memset(&opts, 0, sizeof(opts));
+	opts.flags = flags;
+
+	start = bench_now();
+	for (i = 0; i < RUNS; ++i) {
+		memset(&counts, 0, sizeof(counts));
+
+		for (j = 0; j < nblobs; j += 2)
+			bench_check(git_diff_blobs(blobs[j], blobs[j + 1], &opts,
+				&counts, NULL, count_hunk, count_line), "diffing the blobs");
+	}
+
+	bench_report(name, bench_now() - start, RUNS);
+	printf("%-32s %10d hunks %10d lines\n", "", counts.hunks, counts.lines);
+}
+
+int main(int argc, char **argv)
+{
+	git_repository *repo;
+	git_blob **blobs;
+	int nblobs, i;
+
+	if (argc < 4 || (argc % 2) != 0) {
+		fprintf(stderr,
+			"usage: %s <repository> <old-blob> <new-blob>...\n", argv[0]);
+		return 1;
+	}
+
+	bench_check(git_repository_open(&repo, argv[1]), "opening the repository");
+
+	nblobs = argc - 2;
+	blobs = calloc(nblobs, sizeof(git_blob *));
+	if (!blobs)
+		return 1;
+
+	for (i = 0; i < nblobs; ++i)
+		blobs[i] = lookup_blob(repo, argv[i + 2]);
+
+	run("myers", GIT_DIFF_NORMAL, blobs, nblobs);
+	run("patience", GIT_DIFF_PATIENCE, blobs, nblobs);
+	run("histogram", GIT_DIFF_HISTOGRAM, blobs, nblobs);
+
+	for (i = 0; i < nblobs; ++i)
+		git_blob_free(blobs[i]);
+	free(blobs);
+
+	git_repository_free(repo);
+	return 0;
+}
@@ -0,0 +1,77 @@
+/*
+ * Copyright (C) 2009-2012 the libgit2 contributors
+ *
+ * This file is part of libgit2, distributed under the GNU GPL v2 with
+ * a Linking Exception. For full terms see the included COPYING file.
+ */
+
+/*
+ * Time reading and writing a large index in each on-disk version.
+ *
+ *     bench-index <index-file>
+ *
+ * The index file is rewritten in every version in turn, and is left
+ * in the version it started out with.
+ */
+#include "bench.h"
+#include <sys/stat.h>
+
+#define RUNS 5
+
+static void run(const char *path, unsigned int version)
+{
+	git_index *index;
+	char name[64];
+	double start;
+	struct stat st;
+	int i;
+
+	bench_check(git_index_open(&index, path), "reading the index");
+	bench_check(git_index_set_version(index, version), "setting the version");
+
+	start = bench_now();
+	for (i = 0; i < RUNS; ++i)
+		bench_check(git_index_write(index), "writing the index");
+
+	snprintf(name, sizeof(name), "write v%u", version);
+	bench_report(name, bench_now() - start, RUNS);
+	git_index_free(index);
+
+	start = bench_now();
+	for (i = 0; i < RUNS; ++i) {
+		bench_check(git_index_open(&index, path), "reading the index");
+		git_index_free(index);
+	}
+
+	snprintf(name, sizeof(name), "read v%u", version);
+	bench_report(name, bench_now() - start, RUNS);
+
+	if (stat(path, &st) == 0)
+		printf("%-32s %10ld bytes\n", "", (long)st.st_size);
+}
+
+int main(int argc, char **argv)
+{
+	git_index *index;
+	unsigned int version;
+
+	if (argc != 2) {
+		fprintf(stderr, "usage: %s <index-file>\n", argv[0]);
+		return 1;
+	}
+
+	bench_check(git_index_open(&index, argv[1]), "reading the index");
+	version = git_index_version(index);
+	printf("%u entries\n", git_index_entrycount(index));
+	git_index_free(index);
+
+	run(argv[1], 2);
+	run(argv[1], 4);
+
+	bench_check(git_index_open(&index, argv[1]), "reading the index");
+	bench_check(git_index_set_version(index, version), "setting the version");
+	bench_check(git_index_write(index), "writing the index");
+	git_index_free(index);
+
+	return 0;
+}
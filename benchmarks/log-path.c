@@ -0,0 +1,89 @@
+/*
+ * Copyright (C) 2009-2012 the libgit2 contributors
+ *
+ * This file is part of libgit2, distributed under the GNU GPL v2 with
+ * a Linking Exception. For full terms see the included COPYING file.
+ */
+
+/*
+ * Time `git log -- <path>` style walks with and without changed-path
+ * Bloom filters in the commit-graph.
+ *
+ *     bench-log-path <repository> <path>...
+ *
+ * The commit-graph of the repository is rewritten (twice) and left
+ * with changed-path filters in it.
+ */
+#include "bench.h"
+
+#define RUNS 5
+
+static int walk_paths(git_repository *repo, git_strarray *paths)
+{
+	git_revwalk *walk;
+	git_oid oid;
+	int count = 0;
+
+	bench_check(git_revwalk_new(&walk, repo), "creating the walker");
+	bench_check(git_revwalk_set_pathspec(walk, paths), "setting the pathspec");
+	git_revwalk_sorting(walk, GIT_SORT_TIME);
+	bench_check(git_revwalk_push_head(walk), "pushing HEAD");
+
+	while (git_revwalk_next(&oid, walk) == 0)
+		count++;
+
+	git_revwalk_free(walk);
+	return count;
+}
+
+static void write_graph(git_repository *repo, unsigned int flags)
+{
+	git_revwalk *walk;
+	double start = bench_now();
+
+	bench_check(git_revwalk_new(&walk, repo), "creating the walker");
+	bench_check(git_revwalk_push_glob(walk, "heads/*"), "pushing the branches");
+	bench_check(git_revwalk_write_commit_graph(walk, flags), "writing the commit-graph");
+	git_revwalk_free(walk);
+
+	bench_report((flags & GIT_COMMIT_GRAPH_CHANGED_PATHS) ?
+		"write graph (changed paths)" : "write graph", bench_now() - start, 1);
+}
+
+static void run(git_repository *repo, git_strarray *paths, const char *name)
+{
+	double start;
+	int i, count = 0;
+
+	start = bench_now();
+	for (i = 0; i < RUNS; ++i)
+		count = walk_paths(repo, paths);
+
+	bench_report(name, bench_now() - start, RUNS);
+	printf("%-32s %10d commits\n", "", count);
+}
+
+int main(int argc, char **argv)
+{
+	git_repository *repo;
+	git_strarray paths;
+
+	if (argc < 3) {
+		fprintf(stderr, "usage: %s <repository> <path>...\n", argv[0]);
+		return 1;
+	}
+
+	bench_check(git_repository_open(&repo, argv[1]), "opening the repository");
+
+	paths.strings = argv + 2;
+	paths.count = argc - 2;
+
+	write_graph(repo, 0);
+	run(repo, &paths, "log -- <path> (graph)");
+
+	write_graph(repo, GIT_COMMIT_GRAPH_CHANGED_PATHS);
+	run(repo, &paths, "log -- <path> (bloom filters)");
+
+	git_repository_free(repo);
+	return 0;
+}
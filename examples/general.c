@@ -156,7 +156,9 @@ int main (int argc, char** argv)
 
   // The author and committer methods return [git_signature] structures, which give you name, email
   // and `when`, which is a `git_time` structure, giving you a timestamp and timezone offset.
-  printf("Author: %s (%s)\n", author->name, author->email);
+  // They are parsed when first asked for, so they are NULL if the commit has a malformed signature.
+  if (author != NULL)
+    printf("Author: %s (%s)\n", author->name, author->email);
 
   // Commits can have zero or more parents. The first (root) commit will have no parents, most commits
   // will have one, which is the commit it was based on, and merge commits will have two or more.
@@ -339,7 +341,7 @@ int main (int argc, char** argv)
     error = git_commit_lookup(&wcommit, repo, &oid);
     cmsg  = git_commit_message(wcommit);
     cauth = git_commit_author(wcommit);
-    printf("%s (%s)\n", cmsg, cauth->email);
+    printf("%s (%s)\n", cmsg, cauth ? cauth->email : "unknown");
     git_commit_free(wcommit);
   }
 
@@ -39,6 +39,7 @@
 #include "git2/remote.h"
 #include "git2/clone.h"
 #include "git2/checkout.h"
+#include "git2/sparse.h"
 
 #include "git2/attr.h"
 #include "git2/ignore.h"
@@ -46,6 +47,7 @@
 #include "git2/refspec.h"
 #include "git2/net.h"
 #include "git2/status.h"
+#include "git2/fsmonitor.h"
 #include "git2/indexer.h"
 #include "git2/submodule.h"
 #include "git2/notes.h"
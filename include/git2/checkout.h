@@ -75,6 +75,15 @@ GIT_EXTERN(int) git_checkout_head(
 /**
  * Updates files in the working tree to match the content of the index.
  *
+ * When libgit2 is built thread-safe and `checkout.workers` is set to
+ * more than one (or below one, for one per CPU), the blobs are loaded,
+ * filtered and written on that many threads once there are at least
+ * `checkout.thresholdForParallelism` (100 by default) files to look at.
+ *
+ * The stat data of the files that are written, or found unchanged, is
+ * recorded in their index entries and the index is written, so that the
+ * next status does not have to read them again.
+ *
  * @param repo repository to check out (must be non-bare)
  * @param opts specifies checkout options (may be NULL)
  * @param stats structure through which progress information is reported
@@ -101,14 +101,20 @@ GIT_EXTERN(const char *) git_commit_message(git_commit *commit);
 /**
  * Get the commit time (i.e. committer time) of a commit.
  *
+ * This is 0 if the committer cannot be parsed (see
+ * `git_commit_committer`).
+ *
  * @param commit a previously loaded commit.
- * @return the time of a commit
+ * @return the time of a commit, or 0
  */
 GIT_EXTERN(git_time_t) git_commit_time(git_commit *commit);
 
 /**
  * Get the commit timezone offset (i.e. committer's preferred timezone) of a commit.
  *
+ * This is 0 if the committer cannot be parsed (see
+ * `git_commit_committer`).
+ *
  * @param commit a previously loaded commit.
  * @return positive or negative timezone offset, in minutes from UTC
  */
@@ -117,16 +123,24 @@ GIT_EXTERN(int) git_commit_time_offset(git_commit *commit);
 /**
  * Get the committer of a commit.
  *
+ * The signature is only parsed the first time it is asked for, so a
+ * commit with a malformed committer line can still be looked up.  In
+ * that case, or if memory runs out, NULL is returned and the error is
+ * set.
+ *
  * @param commit a previously loaded commit.
- * @return the committer of a commit
+ * @return the committer of a commit, or NULL on error
  */
 GIT_EXTERN(const git_signature *) git_commit_committer(git_commit *commit);
 
 /**
  * Get the author of a commit.
  *
+ * Like the committer, the author is parsed the first time it is asked
+ * for; NULL is returned and the error is set if that fails.
+ *
  * @param commit a previously loaded commit.
- * @return the author of a commit
+ * @return the author of a commit, or NULL on error
  */
 GIT_EXTERN(const git_signature *) git_commit_author(git_commit *commit);
 
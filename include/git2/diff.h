@@ -32,6 +32,16 @@ GIT_BEGIN_DECL
 /**
  * Flags for diff options.  A combination of these flags can be passed
  * in via the `flags` value in the `git_diff_options`.
+ *
+ * With GIT_DIFF_UPDATE_INDEX, a diff of the working directory against
+ * the index stores the stat data of the files that were read and found
+ * unchanged in the index, and writes the index, so that the next diff
+ * can tell they are unchanged without reading them.
+ *
+ * GIT_DIFF_PATIENCE and GIT_DIFF_HISTOGRAM pick the algorithm used to
+ * compute the changes within a file in place of the default Myers
+ * diff.  Histogram is usually faster than patience and gives similar
+ * hunks; if both flags are given, patience is used.
  */
 enum {
 	GIT_DIFF_NORMAL = 0,
@@ -47,6 +57,8 @@ enum {
 	GIT_DIFF_INCLUDE_UNMODIFIED = (1 << 9),
 	GIT_DIFF_RECURSE_UNTRACKED_DIRS = (1 << 10),
 	GIT_DIFF_DISABLE_PATHSPEC_MATCH = (1 << 11),
+	GIT_DIFF_UPDATE_INDEX = (1 << 12),
+	GIT_DIFF_HISTOGRAM = (1 << 13),
 };
 
 /**
@@ -63,6 +75,8 @@ enum {
  * - new_prefix: "directory" to prefix to new file names (default "b")
  * - pathspec: array of paths / patterns to constrain diff
  * - max_size: maximum blob size to diff, above this treated as binary
+ * - word_regex: POSIX extended regex matching a word, for the word diff
+ *   made by `git_diff_foreach_words` (default is runs of non-space)
  */
 typedef struct {
 	uint32_t flags;				/**< defaults to GIT_DIFF_NORMAL */
@@ -72,8 +86,47 @@ typedef struct {
 	char *new_prefix;			/**< defaults to "b" */
 	git_strarray pathspec;		/**< defaults to show all paths */
 	git_off_t max_size;			/**< defaults to 512Mb */
+	char *word_regex;			/**< defaults to NULL */
 } git_diff_options;
 
+/**
+ * Flags to control the behavior of `git_diff_find_similar`.
+ *
+ * - FIND_RENAMES pairs deleted files with added ones, like `git diff -M`
+ * - FIND_COPIES also looks for added files copied from modified ones,
+ *   like `git diff -C`
+ * - FIND_COPIES_FROM_UNMODIFIED looks at unmodified files as well, like
+ *   `git diff --find-copies-harder`; the diff must have been generated
+ *   with GIT_DIFF_INCLUDE_UNMODIFIED for them to be there
+ * - FIND_EXACT_MATCH_ONLY only pairs files with identical contents,
+ *   without reading any of them
+ */
+enum {
+	GIT_DIFF_FIND_RENAMES = (1 << 0),
+	GIT_DIFF_FIND_COPIES = (1 << 1),
+	GIT_DIFF_FIND_COPIES_FROM_UNMODIFIED = (1 << 2),
+	GIT_DIFF_FIND_EXACT_MATCH_ONLY = (1 << 3),
+};
+
+/**
+ * Structure describing options for `git_diff_find_similar`.
+ *
+ * Setting all values of the structure to zero will yield the default
+ * values, as will passing NULL for the options structure.
+ *
+ * - flags: a combination of the GIT_DIFF_FIND_... values above
+ * - rename_threshold: similarity to pair a deleted and an added file
+ * - copy_threshold: similarity to pair a file with one copied from it
+ * - rename_limit: above this many added files times this many possible
+ *   sources, only files with identical contents are paired
+ */
+typedef struct {
+	unsigned int flags;			/**< defaults to GIT_DIFF_FIND_RENAMES */
+	uint16_t rename_threshold;	/**< defaults to 50 */
+	uint16_t copy_threshold;	/**< defaults to 50 */
+	unsigned int rename_limit;	/**< defaults to diff.renameLimit or 200 */
+} git_diff_find_options;
+
 /**
  * The diff list object that contains all individual file deltas.
  */
@@ -139,7 +192,9 @@ typedef struct {
  * generally tries to fill in as much as possible.  One example is that the
  * "binary" field will not actually look at file contents if you do not
  * pass in hunk and/or line callbacks to the diff foreach iteration function.
- * It will just use the git attributes for those files.
+ * It will just use the git attributes for those files, and the sizes of the
+ * files to mark those larger than `max_size` as binary; it is left at -1
+ * when neither of them tells.
  */
 typedef struct {
 	git_diff_file old_file;
@@ -219,6 +274,42 @@ typedef int (*git_diff_data_fn)(
 	const char *content,
 	size_t content_len);
 
+/**
+ * Origins of the spans of text given to a `git_diff_word_fn`.  These
+ * follow the lines of `git diff --word-diff=porcelain`: a span of words
+ * found on both sides, removed or added, and the end of a line.
+ */
+enum {
+	GIT_DIFF_WORD_CONTEXT  = ' ',
+	GIT_DIFF_WORD_ADDITION = '+',
+	GIT_DIFF_WORD_DELETION = '-',
+	GIT_DIFF_WORD_NEWLINE  = '~'
+};
+
+/**
+ * When iterating over a word diff, callback that will be made per span
+ * of text.  Context and added spans never run over a line end; each
+ * line end of the new side is given as a GIT_DIFF_WORD_NEWLINE span.
+ * Removed spans may hold several lines of the old side.
+ */
+typedef int (*git_diff_word_fn)(
+	void *cb_data,
+	git_diff_delta *delta,
+	git_diff_range *range,
+	char span_origin, /**< GIT_DIFF_WORD_... value from above */
+	const char *content,
+	size_t content_len);
+
+/**
+ * When computing the statistics of a diff, callback made per file with
+ * the number of lines added and removed.  Both are zero for binary files.
+ */
+typedef int (*git_diff_stat_fn)(
+	void *cb_data,
+	git_diff_delta *delta,
+	size_t insertions,
+	size_t deletions);
+
 /**
  * The diff iterator object is used to scan a diff list.
  */
@@ -338,6 +429,29 @@ GIT_EXTERN(int) git_diff_merge(
 	git_diff_list *onto,
 	const git_diff_list *from);
 
+/**
+ * Transform a diff list marking file renames and copies.
+ *
+ * Added files are paired with the deleted files (and, for copies, the
+ * modified or unmodified files) they are most similar to, and become
+ * GIT_DELTA_RENAMED or GIT_DELTA_COPIED deltas whose `old_file` is that
+ * source and whose `similarity` tells how alike the two are; the
+ * deleted files that were renamed leave the list.
+ *
+ * Files with identical contents are paired first, by their OIDs. The
+ * others are compared through a signature of their contents, computed
+ * once per file. Empty files are never paired.
+ *
+ * Call this once the diff list is complete, after any `git_diff_merge`.
+ *
+ * @param diff Diff list to run detection algorithms on
+ * @param options Control how detection should be run, NULL for defaults
+ * @return 0 on success, -1 on failure
+ */
+GIT_EXTERN(int) git_diff_find_similar(
+	git_diff_list *diff,
+	git_diff_find_options *options);
+
 /**@}*/
 
 
@@ -355,13 +469,21 @@ GIT_EXTERN(int) git_diff_merge(
  * should provide a file callback to learn about each file.
  *
  * The "hunk" and "line" callbacks are optional, and the text diff of the
- * files will only be calculated if they are not NULL.  Of course, these
+ * files will only be calculated if they are not NULL.  Without them, the
+ * contents of the files are not read at all, except to settle whether a
+ * file in the working directory really changed.  Of course, these
  * callbacks will not be invoked for binary files on the diff list or for
  * files whose only changed is a file mode change.
  *
  * Returning a non-zero value from any of the callbacks will terminate
  * the iteration and cause this return `GIT_EUSER`.
  *
+ * When libgit2 is built thread-safe and `diff.workers` is set to more
+ * than one (or below one, for one per CPU), the text diffs are computed
+ * on that many threads once there are at least
+ * `diff.thresholdForParallelism` (100 by default) files in the diff.
+ * The callbacks are still made on the calling thread, in order.
+ *
  * @param diff A git_diff_list generated by one of the above functions.
  * @param cb_data Reference pointer that will be passed to your callbacks.
  * @param file_cb Callback function to make per file in the diff.
@@ -380,6 +502,30 @@ GIT_EXTERN(int) git_diff_foreach(
 	git_diff_hunk_fn hunk_cb,
 	git_diff_data_fn line_cb);
 
+/**
+ * Iterate over a diff list, diffing the changed lines word by word.
+ *
+ * This works like `git_diff_foreach`, but instead of the lines of each
+ * hunk the word callback gets spans of text.  Each run of removed lines
+ * and the run of added lines that follows it are split into words by
+ * the `word_regex` of the diff options (any text that is not part of a
+ * word is ignored when comparing) and diffed a second time, word by
+ * word.  The text between the words is taken from the new side.
+ *
+ * @param diff A git_diff_list generated by one of the above functions.
+ * @param cb_data Reference pointer that will be passed to your callbacks.
+ * @param file_cb Callback function to make per file in the diff.
+ * @param hunk_cb Optional callback to make per hunk of text diff.
+ * @param word_cb Callback to make per span of text in the hunks.
+ * @return 0 on success, GIT_EUSER on non-zero callback, or error code
+ */
+GIT_EXTERN(int) git_diff_foreach_words(
+	git_diff_list *diff,
+	void *cb_data,
+	git_diff_file_fn file_cb,
+	git_diff_hunk_fn hunk_cb,
+	git_diff_word_fn word_cb);
+
 /**
  * Create a diff iterator object that can be used to traverse a diff.
  *
@@ -549,6 +695,28 @@ GIT_EXTERN(int) git_diff_print_patch(
 	void *cb_data,
 	git_diff_data_fn print_cb);
 
+/**
+ * Count the lines added and removed in a diff list.
+ *
+ * This gives what `git diff --numstat` and `--shortstat` print.  The
+ * changes are counted from the edit script of the text diff, so no hunk
+ * or line is formatted along the way, which makes this much cheaper
+ * than counting lines with `git_diff_foreach`.
+ *
+ * @param insertions Output total number of added lines (can be NULL)
+ * @param deletions Output total number of removed lines (can be NULL)
+ * @param diff A git_diff_list generated by one of the above functions.
+ * @param cb_data Reference pointer that will be passed to your callback.
+ * @param stat_cb Optional callback to make per file in the diff.
+ * @return 0 on success, GIT_EUSER on non-zero callback, or error code
+ */
+GIT_EXTERN(int) git_diff_stats(
+	size_t *insertions,
+	size_t *deletions,
+	git_diff_list *diff,
+	void *cb_data,
+	git_diff_stat_fn stat_cb);
+
 /**
  * Query how many diff records are there in a diff list.
  *
@@ -0,0 +1,97 @@
+/*
+ * Copyright (C) 2009-2012 the libgit2 contributors
+ *
+ * This file is part of libgit2, distributed under the GNU GPL v2 with
+ * a Linking Exception. For full terms see the included COPYING file.
+ */
+#ifndef INCLUDE_git_fsmonitor_h__
+#define INCLUDE_git_fsmonitor_h__
+
+#include "common.h"
+#include "types.h"
+
+/**
+ * @file git2/fsmonitor.h
+ * @brief Git file system monitor routines
+ * @defgroup git_fsmonitor Git file system monitor routines
+ * @ingroup Git
+ * @{
+ */
+GIT_BEGIN_DECL
+
+/**
+ * Callback for each path that a file system monitor reports as changed.
+ *
+ * The path is relative to the working directory. A path that ends in
+ * a slash stands for everything below that directory.
+ */
+typedef int (*git_fsmonitor_changed_cb)(const char *path, void *payload);
+
+/**
+ * A file system monitor, which tells which paths in the working
+ * directory may have changed since an earlier point in time.
+ *
+ * Paths that the monitor does not report need not be looked at again
+ * by `git_status_foreach_ext` and `git_diff_workdir_to_index`, as long
+ * as they were found unchanged before.
+ */
+typedef struct git_fsmonitor git_fsmonitor;
+
+struct git_fsmonitor {
+	/**
+	 * Report every path that changed since the point in time that
+	 * `since` stands for, and set `token` to stand for now.
+	 *
+	 * `since` is a token that was returned earlier, or NULL for the
+	 * first query. When the monitor cannot tell what changed since
+	 * then, it still sets `token` and returns GIT_ENOTFOUND, and all
+	 * paths are then looked at.
+	 *
+	 * The token must remain valid until the next call.
+	 */
+	int (*query)(
+		git_fsmonitor *fsmonitor,
+		const char **token,
+		const char *since,
+		git_fsmonitor_changed_cb changed,
+		void *payload);
+
+	/** Free the monitor */
+	void (*free)(git_fsmonitor *fsmonitor);
+};
+
+/**
+ * Use a file system monitor for the working directory of a repository
+ *
+ * The repository takes ownership of the monitor, and frees it along
+ * with the repository or when another monitor is set. Pass NULL to
+ * stop using a monitor.
+ *
+ * The token of the last query is stored in the index, along with which
+ * entries were unchanged at that point; both are written out with the
+ * index.
+ *
+ * @param repo A repository object
+ * @param fsmonitor The monitor to use, or NULL
+ * @return 0 or an error code
+ */
+GIT_EXTERN(int) git_repository_set_fsmonitor(
+	git_repository *repo, git_fsmonitor *fsmonitor);
+
+/**
+ * Create a file system monitor backed by inotify
+ *
+ * This watches every directory in the working directory of `repo` for
+ * as long as the monitor lives, so it only knows about the changes
+ * made since it was created. It is only available on Linux.
+ *
+ * @param out pointer to the new monitor
+ * @param repo A repository object with a working directory
+ * @return 0 or an error code
+ */
+GIT_EXTERN(int) git_fsmonitor_inotify_new(
+	git_fsmonitor **out, git_repository *repo);
+
+/** @} */
+GIT_END_DECL
+#endif
@@ -46,6 +46,7 @@ GIT_BEGIN_DECL
 
 #define GIT_IDXENTRY_UNPACKED			(1 << 8)
 #define GIT_IDXENTRY_NEW_SKIP_WORKTREE (1 << 9)
+#define GIT_IDXENTRY_FSMONITOR_VALID	(1 << 10)
 
 /*
  * Extended on-disk flags:
@@ -156,6 +157,59 @@ GIT_EXTERN(unsigned int) git_index_caps(const git_index *index);
  */
 GIT_EXTERN(int) git_index_set_caps(git_index *index, unsigned int caps);
 
+/**
+ * Get the on-disk format version of the index.
+ *
+ * This is the version the index was read in, or the version that
+ * was set with `git_index_set_version`; new indexes default to 2.
+ *
+ * @param index An existing index object
+ * @return the index version (2, 3 or 4)
+ */
+GIT_EXTERN(unsigned int) git_index_version(git_index *index);
+
+/**
+ * Set the on-disk format version used when writing the index.
+ *
+ * Version 4 prefix-compresses the paths of consecutive entries,
+ * which makes the index of a large working directory considerably
+ * smaller and faster to read and write. Version 2 is upgraded to 3
+ * on write if any entry needs the extended flags.
+ *
+ * @param index An existing index object
+ * @param version The new version (2, 3 or 4)
+ * @return 0 on success, -1 on failure
+ */
+GIT_EXTERN(int) git_index_set_version(git_index *index, unsigned int version);
+
+/**
+ * Check whether the index is written as a split index.
+ *
+ * @param index An existing index object
+ * @return 1 if the index is split, 0 otherwise
+ */
+GIT_EXTERN(int) git_index_is_split(git_index *index);
+
+/**
+ * Choose whether the index is written as a split index.
+ *
+ * A split index stores most entries in a shared index file next to
+ * the index (`sharedindex.<sha1>`), and the index file itself only
+ * records the entries that changed since the shared index was
+ * written. Small updates to a large index then only write a small
+ * file. A new shared index is written once too many entries have
+ * changed; entries returned by `git_index_get` may move when that
+ * happens.
+ *
+ * Indexes that were read as split stay split, and repository
+ * indexes follow the `core.splitIndex` configuration.
+ *
+ * @param index An existing index object
+ * @param split 1 to write a split index, 0 to write a single file
+ * @return 0 on success, -1 on failure
+ */
+GIT_EXTERN(int) git_index_set_split(git_index *index, int split);
+
 /**
  * Update the contents of an existing index object in memory
  * by reading from the hard disk.
@@ -0,0 +1,54 @@
+/*
+ * Copyright (C) 2009-2012 the libgit2 contributors
+ *
+ * This file is part of libgit2, distributed under the GNU GPL v2 with
+ * a Linking Exception. For full terms see the included COPYING file.
+ */
+#ifndef INCLUDE_git_sparse_h__
+#define INCLUDE_git_sparse_h__
+
+#include "common.h"
+#include "types.h"
+
+/**
+ * @file git2/sparse.h
+ * @brief Git sparse checkout routines
+ * @defgroup git_sparse Git sparse checkout routines
+ * @ingroup Git
+ * @{
+ */
+GIT_BEGIN_DECL
+
+/**
+ * Restrict the working directory to the given directories
+ *
+ * The files at the top of the working directory are always checked
+ * out, along with everything below each of `dirs` and the files
+ * directly in the directories that lead to them ("cone mode").
+ *
+ * The patterns are written to `info/sparse-checkout`, and
+ * `core.sparseCheckout` and `core.sparseCheckoutCone` are turned on;
+ * `git_checkout_index` and friends then update the working directory
+ * to match. With `index.sparse` set as well, the index stores each
+ * directory outside of the checkout as a single entry.
+ *
+ * @param repo A repository object with a working directory
+ * @param dirs Directories relative to the working directory
+ * @return 0 or an error code
+ */
+GIT_EXTERN(int) git_sparse_checkout_set(
+	git_repository *repo, const git_strarray *dirs);
+
+/**
+ * Turn the sparse checkout off again
+ *
+ * The next checkout brings back the files that were left out.
+ *
+ * @param repo A repository object
+ * @return 0 or an error code
+ */
+GIT_EXTERN(int) git_sparse_checkout_disable(git_repository *repo);
+
+/** @} */
+GIT_END_DECL
+#endif
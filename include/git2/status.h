@@ -98,6 +98,10 @@ typedef enum {
  *   itself will not be included, but all the files in it will.
  * - GIT_STATUS_OPT_DISABLE_PATHSPEC_MATCH indicates that the given
  *   path will be treated as a literal path, and not as a pathspec.
+ * - GIT_STATUS_OPT_UPDATE_INDEX indicates that the stat data of files
+ *   that had to be read to find out that they are unmodified should be
+ *   stored in the index, and the index written, so that the next status
+ *   does not have to read them again.
  */
 
 enum {
@@ -107,6 +111,7 @@ enum {
 	GIT_STATUS_OPT_EXCLUDE_SUBMODULES = (1 << 3),
 	GIT_STATUS_OPT_RECURSE_UNTRACKED_DIRS = (1 << 4),
 	GIT_STATUS_OPT_DISABLE_PATHSPEC_MATCH = (1 << 5),
+	GIT_STATUS_OPT_UPDATE_INDEX = (1 << 6),
 };
 
 /**
@@ -21,6 +21,14 @@
 #include "repository.h"
 #include "filter.h"
 #include "blob.h"
+#include "index.h"
+#include "sparse.h"
+#include "diff.h"
+#include "odb.h"
+
+/* the number of files below which a checkout is done on a single thread */
+#define CHECKOUT_PARALLEL_THRESHOLD 100
+#define CHECKOUT_STREAM_CHUNK (64 * 1024)
 
 struct checkout_diff_data
 {
@@ -29,23 +37,27 @@ struct checkout_diff_data
 	git_checkout_opts *checkout_opts;
 	git_indexer_stats *stats;
 	git_repository *owner;
+	git_sparse *sparse;
+	git_index *index;
 	bool can_symlink;
+	/* whether the stat data of files that were written was recorded */
+	bool entries_updated;
+	/* when not NULL, files are written by checkout_jobs__finish */
+	git_vector *jobs;
 };
 
 static int buffer_to_file(
 	git_buf *buffer,
 	const char *path,
-	mode_t dir_mode,
 	int file_open_flags,
 	mode_t file_mode)
 {
 	int fd, error_write, error_close;
 
-	if (git_futils_mkpath2file(path, dir_mode) < 0)
-		return -1;
-
-	if ((fd = p_open(path, file_open_flags, file_mode)) < 0)
+	if ((fd = p_open(path, file_open_flags, file_mode)) < 0) {
+		giterr_set(GITERR_OS, "Could not open '%s' for writing", path);
 		return -1;
+	}
 
 	error_write = p_write(fd, git_buf_cstr(buffer), git_buf_len(buffer));
 	error_close = p_close(fd);
@@ -57,37 +69,26 @@ static int blob_content_to_file(
 	git_blob *blob,
 	const char *path,
 	mode_t entry_filemode,
+	git_vector *filters,
 	git_checkout_opts *opts)
 {
-	int error = -1, nb_filters = 0;
+	int error = -1;
 	mode_t file_mode = opts->file_mode;
 	bool dont_free_filtered = false;
 	git_buf unfiltered = GIT_BUF_INIT, filtered = GIT_BUF_INIT;
-	git_vector filters = GIT_VECTOR_INIT;
-
-	if (opts->disable_filters ||
-		(nb_filters = git_filters_load(
-			&filters,
-			git_object_owner((git_object *)blob),
-			path,
-			GIT_FILTER_TO_WORKTREE)) == 0) {
 
+	if (filters->length == 0) {
 		/* Create a fake git_buf from the blob raw data... */
 		filtered.ptr = blob->odb_object->raw.data;
 		filtered.size = blob->odb_object->raw.len;
 
 		/* ... and make sure it doesn't get unexpectedly freed */
 		dont_free_filtered = true;
-	}
-
-	if (nb_filters < 0)
-		return nb_filters;
-
-	if (nb_filters > 0)	 {
+	} else {
 		if (git_blob__getbuf(&unfiltered, blob) < 0)
 			goto cleanup;
 
-		if ((error = git_filters_apply(&filtered, &unfiltered, &filters)) < 0)
+		if ((error = git_filters_apply(&filtered, &unfiltered, filters)) < 0)
 			goto cleanup;
 	}
 
@@ -95,10 +96,9 @@ static int blob_content_to_file(
 	if (!file_mode)
 		file_mode = entry_filemode;
 
-	error = buffer_to_file(&filtered, path, opts->dir_mode, opts->file_open_flags, file_mode);
+	error = buffer_to_file(&filtered, path, opts->file_open_flags, file_mode);
 
 cleanup:
-	git_filters_free(&filters);
 	git_buf_free(&unfiltered);
 	if (!dont_free_filtered)
 		git_buf_free(&filtered);
@@ -106,6 +106,71 @@ cleanup:
 	return error;
 }
 
+/*
+ * Write a blob as it is read from the object database, one chunk at
+ * a time, so that only a chunk and its filtered copy are in memory
+ */
+static int blob_stream_to_file(
+	git_odb_stream *stream,
+	const char *path,
+	mode_t entry_filemode,
+	git_vector *filters,
+	git_checkout_opts *opts)
+{
+	int fd, read_bytes, error = 0;
+	mode_t file_mode = opts->file_mode;
+	git_buf chunk = GIT_BUF_INIT, filtered = GIT_BUF_INIT;
+
+	/* Allow overriding of file mode */
+	if (!file_mode)
+		file_mode = entry_filemode;
+
+	if ((fd = p_open(path, opts->file_open_flags, file_mode)) < 0) {
+		giterr_set(GITERR_OS, "Could not open '%s' for writing", path);
+		return -1;
+	}
+
+	for (;;) {
+		/* applying the filters may swap the buffers around */
+		if (git_buf_grow(&chunk, CHECKOUT_STREAM_CHUNK + 1) < 0) {
+			error = -1;
+			break;
+		}
+
+		if ((read_bytes = stream->read(
+				stream, chunk.ptr, CHECKOUT_STREAM_CHUNK)) <= 0) {
+			error = read_bytes;
+			break;
+		}
+
+		chunk.size = read_bytes;
+		chunk.ptr[chunk.size] = '\0';
+
+		if (filters->length > 0) {
+			if ((error = git_filters_apply(&filtered, &chunk, filters)) < 0)
+				break;
+
+			error = p_write(fd, filtered.ptr, filtered.size);
+		} else
+			error = p_write(fd, chunk.ptr, chunk.size);
+
+		if (error < 0) {
+			giterr_set(GITERR_OS, "Could not write to '%s'", path);
+			break;
+		}
+	}
+
+	if (p_close(fd) < 0 && !error) {
+		giterr_set(GITERR_OS, "Could not close '%s'", path);
+		error = -1;
+	}
+
+	git_buf_free(&chunk);
+	git_buf_free(&filtered);
+
+	return error;
+}
+
 static int blob_content_to_link(git_blob *blob, const char *path, bool can_symlink)
 {
 	git_buf linktarget = GIT_BUF_INIT;
@@ -124,30 +189,344 @@ static int blob_content_to_link(git_blob *blob, const char *path, bool can_symli
 	return error;
 }
 
+/*
+ * Write out a blob whose directory is already there; this is safe to do
+ * on several threads at once, as long as the filters are loaded up front.
+ */
 static int checkout_blob(
 	git_repository *repo,
-	git_oid *blob_oid,
+	const git_oid *blob_oid,
 	const char *path,
 	mode_t filemode,
+	git_vector *filters,
 	bool can_symlink,
 	git_checkout_opts *opts)
 {
 	git_blob *blob;
+	git_odb *odb;
+	git_odb_stream *stream;
 	int error;
 
+	/* Stream regular files where the backend allows it */
+	if (!S_ISLNK(filemode) &&
+		git_repository_odb__weakptr(&odb, repo) == 0 &&
+		git_odb_open_rstream(&stream, odb, blob_oid) == 0) {
+		error = blob_stream_to_file(stream, path, filemode, filters, opts);
+		stream->free(stream);
+
+		return error;
+	}
+
+	giterr_clear();
+
 	if (git_blob_lookup(&blob, repo, blob_oid) < 0)
 		return -1; /* Add an error message */
 
 	if (S_ISLNK(filemode))
 		error = blob_content_to_link(blob, path, can_symlink);
 	else
-		error = blob_content_to_file(blob, path, filemode, opts);
+		error = blob_content_to_file(blob, path, filemode, filters, opts);
 
 	git_blob_free(blob);
 
 	return error;
 }
 
+/*
+ * Record the stat data of a file that was just written in its index
+ * entry, so that the next diff sees it is unchanged without reading it
+ */
+static void update_entry_stat(git_index_entry *entry, const char *path)
+{
+	struct stat st;
+	unsigned int mode;
+
+	if (entry == NULL || p_lstat(path, &st) < 0)
+		return;
+
+	/* the mode stays that of the blob, as for a link written as a file */
+	mode = entry->mode;
+	git_index__init_entry_from_stat(&st, entry);
+	entry->mode = mode;
+}
+
+/*
+ * Remove a file that is left out of the checkout, along with the
+ * directories it was in that are now empty
+ */
+static int remove_file(git_buf *path, size_t workdir_len)
+{
+	ssize_t slash;
+
+	if (p_unlink(git_buf_cstr(path)) < 0)
+		return -1;
+
+	while ((slash = git_buf_rfind(path, '/')) > (ssize_t)workdir_len) {
+		git_buf_truncate(path, slash);
+
+		if (p_rmdir(git_buf_cstr(path)) < 0) {
+			if (errno == ENOTEMPTY || errno == EEXIST || errno == ENOENT)
+				break;
+
+			giterr_set(GITERR_OS,
+				"Failed to remove directory '%s'", git_buf_cstr(path));
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+/*
+ * A file to write with the blob loaded, filtered and written on one of
+ * several threads. The directories are created in the order of the diff
+ * and the filters are loaded as the file is queued, as neither is to be
+ * done by several threads at once.
+ */
+typedef struct {
+	git_oid oid;
+	char *path;
+	mode_t mode;
+	git_vector filters;
+	git_index_entry *entry;
+	bool written;
+	/* files to remove wait until the others are written, as the
+	 * directories they leave empty may be waiting for files */
+	bool remove;
+} checkout_job;
+
+static void checkout_jobs__free(git_vector *jobs)
+{
+	checkout_job *job;
+	unsigned int i;
+
+	git_vector_foreach(jobs, i, job) {
+		git_filters_free(&job->filters);
+		git__free(job->path);
+		git__free(job);
+	}
+
+	git_vector_free(jobs);
+}
+
+static checkout_job *checkout_job__push(
+	struct checkout_diff_data *data, const char *path)
+{
+	checkout_job *job = git__calloc(1, sizeof(checkout_job));
+
+	if (job == NULL ||
+		(job->path = git__strdup(path)) == NULL ||
+		git_vector_insert(data->jobs, job) < 0)
+	{
+		if (job != NULL)
+			git__free(job->path);
+		git__free(job);
+		return NULL;
+	}
+
+	return job;
+}
+
+static int checkout_remove(struct checkout_diff_data *data)
+{
+	checkout_job *job;
+
+	if (data->jobs == NULL)
+		return remove_file(data->path, data->workdir_len);
+
+	if ((job = checkout_job__push(data, git_buf_cstr(data->path))) == NULL)
+		return -1;
+
+	job->remove = true;
+	return 0;
+}
+
+static int checkout_file(
+	struct checkout_diff_data *data, const git_diff_file *file)
+{
+	const char *path = git_buf_cstr(data->path);
+	git_checkout_opts *opts = data->checkout_opts;
+	git_vector filters = GIT_VECTOR_INIT;
+	git_index_entry *entry = NULL;
+	checkout_job *job;
+	int error, pos;
+
+	if (git_futils_mkpath2file(path, opts->dir_mode) < 0)
+		return -1;
+
+	if ((pos = git_index_find(data->index, file->path)) >= 0) {
+		entry = git_index_get(data->index, pos);
+
+		if (git_oid_cmp(&entry->oid, &file->oid) != 0)
+			entry = NULL;
+	}
+
+	if (!S_ISLNK(file->mode) && !opts->disable_filters &&
+		git_filters_load(
+			&filters, data->owner, file->path, GIT_FILTER_TO_WORKTREE) < 0)
+	{
+		git_filters_free(&filters);
+		return -1;
+	}
+
+	if (data->jobs == NULL) {
+		error = checkout_blob(data->owner, &file->oid, path,
+			file->mode, &filters, data->can_symlink, opts);
+
+		if (!error && entry != NULL) {
+			update_entry_stat(entry, path);
+			data->entries_updated = true;
+		}
+
+		git_filters_free(&filters);
+		return error;
+	}
+
+	if ((job = checkout_job__push(data, path)) == NULL) {
+		git_filters_free(&filters);
+		return -1;
+	}
+
+	git_oid_cpy(&job->oid, &file->oid);
+	job->mode = file->mode;
+	job->entry = entry;
+	memcpy(&job->filters, &filters, sizeof(filters));
+
+	if (entry != NULL)
+		data->entries_updated = true;
+
+	return 0;
+}
+
+typedef struct {
+	git_vector *jobs;
+	struct checkout_diff_data *data;
+	unsigned int processed;
+	git_atomic next;
+	git_atomic done;
+	git_atomic failed;
+} checkout_queue;
+
+/*
+ * Write queued files until there are none left. Only the calling thread
+ * reports the progress, so the stats are never written concurrently.
+ */
+static void checkout_jobs__run(checkout_queue *queue, bool report)
+{
+	struct checkout_diff_data *data = queue->data;
+	checkout_job *job;
+	size_t i;
+	int done;
+
+	/* after a failure, the files that come after it are left alone */
+	while (!git_atomic_get(&queue->failed) &&
+		(i = (size_t)git_atomic_inc(&queue->next) - 1) < queue->jobs->length)
+	{
+		job = git_vector_get(queue->jobs, i);
+		if (job->remove)
+			continue;
+
+		if (checkout_blob(data->owner, &job->oid, job->path, job->mode,
+				&job->filters, data->can_symlink, data->checkout_opts) < 0) {
+			git_atomic_set(&queue->failed, 1);
+			continue;
+		}
+
+		/* each job has an entry of its own to update */
+		update_entry_stat(job->entry, job->path);
+		job->written = true;
+
+		done = git_atomic_inc(&queue->done);
+		if (report)
+			data->stats->processed = queue->processed + (unsigned int)done;
+	}
+}
+
+#ifdef GIT_THREADS
+static void *checkout_jobs__worker(void *arg)
+{
+	checkout_jobs__run(arg, false);
+	return NULL;
+}
+#endif
+
+/*
+ * Write the queued files on `threads_len` threads. The first file that
+ * could not be written, in the order of the diff, is written again here
+ * to raise its error on this thread.
+ */
+static int checkout_jobs__finish(
+	struct checkout_diff_data *data, size_t threads_len)
+{
+	checkout_queue queue;
+	checkout_job *job;
+	unsigned int i;
+	int error = 0;
+
+	if (data->jobs->length == 0)
+		return 0;
+
+	queue.jobs = data->jobs;
+	queue.data = data;
+	queue.processed = data->stats->processed;
+	git_atomic_set(&queue.next, 0);
+	git_atomic_set(&queue.done, 0);
+	git_atomic_set(&queue.failed, 0);
+
+#ifdef GIT_THREADS
+	{
+		git_thread *threads = NULL;
+		size_t started = 0;
+
+		if (threads_len > 1 &&
+			(threads = git__calloc(threads_len - 1, sizeof(git_thread))) != NULL)
+		{
+			for (; started < threads_len - 1; ++started) {
+				if (git_thread_create(&threads[started],
+						NULL, checkout_jobs__worker, &queue) != 0)
+					break;
+			}
+		}
+
+		checkout_jobs__run(&queue, true);
+
+		for (i = 0; i < started; ++i)
+			git_thread_join(threads[i], NULL);
+
+		git__free(threads);
+	}
+#else
+	GIT_UNUSED(threads_len);
+	checkout_jobs__run(&queue, true);
+#endif
+
+	git_vector_foreach(data->jobs, i, job) {
+		if (job->written)
+			continue;
+
+		if (job->remove) {
+			git_buf_clear(data->path);
+			if ((error = git_buf_puts(data->path, job->path)) < 0 ||
+				(error = remove_file(data->path, data->workdir_len)) < 0)
+				break;
+		} else {
+			if ((error = checkout_blob(data->owner, &job->oid, job->path,
+					job->mode, &job->filters, data->can_symlink,
+					data->checkout_opts)) < 0)
+				break;
+
+			update_entry_stat(job->entry, job->path);
+		}
+
+		job->written = true;
+	}
+
+	if (!error)
+		data->stats->processed = queue.processed + data->jobs->length;
+
+	return error;
+}
+
 static int checkout_diff_fn(
 	void *cb_data,
 	git_diff_delta *delta,
@@ -161,13 +540,33 @@ static int checkout_diff_fn(
 
 	data->stats->processed = (unsigned int)(data->stats->total * progress);
 
+	/* the files that are queued are not written yet */
+	if (data->jobs != NULL)
+		data->stats->processed -=
+			min(data->stats->processed, data->jobs->length);
+
 	git_buf_truncate(data->path, data->workdir_len);
 	if (git_buf_joinpath(data->path, git_buf_cstr(data->path), delta->new_file.path) < 0)
 		return -1;
 
 	opts = data->checkout_opts;
 
+	/* files outside of the sparse checkout are left alone unless they
+	 * are still there untouched, and then they go away */
+	if (data->sparse != NULL && delta->status != GIT_DELTA_UNTRACKED &&
+		!git_sparse__contains(data->sparse, delta->old_file.path))
+	{
+		if (delta->status != GIT_DELTA_UNMODIFIED ||
+			S_ISGITLINK(delta->old_file.mode))
+			return 0;
+
+		return checkout_remove(data);
+	}
+
 	switch (delta->status) {
+	case GIT_DELTA_UNMODIFIED:
+		return 0;
+
 	case GIT_DELTA_UNTRACKED:
 		if (!(opts->checkout_strategy & GIT_CHECKOUT_REMOVE_UNTRACKED))
 			return 0;
@@ -194,13 +593,7 @@ static int checkout_diff_fn(
 			return 0;
 		}
 
-		if (checkout_blob(
-				data->owner,
-				&delta->old_file.oid,
-				git_buf_cstr(data->path),
-				delta->old_file.mode,
-				data->can_symlink,
-				opts) < 0)
+		if (checkout_file(data, &delta->old_file) < 0)
 			goto cleanup;
 
 		break;
@@ -209,13 +602,7 @@ static int checkout_diff_fn(
 		if (!(opts->checkout_strategy & GIT_CHECKOUT_CREATE_MISSING))
 			return 0;
 
-		if (checkout_blob(
-				data->owner,
-				&delta->old_file.oid,
-				git_buf_cstr(data->path),
-				delta->old_file.mode,
-				data->can_symlink,
-				opts) < 0)
+		if (checkout_file(data, &delta->old_file) < 0)
 			goto cleanup;
 
 		break;
@@ -274,6 +661,71 @@ static void normalize_options(git_checkout_opts *normalized, git_checkout_opts *
 		normalized->file_open_flags = O_CREAT | O_TRUNC | O_WRONLY;
 }
 
+/*
+ * Bring back into the index what the sparse checkout now covers, so that
+ * the diff sees it: directories that were collapsed are expanded and the
+ * entries lose their skip-worktree flag.
+ */
+static int sparse_prepare_index(
+	bool *changed, git_index *index, const git_sparse *sparse)
+{
+	git_index_entry *entry;
+	unsigned int i = 0;
+
+	while (i < git_index_entrycount(index)) {
+		entry = git_index_get(index, i);
+
+		if (git_index__is_sparse_dir(entry)) {
+			if (sparse == NULL || !git_sparse__excludes_dir(sparse, entry->path)) {
+				if (git_index__expand_sparse_dir(index, i) < 0)
+					return -1;
+
+				*changed = true;
+				continue;
+			}
+		} else if ((entry->flags_extended & GIT_IDXENTRY_SKIP_WORKTREE) != 0 &&
+			(sparse == NULL || git_sparse__contains(sparse, entry->path)))
+		{
+			entry->flags_extended &= ~GIT_IDXENTRY_SKIP_WORKTREE;
+			*changed = true;
+		}
+
+		++i;
+	}
+
+	return 0;
+}
+
+/* Mark the entries whose files were left out of the working directory */
+static void sparse_finish_index(
+	bool *changed, git_index *index, const git_sparse *sparse, git_buf *path)
+{
+	git_index_entry *entry;
+	size_t workdir_len = git_buf_len(path);
+	struct stat st;
+	unsigned int i;
+
+	for (i = 0; i < git_index_entrycount(index); ++i) {
+		entry = git_index_get(index, i);
+
+		if (git_index_entry_stage(entry) != 0 ||
+			(entry->flags_extended & GIT_IDXENTRY_SKIP_WORKTREE) != 0 ||
+			git_sparse__contains(sparse, entry->path))
+			continue;
+
+		git_buf_truncate(path, workdir_len);
+		if (git_buf_puts(path, entry->path) < 0)
+			break;
+
+		if (p_lstat(git_buf_cstr(path), &st) < 0) {
+			entry->flags_extended |= GIT_IDXENTRY_SKIP_WORKTREE;
+			*changed = true;
+		}
+	}
+
+	git_buf_truncate(path, workdir_len);
+}
+
 int git_checkout_index(
 	git_repository *repo,
 	git_checkout_opts *opts,
@@ -282,12 +734,16 @@ int git_checkout_index(
 	git_index *index = NULL;
 	git_diff_list *diff = NULL;
 	git_indexer_stats dummy_stats;
+	git_sparse *sparse = NULL;
+	bool index_changed = false;
 
 	git_diff_options diff_opts = {0};
 	git_checkout_opts checkout_opts;
 
 	struct checkout_diff_data data;
 	git_buf workdir = GIT_BUF_INIT;
+	git_vector jobs = GIT_VECTOR_INIT;
+	size_t threads_len;
 
 	int error;
 
@@ -296,7 +752,19 @@ int git_checkout_index(
 	if ((git_repository__ensure_not_bare(repo, "checkout")) < 0)
 		return GIT_EBAREREPO;
 
-	diff_opts.flags = GIT_DIFF_INCLUDE_UNTRACKED;
+	if ((error = git_sparse__load(&sparse, repo)) < 0 ||
+		(error = git_repository_index(&index, repo)) < 0 ||
+		(error = sparse_prepare_index(&index_changed, index, sparse)) < 0)
+		goto cleanup;
+
+	/* files found unchanged keep their stat data, and the index is
+	 * written once, together with that of the files written here */
+	diff_opts.flags = GIT_DIFF_INCLUDE_UNTRACKED |
+		GIT_DIFF_UPDATE_INDEX | GIT_DIFF__DEFER_INDEX_WRITE;
+
+	/* unmodified files may have to leave the working directory */
+	if (sparse != NULL)
+		diff_opts.flags |= GIT_DIFF_INCLUDE_UNMODIFIED;
 
 	if (opts && opts->paths.count > 0)
 		diff_opts.pathspec = opts->paths;
@@ -314,9 +782,6 @@ int git_checkout_index(
 
 	stats->processed = 0;
 
-	if ((git_repository_index(&index, repo)) < 0)
-		goto cleanup;
-
 	stats->total = git_index_entrycount(index);
 
 	memset(&data, 0, sizeof(data));
@@ -326,13 +791,33 @@ int git_checkout_index(
 	data.checkout_opts = &checkout_opts;
 	data.stats = stats;
 	data.owner = repo;
+	data.sparse = sparse;
+	data.index = index;
 
 	if ((error = retrieve_symlink_capabilities(repo, &data.can_symlink)) < 0)
 		goto cleanup;
 
-	error = git_diff_foreach(diff, &data, checkout_diff_fn, NULL, NULL);
+	/* with several threads, the files are written once the diff is done */
+	threads_len = git_repository__thread_count(
+		repo, "checkout", diff->deltas.length, CHECKOUT_PARALLEL_THRESHOLD);
+	if (threads_len > 1)
+		data.jobs = &jobs;
+
+	if ((error = git_diff_foreach(diff, &data, checkout_diff_fn, NULL, NULL)) < 0 ||
+		(data.jobs != NULL &&
+		 (error = checkout_jobs__finish(&data, threads_len)) < 0))
+		goto cleanup;
+
+	git_buf_truncate(&workdir, data.workdir_len);
+	if (sparse != NULL)
+		sparse_finish_index(&index_changed, index, sparse, &workdir);
+
+	if (index_changed || diff->index_updated || data.entries_updated)
+		error = git_index_write(index);
 
 cleanup:
+	checkout_jobs__free(&jobs);
+	git_sparse__free(sparse);
 	git_index_free(index);
 	git_diff_list_free(diff);
 	git_buf_free(&workdir);
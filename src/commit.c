@@ -15,31 +15,21 @@
 #include "commit.h"
 #include "signature.h"
 #include "message.h"
+#include "thread-utils.h"
 
 #include <stdarg.h>
 
-static void clear_parents(git_commit *commit)
-{
-	unsigned int i;
-
-	for (i = 0; i < commit->parent_oids.length; ++i) {
-		git_oid *parent = git_vector_get(&commit->parent_oids, i);
-		git__free(parent);
-	}
-
-	git_vector_clear(&commit->parent_oids);
-}
-
 void git_commit__free(git_commit *commit)
 {
-	clear_parents(commit);
-	git_vector_free(&commit->parent_oids);
+	git__free(commit->parent_oids);
 
 	git_signature_free(commit->author);
 	git_signature_free(commit->committer);
-
-	git__free(commit->message);
 	git__free(commit->message_encoding);
+
+	if (commit->odb_object != NULL)
+		git_odb_object_free(commit->odb_object);
+
 	git__free(commit);
 }
 
@@ -136,14 +126,36 @@ on_error:
 	return -1;
 }
 
+/*
+ * Find the end of the header line starting with `header` at `*buffer`,
+ * and move `*buffer` past it. Returns the start of the line.
+ */
+static const char *commit_header_line(
+	const char **buffer, const char *buffer_end, const char *header)
+{
+	const char *line = *buffer, *line_end;
+	size_t header_len = strlen(header);
+
+	if ((size_t)(buffer_end - line) <= header_len ||
+		memcmp(line, header, header_len) != 0)
+		return NULL;
+
+	if ((line_end = memchr(line, '\n', buffer_end - line)) == NULL)
+		return NULL;
+
+	*buffer = line_end + 1;
+	return line;
+}
+
 int git_commit__parse_buffer(git_commit *commit, const void *data, size_t len)
 {
 	const char *buffer = data;
 	const char *buffer_end = (const char *)data + len;
-
+	const char *parents_start;
 	git_oid parent_oid;
+	unsigned int i;
 
-	git_vector_init(&commit->parent_oids, 4, NULL);
+	commit->buffer_end = buffer_end;
 
 	if (git_oid__parse(&commit->tree_oid, &buffer, buffer_end, "tree ") < 0)
 		goto bad_buffer;
@@ -152,30 +164,25 @@ int git_commit__parse_buffer(git_commit *commit, const void *data, size_t len)
 	 * TODO: commit grafts!
 	 */
 
-	while (git_oid__parse(&parent_oid, &buffer, buffer_end, "parent ") == 0) {
-		git_oid *new_oid;
+	/* count the parents first, so they fit in a single allocation */
+	parents_start = buffer;
+	while (git_oid__parse(&parent_oid, &buffer, buffer_end, "parent ") == 0)
+		commit->parent_count++;
 
-		new_oid = git__malloc(sizeof(git_oid));
-		GITERR_CHECK_ALLOC(new_oid);
+	if (commit->parent_count > 0) {
+		commit->parent_oids = git__malloc(commit->parent_count * sizeof(git_oid));
+		GITERR_CHECK_ALLOC(commit->parent_oids);
 
-		git_oid_cpy(new_oid, &parent_oid);
-
-		if (git_vector_insert(&commit->parent_oids, new_oid) < 0)
-			return -1;
+		buffer = parents_start;
+		for (i = 0; i < commit->parent_count; ++i)
+			git_oid__parse(&commit->parent_oids[i], &buffer, buffer_end, "parent ");
 	}
 
-	commit->author = git__malloc(sizeof(git_signature));
-	GITERR_CHECK_ALLOC(commit->author);
-
-	if (git_signature__parse(commit->author, &buffer, buffer_end, "author ", '\n') < 0)
-		return -1;
-
-	/* Always parse the committer; we need the commit time */
-	commit->committer = git__malloc(sizeof(git_signature));
-	GITERR_CHECK_ALLOC(commit->committer);
-
-	if (git_signature__parse(commit->committer, &buffer, buffer_end, "committer ", '\n') < 0)
-		return -1;
+	if ((commit->author_start =
+			commit_header_line(&buffer, buffer_end, "author ")) == NULL ||
+		(commit->committer_start =
+			commit_header_line(&buffer, buffer_end, "committer ")) == NULL)
+		goto bad_buffer;
 
 	if (git__prefixcmp(buffer, "encoding ") == 0) {
 		const char *encoding_end;
@@ -185,20 +192,18 @@ int git_commit__parse_buffer(git_commit *commit, const void *data, size_t len)
 		while (encoding_end < buffer_end && *encoding_end != '\n')
 			encoding_end++;
 
-		commit->message_encoding = git__strndup(buffer, encoding_end - buffer);
-		GITERR_CHECK_ALLOC(commit->message_encoding);
+		commit->encoding_start = buffer;
+		commit->encoding_len = encoding_end - buffer;
 
 		buffer = encoding_end;
 	}
 
-	/* parse commit message */
+	/* the message runs to the end of the (NUL-terminated) buffer */
 	while (buffer < buffer_end - 1 && *buffer == '\n')
 		buffer++;
 
-	if (buffer <= buffer_end) {
-		commit->message = git__strndup(buffer, buffer_end - buffer);
-		GITERR_CHECK_ALLOC(commit->message);
-	}
+	if (buffer <= buffer_end)
+		commit->message = buffer;
 
 	return 0;
 
@@ -210,9 +215,86 @@ bad_buffer:
 int git_commit__parse(git_commit *commit, git_odb_object *obj)
 {
 	assert(commit);
+
+	git_cached_obj_incref((git_cached_obj *)obj);
+	commit->odb_object = obj;
+
 	return git_commit__parse_buffer(commit, obj->raw.data, obj->raw.len);
 }
 
+/*
+ * Parse a signature the first time it is requested. Objects are shared
+ * through the cache, so the result is published atomically; a thread
+ * that loses the race frees its own copy.
+ */
+static const git_signature *commit_signature(
+	git_signature **out, git_commit *commit, const char *start, const char *header)
+{
+	git_signature *sig;
+	const char *buffer = start;
+
+	if (*out != NULL)
+		return *out;
+
+	if ((sig = git__calloc(1, sizeof(git_signature))) == NULL)
+		return NULL;
+
+	if (git_signature__parse(sig, &buffer, commit->buffer_end, header, '\n') < 0) {
+		git_signature_free(sig);
+		return NULL;
+	}
+
+	if (git__compare_and_swap((void * volatile *)out, NULL, sig) != NULL)
+		git_signature_free(sig);
+
+	return *out;
+}
+
+const git_signature *git_commit_author(git_commit *commit)
+{
+	assert(commit);
+	return commit_signature(
+		&commit->author, commit, commit->author_start, "author ");
+}
+
+const git_signature *git_commit_committer(git_commit *commit)
+{
+	assert(commit);
+	return commit_signature(
+		&commit->committer, commit, commit->committer_start, "committer ");
+}
+
+const char *git_commit_message_encoding(git_commit *commit)
+{
+	char *encoding;
+
+	assert(commit);
+
+	if (commit->message_encoding != NULL || commit->encoding_start == NULL)
+		return commit->message_encoding;
+
+	if ((encoding = git__strndup(commit->encoding_start, commit->encoding_len)) == NULL)
+		return NULL;
+
+	if (git__compare_and_swap(
+			(void * volatile *)&commit->message_encoding, NULL, encoding) != NULL)
+		git__free(encoding);
+
+	return commit->message_encoding;
+}
+
+git_time_t git_commit_time(git_commit *commit)
+{
+	const git_signature *committer = git_commit_committer(commit);
+	return committer ? committer->when.time : 0;
+}
+
+int git_commit_time_offset(git_commit *commit)
+{
+	const git_signature *committer = git_commit_committer(commit);
+	return committer ? committer->when.offset : 0;
+}
+
 #define GIT_COMMIT_GETTER(_rvalue, _name, _return) \
 	_rvalue git_commit_##_name(git_commit *commit) \
 	{\
@@ -220,13 +302,8 @@ int git_commit__parse(git_commit *commit, git_odb_object *obj)
 		return _return; \
 	}
 
-GIT_COMMIT_GETTER(const git_signature *, author, commit->author)
-GIT_COMMIT_GETTER(const git_signature *, committer, commit->committer)
 GIT_COMMIT_GETTER(const char *, message, commit->message)
-GIT_COMMIT_GETTER(const char *, message_encoding, commit->message_encoding)
-GIT_COMMIT_GETTER(git_time_t, time, commit->committer->when.time)
-GIT_COMMIT_GETTER(int, time_offset, commit->committer->when.offset)
-GIT_COMMIT_GETTER(unsigned int, parentcount, (unsigned int)commit->parent_oids.length)
+GIT_COMMIT_GETTER(unsigned int, parentcount, commit->parent_count)
 GIT_COMMIT_GETTER(const git_oid *, tree_oid, &commit->tree_oid);
 
 int git_commit_tree(git_tree **tree_out, git_commit *commit)
@@ -239,7 +316,10 @@ const git_oid *git_commit_parent_oid(git_commit *commit, unsigned int n)
 {
 	assert(commit);
 
-	return git_vector_get(&commit->parent_oids, n);
+	if (n >= commit->parent_count)
+		return NULL;
+
+	return &commit->parent_oids[n];
 }
 
 int git_commit_parent(git_commit **parent, git_commit *commit, unsigned int n)
@@ -14,21 +14,39 @@
 
 #include <time.h>
 
+/*
+ * Commits are parsed lazily: only the tree and the parents are read
+ * up front. Everything else is a pointer into the raw object, which
+ * the commit keeps alive; signatures and the encoding are parsed the
+ * first time they are asked for.
+ */
 struct git_commit {
 	git_object object;
 
-	git_vector parent_oids;
+	git_odb_object *odb_object;
+	const char *buffer_end;
+
 	git_oid tree_oid;
+	git_oid *parent_oids;
+	unsigned int parent_count;
+
+	const char *author_start;
+	const char *committer_start;
+	const char *encoding_start;
+	size_t encoding_len;
+	const char *message;
 
 	git_signature *author;
 	git_signature *committer;
-
 	char *message_encoding;
-	char *message;
 };
 
 void git_commit__free(git_commit *c);
 int git_commit__parse(git_commit *commit, git_odb_object *obj);
 
+/*
+ * Parse the commit in `data`, which must be NUL-terminated at `len`
+ * and stay alive for as long as the commit does.
+ */
 int git_commit__parse_buffer(git_commit *commit, const void *data, size_t len);
 #endif
@@ -0,0 +1,1011 @@
+/*
+ * Copyright (C) 2009-2012 the libgit2 contributors
+ *
+ * This file is part of libgit2, distributed under the GNU GPL v2 with
+ * a Linking Exception. For full terms see the included COPYING file.
+ */
+
+#include "common.h"
+#include "commit_graph.h"
+#include "fileops.h"
+#include "filebuf.h"
+#include "sha1_lookup.h"
+#include "tree.h"
+
+#include "git2/revwalk.h"
+
+#define GRAPH_HEADER_SIZE 8
+#define GRAPH_CHUNK_LOOKUP_WIDTH 12
+#define GRAPH_DATA_WIDTH (GIT_OID_RAWSZ + 16)
+
+#define GRAPH_PARENT_NONE 0x70000000
+#define GRAPH_EXTRA_EDGES_NEEDED 0x80000000
+#define GRAPH_EDGE_LAST_MASK 0x7fffffff
+#define GRAPH_LAST_EDGE 0x80000000
+#define GRAPH_GENERATION_MAX 0x3fffffff
+
+#define BLOOM_HEADER_SIZE 12
+#define BLOOM_SEED0 0x293ae76f
+#define BLOOM_SEED1 0x7e646e2c
+
+/*
+ * Minimum size: the header, a chunk table holding the three mandatory
+ * chunks plus its terminator, the fanout table and the trailing hash.
+ */
+#define GRAPH_MIN_SIZE \
+	(GRAPH_HEADER_SIZE + 4 * GRAPH_CHUNK_LOOKUP_WIDTH + 256 * 4 + GIT_OID_RAWSZ)
+
+static int commit_graph_error(const char *message)
+{
+	giterr_set(GITERR_ODB, "Invalid commit-graph file - %s", message);
+	return -1;
+}
+
+GIT_INLINE(uint32_t) get_be32(const unsigned char *p)
+{
+	return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) |
+		((uint32_t)p[2] << 8) | (uint32_t)p[3];
+}
+
+GIT_INLINE(uint64_t) get_be64(const unsigned char *p)
+{
+	return ((uint64_t)get_be32(p) << 32) | get_be32(p + 4);
+}
+
+static int commit_graph_parse(git_commit_graph *graph)
+{
+	const unsigned char *data = graph->graph_map.data;
+	size_t size = graph->graph_map.len, i;
+	uint64_t last_offset = 0;
+	size_t lookup_len = 0, data_len = 0, bloom_index_len = 0;
+	uint32_t nr = 0;
+	unsigned char num_chunks;
+	const unsigned char *chunk;
+
+	if (size < GRAPH_MIN_SIZE)
+		return commit_graph_error("file is too short");
+
+	if (get_be32(data) != GIT_COMMIT_GRAPH_SIGNATURE)
+		return commit_graph_error("bad signature");
+	if (data[4] != GIT_COMMIT_GRAPH_VERSION)
+		return commit_graph_error("unsupported version");
+	if (data[5] != GIT_COMMIT_GRAPH_OID_VERSION)
+		return commit_graph_error("unsupported hash version");
+
+	/* split commit-graph chains are not supported */
+	if (data[7] != 0)
+		return commit_graph_error("base graphs are not supported");
+
+	num_chunks = data[6];
+	if (GRAPH_HEADER_SIZE + (size_t)(num_chunks + 1) * GRAPH_CHUNK_LOOKUP_WIDTH > size)
+		return commit_graph_error("chunk table is truncated");
+
+	chunk = data + GRAPH_HEADER_SIZE;
+
+	for (i = 0; i < num_chunks; ++i, chunk += GRAPH_CHUNK_LOOKUP_WIDTH) {
+		uint32_t id = get_be32(chunk);
+		uint64_t offset = get_be64(chunk + 4);
+		uint64_t next = get_be64(chunk + 4 + GRAPH_CHUNK_LOOKUP_WIDTH);
+
+		if (offset < last_offset || next < offset ||
+			next > size - GIT_OID_RAWSZ || (offset & 3) != 0)
+			return commit_graph_error("chunk has invalid offset");
+		last_offset = offset;
+
+		switch (id) {
+		case GIT_COMMIT_GRAPH_CHUNK_OIDFANOUT:
+			if (next - offset != 256 * 4)
+				return commit_graph_error("fanout chunk has wrong size");
+			graph->oid_fanout = (const uint32_t *)(data + offset);
+			break;
+
+		case GIT_COMMIT_GRAPH_CHUNK_OIDLOOKUP:
+			graph->oid_lookup = data + offset;
+			lookup_len = (size_t)(next - offset);
+			break;
+
+		case GIT_COMMIT_GRAPH_CHUNK_DATA:
+			graph->commit_data = data + offset;
+			data_len = (size_t)(next - offset);
+			break;
+
+		case GIT_COMMIT_GRAPH_CHUNK_EXTRAEDGE:
+			graph->extra_edges = (const uint32_t *)(data + offset);
+			graph->num_extra_edges = (uint32_t)((next - offset) / 4);
+			break;
+
+		case GIT_COMMIT_GRAPH_CHUNK_BLOOMINDEX:
+			graph->bloom_index = (const uint32_t *)(data + offset);
+			bloom_index_len = (size_t)(next - offset);
+			break;
+
+		case GIT_COMMIT_GRAPH_CHUNK_BLOOMDATA:
+			if (next - offset < BLOOM_HEADER_SIZE)
+				return commit_graph_error("bloom data chunk is truncated");
+			graph->bloom_hash_version = get_be32(data + offset);
+			graph->bloom_num_hashes = get_be32(data + offset + 4);
+			graph->bloom_data = data + offset + BLOOM_HEADER_SIZE;
+			graph->bloom_data_len = (size_t)(next - offset - BLOOM_HEADER_SIZE);
+			break;
+
+		default:
+			/* unknown chunks are optional by definition */
+			break;
+		}
+	}
+
+	if (!graph->oid_fanout || !graph->oid_lookup || !graph->commit_data)
+		return commit_graph_error("missing required chunk");
+
+	/* every lookup needs a commit to go with it, and the other way round */
+	graph->num_commits = (uint32_t)(lookup_len / GIT_OID_RAWSZ);
+	if (lookup_len != (size_t)graph->num_commits * GIT_OID_RAWSZ)
+		return commit_graph_error("lookup chunk has wrong size");
+	if (data_len != (size_t)graph->num_commits * GRAPH_DATA_WIDTH)
+		return commit_graph_error("commit data chunk has wrong size");
+
+	for (i = 0; i < 256; ++i) {
+		uint32_t n = ntohl(graph->oid_fanout[i]);
+		if (n < nr)
+			return commit_graph_error("fanout is non-monotonic");
+		nr = n;
+	}
+
+	if (nr != graph->num_commits)
+		return commit_graph_error("fanout does not match the lookup table");
+
+	/*
+	 * Bloom filters written with settings we do not understand are
+	 * ignored rather than rejected, like git.git does.
+	 */
+	if (!graph->bloom_data || bloom_index_len != graph->num_commits * 4 ||
+		(graph->bloom_hash_version != 1 && graph->bloom_hash_version != 2) ||
+		graph->bloom_num_hashes == 0 ||
+		graph->bloom_num_hashes > GIT_COMMIT_GRAPH_BLOOM_MAX_HASHES)
+		graph->bloom_index = NULL;
+
+	return 0;
+}
+
+int git_commit_graph_open(git_commit_graph **out, const char *path)
+{
+	git_commit_graph *graph;
+	int error;
+
+	*out = NULL;
+
+	if (!git_path_isfile(path))
+		return GIT_ENOTFOUND;
+
+	graph = git__calloc(1, sizeof(git_commit_graph));
+	GITERR_CHECK_ALLOC(graph);
+
+	if ((error = git_futils_mmap_ro_file(&graph->graph_map, path)) < 0) {
+		git__free(graph);
+		return error;
+	}
+
+	if ((error = commit_graph_parse(graph)) < 0) {
+		git_commit_graph_free(graph);
+		return error;
+	}
+
+	*out = graph;
+	return 0;
+}
+
+void git_commit_graph_free(git_commit_graph *graph)
+{
+	if (graph == NULL)
+		return;
+
+	if (graph->graph_map.data)
+		git_futils_mmap_free(&graph->graph_map);
+
+	git__free(graph);
+}
+
+int git_commit_graph_entry_at(
+	git_commit_graph_entry *entry,
+	const git_commit_graph *graph,
+	uint32_t pos)
+{
+	const unsigned char *data;
+	uint32_t parent, gen_time;
+
+	if (pos >= graph->num_commits)
+		return commit_graph_error("commit position out of range");
+
+	data = graph->commit_data + (size_t)pos * GRAPH_DATA_WIDTH;
+
+	git_oid_fromraw(&entry->tree_oid, data);
+	entry->graph_pos = pos;
+	entry->parent_count = 0;
+	entry->extra_parents_pos = 0;
+
+	parent = get_be32(data + GIT_OID_RAWSZ);
+	if (parent != GRAPH_PARENT_NONE) {
+		entry->parent_pos[0] = parent;
+		entry->parent_count++;
+	}
+
+	parent = get_be32(data + GIT_OID_RAWSZ + 4);
+	if (parent & GRAPH_EXTRA_EDGES_NEEDED) {
+		uint32_t edge = parent & GRAPH_EDGE_LAST_MASK;
+
+		entry->extra_parents_pos = edge;
+		entry->parent_pos[1] = 0;
+
+		for (; edge < graph->num_extra_edges; ++edge) {
+			entry->parent_count++;
+			if (ntohl(graph->extra_edges[edge]) & GRAPH_LAST_EDGE)
+				break;
+		}
+
+		if (edge >= graph->num_extra_edges)
+			return commit_graph_error("extra edge list is not terminated");
+	} else if (parent != GRAPH_PARENT_NONE) {
+		entry->parent_pos[1] = parent;
+		entry->parent_count++;
+	}
+
+	/*
+	 * The last eight bytes hold the generation number in their top 30
+	 * bits and the commit time in the remaining 34 bits.
+	 */
+	gen_time = get_be32(data + GIT_OID_RAWSZ + 8);
+	entry->generation = gen_time >> 2;
+	entry->commit_time = ((git_time_t)(gen_time & 0x3) << 32) |
+		get_be32(data + GIT_OID_RAWSZ + 12);
+
+	/* graphs written without generation data store zero */
+	if (entry->generation == 0)
+		entry->generation = GIT_COMMIT_GRAPH_GENERATION_INFINITY;
+
+	return 0;
+}
+
+int git_commit_graph_find(
+	git_commit_graph_entry *entry,
+	const git_commit_graph *graph,
+	const git_oid *oid)
+{
+	uint32_t hi, lo;
+	int pos;
+
+	hi = ntohl(graph->oid_fanout[(int)oid->id[0]]);
+	lo = (oid->id[0] == 0x0) ? 0 : ntohl(graph->oid_fanout[(int)oid->id[0] - 1]);
+
+	pos = sha1_entry_pos(graph->oid_lookup, GIT_OID_RAWSZ, 0,
+		lo, hi, graph->num_commits, oid->id);
+	if (pos < 0)
+		return GIT_ENOTFOUND;
+
+	return git_commit_graph_entry_at(entry, graph, (uint32_t)pos);
+}
+
+int git_commit_graph_entry_parent(
+	git_commit_graph_entry *parent,
+	const git_commit_graph *graph,
+	const git_commit_graph_entry *entry,
+	size_t n)
+{
+	uint32_t pos;
+
+	if (n >= entry->parent_count)
+		return commit_graph_error("parent index out of range");
+
+	/* octopus merges keep every parent but the first in the EDGE chunk */
+	if (n == 0 || entry->parent_count <= 2) {
+		pos = entry->parent_pos[n];
+	} else {
+		pos = ntohl(graph->extra_edges[entry->extra_parents_pos + n - 1]) &
+			GRAPH_EDGE_LAST_MASK;
+	}
+
+	return git_commit_graph_entry_at(parent, graph, pos);
+}
+
+/*
+ * MurmurHash3, as used by git.git for its Bloom filters. Version 1 of
+ * the filters sign-extends the trailing bytes (it was written against
+ * a signed `char`); version 2 fixed that.
+ */
+GIT_INLINE(uint32_t) rotate_left(uint32_t value, int count)
+{
+	return (value << count) | (value >> (32 - count));
+}
+
+static uint32_t bloom_murmur3(
+	uint32_t seed, const char *data, size_t len, uint32_t version)
+{
+	const uint32_t c1 = 0xcc9e2d51;
+	const uint32_t c2 = 0x1b873593;
+	const unsigned char *tail;
+	size_t i, len4 = len / 4;
+	uint32_t k, k1 = 0;
+
+	for (i = 0; i < len4; i++) {
+		const unsigned char *p = (const unsigned char *)data + 4 * i;
+
+		if (version == 1)
+			k = (uint32_t)(signed char)p[0] |
+				((uint32_t)(signed char)p[1] << 8) |
+				((uint32_t)(signed char)p[2] << 16) |
+				((uint32_t)(signed char)p[3] << 24);
+		else
+			k = (uint32_t)p[0] | ((uint32_t)p[1] << 8) |
+				((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+
+		k *= c1;
+		k = rotate_left(k, 15);
+		k *= c2;
+
+		seed ^= k;
+		seed = rotate_left(seed, 13) * 5 + 0xe6546b64;
+	}
+
+	tail = (const unsigned char *)data + len4 * 4;
+
+#define BLOOM_TAIL(n) (version == 1 ? \
+	(uint32_t)(signed char)tail[n] : (uint32_t)tail[n])
+
+	switch (len & 3) {
+	case 3:
+		k1 ^= BLOOM_TAIL(2) << 16;
+		/* fall through */
+	case 2:
+		k1 ^= BLOOM_TAIL(1) << 8;
+		/* fall through */
+	case 1:
+		k1 ^= BLOOM_TAIL(0);
+		k1 *= c1;
+		k1 = rotate_left(k1, 15);
+		k1 *= c2;
+		seed ^= k1;
+		break;
+	}
+
+#undef BLOOM_TAIL
+
+	seed ^= (uint32_t)len;
+	seed ^= (seed >> 16);
+	seed *= 0x85ebca6b;
+	seed ^= (seed >> 13);
+	seed *= 0xc2b2ae35;
+	seed ^= (seed >> 16);
+
+	return seed;
+}
+
+static void bloom_key(
+	git_commit_graph_bloom_key *key,
+	const char *path,
+	size_t path_len,
+	uint32_t version,
+	uint32_t num_hashes)
+{
+	uint32_t hash0 = bloom_murmur3(BLOOM_SEED0, path, path_len, version);
+	uint32_t hash1 = bloom_murmur3(BLOOM_SEED1, path, path_len, version);
+	uint32_t i;
+
+	for (i = 0; i < num_hashes; i++)
+		key->hashes[i] = hash0 + i * hash1;
+}
+
+GIT_INLINE(void) bloom_add(
+	unsigned char *filter,
+	size_t filter_len,
+	const git_commit_graph_bloom_key *key,
+	uint32_t num_hashes)
+{
+	uint64_t mod = (uint64_t)filter_len * 8;
+	uint32_t i;
+
+	for (i = 0; i < num_hashes; i++) {
+		uint64_t bit = key->hashes[i] % mod;
+		filter[bit / 8] |= (unsigned char)(1 << (bit & 7));
+	}
+}
+
+void git_commit_graph_bloom_key_init(
+	git_commit_graph_bloom_key *key,
+	const git_commit_graph *graph,
+	const char *path,
+	size_t path_len)
+{
+	bloom_key(key, path, path_len,
+		graph->bloom_hash_version, graph->bloom_num_hashes);
+}
+
+int git_commit_graph_bloom_contains(
+	const git_commit_graph *graph,
+	uint32_t pos,
+	const git_commit_graph_bloom_key *key)
+{
+	const unsigned char *filter;
+	uint32_t start, end, i;
+	uint64_t mod;
+
+	if (!graph->bloom_index || pos >= graph->num_commits)
+		return GIT_ENOTFOUND;
+
+	start = pos ? ntohl(graph->bloom_index[pos - 1]) : 0;
+	end = ntohl(graph->bloom_index[pos]);
+
+	if (end <= start || end > graph->bloom_data_len)
+		return GIT_ENOTFOUND;
+
+	filter = graph->bloom_data + start;
+	mod = (uint64_t)(end - start) * 8;
+
+	for (i = 0; i < graph->bloom_num_hashes; i++) {
+		uint64_t bit = key->hashes[i] % mod;
+
+		if (!(filter[bit / 8] & (1 << (bit & 7))))
+			return 0;
+	}
+
+	return 1;
+}
+
+/*
+ * Writer
+ */
+
+/* a parent, and its position among the entries once they are sorted */
+typedef struct {
+	git_oid oid;
+	uint32_t pos;
+} graph_writer_parent;
+
+typedef struct {
+	git_oid oid;
+	git_oid tree_oid;
+	git_time_t commit_time;
+	uint32_t generation;
+	uint32_t bloom_end;
+	size_t parent_count;
+	graph_writer_parent *parents;
+} graph_writer_entry;
+
+typedef struct {
+	git_repository *repo;
+	git_pool paths;
+	git_vector changed;
+	git_buf path;
+	size_t changes;
+} bloom_changes;
+
+static int writer_entry_cmp(const void *a, const void *b)
+{
+	const graph_writer_entry *entry_a = a, *entry_b = b;
+	return git_oid_cmp(&entry_a->oid, &entry_b->oid);
+}
+
+static int writer_entry_oid_cmp(const void *key, const void *entry)
+{
+	return git_oid_cmp(key, &((const graph_writer_entry *)entry)->oid);
+}
+
+int git_commit_graph_writer_init(
+	git_commit_graph_writer *writer, git_repository *repo)
+{
+	memset(writer, 0x0, sizeof(git_commit_graph_writer));
+	writer->repo = repo;
+
+	if (git_pool_init(&writer->entry_pool, sizeof(graph_writer_entry), 0) < 0 ||
+		git_pool_init(&writer->parent_pool, sizeof(graph_writer_parent), 0) < 0 ||
+		git_vector_init(&writer->entries, 64, writer_entry_cmp) < 0)
+		return -1;
+
+	return 0;
+}
+
+void git_commit_graph_writer_free(git_commit_graph_writer *writer)
+{
+	if (writer == NULL)
+		return;
+
+	git_vector_free(&writer->entries);
+	git_pool_clear(&writer->entry_pool);
+	git_pool_clear(&writer->parent_pool);
+}
+
+int git_commit_graph_writer_add(
+	git_commit_graph_writer *writer,
+	const git_oid *oid,
+	const git_oid *tree_oid,
+	git_time_t commit_time,
+	const git_oid **parents,
+	size_t parent_count)
+{
+	graph_writer_entry *entry;
+	size_t i;
+
+	entry = git_pool_mallocz(&writer->entry_pool, 1);
+	GITERR_CHECK_ALLOC(entry);
+
+	if (parent_count > 0) {
+		entry->parents = git_pool_malloc(
+			&writer->parent_pool, (uint32_t)parent_count);
+		GITERR_CHECK_ALLOC(entry->parents);
+	}
+
+	git_oid_cpy(&entry->oid, oid);
+	git_oid_cpy(&entry->tree_oid, tree_oid);
+	entry->commit_time = commit_time;
+	entry->parent_count = parent_count;
+
+	for (i = 0; i < parent_count; ++i)
+		git_oid_cpy(&entry->parents[i].oid, parents[i]);
+
+	return git_vector_insert(&writer->entries, entry);
+}
+
+static int writer_resolve_parents(git_commit_graph_writer *writer)
+{
+	graph_writer_entry *entry;
+	unsigned int i;
+	size_t j;
+	int pos;
+
+	git_vector_foreach(&writer->entries, i, entry) {
+		for (j = 0; j < entry->parent_count; ++j) {
+			pos = git_vector_bsearch2(
+				&writer->entries, writer_entry_oid_cmp, &entry->parents[j].oid);
+
+			if (pos < 0) {
+				char oid_str[GIT_OID_HEXSZ + 1];
+				git_oid_tostr(oid_str, sizeof(oid_str), &entry->parents[j].oid);
+
+				giterr_set(GITERR_INVALID,
+					"Cannot write commit-graph: parent commit %s is missing", oid_str);
+				return -1;
+			}
+
+			entry->parents[j].pos = (uint32_t)pos;
+		}
+	}
+
+	return 0;
+}
+
+/*
+ * Generation numbers are topological levels: one more than the
+ * largest generation among the parents. They are computed depth-first
+ * with an explicit stack, since histories are far too deep to recurse.
+ */
+static int writer_compute_generations(git_commit_graph_writer *writer)
+{
+	git_vector stack = GIT_VECTOR_INIT;
+	graph_writer_entry *entry, *parent;
+	unsigned int i;
+	size_t j;
+	int error = 0;
+
+	git_vector_foreach(&writer->entries, i, entry) {
+		if (entry->generation)
+			continue;
+
+		if ((error = git_vector_insert(&stack, entry)) < 0)
+			break;
+
+		while (stack.length > 0) {
+			uint32_t max_generation = 0;
+			bool pending = false;
+
+			entry = git_vector_last(&stack);
+
+			for (j = 0; j < entry->parent_count; ++j) {
+				parent = git_vector_get(&writer->entries, entry->parents[j].pos);
+
+				if (!parent->generation) {
+					pending = true;
+					if ((error = git_vector_insert(&stack, parent)) < 0)
+						goto done;
+				} else if (parent->generation > max_generation) {
+					max_generation = parent->generation;
+				}
+			}
+
+			if (pending)
+				continue;
+
+			entry->generation = (max_generation < GRAPH_GENERATION_MAX) ?
+				max_generation + 1 : GRAPH_GENERATION_MAX;
+			git_vector_pop(&stack);
+		}
+	}
+
+done:
+	git_vector_free(&stack);
+	return error;
+}
+
+static int bloom_add_change(bloom_changes *changes, const char *path)
+{
+	char *dup;
+
+	changes->changes++;
+	if (changes->changes > GIT_COMMIT_GRAPH_BLOOM_MAX_CHANGES)
+		return 0;
+
+	/* the path itself and all of its leading directories */
+	for (;;) {
+		const char *slash;
+
+		if ((dup = git_pool_strdup(&changes->paths, path)) == NULL ||
+			git_vector_insert(&changes->changed, dup) < 0)
+			return -1;
+
+		if ((slash = strrchr(dup, '/')) == NULL)
+			break;
+
+		path = git_pool_strndup(&changes->paths, dup, slash - dup);
+		GITERR_CHECK_ALLOC(path);
+	}
+
+	return 0;
+}
+
+static int bloom_diff_trees(
+	bloom_changes *changes, const git_oid *old_oid, const git_oid *new_oid);
+
+static int bloom_diff_entry(
+	bloom_changes *changes,
+	const git_tree_entry *old_entry,
+	const git_tree_entry *new_entry)
+{
+	size_t path_len = changes->path.size;
+	const char *name = new_entry ? new_entry->filename : old_entry->filename;
+	bool old_tree = old_entry && git_tree_entry__is_tree(old_entry);
+	bool new_tree = new_entry && git_tree_entry__is_tree(new_entry);
+	int error = 0;
+
+	if (old_entry && new_entry && old_entry->attr == new_entry->attr &&
+		git_oid_equal(&old_entry->oid, &new_entry->oid))
+		return 0;
+
+	if (git_buf_joinpath(&changes->path, changes->path.ptr, name) < 0)
+		return -1;
+
+	if (old_tree || new_tree)
+		error = bloom_diff_trees(changes,
+			old_tree ? &old_entry->oid : NULL,
+			new_tree ? &new_entry->oid : NULL);
+
+	/* a blob on either side is a change of its own */
+	if (!error && ((old_entry && !old_tree) || (new_entry && !new_tree)))
+		error = bloom_add_change(changes, changes->path.ptr);
+
+	git_buf_truncate(&changes->path, path_len);
+	return error;
+}
+
+static int bloom_diff_trees(
+	bloom_changes *changes, const git_oid *old_oid, const git_oid *new_oid)
+{
+	git_tree *old_tree = NULL, *new_tree = NULL;
+	const git_tree_entry *entry, *other;
+	unsigned int i;
+	int error = 0;
+
+	if ((old_oid && git_tree_lookup(&old_tree, changes->repo, old_oid) < 0) ||
+		(new_oid && git_tree_lookup(&new_tree, changes->repo, new_oid) < 0)) {
+		error = -1;
+		goto cleanup;
+	}
+
+	if (new_tree) {
+		for (i = 0; i < git_tree_entrycount(new_tree); ++i) {
+			entry = git_tree_entry_byindex(new_tree, i);
+			other = old_tree ? git_tree_entry_byname(old_tree, entry->filename) : NULL;
+
+			if ((error = bloom_diff_entry(changes, other, entry)) < 0 ||
+				changes->changes > GIT_COMMIT_GRAPH_BLOOM_MAX_CHANGES)
+				goto cleanup;
+		}
+	}
+
+	if (old_tree) {
+		for (i = 0; i < git_tree_entrycount(old_tree); ++i) {
+			entry = git_tree_entry_byindex(old_tree, i);
+			if (new_tree && git_tree_entry_byname(new_tree, entry->filename) != NULL)
+				continue;
+
+			if ((error = bloom_diff_entry(changes, entry, NULL)) < 0 ||
+				changes->changes > GIT_COMMIT_GRAPH_BLOOM_MAX_CHANGES)
+				goto cleanup;
+		}
+	}
+
+cleanup:
+	git_tree_free(old_tree);
+	git_tree_free(new_tree);
+	return error;
+}
+
+/*
+ * Compute the changed-path filter of a commit against its first parent
+ * (or against the empty tree for root commits) and append it to `out`.
+ */
+static int bloom_compute_filter(
+	git_buf *out,
+	bloom_changes *changes,
+	git_commit_graph_writer *writer,
+	graph_writer_entry *entry)
+{
+	const git_oid *parent_tree = NULL;
+	git_commit_graph_bloom_key key;
+	size_t filter_len, start = out->size;
+	unsigned int i;
+	const char *path;
+
+	if (entry->parent_count > 0) {
+		graph_writer_entry *parent =
+			git_vector_get(&writer->entries, entry->parents[0].pos);
+		parent_tree = &parent->tree_oid;
+	}
+
+	git_vector_clear(&changes->changed);
+	git_pool_clear(&changes->paths);
+	git_buf_clear(&changes->path);
+	changes->changes = 0;
+
+	if (bloom_diff_trees(changes, parent_tree, &entry->tree_oid) < 0)
+		return -1;
+
+	/* too many changes; the filter matches everything */
+	if (changes->changes > GIT_COMMIT_GRAPH_BLOOM_MAX_CHANGES)
+		return git_buf_putc(out, (char)0xff);
+
+	git_vector_sort(&changes->changed);
+	git_vector_uniq(&changes->changed);
+
+	filter_len = (changes->changed.length *
+		GIT_COMMIT_GRAPH_BLOOM_BITS_PER_ENTRY + 7) / 8;
+	if (!filter_len)
+		filter_len = 1;
+
+	if (git_buf_grow(out, start + filter_len + 1) < 0)
+		return -1;
+
+	memset(out->ptr + start, 0x0, filter_len);
+	out->size = start + filter_len;
+	out->ptr[out->size] = '\0';
+
+	git_vector_foreach(&changes->changed, i, path) {
+		bloom_key(&key, path, strlen(path),
+			GIT_COMMIT_GRAPH_BLOOM_HASH_VERSION,
+			GIT_COMMIT_GRAPH_BLOOM_NUM_HASHES);
+		bloom_add((unsigned char *)out->ptr + start, filter_len,
+			&key, GIT_COMMIT_GRAPH_BLOOM_NUM_HASHES);
+	}
+
+	return 0;
+}
+
+static int writer_compute_bloom(git_buf *out, git_commit_graph_writer *writer)
+{
+	bloom_changes changes;
+	graph_writer_entry *entry;
+	unsigned int i;
+	int error = 0;
+
+	memset(&changes, 0x0, sizeof(changes));
+	changes.repo = writer->repo;
+
+	if (git_pool_init(&changes.paths, 1, 0) < 0 ||
+		git_vector_init(&changes.changed, 32, git__strcmp_cb) < 0)
+		return -1;
+
+	git_vector_foreach(&writer->entries, i, entry) {
+		if ((error = bloom_compute_filter(out, &changes, writer, entry)) < 0)
+			break;
+
+		if (out->size > UINT32_MAX) {
+			giterr_set(GITERR_INVALID, "Cannot write commit-graph: bloom filters are too large");
+			error = -1;
+			break;
+		}
+
+		entry->bloom_end = (uint32_t)out->size;
+	}
+
+	git_buf_free(&changes.path);
+	git_vector_free(&changes.changed);
+	git_pool_clear(&changes.paths);
+	return error;
+}
+
+GIT_INLINE(void) put_be32(unsigned char *p, uint32_t value)
+{
+	p[0] = (unsigned char)(value >> 24);
+	p[1] = (unsigned char)(value >> 16);
+	p[2] = (unsigned char)(value >> 8);
+	p[3] = (unsigned char)value;
+}
+
+static int write_be32(git_filebuf *file, uint32_t value)
+{
+	unsigned char buf[4];
+	put_be32(buf, value);
+	return git_filebuf_write(file, buf, sizeof(buf));
+}
+
+static int write_chunk_entry(git_filebuf *file, uint32_t id, uint64_t offset)
+{
+	unsigned char buf[GRAPH_CHUNK_LOOKUP_WIDTH];
+
+	put_be32(buf, id);
+	put_be32(buf + 4, (uint32_t)(offset >> 32));
+	put_be32(buf + 8, (uint32_t)offset);
+
+	return git_filebuf_write(file, buf, sizeof(buf));
+}
+
+static int write_graph(
+	git_filebuf *file,
+	git_commit_graph_writer *writer,
+	git_buf *bloom,
+	bool write_bloom)
+{
+	graph_writer_entry *entry;
+	unsigned char header[GRAPH_HEADER_SIZE];
+	uint32_t chunk_ids[6];
+	uint64_t chunk_sizes[6], offset;
+	uint32_t fanout[256], num_extra_edges = 0;
+	unsigned int i, num_chunks = 0;
+	size_t j;
+	git_oid checksum;
+
+	memset(fanout, 0x0, sizeof(fanout));
+
+	git_vector_foreach(&writer->entries, i, entry) {
+		fanout[entry->oid.id[0]]++;
+		if (entry->parent_count > 2)
+			num_extra_edges += (uint32_t)(entry->parent_count - 1);
+	}
+
+	for (i = 1; i < 256; ++i)
+		fanout[i] += fanout[i - 1];
+
+	chunk_ids[num_chunks] = GIT_COMMIT_GRAPH_CHUNK_OIDFANOUT;
+	chunk_sizes[num_chunks++] = 256 * 4;
+	chunk_ids[num_chunks] = GIT_COMMIT_GRAPH_CHUNK_OIDLOOKUP;
+	chunk_sizes[num_chunks++] = (uint64_t)writer->entries.length * GIT_OID_RAWSZ;
+	chunk_ids[num_chunks] = GIT_COMMIT_GRAPH_CHUNK_DATA;
+	chunk_sizes[num_chunks++] = (uint64_t)writer->entries.length * GRAPH_DATA_WIDTH;
+
+	if (num_extra_edges) {
+		chunk_ids[num_chunks] = GIT_COMMIT_GRAPH_CHUNK_EXTRAEDGE;
+		chunk_sizes[num_chunks++] = (uint64_t)num_extra_edges * 4;
+	}
+
+	if (write_bloom) {
+		chunk_ids[num_chunks] = GIT_COMMIT_GRAPH_CHUNK_BLOOMINDEX;
+		chunk_sizes[num_chunks++] = (uint64_t)writer->entries.length * 4;
+		chunk_ids[num_chunks] = GIT_COMMIT_GRAPH_CHUNK_BLOOMDATA;
+		chunk_sizes[num_chunks++] = BLOOM_HEADER_SIZE + bloom->size;
+	}
+
+	put_be32(header, GIT_COMMIT_GRAPH_SIGNATURE);
+	header[4] = GIT_COMMIT_GRAPH_VERSION;
+	header[5] = GIT_COMMIT_GRAPH_OID_VERSION;
+	header[6] = (unsigned char)num_chunks;
+	header[7] = 0;
+
+	if (git_filebuf_write(file, header, sizeof(header)) < 0)
+		return -1;
+
+	offset = GRAPH_HEADER_SIZE + (num_chunks + 1) * GRAPH_CHUNK_LOOKUP_WIDTH;
+	for (i = 0; i < num_chunks; ++i) {
+		if (write_chunk_entry(file, chunk_ids[i], offset) < 0)
+			return -1;
+		offset += chunk_sizes[i];
+	}
+
+	if (write_chunk_entry(file, 0, offset) < 0)
+		return -1;
+
+	/* OIDF */
+	for (i = 0; i < 256; ++i)
+		if (write_be32(file, fanout[i]) < 0)
+			return -1;
+
+	/* OIDL */
+	git_vector_foreach(&writer->entries, i, entry)
+		if (git_filebuf_write(file, entry->oid.id, GIT_OID_RAWSZ) < 0)
+			return -1;
+
+	/* CDAT */
+	num_extra_edges = 0;
+	git_vector_foreach(&writer->entries, i, entry) {
+		uint32_t parent1 = GRAPH_PARENT_NONE, parent2 = GRAPH_PARENT_NONE;
+
+		if (entry->parent_count > 0)
+			parent1 = entry->parents[0].pos;
+
+		if (entry->parent_count == 2)
+			parent2 = entry->parents[1].pos;
+		else if (entry->parent_count > 2) {
+			parent2 = GRAPH_EXTRA_EDGES_NEEDED | num_extra_edges;
+			num_extra_edges += (uint32_t)(entry->parent_count - 1);
+		}
+
+		if (git_filebuf_write(file, entry->tree_oid.id, GIT_OID_RAWSZ) < 0 ||
+			write_be32(file, parent1) < 0 ||
+			write_be32(file, parent2) < 0 ||
+			write_be32(file, (entry->generation << 2) |
+				(uint32_t)((entry->commit_time >> 32) & 0x3)) < 0 ||
+			write_be32(file, (uint32_t)entry->commit_time) < 0)
+			return -1;
+	}
+
+	/* EDGE */
+	git_vector_foreach(&writer->entries, i, entry) {
+		if (entry->parent_count <= 2)
+			continue;
+
+		for (j = 1; j < entry->parent_count; ++j) {
+			uint32_t edge = entry->parents[j].pos;
+
+			if (j == entry->parent_count - 1)
+				edge |= GRAPH_LAST_EDGE;
+
+			if (write_be32(file, edge) < 0)
+				return -1;
+		}
+	}
+
+	/* BIDX and BDAT */
+	if (write_bloom) {
+		git_vector_foreach(&writer->entries, i, entry)
+			if (write_be32(file, entry->bloom_end) < 0)
+				return -1;
+
+		if (write_be32(file, GIT_COMMIT_GRAPH_BLOOM_HASH_VERSION) < 0 ||
+			write_be32(file, GIT_COMMIT_GRAPH_BLOOM_NUM_HASHES) < 0 ||
+			write_be32(file, GIT_COMMIT_GRAPH_BLOOM_BITS_PER_ENTRY) < 0 ||
+			git_filebuf_write(file, bloom->ptr, bloom->size) < 0)
+			return -1;
+	}
+
+	git_filebuf_hash(&checksum, file);
+	return git_filebuf_write(file, checksum.id, GIT_OID_RAWSZ);
+}
+
+int git_commit_graph_writer_commit(
+	git_commit_graph_writer *writer, const char *path, unsigned int flags)
+{
+	git_filebuf file = GIT_FILEBUF_INIT;
+	git_buf bloom = GIT_BUF_INIT;
+	bool write_bloom = (flags & GIT_COMMIT_GRAPH_CHANGED_PATHS) != 0;
+	int error;
+
+	git_vector_sort(&writer->entries);
+	git_vector_uniq(&writer->entries);
+
+	if ((error = writer_resolve_parents(writer)) < 0 ||
+		(error = writer_compute_generations(writer)) < 0)
+		goto cleanup;
+
+	if (write_bloom && (error = writer_compute_bloom(&bloom, writer)) < 0)
+		goto cleanup;
+
+	if ((error = git_futils_mkpath2file(path, GIT_OBJECT_DIR_MODE)) < 0 ||
+		(error = git_filebuf_open(&file, path, GIT_FILEBUF_HASH_CONTENTS)) < 0)
+		goto cleanup;
+
+	if ((error = write_graph(&file, writer, &bloom, write_bloom)) < 0) {
+		git_filebuf_cleanup(&file);
+		goto cleanup;
+	}
+
+	error = git_filebuf_commit(&file, GIT_COMMIT_GRAPH_FILE_MODE);
+
+cleanup:
+	git_buf_free(&bloom);
+	return error;
+}
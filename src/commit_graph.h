@@ -0,0 +1,176 @@
+/*
+ * Copyright (C) 2009-2012 the libgit2 contributors
+ *
+ * This file is part of libgit2, distributed under the GNU GPL v2 with
+ * a Linking Exception. For full terms see the included COPYING file.
+ */
+#ifndef INCLUDE_commit_graph_h__
+#define INCLUDE_commit_graph_h__
+
+#include "git2/oid.h"
+#include "git2/types.h"
+
+#include "common.h"
+#include "map.h"
+#include "vector.h"
+#include "pool.h"
+
+#define GIT_COMMIT_GRAPH_FILE "objects/info/commit-graph"
+#define GIT_COMMIT_GRAPH_FILE_MODE 0444
+
+#define GIT_COMMIT_GRAPH_SIGNATURE 0x43475048 /* "CGPH" */
+#define GIT_COMMIT_GRAPH_VERSION 1
+#define GIT_COMMIT_GRAPH_OID_VERSION 1
+
+#define GIT_COMMIT_GRAPH_CHUNK_OIDFANOUT 0x4f494446 /* "OIDF" */
+#define GIT_COMMIT_GRAPH_CHUNK_OIDLOOKUP 0x4f49444c /* "OIDL" */
+#define GIT_COMMIT_GRAPH_CHUNK_DATA      0x43444154 /* "CDAT" */
+#define GIT_COMMIT_GRAPH_CHUNK_EXTRAEDGE 0x45444745 /* "EDGE" */
+#define GIT_COMMIT_GRAPH_CHUNK_BLOOMINDEX 0x42494458 /* "BIDX" */
+#define GIT_COMMIT_GRAPH_CHUNK_BLOOMDATA  0x42444154 /* "BDAT" */
+
+/*
+ * Changed-path Bloom filters, using the same parameters as git.git.
+ * Commits that change more paths than the limit get a filter that
+ * matches everything.
+ */
+#define GIT_COMMIT_GRAPH_BLOOM_HASH_VERSION 1
+#define GIT_COMMIT_GRAPH_BLOOM_NUM_HASHES 7
+#define GIT_COMMIT_GRAPH_BLOOM_BITS_PER_ENTRY 10
+#define GIT_COMMIT_GRAPH_BLOOM_MAX_CHANGES 512
+#define GIT_COMMIT_GRAPH_BLOOM_MAX_HASHES 32
+
+/* Commits that are not found in the graph have an unknown generation */
+#define GIT_COMMIT_GRAPH_GENERATION_INFINITY 0xffffffff
+
+/*
+ * A read-only view of the `objects/info/commit-graph` file that
+ * git.git writes on `gc` or `commit-graph write`. The whole file is
+ * mapped and every lookup is served straight out of the mapping.
+ */
+typedef struct {
+	git_map graph_map;
+
+	const uint32_t *oid_fanout;
+	const unsigned char *oid_lookup;
+	const unsigned char *commit_data;
+	const uint32_t *extra_edges;
+
+	uint32_t num_commits;
+	uint32_t num_extra_edges;
+
+	const uint32_t *bloom_index;
+	const unsigned char *bloom_data;
+	size_t bloom_data_len;
+	uint32_t bloom_hash_version;
+	uint32_t bloom_num_hashes;
+} git_commit_graph;
+
+typedef struct {
+	uint32_t hashes[GIT_COMMIT_GRAPH_BLOOM_MAX_HASHES];
+} git_commit_graph_bloom_key;
+
+/*
+ * The parsed form of a single CDAT record. Parent positions are
+ * indices into the graph; use `git_commit_graph_entry_parent` to turn
+ * them into object ids.
+ */
+typedef struct {
+	git_oid tree_oid;
+	uint32_t graph_pos;
+	uint32_t generation;
+	git_time_t commit_time;
+	size_t parent_count;
+	uint32_t parent_pos[2];
+	uint32_t extra_parents_pos;
+} git_commit_graph_entry;
+
+/*
+ * Open the commit graph stored at `path`. Returns GIT_ENOTFOUND
+ * (without setting an error) if the repository does not have one.
+ */
+extern int git_commit_graph_open(git_commit_graph **out, const char *path);
+extern void git_commit_graph_free(git_commit_graph *graph);
+
+/*
+ * Find the commit `oid` in the graph. Returns GIT_ENOTFOUND (without
+ * setting an error) when the commit is not part of it.
+ */
+extern int git_commit_graph_find(
+	git_commit_graph_entry *entry,
+	const git_commit_graph *graph,
+	const git_oid *oid);
+
+/* Load the entry at position `pos` of the graph */
+extern int git_commit_graph_entry_at(
+	git_commit_graph_entry *entry,
+	const git_commit_graph *graph,
+	uint32_t pos);
+
+/* Load the `n`th parent of `entry` */
+extern int git_commit_graph_entry_parent(
+	git_commit_graph_entry *parent,
+	const git_commit_graph *graph,
+	const git_commit_graph_entry *entry,
+	size_t n);
+
+GIT_INLINE(bool) git_commit_graph_has_bloom(const git_commit_graph *graph)
+{
+	return (graph->bloom_index != NULL);
+}
+
+/* Hash `path` into a key for the Bloom filters of `graph` */
+extern void git_commit_graph_bloom_key_init(
+	git_commit_graph_bloom_key *key,
+	const git_commit_graph *graph,
+	const char *path,
+	size_t path_len);
+
+/*
+ * Check the changed-path Bloom filter of the commit at position `pos`.
+ * Returns 0 if the commit definitely did not change the path against
+ * its first parent, 1 if it may have, and GIT_ENOTFOUND if there is
+ * no filter for the commit.
+ */
+extern int git_commit_graph_bloom_contains(
+	const git_commit_graph *graph,
+	uint32_t pos,
+	const git_commit_graph_bloom_key *key);
+
+/*
+ * Writing commit-graph files.
+ *
+ * Commits are added in any order; every parent of an added commit
+ * must be added as well. The file is written atomically to `path`;
+ * `flags` are the GIT_COMMIT_GRAPH_* flags from git2/revwalk.h.
+ */
+typedef struct {
+	git_repository *repo;
+	git_pool entry_pool;
+	git_pool parent_pool;
+	git_vector entries;
+} git_commit_graph_writer;
+
+extern int git_commit_graph_writer_init(
+	git_commit_graph_writer *writer, git_repository *repo);
+
+extern int git_commit_graph_writer_add(
+	git_commit_graph_writer *writer,
+	const git_oid *oid,
+	const git_oid *tree_oid,
+	git_time_t commit_time,
+	const git_oid **parents,
+	size_t parent_count);
+
+extern int git_commit_graph_writer_commit(
+	git_commit_graph_writer *writer, const char *path, unsigned int flags);
+
+extern void git_commit_graph_writer_free(git_commit_graph_writer *writer);
+
+GIT_INLINE(const git_oid *) git_commit_graph_oid(
+	const git_commit_graph *graph, uint32_t pos)
+{
+	return (const git_oid *)(graph->oid_lookup + pos * GIT_OID_RAWSZ);
+}
+
+#endif
@@ -258,7 +258,7 @@ static int crlf_apply_to_workdir(git_filter *self, git_buf *dest, const git_buf
 
 	/* If the line ending is '\n', just copy the input */
 	if (!strcmp(workdir_ending, "\n"))
-		return git_buf_puts(dest, git_buf_cstr(source));
+		return git_buf_put(dest, source->ptr, source->size);
 
 	return convert_line_endings(dest, source, workdir_ending);
 }
@@ -12,6 +12,8 @@
 #include "config.h"
 #include "attr_file.h"
 #include "filter.h"
+#include "fsmonitor.h"
+#include "index.h"
 
 static char *diff_prefix_from_pathspec(const git_strarray *pathspec)
 {
@@ -338,6 +340,10 @@ static git_diff_list *git_diff_list_alloc(
 	if (config_bool(cfg, "core.trustctime", 1))
 		diff->diffcaps = diff->diffcaps | GIT_DIFFCAPS_TRUST_CTIME;
 	/* Don't set GIT_DIFFCAPS_USE_DEV - compile time option in core git */
+#ifdef GIT_THREADS
+	if (config_bool(cfg, "core.preloadindex", 1))
+		diff->diffcaps = diff->diffcaps | GIT_DIFFCAPS_PARALLEL_HASH;
+#endif
 
 	if (opts == NULL)
 		return diff;
@@ -353,6 +359,11 @@ static git_diff_list *git_diff_list_alloc(
 	if (!diff->opts.old_prefix || !diff->opts.new_prefix)
 		goto fail;
 
+	diff->opts.word_regex =
+		git_pool_strdup_safe(&diff->pool, opts->word_regex);
+	if (opts->word_regex && !diff->opts.word_regex)
+		goto fail;
+
 	if (diff->opts.flags & GIT_DIFF_REVERSE) {
 		char *swap = diff->opts.old_prefix;
 		diff->opts.old_prefix = diff->opts.new_prefix;
@@ -425,15 +436,16 @@ void git_diff_list_free(git_diff_list *diff)
 	GIT_REFCOUNT_DEC(diff, diff_list_free);
 }
 
-static int oid_for_workdir_item(
-	git_repository *repo,
+static int hash_workdir_item(
+	const char *workdir,
 	const git_index_entry *item,
+	git_vector *filters,
 	git_oid *oid)
 {
 	int result;
 	git_buf full_path = GIT_BUF_INIT;
 
-	if (git_buf_joinpath(&full_path, git_repository_workdir(repo), item->path) < 0)
+	if (git_buf_joinpath(&full_path, workdir, item->path) < 0)
 		return -1;
 
 	/* calculate OID for file if possible*/
@@ -443,27 +455,298 @@ static int oid_for_workdir_item(
 		giterr_set(GITERR_OS, "File size overflow for 32-bit systems");
 		result = -1;
 	} else {
-		git_vector filters = GIT_VECTOR_INIT;
+		int fd = git_futils_open_ro(full_path.ptr);
+		if (fd < 0)
+			result = fd;
+		else {
+			result = git_odb__hashfd_filtered(
+				oid, fd, (size_t)item->file_size, GIT_OBJ_BLOB, filters);
+			p_close(fd);
+		}
+	}
+
+	git_buf_free(&full_path);
+
+	return result;
+}
 
+static int oid_for_workdir_item(
+	git_repository *repo,
+	const git_index_entry *item,
+	git_oid *oid)
+{
+	int result = 0;
+	git_vector filters = GIT_VECTOR_INIT;
+
+	if (!S_ISLNK(item->mode))
 		result = git_filters_load(
 			&filters, repo, item->path, GIT_FILTER_TO_ODB);
-		if (result >= 0) {
-			int fd = git_futils_open_ro(full_path.ptr);
-			if (fd < 0)
-				result = fd;
-			else {
-				result = git_odb__hashfd_filtered(
-					oid, fd, (size_t)item->file_size, GIT_OBJ_BLOB, &filters);
-				p_close(fd);
+
+	if (result >= 0)
+		result = hash_workdir_item(
+			git_repository_workdir(repo), item, &filters, oid);
+
+	git_filters_free(&filters);
+
+	return result;
+}
+
+static bool diff_entry_is_racy(git_diff_list *diff, const git_index_entry *entry)
+{
+	git_index *index;
+
+	if (diff->old_src != GIT_ITERATOR_INDEX)
+		return false;
+
+	if (git_repository_index__weakptr(&index, diff->repo) < 0) {
+		giterr_clear();
+		return false;
+	}
+
+	return git_index__entry_is_racy(index, entry);
+}
+
+/*
+ * Keep the stat data of a file that was read and found unchanged in its
+ * index entry, with GIT_DIFF_UPDATE_INDEX.
+ */
+static void diff_update_index_entry(
+	git_diff_list *diff,
+	const git_index_entry *oitem,
+	const git_index_entry *nitem)
+{
+	git_index_entry *entry = (git_index_entry *)oitem;
+
+	if ((diff->opts.flags & GIT_DIFF_UPDATE_INDEX) == 0 ||
+		diff->old_src != GIT_ITERATOR_INDEX ||
+		diff->new_src != GIT_ITERATOR_WORKDIR)
+		return;
+
+	/* what the file changes into later this second would not show */
+	if ((time_t)nitem->mtime.seconds >= time(NULL))
+		return;
+
+	entry->ctime = nitem->ctime;
+	entry->mtime = nitem->mtime;
+	entry->dev = nitem->dev;
+	entry->ino = nitem->ino;
+	entry->uid = nitem->uid;
+	entry->gid = nitem->gid;
+	entry->file_size = nitem->file_size;
+
+	diff->index_updated = true;
+}
+
+/*
+ * Write out the stat data that was updated, unless somebody else wrote
+ * the index in the meantime; not being able to is no error.
+ */
+static void diff_write_index(git_diff_list *diff)
+{
+	git_index *index;
+	struct stat st;
+
+	if (git_repository_index__weakptr(&index, diff->repo) < 0 ||
+		(index->on_disk &&
+		 (p_stat(index->index_file_path, &st) < 0 ||
+		  st.st_mtime != index->last_modified)) ||
+		git_index_write(index) < 0)
+		giterr_clear();
+}
+
+/* the number of files to hash that make it worth starting a thread */
+#define DIFF_HASH_THREAD_FILES 16
+
+/*
+ * A file that looks changed and has to be hashed to tell; with
+ * GIT_DIFFCAPS_PARALLEL_HASH they are put off until the iterators are
+ * done and then hashed on several threads. The filters are loaded up
+ * front, as the attribute cache is not to be used by several threads.
+ *
+ * The old oid is copied, as a tree iterator reuses its entry on every
+ * advance; the old entry itself is only kept for an index iterator,
+ * whose entries stay put, to update its stat data.
+ */
+typedef struct {
+	git_diff_delta *delta;
+	const git_index_entry *oitem;
+	git_oid old_oid;
+	git_index_entry item;
+	uint32_t omode;
+	uint32_t nmode;
+	git_vector filters;
+	git_oid oid;
+	int error;
+} diff_hash_job;
+
+static int diff_hash_job__push(
+	git_vector *jobs,
+	git_diff_list *diff,
+	const git_index_entry *oitem,
+	uint32_t omode,
+	const git_index_entry *nitem,
+	uint32_t nmode)
+{
+	diff_hash_job *job = git__calloc(1, sizeof(diff_hash_job));
+	GITERR_CHECK_ALLOC(job);
+
+	if (git_vector_insert(jobs, job) < 0) {
+		git__free(job);
+		return -1;
+	}
+
+	if (!S_ISLNK(nitem->mode) && git_filters_load(
+			&job->filters, diff->repo, nitem->path, GIT_FILTER_TO_ODB) < 0)
+		return -1;
+
+	/* it takes the place of the delta in the list */
+	if (diff_delta__from_two(
+			diff, GIT_DELTA_MODIFIED, oitem, omode, nitem, nmode, NULL) < 0)
+		return -1;
+
+	job->delta = git_vector_last(&diff->deltas);
+	if (diff->old_src == GIT_ITERATOR_INDEX)
+		job->oitem = oitem;
+	git_oid_cpy(&job->old_oid, &oitem->oid);
+	job->omode = omode;
+	job->nmode = nmode;
+
+	memcpy(&job->item, nitem, sizeof(job->item));
+	job->item.path = (char *)job->delta->old_file.path;
+
+	return 0;
+}
+
+static void diff_hash_jobs__free(git_vector *jobs)
+{
+	diff_hash_job *job;
+	unsigned int i;
+
+	git_vector_foreach(jobs, i, job) {
+		git_filters_free(&job->filters);
+		git__free(job);
+	}
+
+	git_vector_free(jobs);
+}
+
+typedef struct {
+	git_vector *jobs;
+	const char *workdir;
+	git_atomic next;
+} diff_hash_queue;
+
+static void *diff_hash_jobs__run(void *arg)
+{
+	diff_hash_queue *queue = arg;
+	diff_hash_job *job;
+	size_t i;
+
+	while ((i = (size_t)git_atomic_inc(&queue->next) - 1) < queue->jobs->length) {
+		job = git_vector_get(queue->jobs, i);
+		job->error = hash_workdir_item(
+			queue->workdir, &job->item, &job->filters, &job->oid);
+	}
+
+	return NULL;
+}
+
+/*
+ * Hash the files that were put off, and settle the status of their
+ * deltas in the order of the list.
+ */
+static int diff_hash_jobs__finish(git_vector *jobs, git_diff_list *diff)
+{
+	diff_hash_queue queue;
+	diff_hash_job *job;
+	git_diff_delta *delta;
+	unsigned int i, j;
+	bool dropped = false;
+	int error;
+
+	if (jobs->length == 0)
+		return 0;
+
+	queue.jobs = jobs;
+	queue.workdir = git_repository_workdir(diff->repo);
+	git_atomic_set(&queue.next, 0);
+
+#ifdef GIT_THREADS
+	{
+		git_index *index;
+		git_thread *threads = NULL;
+		size_t threads_len = 1, started = 0;
+
+		if (git_repository_index__weakptr(&index, diff->repo) < 0)
+			return -1;
+
+		threads_len = git_index__thread_count(
+			index, jobs->length, DIFF_HASH_THREAD_FILES);
+
+		if (threads_len > 1 &&
+			(threads = git__calloc(threads_len - 1, sizeof(git_thread))) != NULL)
+		{
+			for (; started < threads_len - 1; ++started) {
+				if (git_thread_create(&threads[started],
+						NULL, diff_hash_jobs__run, &queue) != 0)
+					break;
 			}
 		}
 
-		git_filters_free(&filters);
+		diff_hash_jobs__run(&queue);
+
+		for (i = 0; i < started; ++i)
+			git_thread_join(threads[i], NULL);
+
+		git__free(threads);
 	}
+#else
+	diff_hash_jobs__run(&queue);
+#endif
+
+	git_vector_foreach(jobs, i, job) {
+		/* the error was raised on another thread; try again on this one,
+		 * where it is reported if it happens again */
+		if (job->error < 0 && (error =
+			oid_for_workdir_item(diff->repo, &job->item, &job->oid)) < 0)
+			return error;
+
+		git_oid_cpy(&job->delta->new_file.oid, &job->oid);
+		job->delta->new_file.flags |= GIT_DIFF_FILE_VALID_OID;
+
+		if (git_oid_cmp(&job->old_oid, &job->oid) != 0 ||
+			job->omode != job->nmode)
+			continue;
 
-	git_buf_free(&full_path);
+		job->delta->status = GIT_DELTA_UNMODIFIED;
 
-	return result;
+		if (job->oitem != NULL) {
+			if ((diff->diffcaps & GIT_DIFFCAPS_USE_FSMONITOR) != 0)
+				git_fsmonitor__mark_valid(job->oitem);
+
+			diff_update_index_entry(diff, job->oitem, &job->item);
+		}
+
+		dropped = dropped ||
+			(diff->opts.flags & GIT_DIFF_INCLUDE_UNMODIFIED) == 0;
+	}
+
+	if (!dropped)
+		return 0;
+
+	for (i = 0, j = 0; i < diff->deltas.length; ++i) {
+		delta = git_vector_get(&diff->deltas, i);
+
+		if (delta->status == GIT_DELTA_UNMODIFIED) {
+			git__free(delta);
+			continue;
+		}
+
+		diff->deltas.contents[j++] = delta;
+	}
+	diff->deltas.length = j;
+
+	return 0;
 }
 
 #define MODE_BITS_MASK 0000777
@@ -473,7 +756,8 @@ static int maybe_modified(
 	const git_index_entry *oitem,
 	git_iterator *new_iter,
 	const git_index_entry *nitem,
-	git_diff_list *diff)
+	git_diff_list *diff,
+	git_vector *hash_jobs)
 {
 	git_oid noid, *use_noid = NULL;
 	git_delta_t status = GIT_DELTA_MODIFIED;
@@ -506,6 +790,11 @@ static int maybe_modified(
 	else if ((oitem->flags_extended & GIT_IDXENTRY_SKIP_WORKTREE) != 0)
 		status = GIT_DELTA_UNMODIFIED;
 
+	/* nothing happened to it since it was last found unchanged */
+	else if ((diff->diffcaps & GIT_DIFFCAPS_USE_FSMONITOR) != 0 &&
+		(oitem->flags_extended & GIT_IDXENTRY_FSMONITOR_VALID) != 0)
+		status = GIT_DELTA_UNMODIFIED;
+
 	/* if basic type of file changed, then split into delete and add */
 	else if (GIT_MODE_TYPE(omode) != GIT_MODE_TYPE(nmode)) {
 		if (diff_delta__from_one(diff, GIT_DELTA_DELETED, oitem) < 0 ||
@@ -526,9 +815,9 @@ static int maybe_modified(
 		git_oid_iszero(&nitem->oid) &&
 		new_iter->type == GIT_ITERATOR_WORKDIR)
 	{
-		/* TODO: add check against index file st_mtime to avoid racy-git */
-
-		/* if they files look exactly alike, then we'll assume the same */
+		/* if they files look exactly alike, then we'll assume the same,
+		 * unless the index was written too soon after the file changed
+		 * for a later change to show in its stat data (racy-git) */
 		if (oitem->file_size == nitem->file_size &&
 			(!(diff->diffcaps & GIT_DIFFCAPS_TRUST_CTIME) ||
 			 (oitem->ctime.seconds == nitem->ctime.seconds)) &&
@@ -537,7 +826,8 @@ static int maybe_modified(
 			 (oitem->dev == nitem->dev)) &&
 			oitem->ino == nitem->ino &&
 			oitem->uid == nitem->uid &&
-			oitem->gid == nitem->gid)
+			oitem->gid == nitem->gid &&
+			!diff_entry_is_racy(diff, oitem))
 			status = GIT_DELTA_UNMODIFIED;
 
 		else if (S_ISGITLINK(nmode)) {
@@ -559,21 +849,85 @@ static int maybe_modified(
 		 * in if it is marked binary.
 		 */
 
-		else if (oid_for_workdir_item(diff->repo, nitem, &noid) < 0)
-			return -1;
+		else if ((diff->diffcaps & GIT_DIFFCAPS_PARALLEL_HASH) != 0)
+			return diff_hash_job__push(
+				hash_jobs, diff, oitem, omode, nitem, nmode);
 
-		else if (git_oid_cmp(&oitem->oid, &noid) == 0 &&
-				 omode == nmode)
-			status = GIT_DELTA_UNMODIFIED;
+		else {
+			if (oid_for_workdir_item(diff->repo, nitem, &noid) < 0)
+				return -1;
+
+			/* store calculated oid so we don't have to recalc later */
+			use_noid = &noid;
+
+			if (git_oid_cmp(&oitem->oid, &noid) == 0 && omode == nmode)
+				status = GIT_DELTA_UNMODIFIED;
+		}
+
+		/* the monitor can tell from now on whether it changes */
+		if (status == GIT_DELTA_UNMODIFIED && !S_ISGITLINK(nmode) &&
+			(diff->diffcaps & GIT_DIFFCAPS_USE_FSMONITOR) != 0)
+			git_fsmonitor__mark_valid(oitem);
 
-		/* store calculated oid so we don't have to recalc later */
-		use_noid = &noid;
+		/* and the stat data that it was hashed with, if asked to */
+		if (status == GIT_DELTA_UNMODIFIED && use_noid != NULL)
+			diff_update_index_entry(diff, oitem, nitem);
 	}
 
 	return diff_delta__from_two(
 		diff, status, oitem, omode, nitem, nmode, use_noid);
 }
 
+/*
+ * Index entries outside of the sparse checkout are not compared with
+ * what may be at their path in the working directory.
+ */
+static bool diff_skips_worktree(git_diff_list *diff, const git_index_entry *oitem)
+{
+	return (diff->old_src == GIT_ITERATOR_INDEX &&
+		diff->new_src == GIT_ITERATOR_WORKDIR &&
+		(oitem->flags_extended & GIT_IDXENTRY_SKIP_WORKTREE) != 0);
+}
+
+/*
+ * Tree iterators made with GIT_ITERATOR_INCLUDE_TREES hand out subtrees as
+ * directories.  When both sides have the same subtree there is nothing to
+ * see in it, and it is stepped over without being loaded; any other
+ * subtree is entered.
+ */
+static bool diff_is_subtree(git_iterator *iter, const git_index_entry *item)
+{
+	return git_iterator_type(iter) == GIT_ITERATOR_TREE && S_ISDIR(item->mode);
+}
+
+static int diff_subtrees(
+	git_diff_list *diff,
+	git_iterator *old_iter, const git_index_entry **oitem,
+	git_iterator *new_iter, const git_index_entry **nitem)
+{
+	bool old_tree = diff_is_subtree(old_iter, *oitem);
+	bool new_tree = diff_is_subtree(new_iter, *nitem);
+
+	if (old_tree && new_tree &&
+		(diff->opts.flags & GIT_DIFF_INCLUDE_UNMODIFIED) == 0 &&
+		git_oid_cmp(&(*oitem)->oid, &(*nitem)->oid) == 0)
+	{
+		if (git_iterator_advance(old_iter, oitem) < 0 ||
+			git_iterator_advance(new_iter, nitem) < 0)
+			return -1;
+
+		return 0;
+	}
+
+	if ((old_tree &&
+		 git_iterator_advance_into_directory(old_iter, oitem) < 0) ||
+		(new_tree &&
+		 git_iterator_advance_into_directory(new_iter, nitem) < 0))
+		return -1;
+
+	return 0;
+}
+
 static int diff_from_iterators(
 	git_repository *repo,
 	const git_diff_options *opts, /**< can be NULL for defaults */
@@ -583,6 +937,7 @@ static int diff_from_iterators(
 {
 	const git_index_entry *oitem, *nitem;
 	git_buf ignore_prefix = GIT_BUF_INIT;
+	git_vector hash_jobs = GIT_VECTOR_INIT;
 	git_diff_list *diff = git_diff_list_alloc(repo, opts);
 	if (!diff)
 		goto fail;
@@ -590,6 +945,13 @@ static int diff_from_iterators(
 	diff->old_src = old_iter->type;
 	diff->new_src = new_iter->type;
 
+	if (old_iter->type == GIT_ITERATOR_INDEX &&
+		git_iterator_uses_fsmonitor(new_iter))
+		diff->diffcaps = diff->diffcaps | GIT_DIFFCAPS_USE_FSMONITOR;
+
+	if (new_iter->type != GIT_ITERATOR_WORKDIR)
+		diff->diffcaps = diff->diffcaps & ~GIT_DIFFCAPS_PARALLEL_HASH;
+
 	if (git_iterator_current(old_iter, &oitem) < 0 ||
 		git_iterator_current(new_iter, &nitem) < 0)
 		goto fail;
@@ -599,7 +961,14 @@ static int diff_from_iterators(
 
 		/* create DELETED records for old items not matched in new */
 		if (oitem && (!nitem || strcmp(oitem->path, nitem->path) < 0)) {
-			if (diff_delta__from_one(diff, GIT_DELTA_DELETED, oitem) < 0 ||
+			if (diff_is_subtree(old_iter, oitem)) {
+				if (git_iterator_advance_into_directory(old_iter, &oitem) < 0)
+					goto fail;
+				continue;
+			}
+
+			if ((!diff_skips_worktree(diff, oitem) &&
+				 diff_delta__from_one(diff, GIT_DELTA_DELETED, oitem) < 0) ||
 				git_iterator_advance(old_iter, &oitem) < 0)
 				goto fail;
 		}
@@ -610,6 +979,12 @@ static int diff_from_iterators(
 		else if (nitem && (!oitem || strcmp(oitem->path, nitem->path) > 0)) {
 			git_delta_t delta_type = GIT_DELTA_UNTRACKED;
 
+			if (diff_is_subtree(new_iter, nitem)) {
+				if (git_iterator_advance_into_directory(new_iter, &nitem) < 0)
+					goto fail;
+				continue;
+			}
+
 			/* check if contained in ignored parent directory */
 			if (git_buf_len(&ignore_prefix) &&
 				git__prefixcmp(nitem->path, git_buf_cstr(&ignore_prefix)) == 0)
@@ -676,16 +1051,34 @@ static int diff_from_iterators(
 		else {
 			assert(oitem && nitem && strcmp(oitem->path, nitem->path) == 0);
 
-			if (maybe_modified(old_iter, oitem, new_iter, nitem, diff) < 0 ||
+			if (diff_is_subtree(old_iter, oitem) ||
+				diff_is_subtree(new_iter, nitem)) {
+				if (diff_subtrees(diff, old_iter, &oitem, new_iter, &nitem) < 0)
+					goto fail;
+				continue;
+			}
+
+			if ((!diff_skips_worktree(diff, oitem) &&
+				 maybe_modified(
+					old_iter, oitem, new_iter, nitem, diff, &hash_jobs) < 0) ||
 				git_iterator_advance(old_iter, &oitem) < 0 ||
 				git_iterator_advance(new_iter, &nitem) < 0)
 				goto fail;
 		}
 	}
 
+	/* the index entries must still be there for this */
+	if (diff_hash_jobs__finish(&hash_jobs, diff) < 0)
+		goto fail;
+
+	if (diff->index_updated &&
+		(diff->opts.flags & GIT_DIFF__DEFER_INDEX_WRITE) == 0)
+		diff_write_index(diff);
+
 	git_iterator_free(old_iter);
 	git_iterator_free(new_iter);
 	git_buf_free(&ignore_prefix);
+	diff_hash_jobs__free(&hash_jobs);
 
 	*diff_ptr = diff;
 	return 0;
@@ -694,6 +1087,7 @@ fail:
 	git_iterator_free(old_iter);
 	git_iterator_free(new_iter);
 	git_buf_free(&ignore_prefix);
+	diff_hash_jobs__free(&hash_jobs);
 
 	git_diff_list_free(diff);
 	*diff_ptr = NULL;
@@ -713,8 +1107,11 @@ int git_diff_tree_to_tree(
 
 	assert(repo && old_tree && new_tree && diff);
 
-	if (git_iterator_for_tree_range(&a, repo, old_tree, prefix, prefix) < 0 ||
-		git_iterator_for_tree_range(&b, repo, new_tree, prefix, prefix) < 0)
+	/* look at the subtrees first, to skip over the ones that are equal */
+	if (git_iterator_for_tree_ext(&a, repo, old_tree,
+			prefix, prefix, GIT_ITERATOR_INCLUDE_TREES) < 0 ||
+		git_iterator_for_tree_ext(&b, repo, new_tree,
+			prefix, prefix, GIT_ITERATOR_INCLUDE_TREES) < 0)
 		return -1;
 
 	git__free(prefix);
@@ -754,11 +1151,19 @@ int git_diff_workdir_to_index(
 {
 	git_iterator *a = NULL, *b = NULL;
 	char *prefix = opts ? diff_prefix_from_pathspec(&opts->pathspec) : NULL;
+	unsigned int flags = 0;
 
 	assert(repo && diff);
 
-	if (git_iterator_for_index_range(&a, repo, prefix, prefix) < 0 ||
-	    git_iterator_for_workdir_range(&b, repo, prefix, prefix) < 0)
+	/* the untracked cache leaves out the ignored files */
+	if (!opts || (opts->flags & GIT_DIFF_INCLUDE_IGNORED) == 0)
+		flags |= GIT_ITERATOR_UNTRACKED_CACHE;
+
+	flags |= GIT_ITERATOR_FSMONITOR | GIT_ITERATOR_PRELOAD;
+
+	if (git_iterator_for_index_ext(
+			&a, repo, prefix, prefix, GIT_ITERATOR_SPARSE_DIRS) < 0 ||
+	    git_iterator_for_workdir_ext(&b, repo, prefix, prefix, flags) < 0)
 		goto on_error;
 
 	git__free(prefix);
@@ -847,6 +1252,8 @@ int git_diff_merge(
 			git_pool_strdup_safe(&onto->pool, onto->opts.old_prefix);
 		onto->opts.new_prefix =
 			git_pool_strdup_safe(&onto->pool, onto->opts.new_prefix);
+		onto->opts.word_regex =
+			git_pool_strdup_safe(&onto->pool, onto->opts.word_regex);
 	}
 
 	git_vector_foreach(&onto_new, i, delta)
@@ -23,8 +23,16 @@ enum {
 	GIT_DIFFCAPS_TRUST_MODE_BITS  = (1 << 2), /* use st_mode? */
 	GIT_DIFFCAPS_TRUST_CTIME      = (1 << 3), /* use st_ctime? */
 	GIT_DIFFCAPS_USE_DEV          = (1 << 4), /* use st_dev? */
+	GIT_DIFFCAPS_USE_FSMONITOR    = (1 << 5), /* skip unchanged paths? */
+	GIT_DIFFCAPS_PARALLEL_HASH    = (1 << 6), /* hash on many threads? */
 };
 
+/*
+ * With GIT_DIFF_UPDATE_INDEX, leave writing the index to the caller; it
+ * finds in `index_updated` whether there is anything to write.
+ */
+#define GIT_DIFF__DEFER_INDEX_WRITE (1u << 31)
+
 #define MAX_DIFF_FILESIZE 0x20000000
 
 struct git_diff_list {
@@ -37,6 +45,7 @@ struct git_diff_list {
 	git_iterator_type_t old_src;
 	git_iterator_type_t new_src;
 	uint32_t diffcaps;
+	bool index_updated;
 };
 
 extern void git_diff__cleanup_modes(
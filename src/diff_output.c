@@ -10,6 +10,8 @@
 #include "git2/blob.h"
 #include "git2/oid.h"
 #include "xdiff/xdiff.h"
+#include "xdiff/xtypes.h"
+#include "xdiff/xdiffi.h"
 #include <ctype.h>
 #include "diff.h"
 #include "map.h"
@@ -33,7 +35,14 @@
  * - In the exec phase, we actually run the diff and execute the callbacks.
  *   For foreach, this is just a pass-through to the user's callbacks.  For
  *   iterators, we record the hunks and data spans into memory.
+ *
+ * When foreach is given no hunk or line callback, the load phase is
+ * replaced by a peek that only looks up the sizes of the files (from
+ * the object headers in the ODB) to mark oversized ones as binary.  The
+ * content is still loaded for deltas whose status is in doubt.
   */
+typedef struct diff_words diff_words;
+
 typedef struct {
 	git_repository   *repo;
 	git_diff_options *opts;
@@ -53,6 +62,7 @@ typedef struct {
 	void *cb_data;
 	git_diff_hunk_fn per_hunk;
 	git_diff_data_fn per_line;
+	diff_words *words;
 	int cb_error;
 	git_diff_range range;
 } diff_delta_context;
@@ -287,6 +297,11 @@ static void setup_xdiff_options(
 		param->flags |= XDF_IGNORE_WHITESPACE_CHANGE;
 	if (opts->flags & GIT_DIFF_IGNORE_WHITESPACE_EOL)
 		param->flags |= XDF_IGNORE_WHITESPACE_AT_EOL;
+
+	if (opts->flags & GIT_DIFF_PATIENCE)
+		param->flags |= XDF_PATIENCE_DIFF;
+	else if (opts->flags & GIT_DIFF_HISTOGRAM)
+		param->flags |= XDF_HISTOGRAM_DIFF;
 }
 
 static int get_blob_content(
@@ -507,6 +522,80 @@ static int diff_delta_prep(diff_delta_context *ctxt)
 	return error;
 }
 
+static void diff_delta_mark_no_data(git_diff_delta *delta)
+{
+	switch (delta->status) {
+	case GIT_DELTA_ADDED:
+		delta->old_file.flags |= GIT_DIFF_FILE_NO_DATA;
+		break;
+	case GIT_DELTA_DELETED:
+		delta->new_file.flags |= GIT_DIFF_FILE_NO_DATA;
+		break;
+	case GIT_DELTA_MODIFIED:
+	case GIT_DELTA_RENAMED:
+	case GIT_DELTA_COPIED:
+		break;
+	default:
+		delta->new_file.flags |= GIT_DIFF_FILE_NO_DATA;
+		delta->old_file.flags |= GIT_DIFF_FILE_NO_DATA;
+		break;
+	}
+}
+
+static int get_blob_size(diff_delta_context *ctxt, git_diff_file *file)
+{
+	git_odb *odb;
+	size_t len;
+	git_otype type;
+
+	if (file->size || git_oid_iszero(&file->oid))
+		return 0;
+
+	if (git_repository_odb__weakptr(&odb, ctxt->repo) < 0 ||
+		git_odb_read_header(&len, &type, odb, &file->oid) < 0)
+		return -1;
+
+	file->size = len;
+	return 0;
+}
+
+static int diff_delta_peek(diff_delta_context *ctxt)
+{
+	int error = 0;
+	git_diff_delta *delta = ctxt->delta;
+
+	if (ctxt->loaded || !ctxt->delta)
+		return 0;
+
+	if (!ctxt->prepped && (error = diff_delta_prep(ctxt)) < 0)
+		return error;
+
+	diff_delta_mark_no_data(delta);
+
+	if (delta->binary != 1 &&
+		(delta->old_file.flags & GIT_DIFF_FILE_NO_DATA) == 0) {
+		if (ctxt->old_src != GIT_ITERATOR_WORKDIR &&
+			(error = get_blob_size(ctxt, &delta->old_file)) < 0)
+			return error;
+		if ((error = diff_delta_is_binary_by_size(ctxt, &delta->old_file)) < 0)
+			return error;
+	}
+
+	if (delta->binary != 1 &&
+		(delta->new_file.flags & GIT_DIFF_FILE_NO_DATA) == 0) {
+		if (ctxt->new_src != GIT_ITERATOR_WORKDIR &&
+			(error = get_blob_size(ctxt, &delta->new_file)) < 0)
+			return error;
+		if ((error = diff_delta_is_binary_by_size(ctxt, &delta->new_file)) < 0)
+			return error;
+	}
+
+	if (delta->binary == -1)
+		update_delta_is_binary(delta);
+
+	return 0;
+}
+
 static int diff_delta_load(diff_delta_context *ctxt)
 {
 	int error = 0;
@@ -530,20 +619,7 @@ static int diff_delta_load(diff_delta_context *ctxt)
 	if (delta->binary == 1)
 		goto cleanup;
 
-	switch (delta->status) {
-	case GIT_DELTA_ADDED:
-		delta->old_file.flags |= GIT_DIFF_FILE_NO_DATA;
-		break;
-	case GIT_DELTA_DELETED:
-		delta->new_file.flags |= GIT_DIFF_FILE_NO_DATA;
-		break;
-	case GIT_DELTA_MODIFIED:
-		break;
-	default:
-		delta->new_file.flags |= GIT_DIFF_FILE_NO_DATA;
-		delta->old_file.flags |= GIT_DIFF_FILE_NO_DATA;
-		break;
-	}
+	diff_delta_mark_no_data(delta);
 
 #define CHECK_UNMODIFIED (GIT_DIFF_FILE_NO_DATA | GIT_DIFF_FILE_VALID_OID)
 
@@ -623,10 +699,365 @@ cleanup:
 	return error;
 }
 
+/*
+ * For a word diff, the removed and added lines of each hunk are not
+ * passed on as they come from xdiff.  The lines of a change are next to
+ * each other in the file data, so we just note where the run of removed
+ * lines and the run of added lines start and end.  When the change ends
+ * (at a context line or at the end of the hunk), both runs are split
+ * into words, which are written one per line into two token streams, and
+ * xdiff is run again on these.  Its hunks tell which words were removed
+ * and added; everything else is passed on as context, from the new side.
+ */
+typedef struct {
+	const char *ptr;
+	size_t len;
+} diff_word;
+
+typedef struct {
+	diff_word *words;
+	size_t len, alloc;
+	git_buf text;
+	git_buf stream;
+} diff_word_list;
+
+struct diff_words {
+	git_diff_word_fn per_word;
+	regex_t regex;
+	int has_regex;
+	const char *old_run, *old_run_end;
+	const char *new_run, *new_run_end;
+	const char *new_pos;
+	diff_word_list old_words;
+	diff_word_list new_words;
+	int error;
+};
+
+static int diff_words_init(
+	diff_words *words, git_diff_options *opts, git_diff_word_fn per_word)
+{
+	int error;
+
+	memset(words, 0, sizeof(*words));
+	words->per_word = per_word;
+
+	if (opts->word_regex != NULL) {
+		error = regcomp(
+			&words->regex, opts->word_regex, REG_EXTENDED | REG_NEWLINE);
+		if (error != 0) {
+			giterr_set_regex(&words->regex, error);
+			regfree(&words->regex);
+			return -1;
+		}
+		words->has_regex = 1;
+	}
+
+	return 0;
+}
+
+static void diff_word_list_free(diff_word_list *list)
+{
+	git__free(list->words);
+	git_buf_free(&list->text);
+	git_buf_free(&list->stream);
+}
+
+static void diff_words_free(diff_words *words)
+{
+	if (words->has_regex)
+		regfree(&words->regex);
+
+	diff_word_list_free(&words->old_words);
+	diff_word_list_free(&words->new_words);
+}
+
+static int diff_word_list_push(
+	diff_word_list *list, const char *ptr, size_t len)
+{
+	diff_word *word;
+	size_t start = list->stream.size;
+
+	if (list->len == list->alloc) {
+		size_t alloc = list->alloc ? list->alloc * 2 : 32;
+
+		word = git__realloc(list->words, alloc * sizeof(diff_word));
+		GITERR_CHECK_ALLOC(word);
+
+		list->words = word;
+		list->alloc = alloc;
+	}
+
+	word = &list->words[list->len++];
+	word->ptr = ptr;
+	word->len = len;
+
+	if (git_buf_put(&list->stream, ptr, len) < 0 ||
+		git_buf_putc(&list->stream, '\n') < 0)
+		return -1;
+
+	/* a regex may match across a line end, but a word is one token */
+	for (; start < list->stream.size - 1; ++start)
+		if (list->stream.ptr[start] == '\n')
+			list->stream.ptr[start] = ' ';
+
+	return 0;
+}
+
+static int diff_words_split(
+	diff_words *words, diff_word_list *list, const char *ptr, size_t len)
+{
+	const char *scan, *end;
+	regmatch_t match;
+
+	list->len = 0;
+	git_buf_clear(&list->stream);
+
+	if (!words->has_regex) {
+		for (scan = ptr, end = ptr + len; scan < end; ) {
+			const char *word;
+
+			while (scan < end && git__isspace(*scan))
+				scan++;
+			for (word = scan; scan < end && !git__isspace(*scan); scan++)
+				/* find end of word */;
+
+			if (scan > word && diff_word_list_push(list, word, scan - word) < 0)
+				return -1;
+		}
+
+		return 0;
+	}
+
+	/* regexec needs a NUL terminated copy of the text */
+	if (git_buf_set(&list->text, ptr, len) < 0)
+		return -1;
+
+	for (scan = list->text.ptr; *scan; ) {
+		int eflags = (scan > list->text.ptr && scan[-1] != '\n') ? REG_NOTBOL : 0;
+
+		if (regexec(&words->regex, scan, 1, &match, eflags) != 0)
+			break;
+
+		if (match.rm_eo > match.rm_so &&
+			diff_word_list_push(list, scan + match.rm_so,
+				(size_t)(match.rm_eo - match.rm_so)) < 0)
+			return -1;
+
+		if (match.rm_eo > 0)
+			scan += match.rm_eo;
+		else if (*scan)
+			scan++;
+	}
+
+	return 0;
+}
+
+static int diff_words_emit(
+	diff_delta_context *ctxt, char origin, const char *ptr, size_t len)
+{
+	while (len > 0) {
+		const char *eol = NULL;
+		size_t span = len;
+
+		if (origin != GIT_DIFF_WORD_DELETION &&
+			(eol = memchr(ptr, '\n', len)) != NULL)
+			span = eol - ptr;
+
+		if (span > 0 &&
+			ctxt->words->per_word(ctxt->cb_data, ctxt->delta, &ctxt->range,
+				origin, ptr, span))
+			return GIT_EUSER;
+
+		if (eol != NULL) {
+			if (ctxt->words->per_word(ctxt->cb_data, ctxt->delta,
+					&ctxt->range, GIT_DIFF_WORD_NEWLINE, eol, 1))
+				return GIT_EUSER;
+			span++;
+		}
+
+		ptr += span;
+		len -= span;
+	}
+
+	return 0;
+}
+
+static const char *diff_word_end(const diff_word *word)
+{
+	return word->ptr + word->len;
+}
+
+static int diff_words_hunk_cb(void *priv, mmbuffer_t *bufs, int len)
+{
+	diff_delta_context *ctxt = priv;
+	diff_words *words = ctxt->words;
+	diff_word_list *old_list = &words->old_words, *new_list = &words->new_words;
+	git_diff_range range;
+	size_t old_first, new_first;
+	const char *context_end;
+
+	if (len != 1)
+		return 0;
+
+	if (parse_hunk_header(&range, bufs[0].ptr) < 0) {
+		words->error = -1;
+		return -1;
+	}
+
+	/* with no lines on one side, the start is the word before the hunk */
+	old_first = range.old_lines ? range.old_start - 1 : range.old_start;
+	new_first = range.new_lines ? range.new_start - 1 : range.new_start;
+
+	if (old_first + range.old_lines > old_list->len ||
+		new_first + range.new_lines > new_list->len) {
+		giterr_set(GITERR_INVALID, "Word diff out of range");
+		words->error = -1;
+		return -1;
+	}
+
+	if (range.new_lines)
+		context_end = new_list->words[new_first].ptr;
+	else if (new_first > 0)
+		context_end = diff_word_end(&new_list->words[new_first - 1]);
+	else
+		context_end = words->new_pos;
+
+	if (context_end > words->new_pos) {
+		if ((words->error = diff_words_emit(ctxt, GIT_DIFF_WORD_CONTEXT,
+				words->new_pos, context_end - words->new_pos)) < 0)
+			return -1;
+		words->new_pos = context_end;
+	}
+
+	if (range.old_lines) {
+		const diff_word *first = &old_list->words[old_first];
+		const diff_word *last = first + range.old_lines - 1;
+
+		if ((words->error = diff_words_emit(ctxt, GIT_DIFF_WORD_DELETION,
+				first->ptr, diff_word_end(last) - first->ptr)) < 0)
+			return -1;
+	}
+
+	if (range.new_lines) {
+		const diff_word *first = &new_list->words[new_first];
+		const diff_word *last = first + range.new_lines - 1;
+
+		if ((words->error = diff_words_emit(ctxt, GIT_DIFF_WORD_ADDITION,
+				first->ptr, diff_word_end(last) - first->ptr)) < 0)
+			return -1;
+		words->new_pos = diff_word_end(last);
+	}
+
+	return 0;
+}
+
+static int diff_words_flush(diff_delta_context *ctxt)
+{
+	diff_words *words = ctxt->words;
+	const char *old_run = words->old_run, *new_run = words->new_run;
+	size_t old_len = words->old_run_end - old_run;
+	size_t new_len = words->new_run_end - new_run;
+	const char *new_end;
+	xpparam_t xdiff_params;
+	xdemitconf_t xdiff_config;
+	xdemitcb_t xdiff_callback;
+	mmfile_t old_stream, new_stream;
+
+	words->old_run = words->old_run_end = NULL;
+	words->new_run = words->new_run_end = NULL;
+
+	/* nothing to compare word by word if one side is empty */
+	if (!new_run)
+		return old_run ?
+			diff_words_emit(ctxt, GIT_DIFF_WORD_DELETION, old_run, old_len) : 0;
+	if (!old_run)
+		return diff_words_emit(ctxt, GIT_DIFF_WORD_ADDITION, new_run, new_len);
+
+	if (diff_words_split(words, &words->old_words, old_run, old_len) < 0 ||
+		diff_words_split(words, &words->new_words, new_run, new_len) < 0)
+		return -1;
+
+	/* the words point into the copies when a regex was used */
+	if (words->has_regex)
+		new_run = words->new_words.text.ptr;
+	words->new_pos = new_run;
+	new_end = new_run + new_len;
+
+	memset(&xdiff_params, 0, sizeof(xdiff_params));
+	xdiff_params.flags = ctxt->xdiff_params.flags &
+		(XDF_PATIENCE_DIFF | XDF_HISTOGRAM_DIFF);
+	memset(&xdiff_config, 0, sizeof(xdiff_config));
+
+	memset(&xdiff_callback, 0, sizeof(xdiff_callback));
+	xdiff_callback.outf = diff_words_hunk_cb;
+	xdiff_callback.priv = ctxt;
+
+	old_stream.ptr  = words->old_words.stream.ptr;
+	old_stream.size = words->old_words.stream.size;
+	new_stream.ptr  = words->new_words.stream.ptr;
+	new_stream.size = words->new_words.stream.size;
+
+	words->error = 0;
+
+	if (xdl_diff(&old_stream, &new_stream,
+			&xdiff_params, &xdiff_config, &xdiff_callback) < 0 && !words->error) {
+		giterr_set(GITERR_NOMEMORY, "Out of memory in word diff");
+		words->error = -1;
+	}
+
+	if (words->error < 0)
+		return words->error;
+
+	return diff_words_emit(ctxt, GIT_DIFF_WORD_CONTEXT,
+		words->new_pos, new_end - words->new_pos);
+}
+
+static void diff_words_extend_run(
+	const char **run, const char **run_end, mmbuffer_t *line)
+{
+	if (*run == NULL)
+		*run = line->ptr;
+	*run_end = line->ptr + line->size;
+}
+
+static int diff_words_cb(diff_delta_context *ctxt, mmbuffer_t *bufs, int len)
+{
+	diff_words *words = ctxt->words;
+
+	if (len == 1) {
+		if ((ctxt->cb_error = diff_words_flush(ctxt)) < 0)
+			return ctxt->cb_error;
+
+		if ((ctxt->cb_error = parse_hunk_header(&ctxt->range, bufs[0].ptr)) < 0)
+			return ctxt->cb_error;
+
+		if (ctxt->per_hunk != NULL &&
+			ctxt->per_hunk(ctxt->cb_data, ctxt->delta, &ctxt->range,
+				bufs[0].ptr, bufs[0].size))
+			ctxt->cb_error = GIT_EUSER;
+	}
+
+	/* a third buffer only marks a missing newline at the end of file */
+	if (len == 2 || len == 3) {
+		if (*bufs[0].ptr == '-')
+			diff_words_extend_run(&words->old_run, &words->old_run_end, &bufs[1]);
+		else if (*bufs[0].ptr == '+')
+			diff_words_extend_run(&words->new_run, &words->new_run_end, &bufs[1]);
+		else if (!(ctxt->cb_error = diff_words_flush(ctxt)))
+			ctxt->cb_error = diff_words_emit(
+				ctxt, GIT_DIFF_WORD_CONTEXT, bufs[1].ptr, bufs[1].size);
+	}
+
+	return ctxt->cb_error;
+}
+
 static int diff_delta_cb(void *priv, mmbuffer_t *bufs, int len)
 {
 	diff_delta_context *ctxt = priv;
 
+	if (ctxt->words != NULL)
+		return diff_words_cb(ctxt, bufs, len);
+
 	if (len == 1) {
 		if ((ctxt->cb_error = parse_hunk_header(&ctxt->range, bufs[0].ptr)) < 0)
 			return ctxt->cb_error;
@@ -694,6 +1125,11 @@ static int diff_delta_exec(
 	ctxt->per_line = per_line;
 	ctxt->cb_error = 0;
 
+	if (ctxt->words != NULL) {
+		ctxt->words->old_run = ctxt->words->old_run_end = NULL;
+		ctxt->words->new_run = ctxt->words->new_run_end = NULL;
+	}
+
 	memset(&xdiff_callback, 0, sizeof(xdiff_callback));
 	xdiff_callback.outf = diff_delta_cb;
 	xdiff_callback.priv = ctxt;
@@ -706,6 +1142,9 @@ static int diff_delta_exec(
 	xdl_diff(&old_xdiff_data, &new_xdiff_data,
 		&ctxt->xdiff_params, &ctxt->xdiff_config, &xdiff_callback);
 
+	if (ctxt->words != NULL && !ctxt->cb_error)
+		ctxt->cb_error = diff_words_flush(ctxt);
+
 	error = ctxt->cb_error;
 
 cleanup:
@@ -714,46 +1153,435 @@ cleanup:
 	return error;
 }
 
-int git_diff_foreach(
-	git_diff_list *diff,
+static int diff_foreach_file(
+	diff_delta_context *ctxt,
+	float progress,
 	void *data,
 	git_diff_file_fn file_cb,
 	git_diff_hunk_fn hunk_cb,
 	git_diff_data_fn line_cb)
 {
-	int error = 0;
+	int error;
+
+	if (diff_delta_is_ambiguous(ctxt->delta))
+		if ((error = diff_delta_load(ctxt)) < 0)
+			return error;
+
+	if (diff_delta_should_skip(ctxt->opts, ctxt->delta))
+		return 0;
+
+	if (!hunk_cb && !line_cb && !ctxt->words)
+		error = diff_delta_peek(ctxt);
+	else
+		error = diff_delta_load(ctxt);
+	if (error < 0)
+		return error;
+
+	if (file_cb != NULL && file_cb(data, ctxt->delta, progress) != 0)
+		return GIT_EUSER;
+
+	if (hunk_cb || line_cb || ctxt->words)
+		error = diff_delta_exec(ctxt, data, hunk_cb, line_cb);
+
+	return error;
+}
+
+/*
+ * The patches of the files can be computed on several threads.  The
+ * deltas go through in windows of DIFF_PARALLEL_FILES_PER_THREAD files
+ * per thread: the attributes of the files in a window are checked, and
+ * working directory files are loaded (they need the filters), on this
+ * thread; the blobs are then loaded and diffed on the workers, which
+ * record the hunks and lines in memory.  Finally the recorded patches are
+ * passed to the callbacks, in the order of the deltas, and unloaded
+ * before the next window starts, so no more than one window of files is
+ * held in memory at a time.
+ */
+#define DIFF_PARALLEL_THRESHOLD 100
+#define DIFF_PARALLEL_FILES_PER_THREAD 8
+
+typedef struct diff_patch_line diff_patch_line;
+struct diff_patch_line {
+	diff_patch_line *next;
+	char origin;
+	const char *ptr;
+	size_t len;
+};
+
+typedef struct diff_patch_hunk diff_patch_hunk;
+struct diff_patch_hunk {
+	diff_patch_hunk *next;
+	git_diff_range range;
+	const char *header;
+	size_t header_len;
+	diff_patch_line *line_head;
+};
+
+typedef struct {
 	diff_delta_context ctxt;
-	size_t idx;
+	git_pool hunks;
+	git_pool lines;
+	git_pool headers;
+	diff_patch_hunk *hunk_head;
+	diff_patch_hunk *last_hunk;
+	diff_patch_line *last_line;
+	bool skip;
+	int error;
+} diff_patch_job;
 
-	diff_delta_init_context_from_diff_list(&ctxt, diff);
+typedef struct {
+	diff_patch_job *jobs;
+	size_t jobs_len;
+	git_atomic next;
+} diff_patch_queue;
 
-	git_vector_foreach(&diff->deltas, idx, ctxt.delta) {
-		if (diff_delta_is_ambiguous(ctxt.delta))
-			if ((error = diff_delta_load(&ctxt)) < 0)
-				goto cleanup;
+static int diff_patch_job__hunk(
+	void *cb_data,
+	git_diff_delta *delta,
+	git_diff_range *range,
+	const char *header,
+	size_t header_len)
+{
+	diff_patch_job *job = cb_data;
+	diff_patch_hunk *hunk;
+
+	GIT_UNUSED(delta);
+
+	if ((hunk = git_pool_mallocz(&job->hunks, 1)) == NULL ||
+		(hunk->header = git_pool_strndup(
+			&job->headers, header, header_len)) == NULL)
+		return -1;
+
+	memcpy(&hunk->range, range, sizeof(hunk->range));
+	hunk->header_len = header_len;
+
+	if (job->last_hunk)
+		job->last_hunk->next = hunk;
+	else
+		job->hunk_head = hunk;
+	job->last_hunk = hunk;
+	job->last_line = NULL;
+
+	return 0;
+}
+
+static int diff_patch_job__line(
+	void *cb_data,
+	git_diff_delta *delta,
+	git_diff_range *range,
+	char line_origin,
+	const char *content,
+	size_t content_len)
+{
+	diff_patch_job *job = cb_data;
+	diff_patch_line *line;
+
+	GIT_UNUSED(delta);
+	GIT_UNUSED(range);
+
+	if ((line = git_pool_mallocz(&job->lines, 1)) == NULL)
+		return -1;
+
+	/* the content points into the loaded files, which stay loaded until
+	 * the patch has been passed on */
+	line->origin = line_origin;
+	line->ptr = content;
+	line->len = content_len;
+
+	if (job->last_line)
+		job->last_line->next = line;
+	else
+		job->last_hunk->line_head = line;
+	job->last_line = line;
+
+	return 0;
+}
+
+static void *diff_patch_jobs__run(void *arg)
+{
+	diff_patch_queue *queue = arg;
+	diff_patch_job *job;
+	size_t i;
+
+	while ((i = (size_t)git_atomic_inc(&queue->next) - 1) < queue->jobs_len) {
+		job = &queue->jobs[i];
+		if (job->skip)
+			continue;
+
+		job->error = diff_delta_exec(&job->ctxt,
+			job, diff_patch_job__hunk, diff_patch_job__line);
+	}
+
+	return NULL;
+}
+
+static void diff_patch_job__clear(diff_patch_job *job)
+{
+	diff_delta_unload(&job->ctxt);
+
+	git_pool_clear(&job->hunks);
+	git_pool_clear(&job->lines);
+	git_pool_clear(&job->headers);
+
+	job->hunk_head = job->last_hunk = NULL;
+	job->last_line = NULL;
+	job->skip = false;
+	job->error = 0;
+}
+
+static int diff_patch_job__replay(
+	diff_patch_job *job,
+	float progress,
+	void *data,
+	git_diff_file_fn file_cb,
+	git_diff_hunk_fn hunk_cb,
+	git_diff_data_fn line_cb)
+{
+	git_diff_delta *delta = job->ctxt.delta;
+	diff_patch_hunk *hunk;
+	diff_patch_line *line;
+
+	if (file_cb != NULL && file_cb(data, delta, progress) != 0)
+		return GIT_EUSER;
+
+	for (hunk = job->hunk_head; hunk != NULL; hunk = hunk->next) {
+		if (hunk_cb != NULL && hunk_cb(
+				data, delta, &hunk->range, hunk->header, hunk->header_len))
+			return GIT_EUSER;
+
+		for (line = hunk->line_head; line != NULL; line = line->next) {
+			if (line_cb != NULL && line_cb(data, delta,
+					&hunk->range, line->origin, line->ptr, line->len))
+				return GIT_EUSER;
+		}
+	}
+
+	return 0;
+}
+
+/*
+ * Set up the jobs for the deltas from `start` on, doing the work that
+ * must be done on this thread.  Returns the number of jobs; if a delta
+ * fails, the window stops short of it, so that it comes first in the
+ * next window and is then processed on its own.
+ */
+static size_t diff_patch_jobs__prepare(
+	diff_patch_job *jobs, size_t jobs_len, git_diff_list *diff, size_t start)
+{
+	diff_patch_job *job;
+	size_t i;
+
+	for (i = 0; i < jobs_len && start + i < diff->deltas.length; ++i) {
+		job = &jobs[i];
+		job->ctxt.delta = git_vector_get(&diff->deltas, start + i);
+
+		if (diff_delta_is_ambiguous(job->ctxt.delta) &&
+			diff_delta_load(&job->ctxt) < 0)
+			break;
 
-		if (diff_delta_should_skip(ctxt.opts, ctxt.delta))
+		if (diff_delta_should_skip(job->ctxt.opts, job->ctxt.delta)) {
+			job->skip = true;
 			continue;
+		}
+
+		if (diff_delta_prep(&job->ctxt) < 0)
+			break;
+
+		if ((job->ctxt.old_src == GIT_ITERATOR_WORKDIR ||
+			 job->ctxt.new_src == GIT_ITERATOR_WORKDIR) &&
+			diff_delta_load(&job->ctxt) < 0)
+			break;
+	}
+
+	if (i < jobs_len && start + i < diff->deltas.length)
+		diff_patch_job__clear(&jobs[i]);
 
-		if ((error = diff_delta_load(&ctxt)) < 0)
+	return i;
+}
+
+static int diff_foreach_parallel(
+	git_diff_list *diff,
+	size_t threads_len,
+	void *data,
+	git_diff_file_fn file_cb,
+	git_diff_hunk_fn hunk_cb,
+	git_diff_data_fn line_cb)
+{
+	diff_patch_queue queue;
+	diff_patch_job *jobs;
+	size_t jobs_len = threads_len * DIFF_PARALLEL_FILES_PER_THREAD;
+	size_t start = 0, count, i;
+	git_odb *odb;
+	int error = 0;
+
+	/* load the object database before the workers need it */
+	if (git_repository_odb__weakptr(&odb, diff->repo) < 0)
+		return -1;
+
+	jobs = git__calloc(jobs_len, sizeof(diff_patch_job));
+	GITERR_CHECK_ALLOC(jobs);
+
+	for (i = 0; i < jobs_len; ++i) {
+		diff_delta_init_context_from_diff_list(&jobs[i].ctxt, diff);
+
+		if (git_pool_init(&jobs[i].hunks, sizeof(diff_patch_hunk), 0) < 0 ||
+			git_pool_init(&jobs[i].lines, sizeof(diff_patch_line), 0) < 0 ||
+			git_pool_init(&jobs[i].headers, 1, 0) < 0) {
+			error = -1;
 			goto cleanup;
+		}
+	}
+
+	while (!error && start < diff->deltas.length) {
+		/* a delta that cannot be prepared goes through on its own */
+		if (!(count = diff_patch_jobs__prepare(jobs, jobs_len, diff, start))) {
+			jobs[0].ctxt.delta = git_vector_get(&diff->deltas, start);
+			error = diff_foreach_file(&jobs[0].ctxt,
+				(float)start / diff->deltas.length,
+				data, file_cb, hunk_cb, line_cb);
+			diff_patch_job__clear(&jobs[0]);
+			start++;
+			continue;
+		}
 
-		if (file_cb != NULL &&
-			file_cb(data, ctxt.delta, (float)idx / diff->deltas.length) != 0)
+		queue.jobs = jobs;
+		queue.jobs_len = count;
+		git_atomic_set(&queue.next, 0);
+
+#ifdef GIT_THREADS
 		{
-			error = GIT_EUSER;
-			goto cleanup;
+			git_thread *threads = NULL;
+			size_t started = 0;
+
+			if (threads_len > 1 &&
+				(threads = git__calloc(threads_len - 1, sizeof(git_thread))) != NULL)
+			{
+				for (; started < threads_len - 1; ++started) {
+					if (git_thread_create(&threads[started],
+							NULL, diff_patch_jobs__run, &queue) != 0)
+						break;
+				}
+			}
+
+			diff_patch_jobs__run(&queue);
+
+			for (i = 0; i < started; ++i)
+				git_thread_join(threads[i], NULL);
+
+			git__free(threads);
 		}
+#else
+		diff_patch_jobs__run(&queue);
+#endif
 
-		error = diff_delta_exec(&ctxt, data, hunk_cb, line_cb);
+		for (i = 0; i < count && !error; ++i) {
+			float progress = (float)(start + i) / diff->deltas.length;
+
+			if (jobs[i].skip)
+				continue;
+
+			/* the error was raised on another thread; raise it here again */
+			if (jobs[i].error < 0) {
+				git_diff_delta *delta = jobs[i].ctxt.delta;
+
+				diff_patch_job__clear(&jobs[i]);
+				jobs[i].ctxt.delta = delta;
+
+				error = diff_foreach_file(&jobs[i].ctxt,
+					progress, data, file_cb, hunk_cb, line_cb);
+				continue;
+			}
+
+			error = diff_patch_job__replay(
+				&jobs[i], progress, data, file_cb, hunk_cb, line_cb);
+		}
+
+		for (i = 0; i < count; ++i)
+			diff_patch_job__clear(&jobs[i]);
+
+		start += count;
+	}
 
 cleanup:
+	for (i = 0; i < jobs_len; ++i)
+		diff_patch_job__clear(&jobs[i]);
+	git__free(jobs);
+
+	return error;
+}
+
+int git_diff_foreach(
+	git_diff_list *diff,
+	void *data,
+	git_diff_file_fn file_cb,
+	git_diff_hunk_fn hunk_cb,
+	git_diff_data_fn line_cb)
+{
+	int error = 0;
+	diff_delta_context ctxt;
+	size_t idx, threads_len;
+
+	if ((hunk_cb || line_cb) &&
+		(threads_len = git_repository__thread_count(diff->repo, "diff",
+			diff->deltas.length, DIFF_PARALLEL_THRESHOLD)) > 1)
+	{
+		error = diff_foreach_parallel(
+			diff, threads_len, data, file_cb, hunk_cb, line_cb);
+		goto done;
+	}
+
+	diff_delta_init_context_from_diff_list(&ctxt, diff);
+
+	git_vector_foreach(&diff->deltas, idx, ctxt.delta) {
+		error = diff_foreach_file(&ctxt, (float)idx / diff->deltas.length,
+			data, file_cb, hunk_cb, line_cb);
+
 		diff_delta_unload(&ctxt);
 
 		if (error < 0)
 			break;
 	}
 
+done:
+	if (error == GIT_EUSER)
+		giterr_clear();
+
+	return error;
+}
+
+int git_diff_foreach_words(
+	git_diff_list *diff,
+	void *data,
+	git_diff_file_fn file_cb,
+	git_diff_hunk_fn hunk_cb,
+	git_diff_word_fn word_cb)
+{
+	int error = 0;
+	diff_delta_context ctxt;
+	diff_words words;
+	size_t idx;
+
+	if (!word_cb)
+		return git_diff_foreach(diff, data, file_cb, hunk_cb, NULL);
+
+	if ((error = diff_words_init(&words, &diff->opts, word_cb)) < 0)
+		return error;
+
+	diff_delta_init_context_from_diff_list(&ctxt, diff);
+	ctxt.words = &words;
+
+	git_vector_foreach(&diff->deltas, idx, ctxt.delta) {
+		error = diff_foreach_file(&ctxt, (float)idx / diff->deltas.length,
+			data, file_cb, hunk_cb, NULL);
+
+		diff_delta_unload(&ctxt);
+
+		if (error < 0)
+			break;
+	}
+
+	diff_words_free(&words);
+
 	if (error == GIT_EUSER)
 		giterr_clear();
 
@@ -805,10 +1633,15 @@ static int print_compact(void *data, git_diff_delta *delta, float progress)
 	git_buf_clear(pi->buf);
 
 	if (delta->old_file.path != delta->new_file.path &&
-		strcmp(delta->old_file.path,delta->new_file.path) != 0)
-		git_buf_printf(pi->buf, "%c\t%s%c -> %s%c\n", code,
-			delta->old_file.path, old_suffix, delta->new_file.path, new_suffix);
-	else if (delta->old_file.mode != delta->new_file.mode &&
+		strcmp(delta->old_file.path,delta->new_file.path) != 0) {
+		git_buf_printf(pi->buf, "%c\t%s", code, delta->old_file.path);
+		if (old_suffix != ' ')
+			git_buf_putc(pi->buf, old_suffix);
+		git_buf_printf(pi->buf, " -> %s", delta->new_file.path);
+		if (new_suffix != ' ')
+			git_buf_putc(pi->buf, new_suffix);
+		git_buf_putc(pi->buf, '\n');
+	} else if (delta->old_file.mode != delta->new_file.mode &&
 		delta->old_file.mode != 0 && delta->new_file.mode != 0)
 		git_buf_printf(pi->buf, "%c\t%s%c (%o -> %o)\n", code,
 			delta->old_file.path, new_suffix, delta->old_file.mode, delta->new_file.mode);
@@ -901,6 +1734,14 @@ static int print_patch_file(void *data, git_diff_delta *delta, float progress)
 	git_buf_clear(pi->buf);
 	git_buf_printf(pi->buf, "diff --git %s%s %s%s\n", oldpfx, delta->old_file.path, newpfx, delta->new_file.path);
 
+	if (delta->status == GIT_DELTA_RENAMED || delta->status == GIT_DELTA_COPIED) {
+		const char *what = (delta->status == GIT_DELTA_RENAMED) ? "rename" : "copy";
+
+		git_buf_printf(pi->buf, "similarity index %u%%\n", delta->similarity);
+		git_buf_printf(pi->buf, "%s from %s\n", what, delta->old_file.path);
+		git_buf_printf(pi->buf, "%s to %s\n", what, delta->new_file.path);
+	}
+
 	if (print_oid_range(pi, delta) < 0)
 		return -1;
 
@@ -1024,6 +1865,130 @@ int git_diff_print_patch(
 	return error;
 }
 
+/*
+ * The statistics are counted from the edit script that xdiff builds:
+ * an emit function that just adds up the sizes of the changes takes the
+ * place of the one that formats the hunks and lines.
+ */
+static int diff_stats_emit(
+	xdfenv_t *xe, xdchange_t *xscr, xdemitcb_t *ecb, xdemitconf_t const *xecfg)
+{
+	size_t *counts = ecb->priv;
+
+	GIT_UNUSED(xe);
+	GIT_UNUSED(xecfg);
+
+	for (; xscr != NULL; xscr = xscr->next) {
+		counts[0] += xscr->chg2;
+		counts[1] += xscr->chg1;
+	}
+
+	return 0;
+}
+
+static size_t diff_count_lines(const git_map *map)
+{
+	const char *scan = map->data, *end = scan + map->len;
+	size_t lines = 0;
+
+	while (scan < end && (scan = memchr(scan, '\n', end - scan)) != NULL) {
+		lines++;
+		scan++;
+	}
+
+	/* a last line without a newline still counts */
+	if (map->len > 0 && ((const char *)map->data)[map->len - 1] != '\n')
+		lines++;
+
+	return lines;
+}
+
+static int diff_delta_count(diff_delta_context *ctxt, size_t counts[2])
+{
+	xdemitconf_t xdiff_config;
+	xdemitcb_t xdiff_callback;
+	mmfile_t old_xdiff_data, new_xdiff_data;
+
+	counts[0] = counts[1] = 0;
+
+	if (!ctxt->diffable)
+		return 0;
+
+	/* added and removed files need no diff, just a count of lines */
+	if (!ctxt->old_data.len || !ctxt->new_data.len) {
+		counts[0] = diff_count_lines(&ctxt->new_data);
+		counts[1] = diff_count_lines(&ctxt->old_data);
+		return 0;
+	}
+
+	memcpy(&xdiff_config, &ctxt->xdiff_config, sizeof(xdiff_config));
+	xdiff_config.emit_func = (void (*)(void))diff_stats_emit;
+
+	memset(&xdiff_callback, 0, sizeof(xdiff_callback));
+	xdiff_callback.priv = counts;
+
+	old_xdiff_data.ptr  = ctxt->old_data.data;
+	old_xdiff_data.size = ctxt->old_data.len;
+	new_xdiff_data.ptr  = ctxt->new_data.data;
+	new_xdiff_data.size = ctxt->new_data.len;
+
+	if (xdl_diff(&old_xdiff_data, &new_xdiff_data,
+			&ctxt->xdiff_params, &xdiff_config, &xdiff_callback) < 0) {
+		giterr_set(GITERR_NOMEMORY, "Out of memory in diff");
+		return -1;
+	}
+
+	return 0;
+}
+
+int git_diff_stats(
+	size_t *insertions,
+	size_t *deletions,
+	git_diff_list *diff,
+	void *data,
+	git_diff_stat_fn stat_cb)
+{
+	int error = 0;
+	diff_delta_context ctxt;
+	size_t idx, counts[2], total_adds = 0, total_dels = 0;
+
+	assert(diff);
+
+	diff_delta_init_context_from_diff_list(&ctxt, diff);
+
+	git_vector_foreach(&diff->deltas, idx, ctxt.delta) {
+		if (diff_delta_is_ambiguous(ctxt.delta))
+			error = diff_delta_load(&ctxt);
+
+		if (!error && !diff_delta_should_skip(ctxt.opts, ctxt.delta) &&
+			!(error = diff_delta_load(&ctxt)) &&
+			!(error = diff_delta_count(&ctxt, counts)))
+		{
+			total_adds += counts[0];
+			total_dels += counts[1];
+
+			if (stat_cb != NULL &&
+				stat_cb(data, ctxt.delta, counts[0], counts[1]))
+				error = GIT_EUSER;
+		}
+
+		diff_delta_unload(&ctxt);
+
+		if (error < 0)
+			break;
+	}
+
+	if (error == GIT_EUSER)
+		giterr_clear();
+
+	if (insertions)
+		*insertions = total_adds;
+	if (deletions)
+		*deletions = total_dels;
+
+	return error;
+}
+
 int git_diff_entrycount(git_diff_list *diff, int delta_t)
 {
 	int count = 0;
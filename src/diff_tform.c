@@ -0,0 +1,687 @@
+/*
+ * Copyright (C) 2012 the libgit2 contributors
+ *
+ * This file is part of libgit2, distributed under the GNU GPL v2 with
+ * a Linking Exception. For full terms see the included COPYING file.
+ */
+#include "common.h"
+#include "git2/diff.h"
+#include "diff.h"
+#include "oidmap.h"
+#include "fileops.h"
+#include "git2/blob.h"
+#include "git2/config.h"
+#include "git2/odb.h"
+
+GIT__USE_OIDMAP;
+
+#define DEFAULT_THRESHOLD 50
+#define DEFAULT_RENAME_LIMIT 200
+
+/* the longest run of bytes without a newline that is hashed as one */
+#define SIMILAR_CHUNK_MAX 64
+
+/*
+ * The signature of a file is the number of bytes in each of the
+ * distinct chunks it splits into, sorted by the hash of the chunk.
+ */
+typedef struct {
+	uint32_t hash;
+	uint32_t bytes;
+} similar_chunk;
+
+enum {
+	SIMILAR_UNLOADED = 0,
+	SIMILAR_LOADED,
+	SIMILAR_UNUSABLE,
+};
+
+typedef struct similar_file {
+	git_diff_delta *delta;
+	git_diff_file *file;
+	/* position of the delta in the diff list */
+	unsigned int pos;
+	/* the next source with the same OID */
+	struct similar_file *next;
+	bool workdir;
+	/* a deleted file that was renamed, or an added one that was paired */
+	bool paired;
+	/* for an added file, what it was paired with */
+	struct similar_file *pair;
+	unsigned int score;
+	bool renamed;
+	int state;
+	git_off_t size;
+	similar_chunk *chunks;
+	size_t chunks_len;
+} similar_file;
+
+typedef struct {
+	similar_file *src;
+	similar_file *tgt;
+	unsigned int score;
+} similar_match;
+
+typedef struct {
+	git_diff_list *diff;
+	git_diff_find_options opts;
+	git_oid empty_blob;
+	similar_file *sources;
+	size_t sources_len;
+	similar_file *targets;
+	size_t targets_len;
+	similar_match *matches;
+	size_t matches_len;
+	size_t matches_alloc;
+} similar_data;
+
+static int normalize_find_opts(
+	git_diff_find_options *out,
+	git_diff_list *diff,
+	const git_diff_find_options *given)
+{
+	git_config *cfg;
+	int32_t limit;
+
+	if (given != NULL)
+		memcpy(out, given, sizeof(git_diff_find_options));
+	else
+		memset(out, 0, sizeof(git_diff_find_options));
+
+	if (!out->flags)
+		out->flags = GIT_DIFF_FIND_RENAMES;
+	if ((out->flags & GIT_DIFF_FIND_COPIES_FROM_UNMODIFIED) != 0)
+		out->flags |= GIT_DIFF_FIND_COPIES;
+
+	if (!out->rename_threshold)
+		out->rename_threshold = DEFAULT_THRESHOLD;
+	if (!out->copy_threshold)
+		out->copy_threshold = DEFAULT_THRESHOLD;
+
+	if (!out->rename_limit) {
+		out->rename_limit = DEFAULT_RENAME_LIMIT;
+
+		if (git_repository_config__weakptr(&cfg, diff->repo) == 0 &&
+			git_config_get_int32(&limit, cfg, "diff.renameLimit") == 0 &&
+			limit > 0)
+			out->rename_limit = (unsigned int)limit;
+
+		giterr_clear();
+	}
+
+	return 0;
+}
+
+/* Whether the file on one side of the diff is in the working directory */
+static bool similar_side_is_workdir(git_diff_list *diff, bool new_side)
+{
+	if (diff->new_src != GIT_ITERATOR_WORKDIR)
+		return false;
+
+	return new_side == ((diff->opts.flags & GIT_DIFF_REVERSE) == 0);
+}
+
+static void similar_file__init(
+	similar_file *f,
+	git_diff_list *diff,
+	git_diff_delta *delta,
+	unsigned int pos,
+	bool new_side)
+{
+	memset(f, 0, sizeof(similar_file));
+
+	f->delta = delta;
+	f->file = new_side ? &delta->new_file : &delta->old_file;
+	f->pos = pos;
+	f->workdir = similar_side_is_workdir(diff, new_side);
+	f->size = -1;
+}
+
+static bool similar_file__is_source(
+	const git_diff_delta *delta, const git_diff_find_options *opts)
+{
+	switch (delta->status) {
+	case GIT_DELTA_DELETED:
+		return true;
+	case GIT_DELTA_MODIFIED:
+		return (opts->flags & GIT_DIFF_FIND_COPIES) != 0;
+	case GIT_DELTA_UNMODIFIED:
+		return (opts->flags & GIT_DIFF_FIND_COPIES_FROM_UNMODIFIED) != 0;
+	default:
+		return false;
+	}
+}
+
+static int similar_file__workdir_path(git_buf *path, similar_data *data, similar_file *f)
+{
+	const char *workdir = git_repository_workdir(data->diff->repo);
+
+	assert(workdir != NULL);
+
+	return git_buf_joinpath(path, workdir, f->file->path);
+}
+
+/*
+ * The OID of a file in the working directory is only known once it has
+ * been read; it is kept in the delta for the diff output as well.
+ */
+static int similar_file__oid(git_oid **out, similar_data *data, similar_file *f)
+{
+	git_buf path = GIT_BUF_INIT;
+	int error = 0;
+
+	*out = NULL;
+
+	if (!git_oid_iszero(&f->file->oid)) {
+		*out = &f->file->oid;
+		return 0;
+	}
+
+	if (!f->workdir || !S_ISREG(f->file->mode))
+		return 0;
+
+	if ((error = similar_file__workdir_path(&path, data, f)) == 0 &&
+		(error = git_odb_hashfile(&f->file->oid, path.ptr, GIT_OBJ_BLOB)) == 0)
+	{
+		f->file->flags |= GIT_DIFF_FILE_VALID_OID;
+		*out = &f->file->oid;
+	}
+
+	git_buf_free(&path);
+
+	return error;
+}
+
+static bool similar_file__is_empty(similar_data *data, const git_oid *oid)
+{
+	return git_oid_cmp(oid, &data->empty_blob) == 0;
+}
+
+/* The size of the file, without reading it where that can be helped */
+static int similar_file__size(git_off_t *out, similar_data *data, similar_file *f)
+{
+	git_buf path = GIT_BUF_INIT;
+	git_odb *odb;
+	git_otype type;
+	size_t len;
+	struct stat st;
+	int error = 0;
+
+	if (f->size < 0) {
+		if (f->workdir) {
+			if ((error = similar_file__workdir_path(&path, data, f)) == 0) {
+				if ((error = p_stat(path.ptr, &st)) < 0)
+					giterr_set(GITERR_OS, "Could not stat '%s'", path.ptr);
+				else
+					f->size = (git_off_t)st.st_size;
+			}
+
+			git_buf_free(&path);
+		} else {
+			if ((error = git_repository_odb__weakptr(&odb, data->diff->repo)) == 0 &&
+				(error = git_odb_read_header(&len, &type, odb, &f->file->oid)) == 0)
+				f->size = (git_off_t)len;
+		}
+	}
+
+	*out = f->size;
+	return error;
+}
+
+static int similar_chunk_cmp(const void *a, const void *b)
+{
+	uint32_t ha = ((const similar_chunk *)a)->hash;
+	uint32_t hb = ((const similar_chunk *)b)->hash;
+
+	return (ha < hb) ? -1 : (ha > hb) ? 1 : 0;
+}
+
+/*
+ * Split the contents into lines, with long lines cut into pieces of at
+ * most SIMILAR_CHUNK_MAX bytes, and count the bytes of each distinct
+ * piece by its hash.
+ */
+static int similar_file__sign(similar_file *f, const char *data, size_t len)
+{
+	size_t i, start = 0, alloc = len / 32 + 1;
+	uint32_t hash = 2166136261u;
+	similar_chunk *chunks, *c;
+
+	if ((chunks = git__malloc(alloc * sizeof(similar_chunk))) == NULL)
+		return -1;
+
+	f->chunks_len = 0;
+
+	for (i = 0; i < len; ++i) {
+		hash = (hash ^ (unsigned char)data[i]) * 16777619u;
+
+		if (data[i] != '\n' && i + 1 - start < SIMILAR_CHUNK_MAX && i + 1 < len)
+			continue;
+
+		if (f->chunks_len == alloc) {
+			alloc *= 2;
+			if ((c = git__realloc(chunks, alloc * sizeof(similar_chunk))) == NULL) {
+				git__free(chunks);
+				return -1;
+			}
+			chunks = c;
+		}
+
+		chunks[f->chunks_len].hash = hash;
+		chunks[f->chunks_len].bytes = (uint32_t)(i + 1 - start);
+		f->chunks_len++;
+
+		hash = 2166136261u;
+		start = i + 1;
+	}
+
+	qsort(chunks, f->chunks_len, sizeof(similar_chunk), similar_chunk_cmp);
+
+	/* merge the pieces that are alike */
+	if (f->chunks_len > 0) {
+		size_t out = 0;
+
+		for (i = 1; i < f->chunks_len; ++i) {
+			if (chunks[i].hash == chunks[out].hash)
+				chunks[out].bytes += chunks[i].bytes;
+			else
+				chunks[++out] = chunks[i];
+		}
+
+		f->chunks_len = out + 1;
+	}
+
+	f->chunks = chunks;
+	f->size = (git_off_t)len;
+
+	return 0;
+}
+
+static int similar_file__load(similar_data *data, similar_file *f)
+{
+	git_buf path = GIT_BUF_INIT, content = GIT_BUF_INIT;
+	git_blob *blob = NULL;
+	int error = 0;
+
+	if (f->state != SIMILAR_UNLOADED)
+		return 0;
+
+	f->state = SIMILAR_UNUSABLE;
+
+	if (f->workdir) {
+		if ((error = similar_file__workdir_path(&path, data, f)) == 0 &&
+			(error = git_futils_readbuffer(&content, path.ptr)) == 0)
+			error = similar_file__sign(f, content.ptr, content.size);
+	} else if ((error = git_blob_lookup(
+			&blob, data->diff->repo, &f->file->oid)) == 0) {
+		error = similar_file__sign(f,
+			git_blob_rawcontent(blob), (size_t)git_blob_rawsize(blob));
+	}
+
+	if (!error)
+		f->state = SIMILAR_LOADED;
+
+	git_blob_free(blob);
+	git_buf_free(&content);
+	git_buf_free(&path);
+
+	return error;
+}
+
+/* How much of the larger file is also in the other one, in percent */
+static unsigned int similar_score(const similar_file *a, const similar_file *b)
+{
+	size_t i = 0, j = 0;
+	uint64_t common = 0;
+	git_off_t larger = a->size > b->size ? a->size : b->size;
+
+	while (i < a->chunks_len && j < b->chunks_len) {
+		if (a->chunks[i].hash < b->chunks[j].hash)
+			i++;
+		else if (a->chunks[i].hash > b->chunks[j].hash)
+			j++;
+		else {
+			common += min(a->chunks[i].bytes, b->chunks[j].bytes);
+			i++;
+			j++;
+		}
+	}
+
+	return larger > 0 ? (unsigned int)(common * 100 / (uint64_t)larger) : 0;
+}
+
+/* The similarity it takes to pair `src` with a target, or 0 if it can't */
+static unsigned int similar_threshold(similar_data *data, const similar_file *src)
+{
+	const git_diff_find_options *opts = &data->opts;
+	bool renames = (opts->flags & GIT_DIFF_FIND_RENAMES) != 0 &&
+		src->delta->status == GIT_DELTA_DELETED && !src->paired;
+	bool copies = (opts->flags & GIT_DIFF_FIND_COPIES) != 0;
+
+	if (renames && copies)
+		return min(opts->rename_threshold, opts->copy_threshold);
+	if (renames)
+		return opts->rename_threshold;
+	if (copies)
+		return opts->copy_threshold;
+
+	return 0;
+}
+
+static int similar_data__push_match(
+	similar_data *data, similar_file *src, similar_file *tgt, unsigned int score)
+{
+	similar_match *m;
+
+	if (data->matches_len == data->matches_alloc) {
+		size_t alloc = data->matches_alloc ? data->matches_alloc * 2 : 16;
+
+		m = git__realloc(data->matches, alloc * sizeof(similar_match));
+		GITERR_CHECK_ALLOC(m);
+
+		data->matches = m;
+		data->matches_alloc = alloc;
+	}
+
+	m = &data->matches[data->matches_len++];
+	m->src = src;
+	m->tgt = tgt;
+	m->score = score;
+
+	return 0;
+}
+
+/*
+ * Pair `tgt` with `src`, as a rename where the source allows it; the
+ * diff list itself only changes once everything has been paired.
+ */
+static void similar_pair(
+	similar_data *data, similar_file *src, similar_file *tgt, unsigned int score)
+{
+	if ((data->opts.flags & GIT_DIFF_FIND_RENAMES) != 0 &&
+		src->delta->status == GIT_DELTA_DELETED && !src->paired &&
+		score >= data->opts.rename_threshold)
+	{
+		tgt->renamed = true;
+		src->paired = true;
+	}
+
+	tgt->pair = src;
+	tgt->score = score;
+	tgt->paired = true;
+}
+
+/* Files with the same OID are paired without reading them */
+static int similar_find_exact(similar_data *data)
+{
+	git_oidmap *map;
+	similar_file *f, *src, *first;
+	git_oid *oid;
+	khiter_t pos;
+	size_t i;
+	int error = 0, put;
+
+	if ((map = git_oidmap_alloc()) == NULL)
+		return -1;
+
+	for (i = data->sources_len; i > 0 && !error; --i) {
+		f = &data->sources[i - 1];
+
+		if ((error = similar_file__oid(&oid, data, f)) < 0 ||
+			oid == NULL || similar_file__is_empty(data, oid))
+			continue;
+
+		/* keep the sources with the same OID in the order of the diff */
+		pos = kh_put(oid, map, oid, &put);
+		if (put < 0) {
+			error = -1;
+			break;
+		}
+
+		f->next = put ? NULL : kh_val(map, pos);
+		kh_val(map, pos) = f;
+	}
+
+	for (i = 0; i < data->targets_len && !error; ++i) {
+		f = &data->targets[i];
+
+		if ((error = similar_file__oid(&oid, data, f)) < 0 ||
+			oid == NULL || similar_file__is_empty(data, oid))
+			continue;
+
+		pos = kh_get(oid, map, oid);
+		if (pos == kh_end(map))
+			continue;
+
+		/* a deleted file that is still free makes for a rename */
+		first = kh_val(map, pos);
+		for (src = first; src != NULL; src = src->next) {
+			if (src->delta->status == GIT_DELTA_DELETED && !src->paired &&
+				(data->opts.flags & GIT_DIFF_FIND_RENAMES) != 0)
+				break;
+		}
+
+		if (src == NULL && (data->opts.flags & GIT_DIFF_FIND_COPIES) != 0)
+			src = first;
+
+		if (src != NULL)
+			similar_pair(data, src, f, 100);
+	}
+
+	git_oidmap_free(map);
+
+	return error;
+}
+
+static int similar_match_cmp(const void *a, const void *b)
+{
+	const similar_match *ma = a, *mb = b;
+
+	if (ma->score != mb->score)
+		return (ma->score > mb->score) ? -1 : 1;
+	if (ma->tgt->pos != mb->tgt->pos)
+		return (ma->tgt->pos < mb->tgt->pos) ? -1 : 1;
+	if (ma->src->pos != mb->src->pos)
+		return (ma->src->pos < mb->src->pos) ? -1 : 1;
+
+	return 0;
+}
+
+/*
+ * The other files are compared through their signatures, computed once
+ * per file, and paired from the most similar down.
+ */
+static int similar_find_inexact(similar_data *data)
+{
+	similar_file *src, *tgt;
+	git_off_t src_size, tgt_size;
+	size_t i, j, targets = 0;
+	unsigned int threshold, score;
+	const git_oid *oid;
+
+	for (i = 0; i < data->targets_len; ++i)
+		if (!data->targets[i].paired)
+			targets++;
+
+	if (targets == 0 || data->sources_len == 0 ||
+		targets * data->sources_len >
+		(size_t)data->opts.rename_limit * data->opts.rename_limit)
+		return 0;
+
+	for (i = 0; i < data->targets_len; ++i) {
+		tgt = &data->targets[i];
+		oid = &tgt->file->oid;
+
+		if (tgt->paired || !S_ISREG(tgt->file->mode) ||
+			similar_file__is_empty(data, oid) ||
+			similar_file__size(&tgt_size, data, tgt) < 0 || tgt_size == 0)
+			continue;
+
+		for (j = 0; j < data->sources_len; ++j) {
+			src = &data->sources[j];
+			oid = &src->file->oid;
+
+			if ((threshold = similar_threshold(data, src)) == 0 ||
+				!S_ISREG(src->file->mode) ||
+				similar_file__is_empty(data, oid) ||
+				similar_file__size(&src_size, data, src) < 0 || src_size == 0)
+				continue;
+
+			/* files too different in size can't be similar enough */
+			if (src_size < tgt_size ?
+				src_size * 100 < (git_off_t)threshold * tgt_size :
+				tgt_size * 100 < (git_off_t)threshold * src_size)
+				continue;
+
+			if (similar_file__load(data, tgt) < 0 ||
+				similar_file__load(data, src) < 0)
+				return -1;
+
+			if (tgt->state != SIMILAR_LOADED)
+				break;
+			if (src->state != SIMILAR_LOADED)
+				continue;
+
+			if ((score = similar_score(src, tgt)) >= threshold &&
+				similar_data__push_match(data, src, tgt, score) < 0)
+				return -1;
+		}
+	}
+
+	/* nothing may be similar enough, and then there are no matches */
+	if (data->matches_len == 0)
+		return 0;
+
+	qsort(data->matches, data->matches_len, sizeof(similar_match),
+		similar_match_cmp);
+
+	for (i = 0; i < data->matches_len; ++i) {
+		similar_match *m = &data->matches[i];
+
+		if (m->tgt->paired || m->score < similar_threshold(data, m->src))
+			continue;
+
+		/* a rename can't happen twice; the copy may be too weak */
+		if ((data->opts.flags & GIT_DIFF_FIND_RENAMES) != 0 &&
+			m->src->delta->status == GIT_DELTA_DELETED && !m->src->paired &&
+			m->score < data->opts.rename_threshold)
+			continue;
+
+		similar_pair(data, m->src, m->tgt, m->score);
+	}
+
+	return 0;
+}
+
+/*
+ * Turn the added files that were paired into renames and copies, and
+ * drop the deleted files that were renamed from the diff list
+ */
+static void similar_apply(similar_data *data)
+{
+	git_vector *deltas = &data->diff->deltas;
+	size_t i, out = 0;
+
+	for (i = 0; i < data->targets_len; ++i) {
+		similar_file *tgt = &data->targets[i];
+
+		if (!tgt->paired)
+			continue;
+
+		tgt->delta->status = tgt->renamed ? GIT_DELTA_RENAMED : GIT_DELTA_COPIED;
+		tgt->delta->similarity = tgt->score;
+		memcpy(&tgt->delta->old_file, tgt->pair->file, sizeof(git_diff_file));
+	}
+
+	for (i = 0; i < data->sources_len; ++i) {
+		similar_file *src = &data->sources[i];
+
+		if (src->paired && src->delta->status == GIT_DELTA_DELETED) {
+			git__free(src->delta);
+			deltas->contents[src->pos] = NULL;
+		}
+	}
+
+	for (i = 0; i < deltas->length; ++i)
+		if (deltas->contents[i] != NULL)
+			deltas->contents[out++] = deltas->contents[i];
+
+	deltas->length = out;
+}
+
+static void similar_data__free(similar_data *data)
+{
+	size_t i;
+
+	for (i = 0; i < data->sources_len; ++i)
+		git__free(data->sources[i].chunks);
+	for (i = 0; i < data->targets_len; ++i)
+		git__free(data->targets[i].chunks);
+
+	git__free(data->sources);
+	git__free(data->targets);
+	git__free(data->matches);
+}
+
+int git_diff_find_similar(
+	git_diff_list *diff,
+	git_diff_find_options *given_opts)
+{
+	similar_data data;
+	git_diff_delta *delta;
+	unsigned int i;
+	int error = 0;
+
+	assert(diff);
+
+	memset(&data, 0, sizeof(data));
+	data.diff = diff;
+
+	if (normalize_find_opts(&data.opts, diff, given_opts) < 0 ||
+		git_odb_hash(&data.empty_blob, "", 0, GIT_OBJ_BLOB) < 0)
+		return -1;
+
+	if ((data.opts.flags &
+		(GIT_DIFF_FIND_RENAMES | GIT_DIFF_FIND_COPIES)) == 0)
+		return 0;
+
+	git_vector_foreach(&diff->deltas, i, delta) {
+		if (delta->status == GIT_DELTA_ADDED)
+			data.targets_len++;
+		else if (similar_file__is_source(delta, &data.opts))
+			data.sources_len++;
+	}
+
+	if (data.targets_len == 0 || data.sources_len == 0)
+		return 0;
+
+	data.sources = git__calloc(data.sources_len, sizeof(similar_file));
+	GITERR_CHECK_ALLOC(data.sources);
+	data.targets = git__calloc(data.targets_len, sizeof(similar_file));
+	if (data.targets == NULL) {
+		git__free(data.sources);
+		return -1;
+	}
+
+	data.sources_len = data.targets_len = 0;
+
+	git_vector_foreach(&diff->deltas, i, delta) {
+		if (delta->status == GIT_DELTA_ADDED)
+			similar_file__init(
+				&data.targets[data.targets_len++], diff, delta, i, true);
+		else if (similar_file__is_source(delta, &data.opts))
+			similar_file__init(
+				&data.sources[data.sources_len++], diff, delta, i, false);
+	}
+
+	if ((error = similar_find_exact(&data)) == 0 &&
+		(data.opts.flags & GIT_DIFF_FIND_EXACT_MATCH_ONLY) == 0)
+		error = similar_find_inexact(&data);
+
+	if (!error)
+		similar_apply(&data);
+
+	similar_data__free(&data);
+
+	return error;
+}
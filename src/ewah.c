@@ -0,0 +1,199 @@
+/*
+ * Copyright (C) 2009-2012 the libgit2 contributors
+ *
+ * This file is part of libgit2, distributed under the GNU GPL v2 with
+ * a Linking Exception. For full terms see the included COPYING file.
+ */
+
+#include "ewah.h"
+
+/*
+ * A compressed bitmap is a sequence of "running length words" (RLW),
+ * each followed by its literal words. An RLW stores, from the least
+ * significant bit up:
+ *
+ *   1 bit   the value of the running bits
+ *   32 bits the number of words that are all running bits
+ *   31 bits the number of literal words that follow it
+ */
+#define RLW_RUNNING_BITS 32
+#define RLW_LITERAL_BITS 31
+#define RLW_LARGEST_RUNNING ((((uint64_t)1) << RLW_RUNNING_BITS) - 1)
+#define RLW_LARGEST_LITERAL ((((uint64_t)1) << RLW_LITERAL_BITS) - 1)
+
+static uint32_t get_be32(const unsigned char *p)
+{
+	return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) |
+		((uint32_t)p[2] << 8) | (uint32_t)p[3];
+}
+
+static uint64_t get_be64(const unsigned char *p)
+{
+	return ((uint64_t)get_be32(p) << 32) | get_be32(p + 4);
+}
+
+static int put_be32(git_buf *out, uint32_t value)
+{
+	unsigned char p[4];
+
+	p[0] = (unsigned char)(value >> 24);
+	p[1] = (unsigned char)(value >> 16);
+	p[2] = (unsigned char)(value >> 8);
+	p[3] = (unsigned char)value;
+
+	return git_buf_put(out, (const char *)p, 4);
+}
+
+static int put_be64(git_buf *out, uint64_t value)
+{
+	put_be32(out, (uint32_t)(value >> 32));
+	return put_be32(out, (uint32_t)value);
+}
+
+static int bitmap_grow(git_ewah_bitmap *bitmap, size_t words_len)
+{
+	uint64_t *words;
+
+	if (words_len <= bitmap->words_len)
+		return 0;
+
+	words = git__realloc(bitmap->words, words_len * sizeof(uint64_t));
+	GITERR_CHECK_ALLOC(words);
+
+	memset(words + bitmap->words_len, 0,
+		(words_len - bitmap->words_len) * sizeof(uint64_t));
+
+	bitmap->words = words;
+	bitmap->words_len = words_len;
+	return 0;
+}
+
+int git_ewah_set(git_ewah_bitmap *bitmap, size_t pos)
+{
+	size_t needed = pos / 64 + 1;
+
+	if (needed > bitmap->words_len &&
+		bitmap_grow(bitmap, needed > bitmap->words_len * 2 ?
+			needed : bitmap->words_len * 2) < 0)
+		return -1;
+
+	bitmap->words[pos / 64] |= (uint64_t)1 << (pos % 64);
+
+	if (pos >= bitmap->bit_size)
+		bitmap->bit_size = pos + 1;
+
+	return 0;
+}
+
+void git_ewah_free(git_ewah_bitmap *bitmap)
+{
+	git__free(bitmap->words);
+	memset(bitmap, 0, sizeof(*bitmap));
+}
+
+static int invalid_bitmap(void)
+{
+	giterr_set(GITERR_INDEX, "Invalid EWAH bitmap");
+	return -1;
+}
+
+int git_ewah_read(
+	git_ewah_bitmap *bitmap, const char *buffer, size_t buffer_size)
+{
+	const unsigned char *data = (const unsigned char *)buffer;
+	size_t bit_size, compressed_len, i, out = 0;
+
+	memset(bitmap, 0, sizeof(*bitmap));
+
+	if (buffer_size < 8)
+		return invalid_bitmap();
+
+	bit_size = get_be32(data);
+	compressed_len = get_be32(data + 4);
+
+	/* the words, and the position of the last RLW after them */
+	if (compressed_len > (buffer_size - 12) / 8)
+		return invalid_bitmap();
+
+	if (bitmap_grow(bitmap, (bit_size + 63) / 64) < 0)
+		return -1;
+
+	data += 8;
+
+	for (i = 0; i < compressed_len; ) {
+		uint64_t rlw = get_be64(data + i * 8);
+		bool running_bit = (rlw & 1) != 0;
+		size_t running_len = (size_t)((rlw >> 1) & RLW_LARGEST_RUNNING);
+		size_t literal_len = (size_t)(rlw >> (1 + RLW_RUNNING_BITS));
+
+		i++;
+
+		if (running_len > bitmap->words_len - out ||
+			literal_len > bitmap->words_len - out - running_len ||
+			literal_len > compressed_len - i)
+			goto fail;
+
+		if (running_bit)
+			memset(bitmap->words + out, 0xff, running_len * sizeof(uint64_t));
+		out += running_len;
+
+		for (; literal_len > 0; --literal_len, ++i)
+			bitmap->words[out++] = get_be64(data + i * 8);
+	}
+
+	bitmap->bit_size = bit_size;
+
+	/* the trailing word is the position of the last RLW */
+	return (int)(12 + compressed_len * 8);
+
+fail:
+	git_ewah_free(bitmap);
+	return invalid_bitmap();
+}
+
+int git_ewah_write(git_buf *out, const git_ewah_bitmap *bitmap)
+{
+	size_t words_len = (bitmap->bit_size + 63) / 64;
+	size_t i = 0, rlw_pos = 0, compressed_len = 0;
+	size_t start = out->size;
+
+	put_be32(out, (uint32_t)bitmap->bit_size);
+	put_be32(out, 0); /* fixed up below */
+
+	/* runs of empty words, each followed by the words that are not */
+	while (i < words_len || compressed_len == 0) {
+		size_t running = 0, literals = 0, j;
+
+		while (i + running < words_len && !bitmap->words[i + running] &&
+			running < RLW_LARGEST_RUNNING)
+			running++;
+
+		while (i + running + literals < words_len &&
+			bitmap->words[i + running + literals] &&
+			literals < RLW_LARGEST_LITERAL)
+			literals++;
+
+		rlw_pos = compressed_len;
+		put_be64(out, ((uint64_t)running << 1) |
+			((uint64_t)literals << (1 + RLW_RUNNING_BITS)));
+		compressed_len++;
+
+		for (j = 0; j < literals; ++j)
+			put_be64(out, bitmap->words[i + running + j]);
+
+		compressed_len += literals;
+		i += running + literals;
+	}
+
+	put_be32(out, (uint32_t)rlw_pos);
+
+	if (git_buf_oom(out))
+		return -1;
+
+	out->ptr[start + 4] = (char)(compressed_len >> 24);
+	out->ptr[start + 5] = (char)(compressed_len >> 16);
+	out->ptr[start + 6] = (char)(compressed_len >> 8);
+	out->ptr[start + 7] = (char)compressed_len;
+
+	return 0;
+}
@@ -0,0 +1,49 @@
+/*
+ * Copyright (C) 2009-2012 the libgit2 contributors
+ *
+ * This file is part of libgit2, distributed under the GNU GPL v2 with
+ * a Linking Exception. For full terms see the included COPYING file.
+ */
+#ifndef INCLUDE_ewah_h__
+#define INCLUDE_ewah_h__
+
+#include "common.h"
+#include "buffer.h"
+
+/*
+ * Bitmaps stored in the EWAH compressed format used by git.git (e.g.
+ * in the split index "link" extension). In memory they are kept as
+ * plain, uncompressed bitsets.
+ */
+typedef struct {
+	uint64_t *words;
+	size_t words_len;
+	size_t bit_size;
+} git_ewah_bitmap;
+
+#define GIT_EWAH_BITMAP_INIT { NULL, 0, 0 }
+
+/* Set bit `pos`, growing the bitmap as needed */
+extern int git_ewah_set(git_ewah_bitmap *bitmap, size_t pos);
+
+GIT_INLINE(bool) git_ewah_get(const git_ewah_bitmap *bitmap, size_t pos)
+{
+	if (pos >= bitmap->bit_size)
+		return false;
+
+	return (bitmap->words[pos / 64] & ((uint64_t)1 << (pos % 64))) != 0;
+}
+
+extern void git_ewah_free(git_ewah_bitmap *bitmap);
+
+/*
+ * Decode the serialized bitmap at `buffer`. Returns the number of
+ * bytes consumed, or -1 if the data is not a valid bitmap.
+ */
+extern int git_ewah_read(
+	git_ewah_bitmap *bitmap, const char *buffer, size_t buffer_size);
+
+/* Append the serialized form of `bitmap` to `out` */
+extern int git_ewah_write(git_buf *out, const git_ewah_bitmap *bitmap);
+
+#endif
@@ -72,6 +72,10 @@ extern int git_filters_load(git_vector *filters, git_repository *repo, const cha
  * the original file may be tampered once the filtering is complete. Regardless, 
  * the `dest` buffer will always contain the final result of the filtering
  *
+ * Checkout streams large blobs through the worktree filters a chunk at a
+ * time, so those filters must give the same result when applied piece by
+ * piece as when applied to the whole file.
+ *
  * @param dest Buffer to store the result of the filtering
  * @param source Buffer containing the document to filter
  * @param filters A non-empty vector of filters as supplied by `git_filters_load`
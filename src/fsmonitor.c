@@ -0,0 +1,101 @@
+/*
+ * Copyright (C) 2009-2012 the libgit2 contributors
+ *
+ * This file is part of libgit2, distributed under the GNU GPL v2 with
+ * a Linking Exception. For full terms see the included COPYING file.
+ */
+
+#include "fsmonitor.h"
+#include "index.h"
+#include "repository.h"
+
+int git_repository_set_fsmonitor(git_repository *repo, git_fsmonitor *fsmonitor)
+{
+	assert(repo);
+
+	if (repo->fsmonitor != NULL && repo->fsmonitor != fsmonitor)
+		repo->fsmonitor->free(repo->fsmonitor);
+
+	repo->fsmonitor = fsmonitor;
+	return 0;
+}
+
+static void invalidate_all(git_index *index)
+{
+	git_index_entry *entry;
+	unsigned int i;
+
+	git_vector_foreach(&index->entries, i, entry)
+		entry->flags_extended &= ~GIT_IDXENTRY_FSMONITOR_VALID;
+}
+
+/* Forget about the path, or everything below it if it is a directory */
+static int invalidate_path(const char *path, void *payload)
+{
+	git_index *index = payload;
+	git_index_entry *entry;
+	size_t len = strlen(path);
+	unsigned int pos;
+	char *name;
+
+	if (len > 0 && path[len - 1] == '/')
+		len--;
+
+	if (len == 0) {
+		invalidate_all(index);
+		return 0;
+	}
+
+	name = git__strndup(path, len);
+	GITERR_CHECK_ALLOC(name);
+
+	for (pos = git_index__prefix_position(index, name);
+		 (entry = git_vector_get(&index->entries, pos)) != NULL &&
+		 strncmp(entry->path, name, len) == 0; pos++)
+	{
+		if (entry->path[len] == '\0' || entry->path[len] == '/')
+			entry->flags_extended &= ~GIT_IDXENTRY_FSMONITOR_VALID;
+	}
+
+	git__free(name);
+	return 0;
+}
+
+int git_fsmonitor__refresh(git_repository *repo, git_index *index)
+{
+	git_fsmonitor *fsmonitor = repo->fsmonitor;
+	const char *token = NULL;
+	char *copy;
+	int error;
+
+	if (fsmonitor == NULL)
+		return 0;
+
+	git_vector_sort(&index->entries);
+
+	error = fsmonitor->query(
+		fsmonitor, &token, index->fsmonitor_token, invalidate_path, index);
+
+	/* without a point to compare with, everything may have changed */
+	if (error == GIT_ENOTFOUND) {
+		giterr_clear();
+		invalidate_all(index);
+		error = 0;
+	}
+
+	if (error < 0)
+		return error;
+
+	if (token == NULL) {
+		giterr_set(GITERR_INVALID, "The file system monitor returned no token");
+		return -1;
+	}
+
+	copy = git__strdup(token);
+	GITERR_CHECK_ALLOC(copy);
+
+	git__free(index->fsmonitor_token);
+	index->fsmonitor_token = copy;
+
+	return 0;
+}
@@ -0,0 +1,31 @@
+/*
+ * Copyright (C) 2009-2012 the libgit2 contributors
+ *
+ * This file is part of libgit2, distributed under the GNU GPL v2 with
+ * a Linking Exception. For full terms see the included COPYING file.
+ */
+#ifndef INCLUDE_fsmonitor_h__
+#define INCLUDE_fsmonitor_h__
+
+#include "common.h"
+#include "git2/fsmonitor.h"
+#include "git2/index.h"
+
+/*
+ * Ask the monitor of the repository what changed since the token in
+ * `index`, and forget that the entries for those paths were unchanged.
+ * Does nothing if the repository has no monitor.
+ */
+extern int git_fsmonitor__refresh(git_repository *repo, git_index *index);
+
+/*
+ * Remember that the index entry was found unchanged after the last
+ * query; the entries that the index iterator hands out are the ones
+ * in the index itself.
+ */
+GIT_INLINE(void) git_fsmonitor__mark_valid(const git_index_entry *entry)
+{
+	((git_index_entry *)entry)->flags_extended |= GIT_IDXENTRY_FSMONITOR_VALID;
+}
+
+#endif
@@ -0,0 +1,343 @@
+/*
+ * Copyright (C) 2009-2012 the libgit2 contributors
+ *
+ * This file is part of libgit2, distributed under the GNU GPL v2 with
+ * a Linking Exception. For full terms see the included COPYING file.
+ */
+
+#include "fsmonitor.h"
+#include "repository.h"
+
+#ifdef __linux__
+
+#include <sys/inotify.h>
+#include "buffer.h"
+#include "path.h"
+#include "posix.h"
+#include "thread-utils.h"
+#include "vector.h"
+
+#define INOTIFY_WATCH_MASK \
+	(IN_CREATE | IN_DELETE | IN_MODIFY | IN_ATTRIB | IN_CLOSE_WRITE | \
+	 IN_MOVED_FROM | IN_MOVED_TO | IN_ONLYDIR | IN_DONT_FOLLOW)
+
+typedef struct {
+	int wd;
+	/* relative to the working directory, with a slash unless the root */
+	char path[GIT_FLEX_ARRAY];
+} inotify_watch;
+
+typedef struct {
+	git_fsmonitor parent;
+	int fd;
+	size_t root_len;
+	git_buf path;
+	git_vector watches;
+	git_vector changed;
+	bool overflow;
+	int instance;
+	unsigned int generation;
+	char token[64];
+} inotify_fsmonitor;
+
+static git_atomic inotify_instances;
+
+static int inotify_watch_cmp(const void *a, const void *b)
+{
+	return ((const inotify_watch *)a)->wd - ((const inotify_watch *)b)->wd;
+}
+
+static int inotify_watch_lookup(const void *key, const void *item)
+{
+	return *(const int *)key - ((const inotify_watch *)item)->wd;
+}
+
+static int inotify_watch_dir(inotify_fsmonitor *mon, git_buf *path);
+
+static int inotify_watch_entry(void *payload, git_buf *path)
+{
+	const char *name = strrchr(path->ptr, '/');
+	struct stat st;
+
+	if (name != NULL && strcmp(name + 1, DOT_GIT) == 0)
+		return 0;
+
+	if (p_lstat(path->ptr, &st) < 0 || !S_ISDIR(st.st_mode))
+		return 0;
+
+	return inotify_watch_dir((inotify_fsmonitor *)payload, path);
+}
+
+/* Watch the directory `path` and everything below it */
+static int inotify_watch_dir(inotify_fsmonitor *mon, git_buf *path)
+{
+	const char *rel = path->ptr + mon->root_len;
+	size_t rel_len = strlen(rel);
+	inotify_watch *watch;
+	int wd;
+
+	if ((wd = inotify_add_watch(mon->fd, path->ptr, INOTIFY_WATCH_MASK)) < 0) {
+		/* gone already, which the parent directory reports */
+		if (errno == ENOENT || errno == ENOTDIR)
+			return 0;
+
+		giterr_set(GITERR_OS, "Failed to watch '%s'", path->ptr);
+		return -1;
+	}
+
+	watch = git__malloc(sizeof(inotify_watch) + rel_len + 2);
+	GITERR_CHECK_ALLOC(watch);
+
+	watch->wd = wd;
+	memcpy(watch->path, rel, rel_len + 1);
+	if (rel_len > 0 && rel[rel_len - 1] != '/')
+		memcpy(watch->path + rel_len, "/", 2);
+
+	if (git_vector_insert(&mon->watches, watch) < 0) {
+		git__free(watch);
+		return -1;
+	}
+
+	return git_path_direach(path, inotify_watch_entry, mon);
+}
+
+/* Stop watching the directories below `dir`, which was moved or deleted */
+static void inotify_forget_dir(inotify_fsmonitor *mon, const char *dir)
+{
+	inotify_watch *watch;
+	unsigned int i, j;
+
+	for (i = 0, j = 0; i < mon->watches.length; ++i) {
+		watch = git_vector_get(&mon->watches, i);
+
+		if (git__prefixcmp(watch->path, dir) == 0) {
+			inotify_rm_watch(mon->fd, watch->wd);
+			git__free(watch);
+			continue;
+		}
+
+		mon->watches.contents[j++] = watch;
+	}
+
+	mon->watches.length = j;
+}
+
+static int inotify_handle_event(
+	inotify_fsmonitor *mon, const struct inotify_event *ev)
+{
+	inotify_watch *watch;
+	char *changed;
+	int pos;
+
+	if ((ev->mask & IN_Q_OVERFLOW) != 0) {
+		mon->overflow = true;
+		return 0;
+	}
+
+	git_vector_sort(&mon->watches);
+	if ((pos = git_vector_bsearch2(
+			&mon->watches, inotify_watch_lookup, &ev->wd)) < 0)
+		return 0;
+
+	watch = git_vector_get(&mon->watches, pos);
+
+	if ((ev->mask & IN_IGNORED) != 0) {
+		git_vector_remove(&mon->watches, pos);
+		git__free(watch);
+		return 0;
+	}
+
+	/* the parent directory reports what happens to the directory itself */
+	if (ev->len == 0 || strcmp(ev->name, DOT_GIT) == 0)
+		return 0;
+
+	git_buf_truncate(&mon->path, mon->root_len);
+	git_buf_puts(&mon->path, watch->path);
+	git_buf_puts(&mon->path, ev->name);
+
+	if ((ev->mask & IN_ISDIR) != 0) {
+		git_buf_putc(&mon->path, '/');
+
+		if ((ev->mask & (IN_DELETE | IN_MOVED_FROM)) != 0)
+			inotify_forget_dir(mon, mon->path.ptr + mon->root_len);
+
+		/* what was not watched in time is not known to be unchanged */
+		if ((ev->mask & (IN_CREATE | IN_MOVED_TO)) != 0 &&
+			!git_buf_oom(&mon->path) &&
+			inotify_watch_dir(mon, &mon->path) < 0)
+		{
+			giterr_clear();
+			mon->overflow = true;
+		}
+	}
+
+	if (git_buf_oom(&mon->path))
+		return -1;
+
+	changed = git__strdup(mon->path.ptr + mon->root_len);
+	GITERR_CHECK_ALLOC(changed);
+
+	return git_vector_insert(&mon->changed, changed);
+}
+
+static int inotify_read_events(inotify_fsmonitor *mon)
+{
+	union {
+		struct inotify_event ev;
+		char data[4096];
+	} buf;
+	const struct inotify_event *ev;
+	ssize_t len, offset;
+
+	for (;;) {
+		if ((len = read(mon->fd, buf.data, sizeof(buf.data))) < 0) {
+			if (errno == EINTR)
+				continue;
+			if (errno == EAGAIN)
+				return 0;
+
+			giterr_set(GITERR_OS, "Failed to read inotify events");
+			return -1;
+		}
+
+		for (offset = 0; offset < len; offset += sizeof(*ev) + ev->len) {
+			ev = (const struct inotify_event *)(buf.data + offset);
+
+			if (inotify_handle_event(mon, ev) < 0)
+				return -1;
+		}
+	}
+}
+
+static void inotify_clear_changed(inotify_fsmonitor *mon)
+{
+	unsigned int i;
+	char *path;
+
+	git_vector_foreach(&mon->changed, i, path)
+		git__free(path);
+	git_vector_clear(&mon->changed);
+}
+
+static int inotify_fsmonitor__query(
+	git_fsmonitor *fsmonitor,
+	const char **token,
+	const char *since,
+	git_fsmonitor_changed_cb changed,
+	void *payload)
+{
+	inotify_fsmonitor *mon = (inotify_fsmonitor *)fsmonitor;
+	const char *path, *prev = NULL;
+	unsigned int i;
+	int error;
+
+	if (inotify_read_events(mon) < 0) {
+		/* events may have been lost */
+		mon->overflow = true;
+		inotify_clear_changed(mon);
+		return -1;
+	}
+
+	/* only the changes since our own last token are known */
+	error = (since != NULL && !mon->overflow && strcmp(since, mon->token) == 0) ?
+		0 : GIT_ENOTFOUND;
+
+	mon->overflow = false;
+	mon->generation++;
+	p_snprintf(mon->token, sizeof(mon->token), "inotify:%d:%d:%u",
+		(int)getpid(), mon->instance, mon->generation);
+	*token = mon->token;
+
+	git_vector_sort(&mon->changed);
+
+	git_vector_foreach(&mon->changed, i, path) {
+		if (!error && (prev == NULL || strcmp(prev, path) != 0) &&
+			changed(path, payload) != 0)
+			error = GIT_EUSER;
+		prev = path;
+	}
+
+	inotify_clear_changed(mon);
+
+	return error;
+}
+
+static void inotify_fsmonitor__free(git_fsmonitor *fsmonitor)
+{
+	inotify_fsmonitor *mon = (inotify_fsmonitor *)fsmonitor;
+	inotify_watch *watch;
+	unsigned int i;
+
+	if (mon->fd >= 0)
+		close(mon->fd);
+
+	git_vector_foreach(&mon->watches, i, watch)
+		git__free(watch);
+	git_vector_free(&mon->watches);
+
+	inotify_clear_changed(mon);
+	git_vector_free(&mon->changed);
+
+	git_buf_free(&mon->path);
+	git__free(mon);
+}
+
+int git_fsmonitor_inotify_new(git_fsmonitor **out, git_repository *repo)
+{
+	inotify_fsmonitor *mon;
+
+	assert(out && repo);
+
+	*out = NULL;
+
+	if (git_repository__ensure_not_bare(repo, "watch the working directory") < 0)
+		return -1;
+
+	mon = git__calloc(1, sizeof(inotify_fsmonitor));
+	GITERR_CHECK_ALLOC(mon);
+
+	mon->parent.query = inotify_fsmonitor__query;
+	mon->parent.free = inotify_fsmonitor__free;
+	mon->instance = git_atomic_inc(&inotify_instances);
+	git_buf_init(&mon->path, 0);
+
+	if ((mon->fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC)) < 0) {
+		giterr_set(GITERR_OS, "Failed to initialize inotify");
+		git__free(mon);
+		return -1;
+	}
+
+	p_snprintf(mon->token, sizeof(mon->token), "inotify:%d:%d:%u",
+		(int)getpid(), mon->instance, mon->generation);
+
+	if (git_vector_init(&mon->watches, 64, inotify_watch_cmp) < 0 ||
+		git_vector_init(&mon->changed, 16, git__strcmp_cb) < 0 ||
+		git_buf_sets(&mon->path, git_repository_workdir(repo)) < 0 ||
+		git_path_to_dir(&mon->path) < 0)
+		goto on_error;
+
+	mon->root_len = mon->path.size;
+
+	if (inotify_watch_dir(mon, &mon->path) < 0)
+		goto on_error;
+
+	*out = (git_fsmonitor *)mon;
+	return 0;
+
+on_error:
+	inotify_fsmonitor__free((git_fsmonitor *)mon);
+	return -1;
+}
+
+#else
+
+int git_fsmonitor_inotify_new(git_fsmonitor **out, git_repository *repo)
+{
+	GIT_UNUSED(repo);
+
+	*out = NULL;
+	giterr_set(GITERR_INVALID, "inotify is not available on this platform");
+	return -1;
+}
+
+#endif
@@ -3,8 +3,6 @@
 #include "path.h"
 
 #define GIT_IGNORE_INTERNAL		"[internal]exclude"
-#define GIT_IGNORE_FILE_INREPO	"info/exclude"
-#define GIT_IGNORE_FILE			".gitignore"
 
 static int parse_ignore_file(
 	git_repository *repo, const char *buffer, git_attr_file *ignores)
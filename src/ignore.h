@@ -10,6 +10,9 @@
 #include "repository.h"
 #include "vector.h"
 
+#define GIT_IGNORE_FILE_INREPO	"info/exclude"
+#define GIT_IGNORE_FILE			".gitignore"
+
 /* The git_ignores structure maintains three sets of ignores:
  * - internal ignores
  * - per directory ignores
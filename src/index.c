@@ -12,7 +12,10 @@
 #include "index.h"
 #include "tree.h"
 #include "tree-cache.h"
+#include "sparse.h"
 #include "hash.h"
+#include "varint.h"
+#include "thread-utils.h"
 #include "git2/odb.h"
 #include "git2/oid.h"
 #include "git2/blob.h"
@@ -24,15 +27,43 @@
 
 #define minimal_entry_size (offsetof(struct entry_short, path))
 
+/* v4 entries are not padded and carry a varint before the path suffix */
+#define compressed_entry_size(type,varint_len,suffix_len) \
+	(offsetof(type, path) + (varint_len) + (suffix_len) + 1)
+
 static const size_t INDEX_FOOTER_SIZE = GIT_OID_RAWSZ;
 static const size_t INDEX_HEADER_SIZE = 12;
 
 static const unsigned int INDEX_VERSION_NUMBER = 2;
 static const unsigned int INDEX_VERSION_NUMBER_EXT = 3;
+static const unsigned int INDEX_VERSION_NUMBER_COMP = 4;
 
 static const unsigned int INDEX_HEADER_SIG = 0x44495243;
 static const char INDEX_EXT_TREECACHE_SIG[] = {'T', 'R', 'E', 'E'};
 static const char INDEX_EXT_UNMERGED_SIG[] = {'R', 'E', 'U', 'C'};
+static const char INDEX_EXT_OFFSETS_SIG[] = {'I', 'E', 'O', 'T'};
+static const char INDEX_EXT_END_OF_ENTRIES_SIG[] = {'E', 'O', 'I', 'E'};
+static const char INDEX_EXT_LINK_SIG[] = {'l', 'i', 'n', 'k'};
+static const char INDEX_EXT_UNTRACKED_SIG[] = {'U', 'N', 'T', 'R'};
+static const char INDEX_EXT_FSMONITOR_SIG[] = {'F', 'S', 'M', 'N'};
+static const char INDEX_EXT_SPARSE_DIRS_SIG[] = {'s', 'd', 'i', 'r'};
+
+#define INDEX_SHARED_PREFIX "sharedindex."
+
+/* write a new shared index once this many percent of the entries
+ * differ from it */
+#define INDEX_SPLIT_MAX_PERCENT_CHANGE 20
+
+/* shared indexes that have not been written for this long are removed */
+#define INDEX_SHARED_EXPIRE (14 * 24 * 60 * 60)
+
+static const size_t INDEX_EXT_HEADER_SIZE = 8;
+static const size_t INDEX_EOIE_SIZE = 4 + GIT_OID_RAWSZ;
+static const uint32_t INDEX_IEOT_VERSION = 1;
+static const uint32_t INDEX_FSMONITOR_VERSION = 2;
+
+/* the number of entries that make it worth starting a thread */
+#define INDEX_THREAD_ENTRIES 10000
 
 #define INDEX_OWNER(idx) ((git_repository *)(GIT_REFCOUNT_OWNER(idx)))
 
@@ -47,6 +78,12 @@ struct index_extension {
 	uint32_t extension_size;
 };
 
+/* a run of entries listed in the entry offset table (IEOT) */
+struct entry_block {
+	size_t offset;
+	size_t count;
+};
+
 struct entry_time {
 	uint32_t seconds;
 	uint32_t nanoseconds;
@@ -83,14 +120,31 @@ struct entry_long {
 
 /* local declarations */
 static size_t read_extension(git_index *index, const char *buffer, size_t buffer_size);
-static size_t read_entry(git_index_entry *dest, const void *buffer, size_t buffer_size);
+static size_t read_entry(
+	git_index_entry *dest, git_pool *pool,
+	const void *buffer, size_t buffer_size, const char *last);
 static int read_header(struct index_header *dest, const void *buffer);
 
 static int parse_index(git_index *index, const char *buffer, size_t buffer_size);
-static int is_index_extended(git_index *index);
-static int write_index(git_index *index, git_filebuf *file);
-
-static void index_entry_free(git_index_entry *entry);
+static int is_index_extended(git_vector *entries);
+static int write_index(
+	git_oid *checksum,
+	git_index *index,
+	git_filebuf *file,
+	git_vector *entries,
+	const git_buf *link,
+	bool shared);
+static int merge_shared_index(git_index *index);
+static void apply_fsmonitor_dirty(git_index *index);
+static int prepare_split_index(
+	git_vector *out,
+	git_buf *link,
+	git_index_entry **stripped_out,
+	git_index *index);
+
+static void index_entry_free(git_index *index, git_index_entry *entry);
+static void index_arena_free(git_index_arena *arena);
+static void index_tree_cache_resize(git_index *index, const char *dir, ssize_t entries);
 
 static int index_srch(const void *key, const void *array_member)
 {
@@ -162,13 +216,22 @@ int git_index_open(git_index **index_out, const char *index_path)
 	if (git_vector_init(&index->entries, 32, index_cmp) < 0)
 		return -1;
 
+	index->version = INDEX_VERSION_NUMBER;
+
 	/* Check if index file is stored on disk already */
 	if (git_path_exists(index->index_file_path) == true)
 		index->on_disk = 1;
 
-	*index_out = index;
 	GIT_REFCOUNT_INC(index);
-	return git_index_read(index);
+
+	/* a split index may fail to find its shared index */
+	if (git_index_read(index) < 0) {
+		git_index_free(index);
+		return -1;
+	}
+
+	*index_out = index;
+	return 0;
 }
 
 static void index_free(git_index *index)
@@ -178,14 +241,18 @@ static void index_free(git_index *index)
 
 	git_index_clear(index);
 	git_vector_foreach(&index->entries, i, e) {
-		index_entry_free(e);
+		index_entry_free(index, e);
 	}
 	git_vector_free(&index->entries);
 	git_vector_foreach(&index->unmerged, i, e) {
-		index_entry_free(e);
+		index_entry_free(index, e);
 	}
 	git_vector_free(&index->unmerged);
 
+	index_arena_free(&index->split.base);
+	git_ewah_free(&index->split.delete_bitmap);
+	git_ewah_free(&index->split.replace_bitmap);
+
 	git__free(index->index_file_path);
 	git__free(index);
 }
@@ -198,18 +265,27 @@ void git_index_free(git_index *index)
 	GIT_REFCOUNT_DEC(index, index_free);
 }
 
+static void index_arena_free(git_index_arena *arena)
+{
+	size_t i;
+
+	for (i = 0; i < arena->pools_len; ++i)
+		git_pool_clear(&arena->pools[i]);
+
+	git__free(arena->pools);
+	git__free(arena->entries);
+
+	memset(arena, 0, sizeof(*arena));
+}
+
 void git_index_clear(git_index *index)
 {
 	unsigned int i;
 
 	assert(index);
 
-	for (i = 0; i < index->entries.length; ++i) {
-		git_index_entry *e;
-		e = git_vector_get(&index->entries, i);
-		git__free(e->path);
-		git__free(e);
-	}
+	for (i = 0; i < index->entries.length; ++i)
+		index_entry_free(index, git_vector_get(&index->entries, i));
 
 	for (i = 0; i < index->unmerged.length; ++i) {
 		git_index_entry_unmerged *e;
@@ -222,8 +298,22 @@ void git_index_clear(git_index *index)
 	git_vector_clear(&index->unmerged);
 	index->last_modified = 0;
 
+	index_arena_free(&index->arena);
+
+	index->split.has_link = 0;
+	git_ewah_free(&index->split.delete_bitmap);
+	git_ewah_free(&index->split.replace_bitmap);
+
 	git_tree_cache_free(index->tree);
 	index->tree = NULL;
+	index->sparse = 0;
+
+	git_untracked_cache_free(index->untracked);
+	index->untracked = NULL;
+
+	git__free(index->fsmonitor_token);
+	index->fsmonitor_token = NULL;
+	git_ewah_free(&index->fsmonitor_dirty);
 }
 
 int git_index_set_caps(git_index *index, unsigned int caps)
@@ -248,6 +338,8 @@ int git_index_set_caps(git_index *index, unsigned int caps)
 			index->distrust_filemode = (val == 0);
 		if (git_config_get_bool(&val, cfg, "core.symlinks") == 0)
 			index->no_symlinks = (val == 0);
+		if (git_config_get_bool(&val, cfg, "core.splitindex") == 0)
+			index->split_index = (val != 0);
 	}
 	else {
 		index->ignore_case = ((caps & GIT_INDEXCAP_IGNORE_CASE) != 0);
@@ -291,7 +383,12 @@ int git_index_read(git_index *index)
 		error = parse_index(index, buffer.ptr, buffer.size);
 
 		if (!error)
+			error = merge_shared_index(index);
+
+		if (!error) {
+			apply_fsmonitor_dirty(index);
 			index->last_modified = mtime;
+		}
 
 		git_buf_free(&buffer);
 	}
@@ -299,31 +396,244 @@ int git_index_read(git_index *index)
 	return error;
 }
 
+/*
+ * The topmost directory that `path` is in that is entirely outside of the
+ * sparse checkout, without a trailing slash; empty if there is none.
+ */
+static int sparse_excluded_dir(
+	git_buf *out, const git_sparse *sparse, const char *path)
+{
+	const char *slash;
+
+	git_buf_clear(out);
+
+	for (slash = strchr(path, '/'); slash; slash = strchr(slash + 1, '/')) {
+		if (git_buf_set(out, path, slash - path) < 0)
+			return -1;
+
+		if (git_sparse__excludes_dir(sparse, out->ptr))
+			return 0;
+	}
+
+	git_buf_clear(out);
+	return 0;
+}
+
+/*
+ * Whether the `count` entries from `pos` on are all outside of the
+ * sparse checkout, so that a sparse directory can stand for them.
+ */
+static bool sparse_can_collapse(git_index *index, unsigned int pos, size_t count)
+{
+	git_index_entry *entry;
+
+	for (; count > 0; --count, ++pos) {
+		if ((entry = git_vector_get(&index->entries, pos)) == NULL ||
+			(entry->flags_extended & GIT_IDXENTRY_SKIP_WORKTREE) == 0 ||
+			git_index_entry_stage(entry) != 0)
+			return false;
+	}
+
+	return true;
+}
+
+static git_index_entry *sparse_dir_entry(const char *dir, const git_oid *oid)
+{
+	git_index_entry *entry = git__calloc(1, sizeof(git_index_entry));
+	size_t len = strlen(dir);
+
+	if (entry == NULL || (entry->path = git__malloc(len + 2)) == NULL) {
+		git__free(entry);
+		return NULL;
+	}
+
+	memcpy(entry->path, dir, len);
+	memcpy(entry->path + len, "/", 2);
+
+	entry->mode = S_IFDIR;
+	git_oid_cpy(&entry->oid, oid);
+	entry->flags = (uint16_t)min(len + 1, GIT_IDXENTRY_NAMEMASK);
+	entry->flags_extended = GIT_IDXENTRY_SKIP_WORKTREE;
+
+	return entry;
+}
+
+/*
+ * With index.sparse, let a single entry stand for each directory that is
+ * entirely outside of the sparse checkout. The trees come from the tree
+ * cache, so they are only written the first time.
+ */
+static int index_collapse_sparse(git_index *index)
+{
+	git_repository *repo = INDEX_OWNER(index);
+	git_sparse *sparse = NULL;
+	git_vector collapsed = GIT_VECTOR_INIT;
+	git_buf dir = GIT_BUF_INIT;
+	git_tree_cache *tree;
+	git_index_entry *entry;
+	git_config *cfg;
+	git_oid oid;
+	unsigned int i, j;
+	size_t count;
+	int enabled = 0, error = 0;
+	bool has_dirs = false;
+
+	if (repo == NULL ||
+		git_repository_config__weakptr(&cfg, repo) < 0 ||
+		git_config_get_bool(&enabled, cfg, "index.sparse") < 0 || !enabled)
+		goto done;
+
+	/* the index just stays whole if any of this fails */
+	if (git_sparse__load(&sparse, repo) < 0 || sparse == NULL ||
+		git_tree_create_fromindex(&oid, index) < 0)
+		goto done;
+
+	if ((error = git_vector_init(
+			&collapsed, index->entries.length, index_cmp)) < 0)
+		goto done;
+
+	for (i = 0; i < index->entries.length; i += count) {
+		entry = git_vector_get(&index->entries, i);
+		count = 1;
+
+		if (git_index__is_sparse_dir(entry))
+			has_dirs = true;
+		else if ((entry->flags_extended & GIT_IDXENTRY_SKIP_WORKTREE) != 0 &&
+			(error = sparse_excluded_dir(&dir, sparse, entry->path)) == 0 &&
+			dir.size > 0 &&
+			(tree = (git_tree_cache *)git_tree_cache_get(index->tree, dir.ptr)) != NULL &&
+			tree->entries > 0 &&
+			sparse_can_collapse(index, i, tree->entries))
+		{
+			if ((entry = sparse_dir_entry(dir.ptr, &tree->oid)) == NULL) {
+				error = -1;
+				break;
+			}
+
+			count = tree->entries;
+			has_dirs = true;
+
+			for (j = 0; j < count; ++j)
+				index_entry_free(index, git_vector_get(&index->entries, i + j));
+
+			/* the subtrees are now out of sight */
+			for (j = 0; j < tree->children_count; ++j)
+				tree->children[j]->entries = -1;
+			git_tree_cache_prune(tree);
+			index_tree_cache_resize(index, dir.ptr, 1);
+		}
+
+		if (error < 0)
+			break;
+
+		/* there is room for all of them */
+		git_vector_insert(&collapsed, entry);
+	}
+
+	/* what was not looked at yet stays as it is */
+	for (; i < index->entries.length; ++i) {
+		entry = git_vector_get(&index->entries, i);
+		has_dirs = has_dirs || git_index__is_sparse_dir(entry);
+		git_vector_insert(&collapsed, entry);
+	}
+
+	git_vector_swap(&index->entries, &collapsed);
+	index->sparse = has_dirs;
+
+done:
+	if (error == 0)
+		giterr_clear();
+
+	git_sparse__free(sparse);
+	git_vector_free(&collapsed);
+	git_buf_free(&dir);
+	return error;
+}
+
 int git_index_write(git_index *index)
 {
 	git_filebuf file = GIT_FILEBUF_INIT;
+	git_vector split_entries = GIT_VECTOR_INIT, *entries = &index->entries;
+	git_buf link = GIT_BUF_INIT;
+	git_index_entry *stripped = NULL;
+	git_oid checksum;
 	struct stat indexst;
 	int error;
 
 	git_vector_sort(&index->entries);
 
+	if ((error = index_collapse_sparse(index)) < 0)
+		goto done;
+
+	if (index->split_index) {
+		if ((error = git_vector_init(&split_entries, 32, NULL)) < 0 ||
+			(error = prepare_split_index(
+				&split_entries, &link, &stripped, index)) < 0)
+			goto done;
+
+		entries = &split_entries;
+	}
+
 	if ((error = git_filebuf_open(
 			 &file, index->index_file_path, GIT_FILEBUF_HASH_CONTENTS)) < 0)
-		return error;
+		goto done;
 
-	if ((error = write_index(index, &file)) < 0) {
+	if ((error = write_index(&checksum, index, &file, entries,
+			index->split_index ? &link : NULL, false)) < 0) {
 		git_filebuf_cleanup(&file);
-		return error;
+		goto done;
 	}
 
 	if ((error = git_filebuf_commit(&file, GIT_INDEX_FILE_MODE)) < 0)
-		return error;
+		goto done;
+
+	git_oid_cpy(&index->checksum, &checksum);
 
 	if (p_stat(index->index_file_path, &indexst) == 0) {
 		index->last_modified = indexst.st_mtime;
 		index->on_disk = 1;
 	}
 
+done:
+	git_vector_free(&split_entries);
+	git_buf_free(&link);
+	git__free(stripped);
+	return error;
+}
+
+int git_index_is_split(git_index *index)
+{
+	assert(index);
+	return index->split_index;
+}
+
+int git_index_set_split(git_index *index, int split)
+{
+	assert(index);
+
+	/* a shared index is only written when it is needed; the current
+	 * one is kept as long as entries may point into it */
+	index->split_index = (split != 0);
+	return 0;
+}
+
+unsigned int git_index_version(git_index *index)
+{
+	assert(index);
+	return index->version;
+}
+
+int git_index_set_version(git_index *index, unsigned int version)
+{
+	assert(index);
+
+	if (version < INDEX_VERSION_NUMBER ||
+		version > INDEX_VERSION_NUMBER_COMP) {
+		giterr_set(GITERR_INDEX, "Invalid index version %u", version);
+		return -1;
+	}
+
+	index->version = version;
 	return 0;
 }
 
@@ -428,14 +738,199 @@ static git_index_entry *index_entry_dup(const git_index_entry *source_entry)
 	return entry;
 }
 
-static void index_entry_free(git_index_entry *entry)
+GIT_INLINE(bool) index_arena_contains(
+	const git_index_arena *arena, const git_index_entry *entry)
+{
+	return (entry >= arena->entries && entry < arena->entries + arena->length);
+}
+
+static void index_entry_free(git_index *index, git_index_entry *entry)
 {
 	if (!entry)
 		return;
+
+	/* entries read from disk go away with their arena */
+	if (index_arena_contains(&index->arena, entry) ||
+		index_arena_contains(&index->split.base, entry))
+		return;
+
 	git__free(entry->path);
 	git__free(entry);
 }
 
+typedef struct {
+	git_vector *out;
+	const char *prefix;
+} sparse_dir_data;
+
+static int read_sparse_dir_cb(
+	const char *root, const git_tree_entry *tentry, void *payload)
+{
+	sparse_dir_data *data = payload;
+	git_index_entry *entry;
+	git_buf path = GIT_BUF_INIT;
+
+	if (git_tree_entry__is_tree(tentry))
+		return 0;
+
+	git_buf_puts(&path, data->prefix);
+	git_buf_puts(&path, root);
+	git_buf_puts(&path, tentry->filename);
+
+	if (git_buf_oom(&path))
+		return -1;
+
+	entry = git__calloc(1, sizeof(git_index_entry));
+	GITERR_CHECK_ALLOC(entry);
+
+	entry->mode = tentry->attr;
+	entry->oid = tentry->oid;
+	entry->flags = (uint16_t)min(path.size, GIT_IDXENTRY_NAMEMASK);
+	entry->flags_extended = GIT_IDXENTRY_SKIP_WORKTREE;
+	entry->path = git_buf_detach(&path);
+
+	if (git_vector_insert(data->out, entry) < 0) {
+		git__free(entry->path);
+		git__free(entry);
+		return -1;
+	}
+
+	return 0;
+}
+
+int git_index__read_sparse_dir(
+	git_vector *out, git_index *index, const git_index_entry *dir)
+{
+	sparse_dir_data data;
+	git_tree *tree;
+	int error;
+
+	if (INDEX_OWNER(index) == NULL) {
+		giterr_set(GITERR_INDEX,
+			"Cannot expand sparse directory '%s' without a repository", dir->path);
+		return -1;
+	}
+
+	if (git_tree_lookup(&tree, INDEX_OWNER(index), &dir->oid) < 0)
+		return -1;
+
+	data.out = out;
+	data.prefix = dir->path;
+
+	error = git_tree_walk(tree, read_sparse_dir_cb, GIT_TREEWALK_PRE, &data);
+
+	git_tree_free(tree);
+	return error;
+}
+
+void git_index__free_sparse_dir(git_vector *entries)
+{
+	git_index_entry *entry;
+	unsigned int i;
+
+	git_vector_foreach(entries, i, entry) {
+		git__free(entry->path);
+		git__free(entry);
+	}
+
+	git_vector_clear(entries);
+}
+
+/* The tree cache node for a subtree now covers `entries` index entries */
+static void index_tree_cache_resize(
+	git_index *index, const char *dir, ssize_t entries)
+{
+	git_tree_cache *tree;
+	ssize_t delta;
+
+	if ((tree = (git_tree_cache *)git_tree_cache_get(index->tree, dir)) == NULL ||
+		tree->entries < 0) {
+		git_tree_cache_invalidate_path(index->tree, dir);
+		return;
+	}
+
+	delta = entries - tree->entries;
+
+	for (; tree != NULL; tree = tree->parent) {
+		if (tree->entries >= 0)
+			tree->entries += delta;
+	}
+}
+
+int git_index__expand_sparse_dir(git_index *index, unsigned int pos)
+{
+	git_vector files = GIT_VECTOR_INIT;
+	git_index_entry *dir = git_vector_get(&index->entries, pos), *entry;
+	unsigned int i;
+	char *path;
+	int error;
+
+	assert(dir && git_index__is_sparse_dir(dir));
+
+	if ((error = git_index__read_sparse_dir(&files, index, dir)) < 0 ||
+		(error = git_vector_remove(&index->entries, pos)) < 0)
+		goto done;
+
+	for (i = 0; i < files.length && !error; ++i) {
+		entry = git_vector_get(&files, i);
+		if ((error = git_vector_insert(&index->entries, entry)) == 0)
+			files.contents[i] = NULL;
+	}
+
+	if (error < 0) {
+		git_vector_insert(&index->entries, dir);
+		goto done;
+	}
+
+	git_vector_sort(&index->entries);
+
+	if ((path = git__strndup(dir->path, strlen(dir->path) - 1)) != NULL) {
+		index_tree_cache_resize(index, path, files.length);
+		git__free(path);
+	} else
+		git_tree_cache_invalidate_path(index->tree, dir->path);
+
+	index_entry_free(index, dir);
+
+done:
+	for (i = 0; i < files.length; ++i) {
+		if ((entry = git_vector_get(&files, i)) != NULL) {
+			git__free(entry->path);
+			git__free(entry);
+		}
+	}
+	git_vector_free(&files);
+	return error;
+}
+
+/* Expand the sparse directory that `path` would be in, if there is one */
+static int index_expand_sparse_parent(git_index *index, const char *path)
+{
+	git_buf dir = GIT_BUF_INIT;
+	const char *slash;
+	git_index_entry *entry;
+	int pos, error = 0;
+
+	for (slash = strchr(path, '/'); slash && !error; slash = strchr(slash + 1, '/')) {
+		git_buf_clear(&dir);
+		if (git_buf_put(&dir, path, slash - path + 1) < 0) {
+			error = -1;
+			break;
+		}
+
+		if ((pos = git_index_find(index, dir.ptr)) >= 0 &&
+			(entry = git_index_get(index, pos)) != NULL &&
+			git_index__is_sparse_dir(entry))
+		{
+			error = git_index__expand_sparse_dir(index, pos);
+			break;
+		}
+	}
+
+	git_buf_free(&dir);
+	return error;
+}
+
 static int index_insert(git_index *index, git_index_entry *entry, int replace)
 {
 	size_t path_length;
@@ -454,6 +949,13 @@ static int index_insert(git_index *index, git_index_entry *entry, int replace)
 	else
 		entry->flags |= GIT_IDXENTRY_NAMEMASK;;
 
+	/* nothing is known about the new entry yet */
+	entry->flags_extended &=
+		~(GIT_IDXENTRY_FSMONITOR_VALID | GIT_IDXENTRY_UPTODATE);
+
+	if (index->sparse && index_expand_sparse_parent(index, entry->path) < 0)
+		return -1;
+
 	/* look if an entry with this path already exists */
 	if ((position = git_index_find(index, entry->path)) >= 0) {
 		existing = (git_index_entry **)&index->entries.contents[position];
@@ -465,12 +967,15 @@ static int index_insert(git_index *index, git_index_entry *entry, int replace)
 	/* if replacing is not requested or no existing entry exists, just
 	 * insert entry at the end; the index is no longer sorted
 	 */
-	if (!replace || !existing)
+	if (!replace || !existing) {
+		if (!existing)
+			git_untracked_cache_invalidate_path(index->untracked, entry->path);
+
 		return git_vector_insert(&index->entries, entry);
+	}
 
 	/* exists, replace it */
-	git__free((*existing)->path);
-	git__free(*existing);
+	index_entry_free(index, *existing);
 	*existing = entry;
 
 	return 0;
@@ -484,7 +989,7 @@ static int index_add(git_index *index, const char *path, int stage, int replace)
 	if ((ret = index_entry_init(&entry, index, path, stage)) < 0 ||
 		(ret = index_insert(index, entry, replace)) < 0)
 	{
-		index_entry_free(entry);
+		index_entry_free(index, entry);
 		return ret;
 	}
 
@@ -513,7 +1018,7 @@ static int index_add2(
 		return -1;
 
 	if ((ret = index_insert(index, entry, replace)) < 0) {
-		index_entry_free(entry);
+		index_entry_free(index, entry);
 		return ret;
 	}
 
@@ -539,13 +1044,15 @@ int git_index_remove(git_index *index, int position)
 	git_vector_sort(&index->entries);
 
 	entry = git_vector_get(&index->entries, position);
-	if (entry != NULL)
+	if (entry != NULL) {
 		git_tree_cache_invalidate_path(index->tree, entry->path);
+		git_untracked_cache_invalidate_path(index->untracked, entry->path);
+	}
 
 	error = git_vector_remove(&index->entries, (unsigned int)position);
 
 	if (!error)
-		index_entry_free(entry);
+		index_entry_free(index, entry);
 
 	return error;
 }
@@ -661,39 +1168,90 @@ static int read_unmerged(git_index *index, const char *buffer, size_t size)
 	return 0;
 }
 
-static size_t read_entry(git_index_entry *dest, const void *buffer, size_t buffer_size)
+static size_t read_entry(
+	git_index_entry *dest, git_pool *pool,
+	const void *buffer, size_t buffer_size, const char *last)
 {
 	size_t path_length, entry_size;
 	uint16_t flags_raw;
 	const char *path_ptr;
-	const struct entry_short *source = buffer;
+	struct entry_short source;
 
 	if (INDEX_FOOTER_SIZE + minimal_entry_size > buffer_size)
 		return 0;
 
+	/* v4 entries are not padded, so copy them out to read aligned */
+	memcpy(&source, buffer, minimal_entry_size);
+
 	memset(dest, 0x0, sizeof(git_index_entry));
 
-	dest->ctime.seconds = (git_time_t)ntohl(source->ctime.seconds);
-	dest->ctime.nanoseconds = ntohl(source->ctime.nanoseconds);
-	dest->mtime.seconds = (git_time_t)ntohl(source->mtime.seconds);
-	dest->mtime.nanoseconds = ntohl(source->mtime.nanoseconds);
-	dest->dev = ntohl(source->dev);
-	dest->ino = ntohl(source->ino);
-	dest->mode = ntohl(source->mode);
-	dest->uid = ntohl(source->uid);
-	dest->gid = ntohl(source->gid);
-	dest->file_size = ntohl(source->file_size);
-	git_oid_cpy(&dest->oid, &source->oid);
-	dest->flags = ntohs(source->flags);
+	dest->ctime.seconds = (git_time_t)ntohl(source.ctime.seconds);
+	dest->ctime.nanoseconds = ntohl(source.ctime.nanoseconds);
+	dest->mtime.seconds = (git_time_t)ntohl(source.mtime.seconds);
+	dest->mtime.nanoseconds = ntohl(source.mtime.nanoseconds);
+	dest->dev = ntohl(source.dev);
+	dest->ino = ntohl(source.ino);
+	dest->mode = ntohl(source.mode);
+	dest->uid = ntohl(source.uid);
+	dest->gid = ntohl(source.gid);
+	dest->file_size = ntohl(source.file_size);
+	git_oid_cpy(&dest->oid, &source.oid);
+	dest->flags = ntohs(source.flags);
 
 	if (dest->flags & GIT_IDXENTRY_EXTENDED) {
-		const struct entry_long *source_l = (const struct entry_long *)source;
-		path_ptr = source_l->path;
+		memcpy(&flags_raw, (const char *)buffer +
+			offsetof(struct entry_long, flags_extended), 2);
+		dest->flags_extended = ntohs(flags_raw);
 
-		flags_raw = ntohs(source_l->flags_extended);
-		memcpy(&dest->flags_extended, &flags_raw, 2);
+		path_ptr = (const char *)buffer + offsetof(struct entry_long, path);
 	} else
-		path_ptr = source->path;
+		path_ptr = (const char *)buffer + offsetof(struct entry_short, path);
+
+	/* v4: strip bytes off the end of the previous path, then append
+	 * the NUL-terminated suffix that follows the varint */
+	if (last != NULL) {
+		const unsigned char *varint_ptr = (const unsigned char *)path_ptr;
+		size_t available, varint_len, strip_len, last_len, suffix_len;
+		const char *suffix, *suffix_end;
+
+		if ((size_t)(path_ptr - (const char *)buffer) + INDEX_FOOTER_SIZE >= buffer_size)
+			return 0;
+
+		available = buffer_size - INDEX_FOOTER_SIZE -
+			(path_ptr - (const char *)buffer);
+
+		strip_len = (size_t)git_decode_varint(varint_ptr, available, &varint_len);
+		last_len = strlen(last);
+
+		if (varint_len == 0)
+			return 0;
+
+		/* at the start of a block there is nothing to strip from */
+		if (!last_len)
+			strip_len = 0;
+		else if (strip_len > last_len)
+			return 0;
+
+		suffix = path_ptr + varint_len;
+		suffix_end = memchr(suffix, '\0', available - varint_len);
+		if (suffix_end == NULL)
+			return 0;
+
+		suffix_len = suffix_end - suffix;
+		path_length = last_len - strip_len;
+
+		dest->path = git_pool_malloc(pool, (uint32_t)(path_length + suffix_len + 1));
+		if (!dest->path)
+			return 0;
+
+		memcpy(dest->path, last, path_length);
+		memcpy(dest->path + path_length, suffix, suffix_len + 1);
+
+		if (dest->flags & GIT_IDXENTRY_EXTENDED)
+			return compressed_entry_size(struct entry_long, varint_len, suffix_len);
+		else
+			return compressed_entry_size(struct entry_short, varint_len, suffix_len);
+	}
 
 	path_length = dest->flags & GIT_IDXENTRY_NAMEMASK;
 
@@ -717,8 +1275,9 @@ static size_t read_entry(git_index_entry *dest, const void *buffer, size_t buffe
 	if (INDEX_FOOTER_SIZE + entry_size > buffer_size)
 		return 0;
 
-	dest->path = git__strdup(path_ptr);
-	assert(dest->path);
+	dest->path = git_pool_strndup(pool, path_ptr, path_length);
+	if (!dest->path)
+		return 0;
 
 	return entry_size;
 }
@@ -732,43 +1291,136 @@ static int read_header(struct index_header *dest, const void *buffer)
 		return index_error_invalid("incorrect header signature");
 
 	dest->version = ntohl(source->version);
-	if (dest->version != INDEX_VERSION_NUMBER_EXT &&
-		dest->version != INDEX_VERSION_NUMBER)
+	if (dest->version < INDEX_VERSION_NUMBER ||
+		dest->version > INDEX_VERSION_NUMBER_COMP)
 		return index_error_invalid("incorrect header version");
 
 	dest->entry_count = ntohl(source->entry_count);
 	return 0;
 }
 
-static size_t read_extension(git_index *index, const char *buffer, size_t buffer_size)
+static int read_link(git_index *index, const char *buffer, size_t size)
 {
-	const struct index_extension *source;
-	struct index_extension dest;
-	size_t total_size;
+	git_index_split *split = &index->split;
+	int len;
 
-	source = (const struct index_extension *)(buffer);
+	if (size < GIT_OID_RAWSZ)
+		return index_error_invalid("truncated link extension");
 
-	memcpy(dest.signature, source->signature, 4);
-	dest.extension_size = ntohl(source->extension_size);
+	git_oid_fromraw(&split->link_id, (const unsigned char *)buffer);
+	buffer += GIT_OID_RAWSZ;
+	size -= GIT_OID_RAWSZ;
 
-	total_size = dest.extension_size + sizeof(struct index_extension);
+	/* the bitmaps are left out when nothing changed */
+	if (size > 0) {
+		if ((len = git_ewah_read(&split->delete_bitmap, buffer, size)) < 0)
+			return -1;
 
-	if (buffer_size - total_size < INDEX_FOOTER_SIZE)
-		return 0;
+		buffer += len;
+		size -= len;
 
-	/* optional extension */
-	if (dest.signature[0] >= 'A' && dest.signature[0] <= 'Z') {
-		/* tree cache */
-		if (memcmp(dest.signature, INDEX_EXT_TREECACHE_SIG, 4) == 0) {
-			if (git_tree_cache_read(&index->tree, buffer + 8, dest.extension_size) < 0)
-				return 0;
-		} else if (memcmp(dest.signature, INDEX_EXT_UNMERGED_SIG, 4) == 0) {
-			if (read_unmerged(index, buffer + 8, dest.extension_size) < 0)
-				return 0;
-		}
-		/* else, unsupported extension. We cannot parse this, but we can skip
-		 * it by returning `total_size */
-	} else {
+		if ((len = git_ewah_read(&split->replace_bitmap, buffer, size)) < 0)
+			return -1;
+
+		if ((size_t)len != size)
+			return index_error_invalid("trailing data in link extension");
+	}
+
+	split->has_link = 1;
+	return 0;
+}
+
+GIT_INLINE(uint32_t) read_be32(const char *buffer)
+{
+	uint32_t value;
+	memcpy(&value, buffer, sizeof(value));
+	return ntohl(value);
+}
+
+/*
+ * Only the second version of the extension is read, which has an
+ * opaque token; the first one has a timestamp for the hook of git.git.
+ */
+static int read_fsmonitor(git_index *index, const char *buffer, size_t size)
+{
+	const char *nul;
+	size_t bitmap_size;
+	int len;
+
+	if (size < 4 || read_be32(buffer) != INDEX_FSMONITOR_VERSION)
+		return index_error_invalid("unsupported fsmonitor extension");
+
+	buffer += 4;
+	size -= 4;
+
+	if ((nul = memchr(buffer, '\0', size)) == NULL)
+		return index_error_invalid("truncated fsmonitor extension");
+
+	index->fsmonitor_token = git__strdup(buffer);
+	GITERR_CHECK_ALLOC(index->fsmonitor_token);
+
+	size -= (nul + 1) - buffer;
+	buffer = nul + 1;
+
+	if (size < 4 || (bitmap_size = read_be32(buffer)) != size - 4)
+		return index_error_invalid("truncated fsmonitor extension");
+
+	if ((len = git_ewah_read(&index->fsmonitor_dirty, buffer + 4, bitmap_size)) < 0)
+		return -1;
+
+	if ((size_t)len != bitmap_size)
+		return index_error_invalid("trailing data in fsmonitor extension");
+
+	return 0;
+}
+
+static size_t read_extension(git_index *index, const char *buffer, size_t buffer_size)
+{
+	struct index_extension dest;
+	size_t total_size;
+
+	/* the extensions of a v4 index are not aligned either */
+	memcpy(dest.signature, buffer, 4);
+	dest.extension_size = read_be32(buffer + 4);
+
+	total_size = dest.extension_size + sizeof(struct index_extension);
+
+	if (buffer_size - total_size < INDEX_FOOTER_SIZE)
+		return 0;
+
+	if (memcmp(dest.signature, INDEX_EXT_LINK_SIG, 4) == 0) {
+		if (read_link(index, buffer + 8, dest.extension_size) < 0)
+			return 0;
+	}
+	else if (memcmp(dest.signature, INDEX_EXT_SPARSE_DIRS_SIG, 4) == 0) {
+		index->sparse = 1;
+	}
+	/* optional extension */
+	else if (dest.signature[0] >= 'A' && dest.signature[0] <= 'Z') {
+		/* tree cache */
+		if (memcmp(dest.signature, INDEX_EXT_TREECACHE_SIG, 4) == 0) {
+			if (git_tree_cache_read(&index->tree, buffer + 8, dest.extension_size) < 0)
+				return 0;
+		} else if (memcmp(dest.signature, INDEX_EXT_UNMERGED_SIG, 4) == 0) {
+			if (read_unmerged(index, buffer + 8, dest.extension_size) < 0)
+				return 0;
+		} else if (memcmp(dest.signature, INDEX_EXT_FSMONITOR_SIG, 4) == 0) {
+			/* without it, every entry just gets looked at again */
+			if (read_fsmonitor(index, buffer + 8, dest.extension_size) < 0) {
+				git__free(index->fsmonitor_token);
+				index->fsmonitor_token = NULL;
+				git_ewah_free(&index->fsmonitor_dirty);
+				giterr_clear();
+			}
+		} else if (memcmp(dest.signature, INDEX_EXT_UNTRACKED_SIG, 4) == 0) {
+			/* the cache can always be rebuilt, so a broken one is dropped */
+			if (git_untracked_cache_read(
+					&index->untracked, buffer + 8, dest.extension_size) < 0)
+				giterr_clear();
+		}
+		/* else, unsupported extension. We cannot parse this, but we can skip
+		 * it by returning `total_size */
+	} else {
 		/* we cannot handle non-ignorable extensions;
 		 * in fact they aren't even defined in the standard */
 		return 0;
@@ -777,58 +1429,175 @@ static size_t read_extension(git_index *index, const char *buffer, size_t buffer
 	return total_size;
 }
 
-static int parse_index(git_index *index, const char *buffer, size_t buffer_size)
+/*
+ * Find the extensions through the "end of index entries" extension,
+ * which is always the last one. Returns the offset of the first
+ * extension, or 0 if there is no (valid) EOIE. The entry offset table
+ * is returned as well when one is found along the way.
+ */
+static size_t read_end_of_entries(
+	const char **offsets,
+	size_t *offsets_size,
+	const char *buffer,
+	size_t buffer_size)
 {
-	unsigned int i;
-	struct index_header header;
-	git_oid checksum_calculated, checksum_expected;
+	const char *eoie, *ext;
+	size_t ext_offset;
+	git_hash_ctx *ctx;
+	git_oid hash;
+
+	*offsets = NULL;
+	*offsets_size = 0;
+
+	if (buffer_size < INDEX_HEADER_SIZE + INDEX_EXT_HEADER_SIZE +
+		INDEX_EOIE_SIZE + INDEX_FOOTER_SIZE)
+		return 0;
+
+	eoie = buffer + buffer_size - INDEX_FOOTER_SIZE -
+		INDEX_EOIE_SIZE - INDEX_EXT_HEADER_SIZE;
+
+	if (memcmp(eoie, INDEX_EXT_END_OF_ENTRIES_SIG, 4) != 0 ||
+		read_be32(eoie + 4) != INDEX_EOIE_SIZE)
+		return 0;
+
+	ext_offset = read_be32(eoie + INDEX_EXT_HEADER_SIZE);
+	if (ext_offset < INDEX_HEADER_SIZE || ext_offset > (size_t)(eoie - buffer))
+		return 0;
+
+	/* the EOIE hashes the header of every extension before it */
+	if ((ctx = git_hash_new_ctx()) == NULL)
+		return 0;
+
+	for (ext = buffer + ext_offset; ext < eoie; ) {
+		size_t ext_size;
 
-#define seek_forward(_increase) { \
-	if (_increase >= buffer_size) \
-		return index_error_invalid("ran out of data while parsing"); \
-	buffer += _increase; \
-	buffer_size -= _increase;\
+		if ((size_t)(eoie - ext) < INDEX_EXT_HEADER_SIZE)
+			break;
+
+		ext_size = read_be32(ext + 4);
+		if (ext_size > (size_t)(eoie - ext) - INDEX_EXT_HEADER_SIZE)
+			break;
+
+		if (memcmp(ext, INDEX_EXT_OFFSETS_SIG, 4) == 0) {
+			*offsets = ext + INDEX_EXT_HEADER_SIZE;
+			*offsets_size = ext_size;
+		}
+
+		git_hash_update(ctx, ext, INDEX_EXT_HEADER_SIZE);
+		ext += INDEX_EXT_HEADER_SIZE + ext_size;
+	}
+
+	git_hash_final(&hash, ctx);
+	git_hash_free_ctx(ctx);
+
+	if (ext != eoie || memcmp(hash.id,
+			eoie + INDEX_EXT_HEADER_SIZE + 4, GIT_OID_RAWSZ) != 0) {
+		*offsets = NULL;
+		*offsets_size = 0;
+		return 0;
+	}
+
+	return ext_offset;
 }
 
-	if (buffer_size < INDEX_HEADER_SIZE + INDEX_FOOTER_SIZE)
-		return index_error_invalid("insufficient buffer space");
+/*
+ * Load the entry offset table. Returns the number of blocks, or 0 if
+ * the table cannot be used for the entries at hand.
+ */
+static size_t read_entry_offsets(
+	struct entry_block **out,
+	const char *buffer,
+	size_t size,
+	size_t entry_count,
+	size_t ext_offset)
+{
+	struct entry_block *blocks;
+	size_t blocks_len, i, total = 0, prev = 0;
 
-	/* Precalculate the SHA1 of the files's contents -- we'll match it to
-	 * the provided SHA1 in the footer */
-	git_hash_buf(&checksum_calculated, buffer, buffer_size - INDEX_FOOTER_SIZE);
+	*out = NULL;
 
-	/* Parse header */
-	if (read_header(&header, buffer) < 0)
-		return -1;
+	if (size < 4 || (size - 4) % 8 != 0 ||
+		read_be32(buffer) != INDEX_IEOT_VERSION)
+		return 0;
 
-	seek_forward(INDEX_HEADER_SIZE);
+	if ((blocks_len = (size - 4) / 8) == 0)
+		return 0;
 
-	git_vector_clear(&index->entries);
+	if ((blocks = git__calloc(blocks_len, sizeof(struct entry_block))) == NULL)
+		return 0;
 
-	/* Parse all the entries */
-	for (i = 0; i < header.entry_count && buffer_size > INDEX_FOOTER_SIZE; ++i) {
-		size_t entry_size;
-		git_index_entry *entry;
+	for (i = 0; i < blocks_len; ++i) {
+		blocks[i].offset = read_be32(buffer + 4 + i * 8);
+		blocks[i].count = read_be32(buffer + 8 + i * 8);
 
-		entry = git__malloc(sizeof(git_index_entry));
-		GITERR_CHECK_ALLOC(entry);
+		if ((i == 0 && blocks[i].offset != INDEX_HEADER_SIZE) ||
+			(i > 0 && blocks[i].offset <= prev) ||
+			blocks[i].offset >= ext_offset)
+			break;
 
-		entry_size = read_entry(entry, buffer, buffer_size);
+		prev = blocks[i].offset;
+		total += blocks[i].count;
+	}
 
-		/* 0 bytes read means an object corruption */
-		if (entry_size == 0)
-			return index_error_invalid("invalid entry");
+	if (i != blocks_len || total != entry_count) {
+		git__free(blocks);
+		return 0;
+	}
 
-		if (git_vector_insert(&index->entries, entry) < 0)
-			return -1;
+	*out = blocks;
+	return blocks_len;
+}
+
+/* Entries from one or more consecutive IEOT blocks, parsed as a unit */
+typedef struct {
+	const char *buffer;
+	size_t buffer_size;
+	const struct entry_block *blocks;
+	size_t blocks_len;
+	git_index_entry *entries;
+	git_pool *pool;
+	int compressed;
+	size_t end;
+	int error;
+} entry_parse_job;
+
+static void *parse_entries(void *payload)
+{
+	entry_parse_job *job = payload;
+	git_index_entry *entry = job->entries;
+	size_t i, j, offset = 0;
+
+	for (i = 0; i < job->blocks_len; ++i) {
+		/* a block does not share a path prefix with the one before */
+		const char *last = job->compressed ? "" : NULL;
+
+		offset = job->blocks[i].offset;
 
-		seek_forward(entry_size);
+		for (j = 0; j < job->blocks[i].count; ++j, ++entry) {
+			size_t entry_size = 0;
+
+			if (offset + INDEX_FOOTER_SIZE < job->buffer_size)
+				entry_size = read_entry(entry, job->pool,
+					job->buffer + offset, job->buffer_size - offset, last);
+
+			if (entry_size == 0) {
+				job->error = -1;
+				return NULL;
+			}
+
+			if (last != NULL)
+				last = entry->path;
+
+			offset += entry_size;
+		}
 	}
 
-	if (i != header.entry_count)
-		return index_error_invalid("header entries changed while parsing");
+	job->end = offset;
+	return NULL;
+}
 
-	/* There's still space for some extensions! */
+static int parse_extensions(git_index *index, const char *buffer, size_t buffer_size)
+{
 	while (buffer_size > INDEX_FOOTER_SIZE) {
 		size_t extension_size;
 
@@ -838,34 +1607,344 @@ static int parse_index(git_index *index, const char *buffer, size_t buffer_size)
 		if (extension_size == 0)
 			return index_error_invalid("extension size is zero");
 
-		seek_forward(extension_size);
+		if (extension_size >= buffer_size)
+			return index_error_invalid("ran out of data while parsing");
+
+		buffer += extension_size;
+		buffer_size -= extension_size;
 	}
 
 	if (buffer_size != INDEX_FOOTER_SIZE)
 		return index_error_invalid("buffer size does not match index footer size");
 
+	return 0;
+}
+
+size_t git_index__thread_count(git_index *index, size_t count, size_t per_thread)
+{
+	size_t threads = index->threads;
+
+#ifdef GIT_THREADS
+	if (!threads) {
+		threads = count / per_thread;
+		if (threads > (size_t)git_online_cpus())
+			threads = git_online_cpus();
+	}
+#else
+	GIT_UNUSED(count);
+	GIT_UNUSED(per_thread);
+#endif
+
+	return threads ? threads : 1;
+}
+
+static int parse_index(git_index *index, const char *buffer, size_t buffer_size)
+{
+	struct index_header header;
+	git_oid checksum_calculated, checksum_expected;
+	struct entry_block single, *blocks = NULL;
+	entry_parse_job *jobs = NULL;
+	const char *offsets;
+	size_t offsets_size, ext_offset, blocks_len = 0, jobs_len, i;
+	int error = 0;
+
+	if (buffer_size < INDEX_HEADER_SIZE + INDEX_FOOTER_SIZE)
+		return index_error_invalid("insufficient buffer space");
+
+	/* Parse header */
+	if (read_header(&header, buffer) < 0)
+		return -1;
+
+	git_vector_clear(&index->entries);
+	index->version = header.version;
+
+	/* The entry offset table lets us split the entries up between
+	 * threads; without it they are parsed as a single block */
+	jobs_len = git_index__thread_count(
+		index, header.entry_count, INDEX_THREAD_ENTRIES);
+	ext_offset = read_end_of_entries(&offsets, &offsets_size, buffer, buffer_size);
+
+	if (jobs_len > 1 && offsets != NULL)
+		blocks_len = read_entry_offsets(&blocks,
+			offsets, offsets_size, header.entry_count, ext_offset);
+
+	if (!blocks_len) {
+		single.offset = INDEX_HEADER_SIZE;
+		single.count = header.entry_count;
+		blocks = &single;
+		blocks_len = 1;
+	}
+
+	if (jobs_len > blocks_len)
+		jobs_len = blocks_len;
+
+	index->arena.entries = git__calloc(
+		header.entry_count ? header.entry_count : 1, sizeof(git_index_entry));
+	index->arena.pools = git__calloc(jobs_len, sizeof(git_pool));
+	jobs = git__calloc(jobs_len, sizeof(entry_parse_job));
+
+	if (!index->arena.entries || !index->arena.pools || !jobs) {
+		giterr_set_oom();
+		error = -1;
+		goto done;
+	}
+
+	index->arena.length = header.entry_count;
+	index->arena.pools_len = jobs_len;
+
+	for (i = 0; i < jobs_len; ++i) {
+		entry_parse_job *job = &jobs[i];
+		size_t first = i * blocks_len / jobs_len, j;
+
+		job->buffer = buffer;
+		job->buffer_size = buffer_size;
+		job->blocks = &blocks[first];
+		job->blocks_len = (i + 1) * blocks_len / jobs_len - first;
+		job->entries = index->arena.entries;
+		job->pool = &index->arena.pools[i];
+		job->compressed = (header.version >= INDEX_VERSION_NUMBER_COMP);
+
+		for (j = 0; j < first; ++j)
+			job->entries += blocks[j].count;
+
+		/* a job must not run into the extensions */
+		if (blocks != &single)
+			job->buffer_size = ext_offset + INDEX_FOOTER_SIZE;
+
+		if (git_pool_init(job->pool, 1, 0) < 0) {
+			error = -1;
+			goto done;
+		}
+	}
+
+#ifdef GIT_THREADS
+	if (jobs_len > 1) {
+		git_thread *threads;
+		size_t started;
+
+		if ((threads = git__calloc(jobs_len, sizeof(git_thread))) == NULL) {
+			giterr_set_oom();
+			error = -1;
+			goto done;
+		}
+
+		for (started = 0; started < jobs_len; ++started) {
+			if (git_thread_create(&threads[started],
+					NULL, parse_entries, &jobs[started]) != 0)
+				break;
+		}
+
+		/* the extensions and the checksum are handled meanwhile */
+		error = parse_extensions(index,
+			buffer + ext_offset, buffer_size - ext_offset);
+		git_hash_buf(&checksum_calculated, buffer, buffer_size - INDEX_FOOTER_SIZE);
+
+		for (i = started; i < jobs_len; ++i)
+			parse_entries(&jobs[i]);
+
+		for (i = 0; i < started; ++i)
+			git_thread_join(threads[i], NULL);
+
+		git__free(threads);
+	} else
+#endif
+	{
+		for (i = 0; i < jobs_len; ++i)
+			parse_entries(&jobs[i]);
+
+		if (!jobs[jobs_len - 1].error) {
+			if (blocks == &single)
+				ext_offset = jobs[0].end;
+
+			error = parse_extensions(index,
+				buffer + ext_offset, buffer_size - ext_offset);
+		}
+
+		/* Calculate the SHA1 of the files's contents -- we'll match it to
+		 * the provided SHA1 in the footer */
+		git_hash_buf(&checksum_calculated, buffer, buffer_size - INDEX_FOOTER_SIZE);
+	}
+
+	/* the jobs have to cover the entries exactly */
+	for (i = 0; i < jobs_len && !error; ++i) {
+		size_t end = (i + 1 < jobs_len) ? jobs[i + 1].blocks[0].offset : ext_offset;
+
+		if (jobs[i].error || jobs[i].end != end)
+			error = index_error_invalid("invalid entry");
+	}
+
+	if (error < 0)
+		goto done;
+
 	/* 160-bit SHA-1 over the content of the index file before this checksum. */
-	git_oid_fromraw(&checksum_expected, (const unsigned char *)buffer);
+	git_oid_fromraw(&checksum_expected,
+		(const unsigned char *)buffer + buffer_size - INDEX_FOOTER_SIZE);
+
+	if (git_oid_cmp(&checksum_calculated, &checksum_expected) != 0) {
+		error = index_error_invalid("calculated checksum does not match expected");
+		goto done;
+	}
 
-	if (git_oid_cmp(&checksum_calculated, &checksum_expected) != 0)
-		return index_error_invalid("calculated checksum does not match expected");
+	git_oid_cpy(&index->checksum, &checksum_expected);
 
-#undef seek_forward
+	for (i = 0; i < header.entry_count && !error; ++i)
+		error = git_vector_insert(&index->entries, &index->arena.entries[i]);
 
 	/* force sorting in the vector: the entries are
 	 * assured to be sorted on the index */
 	index->entries.sorted = 1;
-	return 0;
+
+done:
+	if (blocks != &single)
+		git__free(blocks);
+	git__free(jobs);
+	return error;
+}
+
+static int shared_index_path(git_buf *out, git_index *index, const git_oid *id)
+{
+	char name[sizeof(INDEX_SHARED_PREFIX) + GIT_OID_HEXSZ];
+
+	memcpy(name, INDEX_SHARED_PREFIX, strlen(INDEX_SHARED_PREFIX));
+	git_oid_tostr(name + strlen(INDEX_SHARED_PREFIX),
+		GIT_OID_HEXSZ + 1, id);
+
+	if (git_path_dirname_r(out, index->index_file_path) < 0)
+		return -1;
+
+	return git_buf_joinpath(out, out->ptr, name);
+}
+
+static int load_shared_index(git_index *index, const git_oid *id)
+{
+	git_buf path = GIT_BUF_INIT;
+	git_index *shared = NULL;
+	int error;
+
+	if ((error = shared_index_path(&path, index, id)) < 0)
+		goto done;
+
+	if (!git_path_exists(path.ptr)) {
+		giterr_set(GITERR_INDEX, "Shared index '%s' not found", path.ptr);
+		error = -1;
+		goto done;
+	}
+
+	if ((error = git_index_open(&shared, path.ptr)) < 0)
+		goto done;
+
+	if (shared->split_index || git_oid_cmp(&shared->checksum, id) != 0) {
+		error = index_error_invalid("shared index does not match the link");
+		goto done;
+	}
+
+	/* take over the entries of the shared index */
+	index_arena_free(&index->split.base);
+	index->split.base = shared->arena;
+	memset(&shared->arena, 0, sizeof(shared->arena));
+	git_vector_clear(&shared->entries);
+
+	git_oid_cpy(&index->split.base_id, id);
+
+done:
+	git_index_free(shared);
+	git_buf_free(&path);
+	return error;
+}
+
+/* Entries that did not change by the last query are still unchanged */
+static void apply_fsmonitor_dirty(git_index *index)
+{
+	git_index_entry *entry;
+	unsigned int i;
+
+	if (index->fsmonitor_token != NULL &&
+		index->fsmonitor_dirty.bit_size <= index->entries.length) {
+		git_vector_foreach(&index->entries, i, entry) {
+			if (!git_ewah_get(&index->fsmonitor_dirty, i))
+				entry->flags_extended |= GIT_IDXENTRY_FSMONITOR_VALID;
+		}
+	}
+
+	git_ewah_free(&index->fsmonitor_dirty);
 }
 
-static int is_index_extended(git_index *index)
+static int merge_shared_index(git_index *index)
+{
+	git_index_split *split = &index->split;
+	git_vector entries = GIT_VECTOR_INIT;
+	size_t i, replaced = 0;
+	int error = 0;
+
+	if (!split->has_link) {
+		/* nothing points into the old shared index any more */
+		index_arena_free(&split->base);
+		memset(&split->base_id, 0, sizeof(split->base_id));
+		return 0;
+	}
+
+	index->split_index = 1;
+
+	if (git_oid_iszero(&split->base_id) ||
+		git_oid_cmp(&split->base_id, &split->link_id) != 0) {
+		if ((error = load_shared_index(index, &split->link_id)) < 0)
+			goto done;
+	}
+
+	if ((error = git_vector_init(&entries,
+			split->base.length + index->entries.length, index_cmp)) < 0)
+		goto done;
+
+	/* replacements come first in the index, in shared index order;
+	 * whatever follows them is new */
+	for (i = 0; i < split->base.length && !error; ++i) {
+		git_index_entry *entry = &split->base.entries[i];
+
+		if (git_ewah_get(&split->delete_bitmap, i))
+			continue;
+
+		if (git_ewah_get(&split->replace_bitmap, i)) {
+			git_index_entry *base = entry;
+
+			if (replaced >= index->entries.length) {
+				error = index_error_invalid("too many replaced entries");
+				goto done;
+			}
+
+			entry = git_vector_get(&index->entries, replaced++);
+			entry->path = base->path;
+			entry->flags = (entry->flags & ~GIT_IDXENTRY_NAMEMASK) |
+				(base->flags & GIT_IDXENTRY_NAMEMASK);
+		}
+
+		error = git_vector_insert(&entries, entry);
+	}
+
+	for (i = replaced; i < index->entries.length && !error; ++i)
+		error = git_vector_insert(&entries, git_vector_get(&index->entries, i));
+
+	if (error < 0)
+		goto done;
+
+	git_vector_swap(&index->entries, &entries);
+	git_vector_sort(&index->entries);
+
+done:
+	git_vector_free(&entries);
+	git_ewah_free(&split->delete_bitmap);
+	git_ewah_free(&split->replace_bitmap);
+	split->has_link = 0;
+	return error;
+}
+
+static int is_index_extended(git_vector *entries)
 {
 	unsigned int i, extended;
 	git_index_entry *entry;
 
 	extended = 0;
 
-	git_vector_foreach(&index->entries, i, entry) {
+	git_vector_foreach(entries, i, entry) {
 		entry->flags &= ~GIT_IDXENTRY_EXTENDED;
 		if (entry->flags_extended & GIT_IDXENTRY_EXTENDED_FLAGS) {
 			extended++;
@@ -876,26 +1955,47 @@ static int is_index_extended(git_index *index)
 	return extended;
 }
 
-static int write_disk_entry(git_filebuf *file, git_index_entry *entry)
+static int write_disk_entry(
+	size_t *out_size,
+	git_filebuf *file,
+	git_index_entry *entry,
+	const char *last,
+	bool new_block)
 {
-	void *mem = NULL;
-	struct entry_short *ondisk;
-	size_t path_len, disk_size;
+	char *mem = NULL;
+	struct entry_short ondisk;
+	size_t path_len, disk_size, same_len = 0;
+	int varint_len = 0;
 	char *path;
 
 	path_len = strlen(entry->path);
 
-	if (entry->flags & GIT_IDXENTRY_EXTENDED)
+	if (last != NULL) {
+		size_t last_len = strlen(last);
+
+		/* the first entry of a block strips the whole previous path
+		 * so that readers starting at the block can ignore it */
+		while (!new_block && same_len < path_len && same_len < last_len &&
+			entry->path[same_len] == last[same_len])
+			same_len++;
+
+		varint_len = git_encode_varint(NULL, 0, last_len - same_len);
+
+		if (entry->flags & GIT_IDXENTRY_EXTENDED)
+			disk_size = compressed_entry_size(
+				struct entry_long, varint_len, path_len - same_len);
+		else
+			disk_size = compressed_entry_size(
+				struct entry_short, varint_len, path_len - same_len);
+	} else if (entry->flags & GIT_IDXENTRY_EXTENDED)
 		disk_size = long_entry_size(path_len);
 	else
 		disk_size = short_entry_size(path_len);
 
-	if (git_filebuf_reserve(file, &mem, disk_size) < 0)
+	if (git_filebuf_reserve(file, (void **)&mem, disk_size) < 0)
 		return -1;
 
-	ondisk = (struct entry_short *)mem;
-
-	memset(ondisk, 0x0, disk_size);
+	memset(mem, 0x0, disk_size);
 
 	/**
 	 * Yes, we have to truncate.
@@ -907,78 +2007,564 @@ static int write_disk_entry(git_filebuf *file, git_index_entry *entry)
 	 *
 	 * In 2038 I will be either too dead or too rich to care about this
 	 */
-	ondisk->ctime.seconds = htonl((uint32_t)entry->ctime.seconds);
-	ondisk->mtime.seconds = htonl((uint32_t)entry->mtime.seconds);
-	ondisk->ctime.nanoseconds = htonl(entry->ctime.nanoseconds);
-	ondisk->mtime.nanoseconds = htonl(entry->mtime.nanoseconds);
-	ondisk->dev = htonl(entry->dev);
-	ondisk->ino = htonl(entry->ino);
-	ondisk->mode = htonl(entry->mode);
-	ondisk->uid = htonl(entry->uid);
-	ondisk->gid = htonl(entry->gid);
-	ondisk->file_size = htonl((uint32_t)entry->file_size);
+	ondisk.ctime.seconds = htonl((uint32_t)entry->ctime.seconds);
+	ondisk.mtime.seconds = htonl((uint32_t)entry->mtime.seconds);
+	ondisk.ctime.nanoseconds = htonl(entry->ctime.nanoseconds);
+	ondisk.mtime.nanoseconds = htonl(entry->mtime.nanoseconds);
+	ondisk.dev = htonl(entry->dev);
+	ondisk.ino = htonl(entry->ino);
+	ondisk.mode = htonl(entry->mode);
+	ondisk.uid = htonl(entry->uid);
+	ondisk.gid = htonl(entry->gid);
+	ondisk.file_size = htonl((uint32_t)entry->file_size);
+
+	git_oid_cpy(&ondisk.oid, &entry->oid);
 
-	git_oid_cpy(&ondisk->oid, &entry->oid);
+	ondisk.flags = htons(entry->flags);
 
-	ondisk->flags = htons(entry->flags);
+	/* v4 entries are not padded, so build them aside and copy them in */
+	memcpy(mem, &ondisk, minimal_entry_size);
 
 	if (entry->flags & GIT_IDXENTRY_EXTENDED) {
-		struct entry_long *ondisk_ext;
-		ondisk_ext = (struct entry_long *)ondisk;
-		ondisk_ext->flags_extended = htons(entry->flags_extended);
-		path = ondisk_ext->path;
+		uint16_t flags_extended =
+			htons(entry->flags_extended & GIT_IDXENTRY_EXTENDED_FLAGS);
+
+		memcpy(mem + offsetof(struct entry_long, flags_extended),
+			&flags_extended, 2);
+		path = mem + offsetof(struct entry_long, path);
 	}
 	else
-		path = ondisk->path;
+		path = mem + offsetof(struct entry_short, path);
 
-	memcpy(path, entry->path, path_len);
+	if (last != NULL) {
+		git_encode_varint((unsigned char *)path, varint_len,
+			strlen(last) - same_len);
+		memcpy(path + varint_len, entry->path + same_len, path_len - same_len);
+	} else
+		memcpy(path, entry->path, path_len);
 
+	*out_size = disk_size;
 	return 0;
 }
 
-static int write_entries(git_index *index, git_filebuf *file)
+static int write_entries(
+	size_t *entries_end,
+	git_index *index,
+	git_vector *entries,
+	git_filebuf *file,
+	struct entry_block *blocks,
+	size_t blocks_len)
 {
-	unsigned int i;
+	size_t i, offset = INDEX_HEADER_SIZE, per_block;
+	const char *last = NULL;
 
-	for (i = 0; i < index->entries.length; ++i) {
+	if (index->version >= INDEX_VERSION_NUMBER_COMP)
+		last = "";
+
+	per_block = (entries->length + blocks_len - 1) / blocks_len;
+
+	for (i = 0; i < entries->length; ++i) {
 		git_index_entry *entry;
-		entry = git_vector_get(&index->entries, i);
-		if (write_disk_entry(file, entry) < 0)
+		size_t disk_size;
+
+		if (i % per_block == 0) {
+			blocks[i / per_block].offset = offset;
+			blocks[i / per_block].count = 0;
+		}
+
+		entry = git_vector_get(entries, i);
+		if (write_disk_entry(&disk_size, file, entry, last, i % per_block == 0) < 0)
 			return -1;
+
+		if (last != NULL)
+			last = entry->path;
+
+		blocks[i / per_block].count++;
+		offset += disk_size;
 	}
 
+	*entries_end = offset;
 	return 0;
 }
 
-static int write_index(git_index *index, git_filebuf *file)
+static int write_extension(
+	git_filebuf *file, git_hash_ctx *eoie, const char *signature, git_buf *data)
+{
+	struct index_extension ext;
+
+	memcpy(ext.signature, signature, 4);
+	ext.extension_size = htonl((uint32_t)data->size);
+
+	if (eoie != NULL)
+		git_hash_update(eoie, &ext, sizeof(ext));
+
+	if (git_filebuf_write(file, &ext, sizeof(ext)) < 0)
+		return -1;
+
+	return git_filebuf_write(file, data->ptr, data->size);
+}
+
+static int put_be32(git_buf *buf, uint32_t value)
+{
+	value = htonl(value);
+	return git_buf_put(buf, (const char *)&value, sizeof(value));
+}
+
+/* Record where each block of entries starts, for parallel readers */
+static int write_entry_offsets(
+	git_filebuf *file,
+	git_hash_ctx *eoie,
+	struct entry_block *blocks,
+	size_t blocks_len)
+{
+	git_buf data = GIT_BUF_INIT;
+	size_t i;
+	int error;
+
+	put_be32(&data, INDEX_IEOT_VERSION);
+	for (i = 0; i < blocks_len; ++i) {
+		put_be32(&data, (uint32_t)blocks[i].offset);
+		put_be32(&data, (uint32_t)blocks[i].count);
+	}
+
+	if ((error = git_buf_oom(&data) ? -1 : 0) == 0)
+		error = write_extension(file, eoie, INDEX_EXT_OFFSETS_SIG, &data);
+
+	git_buf_free(&data);
+	return error;
+}
+
+/*
+ * Record where the extensions start, along with a hash of the headers
+ * of every extension written before this one, which must be the last.
+ */
+static int write_end_of_entries(
+	git_filebuf *file, git_hash_ctx *eoie, size_t entries_end)
+{
+	git_buf data = GIT_BUF_INIT;
+	git_oid hash;
+	int error;
+
+	git_hash_final(&hash, eoie);
+
+	put_be32(&data, (uint32_t)entries_end);
+	git_buf_put(&data, (const char *)hash.id, GIT_OID_RAWSZ);
+
+	if ((error = git_buf_oom(&data) ? -1 : 0) == 0)
+		error = write_extension(file, NULL, INDEX_EXT_END_OF_ENTRIES_SIG, &data);
+
+	git_buf_free(&data);
+	return error;
+}
+
+static int write_fsmonitor(git_filebuf *file, git_hash_ctx *eoie, git_index *index)
 {
-	git_oid hash_final;
+	git_buf data = GIT_BUF_INIT, bitmap = GIT_BUF_INIT;
+	git_ewah_bitmap dirty = GIT_EWAH_BITMAP_INIT;
+	git_index_entry *entry;
+	unsigned int i;
+	int error = 0;
+
+	/* the bits are for all entries, even in a split index */
+	git_vector_foreach(&index->entries, i, entry) {
+		if (!error && (entry->flags_extended & GIT_IDXENTRY_FSMONITOR_VALID) == 0)
+			error = git_ewah_set(&dirty, i);
+	}
 
+	if (!error)
+		error = git_ewah_write(&bitmap, &dirty);
+
+	if (!error) {
+		put_be32(&data, INDEX_FSMONITOR_VERSION);
+		git_buf_put(&data, index->fsmonitor_token, strlen(index->fsmonitor_token) + 1);
+		put_be32(&data, (uint32_t)bitmap.size);
+		git_buf_put(&data, bitmap.ptr, bitmap.size);
+
+		if ((error = git_buf_oom(&data) ? -1 : 0) == 0)
+			error = write_extension(file, eoie, INDEX_EXT_FSMONITOR_SIG, &data);
+	}
+
+	git_ewah_free(&dirty);
+	git_buf_free(&bitmap);
+	git_buf_free(&data);
+	return error;
+}
+
+static int write_tree_cache(
+	git_filebuf *file, git_hash_ctx *eoie, const git_tree_cache *tree)
+{
+	git_buf data = GIT_BUF_INIT;
+	int error;
+
+	if ((error = git_tree_cache_write(&data, tree)) == 0)
+		error = write_extension(file, eoie, INDEX_EXT_TREECACHE_SIG, &data);
+
+	git_buf_free(&data);
+	return error;
+}
+
+static int write_untracked_cache(
+	git_filebuf *file, git_hash_ctx *eoie, const git_untracked_cache *untracked)
+{
+	git_buf data = GIT_BUF_INIT;
+	int error;
+
+	if ((error = git_untracked_cache_write(&data, untracked)) == 0)
+		error = write_extension(file, eoie, INDEX_EXT_UNTRACKED_SIG, &data);
+
+	git_buf_free(&data);
+	return error;
+}
+
+static int write_index(
+	git_oid *checksum,
+	git_index *index,
+	git_filebuf *file,
+	git_vector *entries,
+	const git_buf *link,
+	bool shared)
+{
 	struct index_header header;
 
-	int is_extended;
+	unsigned int version;
+
+	struct entry_block *blocks;
+	size_t blocks_len, entries_end;
+	git_hash_ctx *eoie = NULL;
+	int error;
+
+	assert(index && file && entries);
 
-	assert(index && file);
+	version = index->version;
 
-	is_extended = is_index_extended(index);
+	/* extended flags need at least v3, so an index that was
+	 * asked to be v2 is upgraded when they show up */
+	if (is_index_extended(entries) && version < INDEX_VERSION_NUMBER_EXT)
+		version = INDEX_VERSION_NUMBER_EXT;
 
 	header.signature = htonl(INDEX_HEADER_SIG);
-	header.version = htonl(is_extended ? INDEX_VERSION_NUMBER_EXT : INDEX_VERSION_NUMBER);
-	header.entry_count = htonl((uint32_t)index->entries.length);
+	header.version = htonl(version);
+	header.entry_count = htonl((uint32_t)entries->length);
 
 	if (git_filebuf_write(file, &header, sizeof(struct index_header)) < 0)
 		return -1;
 
-	if (write_entries(index, file) < 0)
-		return -1;
+	blocks_len = git_index__thread_count(
+		index, entries->length, INDEX_THREAD_ENTRIES);
+	if (blocks_len > entries->length)
+		blocks_len = entries->length;
+	if (blocks_len < 1)
+		blocks_len = 1;
+
+	blocks = git__calloc(blocks_len, sizeof(struct entry_block));
+	GITERR_CHECK_ALLOC(blocks);
+
+	error = write_entries(&entries_end, index, entries, file, blocks, blocks_len);
+
+	/* rounding up the block size may leave the last blocks empty */
+	while (blocks_len > 1 && blocks[blocks_len - 1].count == 0)
+		blocks_len--;
+
+	/* the entry offsets are only worth it with several blocks; the
+	 * extensions that follow are then covered by the EOIE hash */
+	if (!error && blocks_len > 1) {
+		if ((eoie = git_hash_new_ctx()) == NULL)
+			error = -1;
+		else
+			error = write_entry_offsets(file, eoie, blocks, blocks_len);
+	}
+
+	if (!error && link != NULL)
+		error = write_extension(file, eoie, INDEX_EXT_LINK_SIG, (git_buf *)link);
+
+	/* the trees describe all entries, shared or not */
+	if (!error && !shared && index->tree != NULL)
+		error = write_tree_cache(file, eoie, index->tree);
+
+	/* the state of the working directory is kept in the main index */
+	if (!error && !shared && index->untracked != NULL)
+		error = write_untracked_cache(file, eoie, index->untracked);
+
+	if (!error && !shared && index->fsmonitor_token != NULL)
+		error = write_fsmonitor(file, eoie, index);
 
-	/* TODO: write extensions (tree cache) */
+	/* only says that there may be sparse directories */
+	if (!error && !shared && index->sparse) {
+		git_buf none = GIT_BUF_INIT;
+		error = write_extension(file, eoie, INDEX_EXT_SPARSE_DIRS_SIG, &none);
+	}
+
+	if (!error && eoie != NULL)
+		error = write_end_of_entries(file, eoie, entries_end);
+
+	git_hash_free_ctx(eoie);
+	git__free(blocks);
+
+	if (error < 0)
+		return error;
 
 	/* get out the hash for all the contents we've appended to the file */
-	git_filebuf_hash(&hash_final, file);
+	git_filebuf_hash(checksum, file);
 
 	/* write it at the end of the file */
-	return git_filebuf_write(file, hash_final.id, GIT_OID_RAWSZ);
+	return git_filebuf_write(file, checksum->id, GIT_OID_RAWSZ);
+}
+
+static int remove_expired_shared_index(void *payload, git_buf *path)
+{
+	const char *keep = payload, *name;
+	struct stat st;
+
+	name = strrchr(path->ptr, '/');
+	name = name ? name + 1 : path->ptr;
+
+	if (git__prefixcmp(name, INDEX_SHARED_PREFIX) != 0 ||
+		strcmp(path->ptr, keep) == 0)
+		return 0;
+
+	if (p_stat(path->ptr, &st) == 0 &&
+		st.st_mtime + INDEX_SHARED_EXPIRE < time(NULL))
+		p_unlink(path->ptr);
+
+	return 0;
+}
+
+/*
+ * Write all entries to a new shared index, and make it the base of
+ * the split index. The entries move into the shared index' arena.
+ */
+static int write_shared_index(git_index *index)
+{
+	git_index_arena arena;
+	git_vector entries = GIT_VECTOR_INIT;
+	git_filebuf file = GIT_FILEBUF_INIT;
+	git_buf path = GIT_BUF_INIT, dir = GIT_BUF_INIT;
+	git_oid checksum;
+	size_t i;
+	int error = -1;
+
+	memset(&arena, 0, sizeof(arena));
+
+	arena.entries = git__calloc(
+		index->entries.length ? index->entries.length : 1, sizeof(git_index_entry));
+	arena.pools = git__calloc(1, sizeof(git_pool));
+
+	if (!arena.entries || !arena.pools) {
+		giterr_set_oom();
+		goto done;
+	}
+
+	arena.length = index->entries.length;
+	arena.pools_len = 1;
+
+	if (git_pool_init(arena.pools, 1, 0) < 0 ||
+		git_vector_init(&entries, arena.length, index_cmp) < 0)
+		goto done;
+
+	for (i = 0; i < arena.length; ++i) {
+		git_index_entry *entry = &arena.entries[i];
+
+		memcpy(entry, git_vector_get(&index->entries, i), sizeof(*entry));
+
+		if ((entry->path = git_pool_strdup(arena.pools, entry->path)) == NULL ||
+			git_vector_insert(&entries, entry) < 0)
+			goto done;
+	}
+
+	if (git_path_dirname_r(&dir, index->index_file_path) < 0 ||
+		git_buf_joinpath(&path, dir.ptr, INDEX_SHARED_PREFIX) < 0)
+		goto done;
+
+	if (git_filebuf_open(&file, path.ptr,
+			GIT_FILEBUF_HASH_CONTENTS | GIT_FILEBUF_TEMPORARY) < 0)
+		goto done;
+
+	if (write_index(&checksum, index, &file, &entries, NULL, true) < 0 ||
+		shared_index_path(&path, index, &checksum) < 0) {
+		git_filebuf_cleanup(&file);
+		goto done;
+	}
+
+	if (git_filebuf_commit_at(&file, path.ptr, GIT_INDEX_FILE_MODE) < 0)
+		goto done;
+
+	for (i = 0; i < arena.length; ++i) {
+		git_index_entry *old = git_vector_get(&index->entries, i);
+
+		index->entries.contents[i] = &arena.entries[i];
+		index_entry_free(index, old);
+	}
+
+	index_arena_free(&index->arena);
+	index_arena_free(&index->split.base);
+
+	index->split.base = arena;
+	memset(&arena, 0, sizeof(arena));
+	git_oid_cpy(&index->split.base_id, &checksum);
+
+	/* old shared indexes may still be used by other index files */
+	git_path_direach(&dir, remove_expired_shared_index, path.ptr);
+	giterr_clear();
+	error = 0;
+
+done:
+	index_arena_free(&arena);
+	git_vector_free(&entries);
+	git_buf_free(&path);
+	git_buf_free(&dir);
+	return error;
+}
+
+static int find_shared_entry(git_index_split *split, const git_index_entry *entry)
+{
+	size_t lo = 0, hi = split->base.length;
+
+	while (lo < hi) {
+		size_t mid = lo + (hi - lo) / 2;
+
+		if (strcmp(split->base.entries[mid].path, entry->path) < 0)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	for (; lo < split->base.length &&
+		!strcmp(split->base.entries[lo].path, entry->path); ++lo) {
+		if (git_index_entry_stage(&split->base.entries[lo]) ==
+			git_index_entry_stage(entry))
+			return (int)lo;
+	}
+
+	return -1;
+}
+
+/*
+ * Work out the entries and the "link" extension of a split index.
+ * Entries that still point into the shared index are unchanged; the
+ * others replace a shared entry with the same path, or are new.
+ */
+static int prepare_split_index(
+	git_vector *out,
+	git_buf *link,
+	git_index_entry **stripped_out,
+	git_index *index)
+{
+	git_index_split *split = &index->split;
+	git_ewah_bitmap deleted = GIT_EWAH_BITMAP_INIT, replaced = GIT_EWAH_BITMAP_INIT;
+	git_index_entry **replacements = NULL, *stripped = NULL, *entry;
+	unsigned char *kept = NULL;
+	size_t i, replaced_len = 0, changed = 0;
+	int error = -1;
+
+	*stripped_out = NULL;
+
+	if (git_oid_iszero(&split->base_id))
+		goto new_base;
+
+	kept = git__calloc(split->base.length + 1, 1);
+	replacements = git__calloc(split->base.length + 1, sizeof(git_index_entry *));
+	if (!kept || !replacements) {
+		giterr_set_oom();
+		goto done;
+	}
+
+	git_vector_foreach(&index->entries, i, entry) {
+		if (index_arena_contains(&split->base, entry))
+			kept[entry - split->base.entries] = 1;
+		else
+			changed++;
+	}
+
+	git_vector_foreach(&index->entries, i, entry) {
+		int pos;
+
+		if (index_arena_contains(&split->base, entry))
+			continue;
+
+		pos = find_shared_entry(split, entry);
+		if (pos >= 0 && !kept[pos] && !replacements[pos]) {
+			replacements[pos] = entry;
+			replaced_len++;
+		}
+	}
+
+	for (i = 0; i < split->base.length; ++i) {
+		if (replacements[i])
+			error = git_ewah_set(&replaced, i);
+		else if (!kept[i]) {
+			error = git_ewah_set(&deleted, i);
+			changed++;
+		} else
+			error = 0;
+
+		if (error < 0)
+			goto done;
+	}
+
+	error = -1;
+
+	if (changed * 100 > index->entries.length * INDEX_SPLIT_MAX_PERCENT_CHANGE)
+		goto new_base;
+
+	/* replaced entries are written without their path */
+	stripped = git__calloc(replaced_len + 1, sizeof(git_index_entry));
+	GITERR_CHECK_ALLOC(stripped);
+
+	for (i = 0, replaced_len = 0; i < split->base.length; ++i) {
+		if (!replacements[i])
+			continue;
+
+		entry = &stripped[replaced_len++];
+		memcpy(entry, replacements[i], sizeof(*entry));
+		entry->path = "";
+		entry->flags &= ~GIT_IDXENTRY_NAMEMASK;
+
+		if (git_vector_insert(out, entry) < 0)
+			goto done;
+	}
+
+	git_vector_foreach(&index->entries, i, entry) {
+		int pos;
+
+		if (index_arena_contains(&split->base, entry))
+			continue;
+
+		pos = find_shared_entry(split, entry);
+		if (pos >= 0 && replacements[pos] == entry)
+			continue;
+
+		if (git_vector_insert(out, entry) < 0)
+			goto done;
+	}
+
+	goto write_link;
+
+new_base:
+	git_vector_clear(out);
+	git_ewah_free(&deleted);
+	git_ewah_free(&replaced);
+
+	if (write_shared_index(index) < 0)
+		goto done;
+
+write_link:
+	git_buf_put(link, (const char *)split->base_id.id, GIT_OID_RAWSZ);
+
+	if (git_ewah_write(link, &deleted) < 0 ||
+		git_ewah_write(link, &replaced) < 0)
+		goto done;
+
+	*stripped_out = stripped;
+	stripped = NULL;
+	error = 0;
+
+done:
+	git__free(stripped);
+	git__free(kept);
+	git__free(replacements);
+	git_ewah_free(&deleted);
+	git_ewah_free(&replaced);
+	return error;
 }
 
 int git_index_entry_stage(const git_index_entry *entry)
@@ -1014,7 +2600,7 @@ static int read_tree_cb(const char *root, const git_tree_entry *tentry, void *da
 	git_buf_free(&path);
 
 	if (index_insert(rtd->index, entry, 0) < 0) {
-		index_entry_free(entry);
+		index_entry_free(rtd->index, entry);
 		return -1;
 	}
 
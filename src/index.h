@@ -11,18 +11,51 @@
 #include "filebuf.h"
 #include "vector.h"
 #include "tree-cache.h"
+#include "pool.h"
+#include "ewah.h"
+#include "untracked-cache.h"
 #include "git2/odb.h"
 #include "git2/index.h"
 
 #define GIT_INDEX_FILE "index"
 #define GIT_INDEX_FILE_MODE 0666
 
+/*
+ * Entries read from disk are allocated in one block, with their paths
+ * in one string pool per parsing thread; they are released all at once
+ * when the index is cleared.
+ */
+typedef struct {
+	git_index_entry *entries;
+	size_t length;
+	git_pool *pools;
+	size_t pools_len;
+} git_index_arena;
+
+/*
+ * A split index keeps most of its entries in a shared index file,
+ * `sharedindex.<checksum>` next to the index, and the index itself
+ * only lists how the entries differ from it (the "link" extension).
+ */
+typedef struct {
+	/* the shared index; entries that did not change point into it */
+	git_oid base_id;
+	git_index_arena base;
+
+	/* the "link" extension, until the shared index is merged in */
+	unsigned int has_link:1;
+	git_oid link_id;
+	git_ewah_bitmap delete_bitmap;
+	git_ewah_bitmap replace_bitmap;
+} git_index_split;
+
 struct git_index {
 	git_refcount rc;
 
 	char *index_file_path;
 
 	time_t last_modified;
+	git_oid checksum;
 	git_vector entries;
 
 	unsigned int on_disk:1;
@@ -31,7 +64,27 @@ struct git_index {
 	unsigned int distrust_filemode:1;
 	unsigned int no_symlinks:1;
 
+	unsigned int split_index:1;
+
+	/* some entries may be sparse directories */
+	unsigned int sparse:1;
+
+	unsigned int version;
+
+	/* threads used to parse and blocks written to the entry offset
+	 * table; 0 picks a count from the CPUs and the index size */
+	unsigned int threads;
+
+	git_index_arena arena;
+	git_index_split split;
+
 	git_tree_cache *tree;
+	git_untracked_cache *untracked;
+
+	/* the token of the last file system monitor query, and the entries
+	 * that had changed by then (only until the index is read) */
+	char *fsmonitor_token;
+	git_ewah_bitmap fsmonitor_dirty;
 
 	git_vector unmerged;
 };
@@ -40,4 +93,44 @@ extern void git_index__init_entry_from_stat(struct stat *st, git_index_entry *en
 
 extern unsigned int git_index__prefix_position(git_index *index, const char *path);
 
+/*
+ * Whether the entry changed in the same second as the index file was
+ * written; its file may have changed after that without its stat data
+ * showing it, so the contents have to be looked at.
+ */
+GIT_INLINE(bool) git_index__entry_is_racy(
+	const git_index *index, const git_index_entry *entry)
+{
+	return (index->last_modified != 0 &&
+		(time_t)entry->mtime.seconds >= index->last_modified);
+}
+
+/*
+ * Whether the entry stands for a whole directory outside of the sparse
+ * checkout, by the OID of its tree; its path ends in a slash.
+ */
+GIT_INLINE(bool) git_index__is_sparse_dir(const git_index_entry *entry)
+{
+	return S_ISDIR(entry->mode);
+}
+
+/*
+ * Add the files of the sparse directory `dir` to `out`, as entries
+ * outside of the sparse checkout, in index order.
+ */
+extern int git_index__read_sparse_dir(
+	git_vector *out, git_index *index, const git_index_entry *dir);
+
+extern void git_index__free_sparse_dir(git_vector *entries);
+
+/* Replace the sparse directory at `pos` with the files in it */
+extern int git_index__expand_sparse_dir(git_index *index, unsigned int pos);
+
+/*
+ * The number of threads to spread `count` items over, at least
+ * `per_thread` of them each unless `threads` says otherwise.
+ */
+extern size_t git_index__thread_count(
+	git_index *index, size_t count, size_t per_thread);
+
 #endif
@@ -9,8 +9,17 @@
 #include "tree.h"
 #include "ignore.h"
 #include "buffer.h"
+#include "index.h"
+#include "fsmonitor.h"
+#include "repository.h"
+#include "thread-utils.h"
+#include "strmap.h"
+#include "git2/config.h"
+#include "git2/odb.h"
 #include "git2/submodule.h"
 
+GIT__USE_STRMAP;
+
 #define ITERATOR_BASE_INIT(P,NAME_LC,NAME_UC) do { \
 	(P) = git__calloc(1, sizeof(NAME_LC ## _iterator)); \
 	GITERR_CHECK_ALLOC(P); \
@@ -94,6 +103,8 @@ typedef struct {
 	git_index_entry entry;
 	git_buf path;
 	bool path_has_filename;
+	/* hand out subtrees as directories instead of descending into them */
+	bool include_trees;
 } tree_iterator;
 
 static const git_tree_entry *tree_iterator__tree_entry(tree_iterator *ti)
@@ -106,7 +117,8 @@ static char *tree_iterator__current_filename(
 	tree_iterator *ti, const git_tree_entry *te)
 {
 	if (!ti->path_has_filename) {
-		if (git_buf_joinpath(&ti->path, ti->path.ptr, te->filename) < 0)
+		if (git_buf_joinpath(&ti->path, ti->path.ptr, te->filename) < 0 ||
+			(git_tree_entry__is_tree(te) && git_buf_putc(&ti->path, '/') < 0))
 			return NULL;
 		ti->path_has_filename = true;
 	}
@@ -184,42 +196,56 @@ static tree_iterator_frame *tree_iterator__alloc_frame(
 	return tf;
 }
 
-static int tree_iterator__expand_tree(tree_iterator *ti)
+static int tree_iterator__push_frame(
+	tree_iterator *ti, const git_tree_entry *te)
 {
 	int error;
 	git_tree *subtree;
-	const git_tree_entry *te = tree_iterator__tree_entry(ti);
 	tree_iterator_frame *tf;
 	char *relpath;
 
-	while (te != NULL && git_tree_entry__is_tree(te)) {
-		if (git_buf_joinpath(&ti->path, ti->path.ptr, te->filename) < 0)
-			return -1;
+	if (git_buf_joinpath(&ti->path, ti->path.ptr, te->filename) < 0)
+		return -1;
 
-		/* check that we have not passed the range end */
-		if (ti->base.end != NULL &&
-			git__prefixcmp(ti->path.ptr, ti->base.end) > 0)
-			return tree_iterator__to_end(ti);
+	/* check that we have not passed the range end */
+	if (ti->base.end != NULL &&
+		git__prefixcmp(ti->path.ptr, ti->base.end) > 0)
+		return tree_iterator__to_end(ti);
 
-		if ((error = git_tree_lookup(&subtree, ti->repo, &te->oid)) < 0)
-			return error;
+	if ((error = git_tree_lookup(&subtree, ti->repo, &te->oid)) < 0)
+		return error;
 
-		relpath = NULL;
+	relpath = NULL;
 
-		/* apply range start to new frame if relevant */
-		if (ti->stack->start &&
-			git__prefixcmp(ti->stack->start, te->filename) == 0)
-		{
-			size_t namelen = strlen(te->filename);
-			if (ti->stack->start[namelen] == '/')
-				relpath = ti->stack->start + namelen + 1;
-		}
+	/* apply range start to new frame if relevant */
+	if (ti->stack->start &&
+		git__prefixcmp(ti->stack->start, te->filename) == 0)
+	{
+		size_t namelen = strlen(te->filename);
+		if (ti->stack->start[namelen] == '/')
+			relpath = ti->stack->start + namelen + 1;
+	}
 
-		if ((tf = tree_iterator__alloc_frame(subtree, relpath)) == NULL)
-			return -1;
+	if ((tf = tree_iterator__alloc_frame(subtree, relpath)) == NULL)
+		return -1;
+
+	tf->next  = ti->stack;
+	ti->stack = tf;
+
+	return 0;
+}
 
-		tf->next  = ti->stack;
-		ti->stack = tf;
+static int tree_iterator__expand_tree(tree_iterator *ti)
+{
+	int error;
+	const git_tree_entry *te = tree_iterator__tree_entry(ti);
+
+	if (ti->include_trees)
+		return 0;
+
+	while (te != NULL && git_tree_entry__is_tree(te)) {
+		if ((error = tree_iterator__push_frame(ti, te)) < 0)
+			return error;
 
 		te = tree_iterator__tree_entry(ti);
 	}
@@ -261,6 +287,31 @@ static int tree_iterator__advance(
 	return error;
 }
 
+static int tree_iterator__advance_into_directory(
+	git_iterator *self, const git_index_entry **entry)
+{
+	int error;
+	tree_iterator *ti = (tree_iterator *)self;
+	const git_tree_entry *te = tree_iterator__tree_entry(ti);
+
+	if (te == NULL || !git_tree_entry__is_tree(te))
+		return entry ? tree_iterator__current(self, entry) : 0;
+
+	if (ti->path_has_filename) {
+		git_buf_rtruncate_at_char(&ti->path, '/');
+		ti->path_has_filename = false;
+	}
+
+	if ((error = tree_iterator__push_frame(ti, te)) < 0)
+		return error;
+
+	/* an empty subtree is stepped over */
+	if (ti->stack && tree_iterator__tree_entry(ti) == NULL && ti->stack->next)
+		return tree_iterator__advance(self, entry);
+
+	return tree_iterator__current(self, entry);
+}
+
 static int tree_iterator__seek(git_iterator *self, const char *prefix)
 {
 	GIT_UNUSED(self);
@@ -295,12 +346,13 @@ static int tree_iterator__reset(git_iterator *self)
 	return tree_iterator__expand_tree(ti);
 }
 
-int git_iterator_for_tree_range(
+int git_iterator_for_tree_ext(
 	git_iterator **iter,
 	git_repository *repo,
 	git_tree *tree,
 	const char *start,
-	const char *end)
+	const char *end,
+	unsigned int flags)
 {
 	int error;
 	tree_iterator *ti;
@@ -312,6 +364,7 @@ int git_iterator_for_tree_range(
 
 	ti->repo  = repo;
 	ti->stack = tree_iterator__alloc_frame(tree, ti->base.start);
+	ti->include_trees = (flags & GIT_ITERATOR_INCLUDE_TREES) != 0;
 
 	if ((error = tree_iterator__expand_tree(ti)) < 0)
 		git_iterator_free((git_iterator *)ti);
@@ -326,18 +379,41 @@ typedef struct {
 	git_iterator base;
 	git_index *index;
 	unsigned int current;
+	/* hand out sparse directories as they are, not the files in them */
+	bool sparse_dirs;
+	/* the files of the sparse directory at `current` */
+	git_vector sparse;
+	unsigned int sparse_pos;
 } index_iterator;
 
+static void index_iterator__clear_sparse(index_iterator *ii)
+{
+	git_index__free_sparse_dir(&ii->sparse);
+	ii->sparse_pos = 0;
+}
+
 static int index_iterator__current(
 	git_iterator *self, const git_index_entry **entry)
 {
 	index_iterator *ii = (index_iterator *)self;
-	git_index_entry *ie = git_index_get(ii->index, ii->current);
+	git_index_entry *ie = git_vector_get(&ii->sparse, ii->sparse_pos);
+
+	if (ie == NULL &&
+		(ie = git_index_get(ii->index, ii->current)) != NULL &&
+		!ii->sparse_dirs && git_index__is_sparse_dir(ie))
+	{
+		if (git_index__read_sparse_dir(&ii->sparse, ii->index, ie) < 0)
+			return -1;
+
+		if (ii->sparse.length > 0)
+			ie = git_vector_get(&ii->sparse, 0);
+	}
 
 	if (ie != NULL &&
 		ii->base.end != NULL &&
 		git__prefixcmp(ie->path, ii->base.end) > 0)
 	{
+		index_iterator__clear_sparse(ii);
 		ii->current = git_index_entrycount(ii->index);
 		ie = NULL;
 	}
@@ -359,6 +435,11 @@ static int index_iterator__advance(
 {
 	index_iterator *ii = (index_iterator *)self;
 
+	if (ii->sparse.length > 0 && ++ii->sparse_pos < ii->sparse.length)
+		return index_iterator__current(self, entry);
+
+	index_iterator__clear_sparse(ii);
+
 	if (ii->current < git_index_entrycount(ii->index))
 		ii->current++;
 
@@ -376,6 +457,7 @@ static int index_iterator__seek(git_iterator *self, const char *prefix)
 static int index_iterator__reset(git_iterator *self)
 {
 	index_iterator *ii = (index_iterator *)self;
+	index_iterator__clear_sparse(ii);
 	ii->current = 0;
 	return 0;
 }
@@ -383,18 +465,22 @@ static int index_iterator__reset(git_iterator *self)
 static void index_iterator__free(git_iterator *self)
 {
 	index_iterator *ii = (index_iterator *)self;
+	index_iterator__clear_sparse(ii);
+	git_vector_free(&ii->sparse);
 	git_index_free(ii->index);
 	ii->index = NULL;
 }
 
-int git_iterator_for_index_range(
+int git_iterator_for_index_ext(
 	git_iterator **iter,
 	git_repository *repo,
 	const char *start,
-	const char *end)
+	const char *end,
+	unsigned int flags)
 {
 	int error;
 	index_iterator *ii;
+	git_index_entry *ie;
 
 	ITERATOR_BASE_INIT(ii, index, INDEX);
 
@@ -402,6 +488,15 @@ int git_iterator_for_index_range(
 		git__free(ii);
 	else {
 		ii->current = start ? git_index__prefix_position(ii->index, start) : 0;
+		ii->sparse_dirs = ((flags & GIT_ITERATOR_SPARSE_DIRS) != 0);
+
+		/* start within the sparse directory that `start` is in */
+		if (ii->current > 0 &&
+			(ie = git_index_get(ii->index, ii->current - 1)) != NULL &&
+			git_index__is_sparse_dir(ie) &&
+			git__prefixcmp(start, ie->path) == 0)
+			ii->current--;
+
 		*iter = (git_iterator *)ii;
 	}
 
@@ -415,6 +510,8 @@ struct workdir_iterator_frame {
 	git_vector entries;
 	unsigned int index;
 	char *start;
+	/* whether each entry is ignored, when known (or -1) */
+	signed char *ignored;
 };
 
 typedef struct {
@@ -426,6 +523,14 @@ typedef struct {
 	git_index_entry entry;
 	git_buf path;
 	int is_ignored;
+	git_index *index;
+	git_untracked_cache *untracked;
+	git_buf dir;
+	bool fsmonitor;
+	bool preloaded;
+	/* the names and paths of the submodules, loaded with the first
+	 * directory */
+	git_strmap *gitlinks;
 } workdir_iterator;
 
 static workdir_iterator_frame *workdir_iterator__alloc_frame(void)
@@ -448,6 +553,7 @@ static void workdir_iterator__free_frame(workdir_iterator_frame *wf)
 	git_vector_foreach(&wf->entries, i, path)
 		git__free(path);
 	git_vector_free(&wf->entries);
+	git__free(wf->ignored);
 	git__free(wf);
 }
 
@@ -459,13 +565,529 @@ static int workdir_iterator__entry_cmp(const void *prefix, const void *item)
 	return git__prefixcmp((const char *)prefix, ps->path);
 }
 
+static bool workdir_iterator__is_dot_git(const char *name)
+{
+	return (strcmp(name, DOT_GIT "/") == 0 || strcmp(name, DOT_GIT) == 0);
+}
+
+/* The id of the .gitignore in the directory being expanded, or zero */
+static void workdir_iterator__exclude_oid(workdir_iterator *wi, git_oid *oid)
+{
+	git_buf path = GIT_BUF_INIT;
+
+	memset(oid, 0, sizeof(*oid));
+
+	if (git_buf_joinpath(&path, wi->path.ptr, GIT_IGNORE_FILE) == 0 &&
+		git_path_isfile(path.ptr) &&
+		git_odb_hashfile(oid, path.ptr, GIT_OBJ_BLOB) < 0)
+		memset(oid, 0, sizeof(*oid));
+
+	giterr_clear();
+	git_buf_free(&path);
+}
+
+/*
+ * The index entry for `path` if nothing happened to it since it was
+ * checked, according to the file system monitor or the preload.
+ */
+static const git_index_entry *workdir_iterator__unchanged(
+	workdir_iterator *wi, const char *path)
+{
+	git_index_entry *ie;
+	int pos;
+
+	if ((!wi->fsmonitor && !wi->preloaded) ||
+		(pos = git_index_find(wi->index, path)) < 0)
+		return NULL;
+
+	ie = git_index_get(wi->index, pos);
+
+	if (git_index_entry_stage(ie) != 0 || S_ISGITLINK(ie->mode))
+		return NULL;
+
+	if ((wi->fsmonitor &&
+		 (ie->flags_extended & GIT_IDXENTRY_FSMONITOR_VALID) != 0) ||
+		(wi->preloaded &&
+		 (ie->flags_extended & GIT_IDXENTRY_UPTODATE) != 0))
+		return ie;
+
+	return NULL;
+}
+
+#ifdef GIT_THREADS
+
+/* the number of index entries that make it worth starting a thread */
+#define PRELOAD_THREAD_ENTRIES 500
+
+typedef struct {
+	const git_index *index;
+	git_index_entry **entries;
+	size_t entries_len;
+	const char *workdir;
+	bool trust_ctime;
+	bool trust_mode;
+} preload_job;
+
+/* Whether the file looks just like the index entry, as diff sees it */
+static bool preload_stat_matches(
+	preload_job *job, const git_index_entry *ie, struct stat *st)
+{
+	git_index_entry wt;
+
+	memset(&wt, 0, sizeof(wt));
+	git_index__init_entry_from_stat(st, &wt);
+	wt.mode = git_futils_canonical_mode(st->st_mode);
+
+	if (!job->trust_mode && GIT_MODE_TYPE(wt.mode) == GIT_MODE_TYPE(ie->mode))
+		wt.mode = ie->mode;
+
+	return (wt.mode == ie->mode &&
+		wt.file_size == ie->file_size &&
+		wt.mtime.seconds == ie->mtime.seconds &&
+		(!job->trust_ctime || wt.ctime.seconds == ie->ctime.seconds) &&
+		wt.ino == ie->ino &&
+		wt.uid == ie->uid &&
+		wt.gid == ie->gid);
+}
+
+static void *preload_entries(void *arg)
+{
+	preload_job *job = arg;
+	git_buf path = GIT_BUF_INIT;
+	struct stat st;
+	size_t i, root_len;
+
+	if (git_buf_sets(&path, job->workdir) < 0)
+		return NULL;
+	root_len = path.size;
+
+	for (i = 0; i < job->entries_len; ++i) {
+		git_index_entry *ie = job->entries[i];
+
+		/* racy entries have to be hashed however they look */
+		if (git_index_entry_stage(ie) != 0 || S_ISGITLINK(ie->mode) ||
+			(ie->flags_extended &
+			 (GIT_IDXENTRY_INTENT_TO_ADD | GIT_IDXENTRY_SKIP_WORKTREE)) != 0 ||
+			git_index__entry_is_racy(job->index, ie))
+			continue;
+
+		git_buf_truncate(&path, root_len);
+		if (git_buf_puts(&path, ie->path) < 0)
+			break;
+
+		if (p_lstat(path.ptr, &st) == 0 && preload_stat_matches(job, ie, &st))
+			ie->flags_extended |= GIT_IDXENTRY_UPTODATE;
+	}
+
+	git_buf_free(&path);
+	return NULL;
+}
+
+static bool preload_config(git_config *cfg, const char *name, int defvalue)
+{
+	int val = defvalue;
+
+	if (git_config_get_bool(&val, cfg, name) < 0)
+		giterr_clear();
+
+	return (val != 0);
+}
+
+/*
+ * Look at the files of the index entries within the range of the
+ * iterator with as many threads as there are CPUs, so that the ones
+ * which did not change need not be looked at again while iterating.
+ */
+static int workdir_iterator__preload(workdir_iterator *wi)
+{
+	git_config *cfg;
+	git_index_entry *ie;
+	preload_job *jobs;
+	git_thread *threads;
+	size_t first, last, jobs_len, started, i;
+
+	if (git_repository_config__weakptr(&cfg, wi->repo) < 0)
+		return -1;
+
+	if (!preload_config(cfg, "core.preloadindex", 1))
+		return 0;
+
+	/* what an earlier preload found may be out of date by now */
+	git_vector_foreach(&wi->index->entries, i, ie)
+		ie->flags_extended &= ~GIT_IDXENTRY_UPTODATE;
+
+	first = wi->base.start ?
+		git_index__prefix_position(wi->index, wi->base.start) : 0;
+
+	for (last = first; last < wi->index->entries.length; ++last) {
+		ie = git_vector_get(&wi->index->entries, last);
+		if (wi->base.end && git__prefixcmp(ie->path, wi->base.end) > 0)
+			break;
+	}
+
+	jobs_len = git_index__thread_count(
+		wi->index, last - first, PRELOAD_THREAD_ENTRIES);
+	if (jobs_len > last - first)
+		jobs_len = last - first;
+
+	/* looking at the files twice on one thread does not pay off */
+	if (jobs_len < 2)
+		return 0;
+
+	jobs = git__calloc(jobs_len, sizeof(preload_job));
+	GITERR_CHECK_ALLOC(jobs);
+
+	if ((threads = git__calloc(jobs_len, sizeof(git_thread))) == NULL) {
+		git__free(jobs);
+		giterr_set_oom();
+		return -1;
+	}
+
+	for (i = 0; i < jobs_len; ++i) {
+		size_t from = first + i * (last - first) / jobs_len;
+		size_t to = first + (i + 1) * (last - first) / jobs_len;
+
+		jobs[i].index = wi->index;
+		jobs[i].entries = (git_index_entry **)&wi->index->entries.contents[from];
+		jobs[i].entries_len = to - from;
+		jobs[i].workdir = git_repository_workdir(wi->repo);
+		jobs[i].trust_ctime = preload_config(cfg, "core.trustctime", 1);
+		jobs[i].trust_mode = preload_config(cfg, "core.filemode", 1);
+	}
+
+	for (started = 0; started < jobs_len - 1; ++started) {
+		if (git_thread_create(&threads[started],
+				NULL, preload_entries, &jobs[started]) != 0)
+			break;
+	}
+
+	for (i = started; i < jobs_len; ++i)
+		preload_entries(&jobs[i]);
+
+	for (i = 0; i < started; ++i)
+		git_thread_join(threads[i], NULL);
+
+	git__free(threads);
+	git__free(jobs);
+
+	wi->preloaded = true;
+	return 0;
+}
+
+#endif
+
+static void workdir_iterator__stat_from_entry(
+	struct stat *st, const git_index_entry *ie)
+{
+	memset(st, 0, sizeof(*st));
+
+	st->st_mode  = ie->mode;
+	st->st_size  = ie->file_size;
+	st->st_mtime = ie->mtime.seconds;
+	st->st_ctime = ie->ctime.seconds;
+	st->st_dev   = ie->dev;
+	st->st_ino   = ie->ino;
+	st->st_uid   = ie->uid;
+	st->st_gid   = ie->gid;
+}
+
+/*
+ * Like git_path_dirload_with_stat, but without an lstat for the paths
+ * that the file system monitor knows to be unchanged.
+ */
+static int workdir_iterator__dirload(
+	workdir_iterator *wi, workdir_iterator_frame *wf)
+{
+	int error;
+	unsigned int i;
+	git_path_with_stat *ps;
+	const git_index_entry *ie;
+	git_buf full = GIT_BUF_INIT;
+
+	if (!wi->fsmonitor)
+		return git_path_dirload_with_stat(wi->path.ptr, wi->root_len, &wf->entries);
+
+	if (git_buf_set(&full, wi->path.ptr, wi->root_len) < 0)
+		return -1;
+
+	error = git_path_dirload(
+		wi->path.ptr, wi->root_len, sizeof(git_path_with_stat) + 1, &wf->entries);
+
+	git_vector_foreach(&wf->entries, i, ps) {
+		size_t path_len;
+
+		if (error < 0)
+			break;
+
+		path_len = strlen((char *)ps);
+		memmove(ps->path, ps, path_len + 1);
+		ps->path_len = path_len;
+
+		if ((ie = workdir_iterator__unchanged(wi, ps->path)) != NULL)
+			workdir_iterator__stat_from_entry(&ps->st, ie);
+		else if ((error = git_buf_joinpath(&full, full.ptr, ps->path)) < 0 ||
+			(error = git_path_lstat(full.ptr, &ps->st)) < 0)
+			break;
+
+		git_buf_truncate(&full, wi->root_len);
+
+		if (S_ISDIR(ps->st.st_mode)) {
+			ps->path[path_len] = '/';
+			ps->path[path_len + 1] = '\0';
+		}
+	}
+
+	git_buf_free(&full);
+
+	return error;
+}
+
+static int workdir_iterator__add_cached(
+	workdir_iterator *wi, workdir_iterator_frame *wf,
+	const char *prefix, size_t prefix_len, const char *name, size_t name_len)
+{
+	git_path_with_stat *ps;
+	const git_index_entry *ie;
+	struct stat st;
+
+	if (name_len > 0 && name[name_len - 1] == '/')
+		name_len--;
+
+	git_buf_truncate(&wi->path, wi->root_len);
+	if (git_buf_put(&wi->path, prefix, prefix_len) < 0 ||
+		git_buf_put(&wi->path, name, name_len) < 0)
+		return -1;
+
+	if ((ie = workdir_iterator__unchanged(wi, wi->path.ptr + wi->root_len)) != NULL)
+		workdir_iterator__stat_from_entry(&st, ie);
+
+	/* whatever has gone in the meantime is just left out */
+	else if (p_lstat(wi->path.ptr, &st) < 0)
+		return 0;
+
+	ps = git__malloc(sizeof(git_path_with_stat) + prefix_len + name_len + 2);
+	GITERR_CHECK_ALLOC(ps);
+
+	memcpy(&ps->st, &st, sizeof(st));
+	memcpy(ps->path, prefix, prefix_len);
+	memcpy(ps->path + prefix_len, name, name_len);
+	ps->path_len = prefix_len + name_len;
+	ps->path[ps->path_len] = '\0';
+
+	if (S_ISDIR(st.st_mode)) {
+		ps->path[ps->path_len] = '/';
+		ps->path[ps->path_len + 1] = '\0';
+	}
+
+	return git_vector_insert(&wf->entries, ps);
+}
+
+/*
+ * List a directory from its untracked cache record and the index, so
+ * it need not be read. The record is only good as long as neither the
+ * directory nor its .gitignore changed.
+ */
+static int workdir_iterator__load_cached(
+	workdir_iterator *wi, workdir_iterator_frame *wf,
+	git_untracked_dir *ud, const git_untracked_stat *st)
+{
+	const char *prefix = wi->dir.ptr, *name;
+	size_t prefix_len = wi->dir.size, path_len = wi->path.size;
+	size_t pos, name_len, last_len = 0;
+	const char *last = NULL;
+	git_index_entry *ie;
+	git_path_with_stat *ps, *prev = NULL;
+	unsigned int i, j;
+	git_oid exclude_oid;
+	int error = 0;
+
+	if (!ud->valid || !git_untracked_stat_match(&ud->st, st))
+		return GIT_ENOTFOUND;
+
+	workdir_iterator__exclude_oid(wi, &exclude_oid);
+	if (git_oid_cmp(&exclude_oid, &ud->exclude_oid) != 0)
+		return GIT_ENOTFOUND;
+
+	/* what is tracked, one name per file or directory */
+	for (pos = git_index__prefix_position(wi->index, prefix);
+		 !error && (ie = git_index_get(wi->index, pos)) != NULL &&
+		 git__prefixcmp(ie->path, prefix) == 0; pos++)
+	{
+		const char *slash;
+
+		name = ie->path + prefix_len;
+		slash = strchr(name, '/');
+		name_len = slash ? (size_t)(slash - name) + 1 : strlen(name);
+
+		if (last && last_len == name_len && !memcmp(last, name, name_len))
+			continue;
+
+		last = name;
+		last_len = name_len;
+		error = workdir_iterator__add_cached(wi, wf, prefix, prefix_len, name, name_len);
+	}
+
+	git_vector_foreach(&ud->untracked, i, name) {
+		if (!error)
+			error = workdir_iterator__add_cached(
+				wi, wf, prefix, prefix_len, name, strlen(name));
+	}
+
+	git_buf_truncate(&wi->path, path_len);
+
+	if (error < 0)
+		return error;
+
+	/* a name may show up twice if it changed from tracked to untracked */
+	git_vector_sort(&wf->entries);
+
+	for (i = 0, j = 0; i < wf->entries.length; ++i) {
+		ps = git_vector_get(&wf->entries, i);
+
+		if (prev && strcmp(prev->path, ps->path) == 0) {
+			git__free(ps);
+			continue;
+		}
+
+		wf->entries.contents[j++] = prev = ps;
+	}
+	wf->entries.length = j;
+
+	if (j == 0)
+		return 0;
+
+	wf->ignored = git__malloc(j);
+	GITERR_CHECK_ALLOC(wf->ignored);
+
+	/* the untracked names are known not to be ignored */
+	git_vector_foreach(&wf->entries, i, ps) {
+		wf->ignored[i] =
+			(git_vector_bsearch(&ud->untracked, ps->path + prefix_len) >= 0) ? 0 : -1;
+	}
+
+	return 0;
+}
+
+static bool workdir_iterator__is_tracked(
+	workdir_iterator *wi, git_path_with_stat *ps)
+{
+	git_index_entry *ie;
+	bool tracked;
+
+	if (!S_ISDIR(ps->st.st_mode))
+		return (git_index_find(wi->index, ps->path) >= 0);
+
+	ie = git_index_get(wi->index, git_index__prefix_position(wi->index, ps->path));
+	if (ie != NULL && git__prefixcmp(ie->path, ps->path) == 0)
+		return true;
+
+	/* a submodule is tracked under its name without the slash */
+	ps->path[ps->path_len] = '\0';
+	tracked = (git_index_find(wi->index, ps->path) >= 0);
+	ps->path[ps->path_len] = '/';
+
+	return tracked;
+}
+
+/*
+ * Record the names in a directory that was just read which are neither
+ * tracked nor ignored, and what is ignored for the iteration itself.
+ */
+static int workdir_iterator__record_untracked(
+	workdir_iterator *wi, workdir_iterator_frame *wf,
+	git_untracked_dir *ud, const git_untracked_stat *st)
+{
+	git_path_with_stat *ps;
+	git_oid exclude_oid;
+	unsigned int i;
+	int ignored;
+	bool complete = true;
+
+	workdir_iterator__exclude_oid(wi, &exclude_oid);
+
+	/* different ignore rules may hold all the way down */
+	git_untracked_dir_clear(ud, git_oid_cmp(&exclude_oid, &ud->exclude_oid) != 0);
+	git_oid_cpy(&ud->exclude_oid, &exclude_oid);
+
+	wf->ignored = git__malloc(wf->entries.length);
+	GITERR_CHECK_ALLOC(wf->ignored);
+
+	git_vector_foreach(&wf->entries, i, ps) {
+		const char *name = ps->path + wi->dir.size;
+
+		wf->ignored[i] = -1;
+
+		if (workdir_iterator__is_dot_git(name) ||
+			git_futils_canonical_mode(ps->st.st_mode) == 0)
+			continue;
+
+		if (git_ignore__lookup(&wi->ignores, ps->path, &ignored) < 0) {
+			giterr_clear();
+			complete = false;
+			continue;
+		}
+
+		wf->ignored[i] = (signed char)ignored;
+
+		if (ignored || workdir_iterator__is_tracked(wi, ps))
+			continue;
+
+		if (git_untracked_dir_add(ud, name, strlen(name)) < 0)
+			return -1;
+	}
+
+	git_vector_sort(&ud->untracked);
+
+	/* files may still show up within the second the directory changed */
+	ud->st = *st;
+	ud->valid = (complete && (time_t)st->mtime < time(NULL));
+
+	return 0;
+}
+
 static int workdir_iterator__expand_dir(workdir_iterator *wi)
 {
 	int error;
+	struct stat st;
+	git_untracked_stat dir_st;
+	git_untracked_dir *ud = NULL;
+	bool cached = false;
 	workdir_iterator_frame *wf = workdir_iterator__alloc_frame();
 	GITERR_CHECK_ALLOC(wf);
 
-	error = git_path_dirload_with_stat(wi->path.ptr, wi->root_len, &wf->entries);
+	memset(&dir_st, 0, sizeof(dir_st));
+
+	if (wi->untracked != NULL) {
+		/* the directory relative to the working directory, with a slash */
+		git_buf_sets(&wi->dir, wi->path.ptr + wi->root_len);
+		if (wi->dir.size > 0)
+			git_path_to_dir(&wi->dir);
+
+		if (git_buf_oom(&wi->dir) ||
+			(ud = git_untracked_cache_lookup(wi->untracked, wi->dir.ptr)) == NULL) {
+			workdir_iterator__free_frame(wf);
+			return -1;
+		}
+
+		if (p_stat(wi->path.ptr, &st) < 0)
+			ud = NULL;
+		else {
+			git_untracked_stat_from(&dir_st, &st);
+
+			if ((error = workdir_iterator__load_cached(wi, wf, ud, &dir_st)) == 0)
+				cached = true;
+			else if (error != GIT_ENOTFOUND) {
+				workdir_iterator__free_frame(wf);
+				return error;
+			}
+		}
+	}
+
+	if (!cached)
+		error = workdir_iterator__dirload(wi, wf);
+	else
+		error = 0;
+
 	if (error < 0 || wf->entries.length == 0) {
 		workdir_iterator__free_frame(wf);
 		return GIT_ENOTFOUND;
@@ -492,6 +1114,10 @@ static int workdir_iterator__expand_dir(workdir_iterator *wi)
 		(void)git_ignore__push_dir(&wi->ignores, &wi->path.ptr[slash_pos + 1]);
 	}
 
+	if (ud != NULL && !cached &&
+		workdir_iterator__record_untracked(wi, wf, ud, &dir_st) < 0)
+		return -1;
+
 	return workdir_iterator__update_entry(wi);
 }
 
@@ -526,8 +1152,7 @@ static int workdir_iterator__advance(
 		next = git_vector_get(&wf->entries, ++wf->index);
 		if (next != NULL) {
 			/* match git's behavior of ignoring anything named ".git" */
-			if (strcmp(next->path, DOT_GIT "/") == 0 ||
-				strcmp(next->path, DOT_GIT) == 0)
+			if (workdir_iterator__is_dot_git(next->path))
 				continue;
 			/* else found a good entry */
 			break;
@@ -588,6 +1213,69 @@ static void workdir_iterator__free(git_iterator *self)
 
 	git_ignore__free(&wi->ignores);
 	git_buf_free(&wi->path);
+	git_buf_free(&wi->dir);
+	git_index_free(wi->index);
+
+	if (wi->gitlinks != NULL) {
+		char *path;
+
+		git_strmap_foreach_value(wi->gitlinks, path, {
+			git__free(path);
+		});
+		git_strmap_free(wi->gitlinks);
+	}
+}
+
+static int workdir_iterator__add_gitlink(workdir_iterator *wi, const char *path)
+{
+	char *key;
+	int error;
+
+	if (git_strmap_exists(wi->gitlinks, path))
+		return 0;
+
+	key = git__strdup(path);
+	GITERR_CHECK_ALLOC(key);
+
+	git_strmap_insert(wi->gitlinks, key, key, error);
+	if (error < 0) {
+		git__free(key);
+		giterr_set_oom();
+		return -1;
+	}
+
+	return 0;
+}
+
+static int workdir_iterator__add_submodule(
+	git_submodule *sm, const char *name, void *payload)
+{
+	workdir_iterator *wi = payload;
+
+	if (workdir_iterator__add_gitlink(wi, name) < 0 ||
+		workdir_iterator__add_gitlink(wi, git_submodule_path(sm)) < 0)
+		return -1;
+
+	return 0;
+}
+
+/*
+ * Collect everything that git_submodule_lookup would find, so that each
+ * directory takes a single lookup. A submodule that cannot be loaded
+ * is not looked for, just like a failed lookup.
+ */
+static int workdir_iterator__load_gitlinks(workdir_iterator *wi)
+{
+	if (wi->gitlinks != NULL)
+		return 0;
+
+	wi->gitlinks = git_strmap_alloc();
+	GITERR_CHECK_ALLOC(wi->gitlinks);
+
+	if (git_submodule_foreach(wi->repo, workdir_iterator__add_submodule, wi) < 0)
+		giterr_clear();
+
+	return 0;
 }
 
 static int workdir_iterator__update_entry(workdir_iterator *wi)
@@ -610,7 +1298,7 @@ static int workdir_iterator__update_entry(workdir_iterator *wi)
 	wi->entry.path = ps->path;
 
 	/* skip over .git entry */
-	if (strcmp(ps->path, DOT_GIT "/") == 0 || strcmp(ps->path, DOT_GIT) == 0)
+	if (workdir_iterator__is_dot_git(ps->path))
 		return workdir_iterator__advance((git_iterator *)wi, NULL);
 
 	/* if there is an error processing the entry, treat as ignored */
@@ -626,33 +1314,38 @@ static int workdir_iterator__update_entry(workdir_iterator *wi)
 		return 0;
 
 	/* okay, we are far enough along to look up real ignore rule */
-	if (git_ignore__lookup(&wi->ignores, wi->entry.path, &wi->is_ignored) < 0)
+	if (wi->stack->ignored != NULL && wi->stack->ignored[wi->stack->index] >= 0)
+		wi->is_ignored = wi->stack->ignored[wi->stack->index];
+	else if (git_ignore__lookup(&wi->ignores, wi->entry.path, &wi->is_ignored) < 0)
 		return 0; /* if error, ignore it and ignore file */
 
 	/* detect submodules */
 	if (S_ISDIR(wi->entry.mode)) {
-		int res = git_submodule_lookup(NULL, wi->repo, wi->entry.path);
-		bool is_submodule = (res == 0);
-		if (res == GIT_ENOTFOUND)
-			giterr_clear();
+		size_t len = strlen(wi->entry.path);
+		assert(wi->entry.path[len - 1] == '/');
+
+		if (workdir_iterator__load_gitlinks(wi) < 0)
+			return -1;
 
 		/* if submodule, mark as GITLINK and remove trailing slash */
-		if (is_submodule) {
-			size_t len = strlen(wi->entry.path);
-			assert(wi->entry.path[len - 1] == '/');
-			wi->entry.path[len - 1] = '\0';
+		wi->entry.path[len - 1] = '\0';
+
+		if (git_strmap_num_entries(wi->gitlinks) > 0 &&
+			git_strmap_exists(wi->gitlinks, wi->entry.path))
 			wi->entry.mode = S_IFGITLINK;
-		}
+		else
+			wi->entry.path[len - 1] = '/';
 	}
 
 	return 0;
 }
 
-int git_iterator_for_workdir_range(
+int git_iterator_for_workdir_ext(
 	git_iterator **iter,
 	git_repository *repo,
 	const char *start,
-	const char *end)
+	const char *end,
+	unsigned int flags)
 {
 	int error;
 	workdir_iterator *wi;
@@ -665,6 +1358,7 @@ int git_iterator_for_workdir_range(
 	ITERATOR_BASE_INIT(wi, workdir, WORKDIR);
 
 	wi->repo = repo;
+	git_buf_init(&wi->dir, 0);
 
 	if (git_buf_sets(&wi->path, git_repository_workdir(repo)) < 0 ||
 		git_path_to_dir(&wi->path) < 0 ||
@@ -676,6 +1370,42 @@ int git_iterator_for_workdir_range(
 
 	wi->root_len = wi->path.size;
 
+	/* rules that were added at runtime are not known to the cache */
+	if ((flags & GIT_ITERATOR_UNTRACKED_CACHE) != 0 &&
+		wi->ignores.ign_internal->rules.length == 0)
+	{
+		if ((error = git_repository_index(&wi->index, repo)) < 0 ||
+			(error = git_untracked_cache_setup(&wi->untracked, repo, wi->index)) < 0)
+		{
+			git_iterator_free((git_iterator *)wi);
+			return error;
+		}
+	}
+
+	if ((flags & GIT_ITERATOR_FSMONITOR) != 0 && repo->fsmonitor != NULL) {
+		if ((!wi->index &&
+			 (error = git_repository_index(&wi->index, repo)) < 0) ||
+			(error = git_fsmonitor__refresh(repo, wi->index)) < 0)
+		{
+			git_iterator_free((git_iterator *)wi);
+			return error;
+		}
+
+		wi->fsmonitor = true;
+	}
+
+#ifdef GIT_THREADS
+	if ((flags & GIT_ITERATOR_PRELOAD) != 0) {
+		if ((!wi->index &&
+			 (error = git_repository_index(&wi->index, repo)) < 0) ||
+			(error = workdir_iterator__preload(wi)) < 0)
+		{
+			git_iterator_free((git_iterator *)wi);
+			return error;
+		}
+	}
+#endif
+
 	if ((error = workdir_iterator__expand_dir(wi)) < 0) {
 		if (error == GIT_ENOTFOUND)
 			error = 0;
@@ -705,11 +1435,20 @@ int git_iterator_current_is_ignored(git_iterator *iter)
 		((workdir_iterator *)iter)->is_ignored;
 }
 
+bool git_iterator_uses_fsmonitor(git_iterator *iter)
+{
+	return (iter->type == GIT_ITERATOR_WORKDIR &&
+		((workdir_iterator *)iter)->fsmonitor);
+}
+
 int git_iterator_advance_into_directory(
 	git_iterator *iter, const git_index_entry **entry)
 {
 	workdir_iterator *wi = (workdir_iterator *)iter;
 
+	if (iter->type == GIT_ITERATOR_TREE)
+		return tree_iterator__advance_into_directory(iter, entry);
+
 	if (iter->type == GIT_ITERATOR_WORKDIR &&
 		wi->entry.path &&
 		S_ISDIR(wi->entry.mode) &&
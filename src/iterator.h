@@ -33,9 +33,37 @@ struct git_iterator {
 
 extern int git_iterator_for_nothing(git_iterator **iter);
 
-extern int git_iterator_for_tree_range(
+typedef enum {
+	/* list directories through the untracked cache of the index where
+	 * possible; ignored files are then only reported inside directories
+	 * that have tracked files */
+	GIT_ITERATOR_UNTRACKED_CACHE = (1 << 0),
+	/* ask the file system monitor of the repository what changed, and
+	 * take the stat data of the index entries for everything else */
+	GIT_ITERATOR_FSMONITOR = (1 << 1),
+	/* with core.preloadindex, compare the index entries with their files
+	 * in parallel up front and take the stat data of the index entries
+	 * for the ones that match */
+	GIT_ITERATOR_PRELOAD = (1 << 2),
+	/* hand out the sparse directories of the index as they are, instead
+	 * of the files in their trees */
+	GIT_ITERATOR_SPARSE_DIRS = (1 << 3),
+	/* hand out the subtrees of a tree as directories, with the oid of
+	 * the subtree, and only descend into the ones that are asked for
+	 * with git_iterator_advance_into_directory */
+	GIT_ITERATOR_INCLUDE_TREES = (1 << 4)
+} git_iterator_flag_t;
+
+extern int git_iterator_for_tree_ext(
 	git_iterator **iter, git_repository *repo, git_tree *tree,
-	const char *start, const char *end);
+	const char *start, const char *end, unsigned int flags);
+
+GIT_INLINE(int) git_iterator_for_tree_range(
+	git_iterator **iter, git_repository *repo, git_tree *tree,
+	const char *start, const char *end)
+{
+	return git_iterator_for_tree_ext(iter, repo, tree, start, end, 0);
+}
 
 GIT_INLINE(int) git_iterator_for_tree(
 	git_iterator **iter, git_repository *repo, git_tree *tree)
@@ -43,9 +71,16 @@ GIT_INLINE(int) git_iterator_for_tree(
 	return git_iterator_for_tree_range(iter, repo, tree, NULL, NULL);
 }
 
-extern int git_iterator_for_index_range(
+extern int git_iterator_for_index_ext(
+	git_iterator **iter, git_repository *repo,
+	const char *start, const char *end, unsigned int flags);
+
+GIT_INLINE(int) git_iterator_for_index_range(
 	git_iterator **iter, git_repository *repo,
-	const char *start, const char *end);
+	const char *start, const char *end)
+{
+	return git_iterator_for_index_ext(iter, repo, start, end, 0);
+}
 
 GIT_INLINE(int) git_iterator_for_index(
 	git_iterator **iter, git_repository *repo)
@@ -53,9 +88,16 @@ GIT_INLINE(int) git_iterator_for_index(
 	return git_iterator_for_index_range(iter, repo, NULL, NULL);
 }
 
-extern int git_iterator_for_workdir_range(
+extern int git_iterator_for_workdir_ext(
 	git_iterator **iter, git_repository *repo,
-	const char *start, const char *end);
+	const char *start, const char *end, unsigned int flags);
+
+GIT_INLINE(int) git_iterator_for_workdir_range(
+	git_iterator **iter, git_repository *repo,
+	const char *start, const char *end)
+{
+	return git_iterator_for_workdir_ext(iter, repo, start, end, 0);
+}
 
 GIT_INLINE(int) git_iterator_for_workdir(
 	git_iterator **iter, git_repository *repo)
@@ -125,6 +167,9 @@ extern int git_iterator_current_tree_entry(
 
 extern int git_iterator_current_is_ignored(git_iterator *iter);
 
+/* Whether the index entries the monitor vouches for may be trusted */
+extern bool git_iterator_uses_fsmonitor(git_iterator *iter);
+
 /**
  * Iterate into a workdir directory.
  *
@@ -133,13 +178,14 @@ extern int git_iterator_current_is_ignored(git_iterator *iter);
  * directory in the workdir).  As a result, you may get S_ISDIR items from
  * a workdir iterator.  If you wish to iterate over the contents of the
  * directories you encounter, then call this function when you encounter
- * a directory.
+ * a directory.  Tree iterators made with GIT_ITERATOR_INCLUDE_TREES hand
+ * out their subtrees the same way.
  *
  * If there are no files in the directory, this will end up acting like a
  * regular advance and will skip past the directory, so you should be
  * prepared for that case.
  *
- * On non-workdir iterators or if not pointing at a directory, this is a
+ * On other iterators or if not pointing at a directory, this is a
  * no-op and will not advance the iterator.
  */
 extern int git_iterator_advance_into_directory(
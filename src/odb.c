@@ -313,6 +313,57 @@ static int init_fake_wstream(git_odb_stream **stream_p, git_odb_backend *backend
 	return 0;
 }
 
+/**
+ * FAKE RSTREAM
+ */
+
+typedef struct {
+	git_odb_stream stream;
+	git_rawobj raw;
+	size_t offset;
+} fake_rstream;
+
+static int fake_rstream__read(git_odb_stream *_stream, char *buffer, size_t len)
+{
+	fake_rstream *stream = (fake_rstream *)_stream;
+
+	if (len > stream->raw.len - stream->offset)
+		len = stream->raw.len - stream->offset;
+
+	memcpy(buffer, (char *)stream->raw.data + stream->offset, len);
+	stream->offset += len;
+	return (int)len;
+}
+
+static void fake_rstream__free(git_odb_stream *_stream)
+{
+	fake_rstream *stream = (fake_rstream *)_stream;
+
+	git__free(stream->raw.data);
+	git__free(stream);
+}
+
+int git_odb__init_fake_rstream(
+	git_odb_stream **stream_p, git_odb_backend *backend, git_rawobj *raw)
+{
+	fake_rstream *stream;
+
+	stream = git__calloc(1, sizeof(fake_rstream));
+	GITERR_CHECK_ALLOC(stream);
+
+	memcpy(&stream->raw, raw, sizeof(git_rawobj));
+
+	stream->stream.backend = backend;
+	stream->stream.read = &fake_rstream__read;
+	stream->stream.write = NULL; /* read only */
+	stream->stream.finalize_write = NULL;
+	stream->stream.free = &fake_rstream__free;
+	stream->stream.mode = GIT_STREAM_RDONLY;
+
+	*stream_p = (git_odb_stream *)stream;
+	return 0;
+}
+
 /***********************************************************
  *
  * OBJECT DATABASE PUBLIC API
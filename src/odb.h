@@ -74,6 +74,13 @@ int git_odb__hashfd_filtered(
  */
 int git_odb__hashlink(git_oid *out, const char *path);
 
+/*
+ * Make a read stream out of an object that was read whole, for the
+ * backends that cannot stream it; the stream takes over `raw->data`.
+ */
+int git_odb__init_fake_rstream(
+	git_odb_stream **stream_p, git_odb_backend *backend, git_rawobj *raw);
+
 /*
  * Generate a GIT_ENOTFOUND error for the ODB.
  */
@@ -28,6 +28,16 @@ typedef struct {
 	git_filebuf fbuf;
 } loose_writestream;
 
+typedef struct {
+	git_odb_stream stream;
+	git_file fd;
+	z_stream zs;
+	unsigned char head[64];
+	size_t head_pos, head_len;
+	size_t left; /* the number of bytes of the object yet to be read */
+	unsigned char in[4096];
+} loose_readstream;
+
 typedef struct loose_backend {
 	git_odb_backend parent;
 
@@ -855,6 +865,140 @@ static int loose_backend__stream(git_odb_stream **stream_out, git_odb_backend *_
 	return !stream ? -1 : 0;
 }
 
+static int loose_backend__readstream_read(git_odb_stream *_stream, char *buffer, size_t len)
+{
+	loose_readstream *stream = (loose_readstream *)_stream;
+	size_t n = 0, want;
+	ssize_t read_bytes;
+	int status;
+
+	if (len > stream->left)
+		len = stream->left;
+
+	/* what was inflated along with the header comes first */
+	if (stream->head_pos < stream->head_len) {
+		n = min(stream->head_len - stream->head_pos, len);
+		memcpy(buffer, stream->head + stream->head_pos, n);
+		stream->head_pos += n;
+	}
+
+	while (n < len) {
+		if (stream->zs.avail_in == 0) {
+			if ((read_bytes = p_read(stream->fd, stream->in, sizeof(stream->in))) <= 0)
+				goto fail;
+
+			set_stream_input(&stream->zs, stream->in, read_bytes);
+		}
+
+		want = len - n;
+		set_stream_output(&stream->zs, buffer + n, want);
+		status = inflate(&stream->zs, Z_NO_FLUSH);
+		n += want - stream->zs.avail_out;
+
+		if ((status == Z_STREAM_END && n < len) ||
+			(status != Z_OK && status != Z_STREAM_END))
+			goto fail;
+	}
+
+	stream->left -= n;
+	return (int)n;
+
+fail:
+	giterr_set(GITERR_ZLIB, "Failed to inflate loose object");
+	return -1;
+}
+
+static void loose_backend__readstream_free(git_odb_stream *_stream)
+{
+	loose_readstream *stream = (loose_readstream *)_stream;
+
+	inflateEnd(&stream->zs);
+	p_close(stream->fd);
+	git__free(stream);
+}
+
+static int loose_backend__readstream_fake(
+	git_odb_stream **stream_out, git_odb_backend *backend, git_buf *object_path)
+{
+	git_rawobj raw;
+	int error;
+
+	if ((error = read_loose(&raw, object_path)) < 0)
+		return error;
+
+	if ((error = git_odb__init_fake_rstream(stream_out, backend, &raw)) < 0)
+		git__free(raw.data);
+
+	return error;
+}
+
+static int loose_backend__readstream(git_odb_stream **stream_out, git_odb_backend *backend, const git_oid *oid)
+{
+	loose_readstream *stream = NULL;
+	git_buf object_path = GIT_BUF_INIT;
+	ssize_t read_bytes;
+	obj_hdr hdr;
+	size_t used;
+	int error = -1;
+
+	assert(backend && oid);
+
+	if (locate_object(&object_path, (loose_backend *)backend, oid) < 0) {
+		error = git_odb__error_notfound("no matching loose object", oid);
+		goto done;
+	}
+
+	if ((stream = git__calloc(1, sizeof(loose_readstream))) == NULL)
+		goto done;
+
+	if ((stream->fd = git_futils_open_ro(object_path.ptr)) < 0) {
+		git__free(stream);
+		stream = NULL;
+		goto done;
+	}
+
+	read_bytes = p_read(stream->fd, stream->in, sizeof(stream->in));
+
+	/* the old pack-like format is rare enough to be read whole */
+	if (read_bytes >= 2 && !is_zlib_compressed_data(stream->in)) {
+		error = loose_backend__readstream_fake(stream_out, backend, &object_path);
+		goto done;
+	}
+
+	/* inflate the start of the object to parse its header */
+	init_stream(&stream->zs, stream->head, sizeof(stream->head));
+	set_stream_input(&stream->zs, stream->in, read_bytes > 0 ? read_bytes : 0);
+
+	if (read_bytes < 2 ||
+		inflateInit(&stream->zs) < Z_OK ||
+		inflate(&stream->zs, 0) < Z_OK ||
+		(used = get_object_header(&hdr, stream->head)) == 0 ||
+		!git_object_typeisloose(hdr.type))
+	{
+		giterr_set(GITERR_ODB, "Failed to inflate disk object.");
+		goto done;
+	}
+
+	stream->head_pos = used;
+	stream->head_len = min(stream->zs.total_out, used + hdr.size);
+	stream->left = hdr.size;
+
+	stream->stream.backend = backend;
+	stream->stream.read = &loose_backend__readstream_read;
+	stream->stream.free = &loose_backend__readstream_free;
+	stream->stream.mode = GIT_STREAM_RDONLY;
+
+	*stream_out = (git_odb_stream *)stream;
+	stream = NULL;
+	error = 0;
+
+done:
+	if (stream != NULL)
+		loose_backend__readstream_free((git_odb_stream *)stream);
+	git_buf_free(&object_path);
+	return error;
+}
+
 static int loose_backend__write(git_oid *oid, git_odb_backend *_backend, const void *data, size_t len, git_otype type)
 {
 	int error = 0, header_len;
@@ -929,6 +1073,7 @@ int git_odb_backend_loose(
 	backend->parent.read_prefix = &loose_backend__read_prefix;
 	backend->parent.read_header = &loose_backend__read_header;
 	backend->parent.writestream = &loose_backend__stream;
+	backend->parent.readstream = &loose_backend__readstream;
 	backend->parent.exists = &loose_backend__exists;
 	backend->parent.foreach = &loose_backend__foreach;
 	backend->parent.free = &loose_backend__free;
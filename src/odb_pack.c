@@ -19,12 +19,20 @@
 
 #include "git2/odb_backend.h"
 
+struct pack_readstream {
+	git_odb_stream stream;
+	git_packfile_stream obj;
+};
+
 struct pack_backend {
 	git_odb_backend parent;
 	git_vector packs;
 	struct git_pack_file *last_found;
 	char *pack_folder;
 	time_t pack_folder_mtime;
+	/* guards the list of packs and the packs that are opened lazily,
+	 * so that objects can be read on several threads */
+	git_mutex lock;
 };
 
 /**
@@ -362,14 +370,19 @@ int pack_backend__read_header(git_rawobj *obj, git_odb_backend *backend, const g
 }
 */
 
-static int pack_backend__read(void **buffer_p, size_t *len_p, git_otype *type_p, git_odb_backend *backend, const git_oid *oid)
+static int pack_backend__read(void **buffer_p, size_t *len_p, git_otype *type_p, git_odb_backend *_backend, const git_oid *oid)
 {
+	struct pack_backend *backend = (struct pack_backend *)_backend;
 	struct git_pack_entry e;
 	git_rawobj raw;
 	int error;
 
-	if ((error = pack_entry_find(&e, (struct pack_backend *)backend, oid)) < 0 ||
-		(error = git_packfile_unpack(&raw, e.p, &e.offset)) < 0)
+	git_mutex_lock(&backend->lock);
+	error = pack_entry_find(&e, backend, oid);
+	git_mutex_unlock(&backend->lock);
+
+	/* the pack is open by now; its windows have a lock of their own */
+	if (error < 0 || (error = git_packfile_unpack(&raw, e.p, &e.offset)) < 0)
 		return error;
 
 	*buffer_p = raw.data;
@@ -399,11 +412,15 @@ static int pack_backend__read_prefix(
 		if (!error)
 			git_oid_cpy(out_oid, short_oid);
 	} else {
+		struct pack_backend *pack = (struct pack_backend *)backend;
 		struct git_pack_entry e;
 		git_rawobj raw;
 
-		if ((error = pack_entry_find_prefix(
-				&e, (struct pack_backend *)backend, short_oid, len)) == 0 &&
+		git_mutex_lock(&pack->lock);
+		error = pack_entry_find_prefix(&e, pack, short_oid, len);
+		git_mutex_unlock(&pack->lock);
+
+		if (error == 0 &&
 			(error = git_packfile_unpack(&raw, e.p, &e.offset)) == 0)
 		{
 			*buffer_p = raw.data;
@@ -416,10 +433,89 @@ static int pack_backend__read_prefix(
 	return error;
 }
 
-static int pack_backend__exists(git_odb_backend *backend, const git_oid *oid)
+static int pack_readstream__read(git_odb_stream *_stream, char *buffer, size_t len)
+{
+	struct pack_readstream *stream = (struct pack_readstream *)_stream;
+	return git_packfile_stream_read(&stream->obj, buffer, len);
+}
+
+static void pack_readstream__free(git_odb_stream *_stream)
 {
+	struct pack_readstream *stream = (struct pack_readstream *)_stream;
+
+	git_packfile_stream_free(&stream->obj);
+	git__free(stream);
+}
+
+/*
+ * Objects stored whole are inflated as they are read; deltas have to
+ * be applied to their base, so they are read whole first.
+ */
+static int pack_backend__readstream(
+	git_odb_stream **stream_out, git_odb_backend *_backend, const git_oid *oid)
+{
+	struct pack_backend *backend = (struct pack_backend *)_backend;
+	struct pack_readstream *stream;
 	struct git_pack_entry e;
-	return pack_entry_find(&e, (struct pack_backend *)backend, oid) == 0;
+	git_mwindow *w_curs = NULL;
+	git_off_t curpos;
+	git_rawobj raw;
+	size_t size;
+	git_otype type;
+	int error;
+
+	git_mutex_lock(&backend->lock);
+	error = pack_entry_find(&e, backend, oid);
+	git_mutex_unlock(&backend->lock);
+
+	if (error < 0)
+		return error;
+
+	curpos = e.offset;
+	error = git_packfile_unpack_header(&size, &type, &e.p->mwf, &w_curs, &curpos);
+	git_mwindow_close(&w_curs);
+
+	if (error < 0)
+		return error;
+
+	if (type == GIT_OBJ_OFS_DELTA || type == GIT_OBJ_REF_DELTA) {
+		if ((error = git_packfile_unpack(&raw, e.p, &e.offset)) < 0)
+			return error;
+
+		if ((error = git_odb__init_fake_rstream(stream_out, _backend, &raw)) < 0)
+			git__free(raw.data);
+
+		return error;
+	}
+
+	stream = git__calloc(1, sizeof(struct pack_readstream));
+	GITERR_CHECK_ALLOC(stream);
+
+	if (git_packfile_stream_open(&stream->obj, e.p, curpos, size) < 0) {
+		git__free(stream);
+		return -1;
+	}
+
+	stream->stream.backend = _backend;
+	stream->stream.read = &pack_readstream__read;
+	stream->stream.free = &pack_readstream__free;
+	stream->stream.mode = GIT_STREAM_RDONLY;
+
+	*stream_out = (git_odb_stream *)stream;
+	return 0;
+}
+
+static int pack_backend__exists(git_odb_backend *_backend, const git_oid *oid)
+{
+	struct pack_backend *backend = (struct pack_backend *)_backend;
+	struct git_pack_entry e;
+	int error;
+
+	git_mutex_lock(&backend->lock);
+	error = pack_entry_find(&e, backend, oid);
+	git_mutex_unlock(&backend->lock);
+
+	return error == 0;
 }
 
 static int pack_backend__foreach(git_odb_backend *_backend, int (*cb)(git_oid *oid, void *data), void *data)
@@ -433,7 +529,11 @@ static int pack_backend__foreach(git_odb_backend *_backend, int (*cb)(git_oid *o
 	backend = (struct pack_backend *)_backend;
 
 	/* Make sure we know about the packfiles */
-	if ((error = packfile_refresh_all(backend)) < 0)
+	git_mutex_lock(&backend->lock);
+	error = packfile_refresh_all(backend);
+	git_mutex_unlock(&backend->lock);
+
+	if (error < 0)
 		return error;
 
 	git_vector_foreach(&backend->packs, i, p) {
@@ -460,6 +560,7 @@ static void pack_backend__free(git_odb_backend *_backend)
 
 	git_vector_free(&backend->packs);
 	git__free(backend->pack_folder);
+	git_mutex_free(&backend->lock);
 	git__free(backend);
 }
 
@@ -483,10 +584,13 @@ int git_odb_backend_one_pack(git_odb_backend **backend_out, const char *idx)
 	backend->parent.read = &pack_backend__read;
 	backend->parent.read_prefix = &pack_backend__read_prefix;
 	backend->parent.read_header = NULL;
+	backend->parent.readstream = &pack_backend__readstream;
 	backend->parent.exists = &pack_backend__exists;
 	backend->parent.foreach = &pack_backend__foreach;
 	backend->parent.free = &pack_backend__free;
 
+	git_mutex_init(&backend->lock);
+
 	*backend_out = (git_odb_backend *)backend;
 
 	return 0;
@@ -521,10 +625,13 @@ int git_odb_backend_pack(git_odb_backend **backend_out, const char *objects_dir)
 	backend->parent.read = &pack_backend__read;
 	backend->parent.read_prefix = &pack_backend__read_prefix;
 	backend->parent.read_header = NULL;
+	backend->parent.readstream = &pack_backend__readstream;
 	backend->parent.exists = &pack_backend__exists;
 	backend->parent.foreach = &pack_backend__foreach;
 	backend->parent.free = &pack_backend__free;
 
+	git_mutex_init(&backend->lock);
+
 	*backend_out = (git_odb_backend *)backend;
 
 	git_buf_free(&path);
@@ -452,6 +452,66 @@ int packfile_unpack_compressed(
 	return 0;
 }
 
+int git_packfile_stream_open(
+	git_packfile_stream *obj, struct git_pack_file *p,
+	git_off_t curpos, size_t size)
+{
+	memset(obj, 0, sizeof(git_packfile_stream));
+	obj->p = p;
+	obj->curpos = curpos;
+	obj->size = size;
+	obj->zstream.zalloc = use_git_alloc;
+	obj->zstream.zfree = use_git_free;
+
+	if (inflateInit(&obj->zstream) != Z_OK) {
+		giterr_set(GITERR_ZLIB, "Failed to inflate packfile");
+		return -1;
+	}
+
+	return 0;
+}
+
+int git_packfile_stream_read(git_packfile_stream *obj, void *buffer, size_t len)
+{
+	git_mwindow *w_curs = NULL;
+	unsigned char *in;
+	int st = Z_OK;
+
+	if (obj->done)
+		return 0;
+
+	obj->zstream.next_out = buffer;
+	obj->zstream.avail_out = (uInt)len;
+
+	while (obj->zstream.avail_out > 0 && st == Z_OK) {
+		if ((in = pack_window_open(
+				obj->p, &w_curs, obj->curpos, &obj->zstream.avail_in)) == NULL) {
+			st = Z_BUF_ERROR;
+			break;
+		}
+
+		obj->zstream.next_in = in;
+		st = inflate(&obj->zstream, Z_NO_FLUSH);
+		git_mwindow_close(&w_curs);
+
+		obj->curpos += obj->zstream.next_in - in;
+	}
+
+	if (st == Z_STREAM_END && obj->zstream.total_out == obj->size)
+		obj->done = 1;
+	else if (st != Z_OK || obj->zstream.total_out > obj->size) {
+		giterr_set(GITERR_ZLIB, "Failed to inflate packfile");
+		return -1;
+	}
+
+	return (int)(len - obj->zstream.avail_out);
+}
+
+void git_packfile_stream_free(git_packfile_stream *obj)
+{
+	inflateEnd(&obj->zstream);
+}
+
 /*
  * curpos is where the data starts, delta_obj_offset is the where the
  * header starts
@@ -8,6 +8,8 @@
 #ifndef INCLUDE_pack_h__
 #define INCLUDE_pack_h__
 
+#include <zlib.h>
+
 #include "git2/oid.h"
 
 #include "common.h"
@@ -92,6 +94,31 @@ int packfile_unpack_compressed(
 	size_t size,
 	git_otype type);
 
+/*
+ * An object that is stored whole in a pack, inflated a piece at a
+ * time; deltas cannot be read this way.
+ */
+typedef struct {
+	z_stream zstream;
+	struct git_pack_file *p;
+	git_off_t curpos;
+	size_t size;
+	int done;
+} git_packfile_stream;
+
+/*
+ * Start reading the object whose data starts at `curpos`, right after
+ * its header, and is `size` bytes long once inflated.
+ */
+int git_packfile_stream_open(
+	git_packfile_stream *obj, struct git_pack_file *p,
+	git_off_t curpos, size_t size);
+
+/* Inflate up to `len` bytes; 0 means the object is done */
+int git_packfile_stream_read(git_packfile_stream *obj, void *buffer, size_t len);
+
+void git_packfile_stream_free(git_packfile_stream *obj);
+
 git_off_t get_delta_base(struct git_pack_file *p, git_mwindow **w_curs,
 		git_off_t *curpos, git_otype type,
 		git_off_t delta_obj_offset);
@@ -66,6 +66,7 @@ void git_repository_free(git_repository *repo)
 	git_repository__refcache_free(&repo->references);
 	git_attr_cache_flush(repo);
 	git_submodule_config_free(repo);
+	git_repository_set_fsmonitor(repo, NULL);
 
 	git__free(repo->path_repository);
 	git__free(repo->workdir);
@@ -624,6 +625,51 @@ void git_repository_set_index(git_repository *repo, git_index *index)
 	GIT_REFCOUNT_INC(index);
 }
 
+size_t git_repository__thread_count(
+	git_repository *repo,
+	const char *section,
+	size_t count,
+	int32_t default_threshold)
+{
+	int32_t workers = 1;
+
+#ifdef GIT_THREADS
+	git_config *cfg;
+	git_buf name = GIT_BUF_INIT;
+	int32_t threshold = default_threshold;
+
+	if (git_repository_config__weakptr(&cfg, repo) < 0) {
+		giterr_clear();
+		return 1;
+	}
+
+	if (git_buf_printf(&name, "%s.workers", section) < 0 ||
+		git_config_get_int32(&workers, cfg, name.ptr) < 0)
+		workers = 1;
+
+	git_buf_clear(&name);
+	if (git_buf_printf(&name, "%s.thresholdForParallelism", section) < 0 ||
+		git_config_get_int32(&threshold, cfg, name.ptr) < 0)
+		threshold = default_threshold;
+
+	git_buf_free(&name);
+	giterr_clear();
+
+	if (workers < 1)
+		workers = git_online_cpus();
+
+	if (count < (size_t)threshold)
+		workers = 1;
+#else
+	GIT_UNUSED(repo);
+	GIT_UNUSED(section);
+	GIT_UNUSED(count);
+	GIT_UNUSED(default_threshold);
+#endif
+
+	return workers > 1 ? (size_t)workers : 1;
+}
+
 static int check_repositoryformatversion(git_config *config)
 {
 	int version;
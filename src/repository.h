@@ -11,6 +11,7 @@
 #include "git2/oid.h"
 #include "git2/odb.h"
 #include "git2/repository.h"
+#include "git2/fsmonitor.h"
 #include "git2/object.h"
 
 #include "index.h"
@@ -86,6 +87,7 @@ struct git_repository {
 	git_refcache references;
 	git_attr_cache attrcache;
 	git_strmap *submodules;
+	git_fsmonitor *fsmonitor;
 
 	char *path_repository;
 	char *workdir;
@@ -123,6 +125,17 @@ int git_repository_index__weakptr(git_index **out, git_repository *repo);
 int git_repository__cvar(int *out, git_repository *repo, git_cvar_cached cvar);
 void git_repository__cvar_cache_clear(git_repository *repo);
 
+/*
+ * The number of threads to work on `count` items on, from the
+ * "<section>.workers" and "<section>.thresholdForParallelism" settings;
+ * a number of workers below one means one per CPU.
+ */
+size_t git_repository__thread_count(
+	git_repository *repo,
+	const char *section,
+	size_t count,
+	int32_t default_threshold);
+
 /*
  * Submodule cache
  */
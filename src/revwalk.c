@@ -7,10 +7,12 @@
 
 #include "common.h"
 #include "commit.h"
+#include "commit_graph.h"
 #include "odb.h"
 #include "pqueue.h"
 #include "pool.h"
 #include "oidmap.h"
+#include "tree.h"
 
 #include "git2/revwalk.h"
 #include "git2/merge.h"
@@ -26,12 +28,21 @@ GIT__USE_OIDMAP;
 
 typedef struct commit_object {
 	git_oid oid;
+	git_oid tree;
 	uint32_t time;
+	uint32_t generation;
+	uint32_t graph_pos;
 	unsigned int seen:1,
 			 uninteresting:1,
+			 bottom:1,
 			 topo_delay:1,
 			 parsed:1,
-			 flags : 4;
+			 in_graph:1,
+			 simplified:1,
+			 treesame:1,
+			 collapsed:1,
+			 flags : 4,
+			 treesame_parent : 16;
 
 	unsigned short in_degree;
 	unsigned short out_degree;
@@ -39,6 +50,15 @@ typedef struct commit_object {
 	struct commit_object **parents;
 } commit_object;
 
+/*
+ * The Bloom filter keys for one path of the pathspec: the path itself
+ * followed by each of its leading directories.
+ */
+typedef struct {
+	size_t count;
+	git_commit_graph_bloom_key keys[GIT_FLEX_ARRAY];
+} bloom_path_keys;
+
 typedef struct commit_list {
 	commit_object *item;
 	struct commit_list *next;
@@ -56,10 +76,22 @@ struct git_revwalk {
 	commit_list *iterator_reverse;
 	git_pqueue iterator_time;
 
+	/* incremental topological sort */
+	git_pqueue indegree_queue;
+	uint32_t min_generation;
+
+	git_commit_graph *graph;
+
+	/* history simplification by path */
+	git_vector pathspec;
+	git_buf path_component;
+	git_vector bloom_keys;
+
 	int (*get_next)(commit_object **, git_revwalk *);
 	int (*enqueue)(git_revwalk *, commit_object *);
 
-	unsigned walking:1;
+	unsigned walking:1,
+			 did_hide:1;
 	unsigned int sorting;
 
 	/* merge base calculation */
@@ -75,6 +107,17 @@ static int commit_time_cmp(void *a, void *b)
 	return (commit_a->time < commit_b->time);
 }
 
+static int commit_generation_cmp(void *a, void *b)
+{
+	commit_object *commit_a = (commit_object *)a;
+	commit_object *commit_b = (commit_object *)b;
+
+	if (commit_a->generation != commit_b->generation)
+		return (commit_a->generation < commit_b->generation);
+
+	return (commit_a->time < commit_b->time);
+}
+
 static commit_list *commit_list_insert(commit_object *item, commit_list **list_p)
 {
 	commit_list *new_list = git__malloc(sizeof(commit_list));
@@ -192,6 +235,10 @@ static int commit_quick_parse(git_revwalk *walk, commit_object *commit, git_rawo
 	int i, parents = 0;
 	int commit_time;
 
+	if (buffer + strlen("tree ") + GIT_OID_HEXSZ + 1 > buffer_end ||
+		git_oid_fromstr(&commit->tree, (char *)buffer + strlen("tree ")) < 0)
+		return commit_error(commit, "object is corrupted");
+
 	buffer += strlen("tree ") + GIT_OID_HEXSZ + 1;
 
 	parents_start = buffer;
@@ -250,6 +297,36 @@ static int commit_quick_parse(git_revwalk *walk, commit_object *commit, git_rawo
 		return commit_error(commit, "cannot parse commit time");
 
 	commit->time = (time_t)commit_time;
+	commit->generation = GIT_COMMIT_GRAPH_GENERATION_INFINITY;
+	commit->parsed = 1;
+	return 0;
+}
+
+static int commit_graph_parse(
+	git_revwalk *walk, commit_object *commit, git_commit_graph_entry *entry)
+{
+	git_commit_graph_entry parent;
+	size_t i;
+
+	commit->parents = alloc_parents(walk, commit, entry->parent_count);
+	GITERR_CHECK_ALLOC(commit->parents);
+
+	for (i = 0; i < entry->parent_count; ++i) {
+		if (git_commit_graph_entry_parent(&parent, walk->graph, entry, i) < 0)
+			return -1;
+
+		commit->parents[i] = commit_lookup(
+			walk, git_commit_graph_oid(walk->graph, parent.graph_pos));
+		if (commit->parents[i] == NULL)
+			return -1;
+	}
+
+	git_oid_cpy(&commit->tree, &entry->tree_oid);
+	commit->out_degree = (unsigned short)entry->parent_count;
+	commit->time = (uint32_t)entry->commit_time;
+	commit->generation = entry->generation;
+	commit->graph_pos = entry->graph_pos;
+	commit->in_graph = 1;
 	commit->parsed = 1;
 	return 0;
 }
@@ -262,6 +339,15 @@ static int commit_parse(git_revwalk *walk, commit_object *commit)
 	if (commit->parsed)
 		return 0;
 
+	if (walk->graph != NULL) {
+		git_commit_graph_entry entry;
+
+		if ((error = git_commit_graph_find(&entry, walk->graph, &commit->oid)) == 0)
+			return commit_graph_parse(walk, commit, &entry);
+		if (error != GIT_ENOTFOUND)
+			return error;
+	}
+
 	if ((error = git_odb_read(&obj, walk->odb, &commit->oid)) < 0)
 		return error;
 	assert(obj->raw.type == GIT_OBJ_COMMIT);
@@ -271,6 +357,307 @@ static int commit_parse(git_revwalk *walk, commit_object *commit)
 	return error;
 }
 
+/*
+ * Look up `name` in the tree `tree_oid`. Only trees are descended into;
+ * asking for a child of anything else yields GIT_ENOTFOUND.
+ */
+static int tree_path_lookup(
+	git_oid *oid_out,
+	uint16_t *attr_out,
+	git_revwalk *walk,
+	const git_oid *tree_oid,
+	uint16_t tree_attr,
+	const char *name)
+{
+	git_tree *tree;
+	const git_tree_entry *entry;
+
+	if (!S_ISDIR(tree_attr) || S_ISGITLINK(tree_attr))
+		return GIT_ENOTFOUND;
+
+	if (git_tree_lookup(&tree, walk->repo, tree_oid) < 0)
+		return -1;
+
+	if ((entry = git_tree_entry_byname(tree, name)) == NULL) {
+		git_tree_free(tree);
+		return GIT_ENOTFOUND;
+	}
+
+	git_oid_cpy(oid_out, &entry->oid);
+	*attr_out = entry->attr;
+
+	git_tree_free(tree);
+	return 0;
+}
+
+/*
+ * Check whether `path` is different between two trees (either of which
+ * may be NULL for a root commit). Both trees are descended one path
+ * component at a time, and the descent stops as soon as the subtrees
+ * share an id, so unrelated trees are never loaded.
+ */
+static int tree_path_differs(
+	int *differs,
+	git_revwalk *walk,
+	const git_oid *old_tree,
+	const git_oid *new_tree,
+	const char *path)
+{
+	git_oid old_oid, new_oid;
+	const git_oid *old_id = old_tree, *new_id = new_tree;
+	uint16_t old_attr = GIT_FILEMODE_TREE, new_attr = GIT_FILEMODE_TREE;
+	const char *component = path;
+	int error;
+
+	for (;;) {
+		size_t len;
+
+		if (old_id == NULL && new_id == NULL) {
+			*differs = 0;
+			return 0;
+		}
+
+		if (old_id != NULL && new_id != NULL &&
+			git_oid_equal(old_id, new_id) && old_attr == new_attr) {
+			*differs = 0;
+			return 0;
+		}
+
+		if (*component == '\0') {
+			*differs = 1;
+			return 0;
+		}
+
+		len = strcspn(component, "/");
+		if (git_buf_set(&walk->path_component, component, len) < 0)
+			return -1;
+
+		component += len;
+		while (*component == '/')
+			component++;
+
+		if (old_id != NULL) {
+			error = tree_path_lookup(&old_oid, &old_attr, walk,
+				old_id, old_attr, walk->path_component.ptr);
+			if (error < 0 && error != GIT_ENOTFOUND)
+				return error;
+			old_id = error ? NULL : &old_oid;
+		}
+
+		if (new_id != NULL) {
+			error = tree_path_lookup(&new_oid, &new_attr, walk,
+				new_id, new_attr, walk->path_component.ptr);
+			if (error < 0 && error != GIT_ENOTFOUND)
+				return error;
+			new_id = error ? NULL : &new_oid;
+		}
+	}
+}
+
+static int commit_paths_differ(
+	int *differs, git_revwalk *walk, commit_object *parent, commit_object *commit)
+{
+	unsigned int i;
+	const char *path;
+	int error;
+
+	*differs = 0;
+
+	if (parent && git_oid_equal(&parent->tree, &commit->tree))
+		return 0;
+
+	git_vector_foreach(&walk->pathspec, i, path) {
+		if ((error = tree_path_differs(differs, walk,
+			parent ? &parent->tree : NULL, &commit->tree, path)) < 0)
+			return error;
+
+		if (*differs)
+			break;
+	}
+
+	return 0;
+}
+
+static void bloom_keys_clear(git_revwalk *walk)
+{
+	unsigned int i;
+	bloom_path_keys *keys;
+
+	git_vector_foreach(&walk->bloom_keys, i, keys)
+		git__free(keys);
+	git_vector_clear(&walk->bloom_keys);
+}
+
+static int bloom_keys_prepare(git_revwalk *walk)
+{
+	unsigned int i;
+	const char *path;
+	bloom_path_keys *keys;
+	size_t len, count;
+
+	if (walk->bloom_keys.length > 0)
+		return 0;
+
+	git_vector_foreach(&walk->pathspec, i, path) {
+		for (count = 1, len = 0; path[len]; ++len)
+			if (path[len] == '/')
+				count++;
+
+		keys = git__malloc(sizeof(bloom_path_keys) +
+			count * sizeof(git_commit_graph_bloom_key));
+		GITERR_CHECK_ALLOC(keys);
+
+		keys->count = 0;
+		while (len > 0) {
+			git_commit_graph_bloom_key_init(
+				&keys->keys[keys->count++], walk->graph, path, len);
+
+			while (len > 0 && path[len - 1] != '/')
+				len--;
+			if (len > 0)
+				len--;
+		}
+
+		if (git_vector_insert(&walk->bloom_keys, keys) < 0) {
+			git__free(keys);
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+/*
+ * Ask the changed-path Bloom filters whether `commit` may have changed
+ * any of the paths against its first parent. Returns 0 when it surely
+ * did not, 1 when it may have and the trees need to be compared.
+ */
+static int bloom_maybe_changed(git_revwalk *walk, commit_object *commit)
+{
+	unsigned int i;
+	size_t j;
+	bloom_path_keys *keys;
+	int found;
+
+	if (!commit->in_graph || !walk->graph ||
+		!git_commit_graph_has_bloom(walk->graph))
+		return 1;
+
+	if (bloom_keys_prepare(walk) < 0) {
+		giterr_clear();
+		return 1;
+	}
+
+	git_vector_foreach(&walk->bloom_keys, i, keys) {
+		for (j = 0; j < keys->count; ++j) {
+			found = git_commit_graph_bloom_contains(
+				walk->graph, commit->graph_pos, &keys->keys[j]);
+
+			if (found == GIT_ENOTFOUND)
+				return 1;
+			if (!found)
+				break;
+		}
+
+		/* every key of the path is in the filter */
+		if (j == keys->count)
+			return 1;
+	}
+
+	return 0;
+}
+
+/*
+ * A parent that was only reached from the hidden commits does not
+ * decide what the interesting history looks like, unless it is one of
+ * the hidden commits itself.
+ */
+GIT_INLINE(int) commit_is_relevant(commit_object *commit)
+{
+	return !commit->uninteresting || commit->bottom;
+}
+
+/*
+ * Simplify the history of a commit for a path-limited walk, the same
+ * way `git log -- <paths>` does by default: a commit that is TREESAME
+ * to one of its relevant parents (i.e. has the same contents for all
+ * the paths) is hidden from the output, and only that parent is walked
+ * further. A commit that is only TREESAME to irrelevant parents is
+ * hidden when none of its relevant parents changed the paths, but all
+ * of its parents are walked.
+ *
+ * The first parent is checked against the changed-path Bloom filters
+ * of the commit-graph before comparing any trees.
+ */
+static int commit_simplify(git_revwalk *walk, commit_object *commit)
+{
+	unsigned short i, relevant_parents = 0;
+	int error, differs, relevant_change = 0, irrelevant_change = 0;
+
+	/* the hidden part of the history is walked as it is */
+	if (commit->simplified || commit->uninteresting || !walk->pathspec.length)
+		return 0;
+
+	if (commit->out_degree == 0) {
+		if ((error = commit_paths_differ(&differs, walk, NULL, commit)) < 0)
+			return error;
+
+		commit->treesame = !differs;
+		commit->simplified = 1;
+		return 0;
+	}
+
+	for (i = 0; i < commit->out_degree; ++i) {
+		commit_object *parent = commit->parents[i];
+		int relevant = commit_is_relevant(parent);
+
+		relevant_parents += relevant;
+
+		if (i == 0 && !bloom_maybe_changed(walk, commit))
+			differs = 0;
+		else if ((error = commit_parse(walk, parent)) < 0 ||
+			(error = commit_paths_differ(&differs, walk, parent, commit)) < 0)
+			return error;
+
+		if (differs) {
+			if (relevant)
+				relevant_change = 1;
+			else
+				irrelevant_change = 1;
+		} else if (relevant) {
+			commit->treesame = 1;
+			commit->collapsed = 1;
+			commit->treesame_parent = i;
+			commit->simplified = 1;
+			return 0;
+		}
+	}
+
+	commit->treesame = relevant_parents ? !relevant_change : !irrelevant_change;
+	commit->simplified = 1;
+	return 0;
+}
+
+/*
+ * The parents that the walk follows: all of them, or only the one that
+ * the commit is TREESAME to.
+ */
+GIT_INLINE(unsigned short) commit_walk_parents(commit_object *commit)
+{
+	if (commit->collapsed)
+		return 1;
+
+	return commit->out_degree;
+}
+
+GIT_INLINE(commit_object *) commit_walk_parent(commit_object *commit, unsigned short n)
+{
+	if (commit->collapsed)
+		return commit->parents[commit->treesame_parent];
+
+	return commit->parents[n];
+}
+
 static int interesting(git_pqueue *list)
 {
 	unsigned int i;
@@ -500,11 +887,16 @@ static int process_commit(git_revwalk *walk, commit_object *commit, int hide)
 
 static int process_commit_parents(git_revwalk *walk, commit_object *commit)
 {
-	unsigned short i;
-	int error = 0;
+	unsigned short i, parents;
+	int error;
 
-	for (i = 0; i < commit->out_degree && !error; ++i)
-		error = process_commit(walk, commit->parents[i], commit->uninteresting);
+	if ((error = commit_simplify(walk, commit)) < 0)
+		return error;
+
+	parents = commit_walk_parents(commit);
+
+	for (i = 0; i < parents && !error; ++i)
+		error = process_commit(walk, commit_walk_parent(commit, i), commit->uninteresting);
 
 	return error;
 }
@@ -531,6 +923,11 @@ static int push_commit(git_revwalk *walk, const git_oid *oid, int uninteresting)
 		return -1; /* error already reported by failed lookup */
 
 	commit->uninteresting = uninteresting;
+	if (uninteresting) {
+		commit->bottom = 1;
+		walk->did_hide = 1;
+	}
+
 	if (walk->one == NULL && !uninteresting) {
 		walk->one = commit;
 	} else {
@@ -706,7 +1103,7 @@ static int revwalk_next_unsorted(commit_object **object_out, git_revwalk *walk)
 	return GIT_ITEROVER;
 }
 
-static int revwalk_next_toposort(commit_object **object_out, git_revwalk *walk)
+static int revwalk_next_toposort_limited(commit_object **object_out, git_revwalk *walk)
 {
 	commit_object *next;
 	unsigned short i;
@@ -723,8 +1120,8 @@ static int revwalk_next_toposort(commit_object **object_out, git_revwalk *walk)
 			continue;
 		}
 
-		for (i = 0; i < next->out_degree; ++i) {
-			commit_object *parent = next->parents[i];
+		for (i = 0; i < commit_walk_parents(next); ++i) {
+			commit_object *parent = commit_walk_parent(next, i);
 
 			if (--parent->in_degree == 0 && parent->topo_delay) {
 				parent->topo_delay = 0;
@@ -738,6 +1135,152 @@ static int revwalk_next_toposort(commit_object **object_out, git_revwalk *walk)
 	}
 }
 
+/*
+ * Incremental topological ordering, following git.git's topo walk.
+ *
+ * Each reached commit carries an in-degree of one plus the number of
+ * its children that still have to be emitted. The in-degrees are only
+ * computed down to the smallest generation number the output has
+ * reached so far, so a commit-graph file with generation numbers
+ * makes the cost of the walk proportional to the number of commits
+ * returned. Without generation numbers every commit is treated as
+ * being infinitely deep and the first call explores the whole history.
+ */
+static int compute_indegrees_to_depth(git_revwalk *walk, uint32_t gen_cutoff)
+{
+	commit_object *next;
+	unsigned short i;
+	int error;
+
+	while ((next = git_pqueue_peek(&walk->indegree_queue)) != NULL &&
+		next->generation >= gen_cutoff) {
+		git_pqueue_pop(&walk->indegree_queue);
+
+		if ((error = commit_simplify(walk, next)) < 0)
+			return error;
+
+		for (i = 0; i < commit_walk_parents(next); ++i) {
+			commit_object *parent = commit_walk_parent(next, i);
+
+			if (parent->in_degree) {
+				parent->in_degree++;
+				continue;
+			}
+
+			if ((error = commit_parse(walk, parent)) < 0)
+				return error;
+
+			parent->in_degree = 2;
+			if (git_pqueue_insert(&walk->indegree_queue, parent) < 0)
+				return -1;
+		}
+	}
+
+	return 0;
+}
+
+static int topo_enqueue(git_revwalk *walk, commit_object *commit)
+{
+	if (walk->sorting & GIT_SORT_TIME)
+		return git_pqueue_insert(&walk->iterator_time, commit);
+
+	return commit_list_insert(commit, &walk->iterator_topo) ? 0 : -1;
+}
+
+static int revwalk_next_toposort(commit_object **object_out, git_revwalk *walk)
+{
+	commit_object *next;
+	unsigned short i;
+	int error;
+
+	if (walk->sorting & GIT_SORT_TIME)
+		next = git_pqueue_pop(&walk->iterator_time);
+	else
+		next = commit_list_pop(&walk->iterator_topo);
+
+	if (next == NULL) {
+		giterr_clear();
+		return GIT_ITEROVER;
+	}
+
+	next->in_degree = 0;
+
+	for (i = 0; i < commit_walk_parents(next); ++i) {
+		commit_object *parent = commit_walk_parent(next, i);
+
+		if ((error = commit_parse(walk, parent)) < 0)
+			return error;
+
+		if (parent->generation < walk->min_generation) {
+			walk->min_generation = parent->generation;
+
+			if ((error = compute_indegrees_to_depth(walk, walk->min_generation)) < 0)
+				return error;
+		}
+
+		if (--parent->in_degree == 1 && topo_enqueue(walk, parent) < 0)
+			return -1;
+	}
+
+	*object_out = next;
+	return 0;
+}
+
+static int prepare_topo_start(git_revwalk *walk, commit_object *commit)
+{
+	int error;
+
+	if (commit->in_degree)
+		return 0;
+
+	if ((error = commit_parse(walk, commit)) < 0)
+		return error;
+
+	commit->in_degree = 1;
+	if (commit->generation < walk->min_generation)
+		walk->min_generation = commit->generation;
+
+	return git_pqueue_insert(&walk->indegree_queue, commit);
+}
+
+static int prepare_topo_walk(git_revwalk *walk)
+{
+	unsigned int i;
+	int error;
+	commit_object *two;
+
+	walk->min_generation = GIT_COMMIT_GRAPH_GENERATION_INFINITY;
+
+	if ((error = prepare_topo_start(walk, walk->one)) < 0)
+		return error;
+
+	git_vector_foreach(&walk->twos, i, two) {
+		if ((error = prepare_topo_start(walk, two)) < 0)
+			return error;
+	}
+
+	if ((error = compute_indegrees_to_depth(walk, walk->min_generation)) < 0)
+		return error;
+
+	/* the stack hands the tips out in reverse push order */
+	git_vector_rforeach(&walk->twos, i, two) {
+		if (two->in_degree == 1 && !two->topo_delay) {
+			two->topo_delay = 1;
+			if (topo_enqueue(walk, two) < 0)
+				return -1;
+		}
+	}
+
+	if (walk->one->in_degree == 1 && !walk->one->topo_delay) {
+		walk->one->topo_delay = 1;
+		if (topo_enqueue(walk, walk->one) < 0)
+			return -1;
+	}
+
+	walk->get_next = &revwalk_next_toposort;
+	return 0;
+}
+
 static int revwalk_next_reverse(commit_object **object_out, git_revwalk *walk)
 {
 	*object_out = commit_list_pop(&walk->iterator_reverse);
@@ -761,25 +1304,42 @@ static int prepare_walk(git_revwalk *walk)
 		return GIT_ITEROVER;
 	}
 
-	/* first figure out what the merge bases are */
-	if (merge_bases_many(&bases, walk, walk->one, &walk->twos) < 0)
-		return -1;
+	/*
+	 * The merge bases are only needed to stop marking commits as
+	 * uninteresting; without hidden commits there is nothing to mark
+	 * and no reason to walk the history up front.
+	 */
+	if (walk->did_hide) {
+		if (merge_bases_many(&bases, walk, walk->one, &walk->twos) < 0)
+			return -1;
 
-	commit_list_free(&bases);
-	if (process_commit(walk, walk->one, walk->one->uninteresting) < 0)
-		return -1;
+		commit_list_free(&bases);
+	}
 
-	git_vector_foreach(&walk->twos, i, two) {
-		if (process_commit(walk, two, two->uninteresting) < 0)
+	/*
+	 * Hidden commits can only be excluded reliably once everything
+	 * reachable from them has been marked, so a topological walk
+	 * with hidden commits still collects the whole result first.
+	 */
+	if ((walk->sorting & GIT_SORT_TOPOLOGICAL) && !walk->did_hide) {
+		if ((error = prepare_topo_walk(walk)) < 0)
+			return error;
+	} else {
+		if (process_commit(walk, walk->one, walk->one->uninteresting) < 0)
 			return -1;
+
+		git_vector_foreach(&walk->twos, i, two) {
+			if (process_commit(walk, two, two->uninteresting) < 0)
+				return -1;
+		}
 	}
 
-	if (walk->sorting & GIT_SORT_TOPOLOGICAL) {
+	if ((walk->sorting & GIT_SORT_TOPOLOGICAL) && walk->did_hide) {
 		unsigned short i;
 
 		while ((error = walk->get_next(&next, walk)) == 0) {
-			for (i = 0; i < next->out_degree; ++i) {
-				commit_object *parent = next->parents[i];
+			for (i = 0; i < commit_walk_parents(next); ++i) {
+				commit_object *parent = commit_walk_parent(next, i);
 				parent->in_degree++;
 			}
 
@@ -790,7 +1350,7 @@ static int prepare_walk(git_revwalk *walk)
 		if (error != GIT_ITEROVER)
 			return error;
 
-		walk->get_next = &revwalk_next_toposort;
+		walk->get_next = &revwalk_next_toposort_limited;
 	}
 
 	if (walk->sorting & GIT_SORT_REVERSE) {
@@ -813,6 +1373,27 @@ static int prepare_walk(git_revwalk *walk)
 
 
 
+static int commit_graph_load(git_revwalk *walk)
+{
+	git_buf path = GIT_BUF_INIT;
+	int error;
+
+	if (git_buf_joinpath(&path,
+		walk->repo->path_repository, GIT_COMMIT_GRAPH_FILE) < 0)
+		return -1;
+
+	error = git_commit_graph_open(&walk->graph, path.ptr);
+	git_buf_free(&path);
+
+	/* the commit-graph is only an optimization; work without it */
+	if (error < 0) {
+		walk->graph = NULL;
+		giterr_clear();
+	}
+
+	return 0;
+}
+
 int git_revwalk_new(git_revwalk **revwalk_out, git_repository *repo)
 {
 	git_revwalk *walk;
@@ -826,7 +1407,10 @@ int git_revwalk_new(git_revwalk **revwalk_out, git_repository *repo)
 	GITERR_CHECK_ALLOC(walk->commits);
 
 	if (git_pqueue_init(&walk->iterator_time, 8, commit_time_cmp) < 0 ||
+		git_pqueue_init(&walk->indegree_queue, 8, commit_generation_cmp) < 0 ||
 		git_vector_init(&walk->twos, 4, NULL) < 0 ||
+		git_vector_init(&walk->pathspec, 0, NULL) < 0 ||
+		git_vector_init(&walk->bloom_keys, 0, NULL) < 0 ||
 		git_pool_init(&walk->commit_pool, 1,
 			git_pool__suggest_items_per_page(COMMIT_ALLOC) * COMMIT_ALLOC) < 0)
 		return -1;
@@ -841,12 +1425,20 @@ int git_revwalk_new(git_revwalk **revwalk_out, git_repository *repo)
 		return -1;
 	}
 
+	if (commit_graph_load(walk) < 0) {
+		git_revwalk_free(walk);
+		return -1;
+	}
+
 	*revwalk_out = walk;
 	return 0;
 }
 
 void git_revwalk_free(git_revwalk *walk)
 {
+	unsigned int i;
+	char *path;
+
 	if (walk == NULL)
 		return;
 
@@ -856,7 +1448,18 @@ void git_revwalk_free(git_revwalk *walk)
 	git_oidmap_free(walk->commits);
 	git_pool_clear(&walk->commit_pool);
 	git_pqueue_free(&walk->iterator_time);
+	git_pqueue_free(&walk->indegree_queue);
 	git_vector_free(&walk->twos);
+	git_commit_graph_free(walk->graph);
+
+	git_vector_foreach(&walk->pathspec, i, path)
+		git__free(path);
+	git_vector_free(&walk->pathspec);
+	git_buf_free(&walk->path_component);
+
+	bloom_keys_clear(walk);
+	git_vector_free(&walk->bloom_keys);
+
 	git__free(walk);
 }
 
@@ -866,6 +1469,17 @@ git_repository *git_revwalk_repository(git_revwalk *walk)
 	return walk->repo;
 }
 
+static void revwalk_set_iterators(git_revwalk *walk)
+{
+	if (walk->sorting & GIT_SORT_TIME) {
+		walk->get_next = &revwalk_next_timesort;
+		walk->enqueue = &revwalk_enqueue_timesort;
+	} else {
+		walk->get_next = &revwalk_next_unsorted;
+		walk->enqueue = &revwalk_enqueue_unsorted;
+	}
+}
+
 void git_revwalk_sorting(git_revwalk *walk, unsigned int sort_mode)
 {
 	assert(walk);
@@ -874,14 +1488,174 @@ void git_revwalk_sorting(git_revwalk *walk, unsigned int sort_mode)
 		git_revwalk_reset(walk);
 
 	walk->sorting = sort_mode;
+	revwalk_set_iterators(walk);
+}
 
-	if (walk->sorting & GIT_SORT_TIME) {
-		walk->get_next = &revwalk_next_timesort;
-		walk->enqueue = &revwalk_enqueue_timesort;
-	} else {
-		walk->get_next = &revwalk_next_unsorted;
-		walk->enqueue = &revwalk_enqueue_unsorted;
+int git_revwalk_set_pathspec(git_revwalk *walk, const git_strarray *pathspec)
+{
+	commit_object *commit;
+	unsigned int i;
+	size_t len;
+	char *path;
+
+	assert(walk);
+
+	if (walk->walking)
+		git_revwalk_reset(walk);
+
+	git_vector_foreach(&walk->pathspec, i, path)
+		git__free(path);
+	git_vector_clear(&walk->pathspec);
+	bloom_keys_clear(walk);
+
+	/* history simplification depends on the paths; start over */
+	kh_foreach_value(walk->commits, commit, {
+		commit->simplified = 0;
+		commit->treesame = 0;
+		commit->collapsed = 0;
+	});
+
+	if (pathspec == NULL)
+		return 0;
+
+	for (i = 0; i < pathspec->count; ++i) {
+		len = strlen(pathspec->strings[i]);
+		while (len > 0 && pathspec->strings[i][len - 1] == '/')
+			len--;
+
+		/* an empty path matches the whole tree */
+		if (len == 0)
+			continue;
+
+		path = git__strndup(pathspec->strings[i], len);
+		GITERR_CHECK_ALLOC(path);
+
+		if (git_vector_insert(&walk->pathspec, path) < 0)
+			return -1;
 	}
+
+	return 0;
+}
+
+static int commit_graph_collect(
+	git_commit_graph_writer *writer, git_revwalk *walk, commit_object *tip)
+{
+	git_vector stack = GIT_VECTOR_INIT;
+	const git_oid **parents = NULL;
+	commit_object *commit;
+	unsigned short i;
+	int error = 0;
+
+	if (tip->seen)
+		return 0;
+
+	tip->seen = 1;
+	if ((error = git_vector_insert(&stack, tip)) < 0)
+		return error;
+
+	while (stack.length > 0) {
+		commit = git_vector_last(&stack);
+		git_vector_pop(&stack);
+
+		if ((error = commit_parse(walk, commit)) < 0)
+			break;
+
+		git__free(parents);
+		parents = git__calloc(commit->out_degree + 1, sizeof(git_oid *));
+		if (!parents) {
+			error = -1;
+			break;
+		}
+
+		for (i = 0; i < commit->out_degree; ++i) {
+			commit_object *parent = commit->parents[i];
+
+			parents[i] = &parent->oid;
+
+			if (!parent->seen) {
+				parent->seen = 1;
+				if ((error = git_vector_insert(&stack, parent)) < 0)
+					goto done;
+			}
+		}
+
+		if ((error = git_commit_graph_writer_add(writer, &commit->oid,
+			&commit->tree, commit->time, parents, commit->out_degree)) < 0)
+			break;
+	}
+
+done:
+	git__free(parents);
+	git_vector_free(&stack);
+	return error;
+}
+
+/* Point the commits that were already parsed at the new graph */
+static int commit_graph_reload(git_revwalk *walk)
+{
+	commit_object *commit;
+	git_commit_graph_entry entry;
+
+	git_commit_graph_free(walk->graph);
+	walk->graph = NULL;
+	bloom_keys_clear(walk);
+
+	if (commit_graph_load(walk) < 0)
+		return -1;
+
+	kh_foreach_value(walk->commits, commit, {
+		commit->in_graph = 0;
+
+		if (walk->graph != NULL &&
+			git_commit_graph_find(&entry, walk->graph, &commit->oid) == 0) {
+			commit->graph_pos = entry.graph_pos;
+			commit->in_graph = 1;
+		}
+	});
+
+	return 0;
+}
+
+int git_revwalk_write_commit_graph(git_revwalk *walk, unsigned int flags)
+{
+	git_commit_graph_writer writer;
+	git_buf path = GIT_BUF_INIT;
+	commit_object *two;
+	unsigned int i;
+	int error;
+
+	assert(walk);
+
+	if (walk->walking) {
+		giterr_set(GITERR_INVALID,
+			"Cannot write the commit-graph while the walk is in progress");
+		return -1;
+	}
+
+	if ((error = git_commit_graph_writer_init(&writer, walk->repo)) < 0)
+		goto cleanup;
+
+	if (walk->one != NULL &&
+		(error = commit_graph_collect(&writer, walk, walk->one)) < 0)
+		goto cleanup;
+
+	git_vector_foreach(&walk->twos, i, two) {
+		if ((error = commit_graph_collect(&writer, walk, two)) < 0)
+			goto cleanup;
+	}
+
+	if ((error = git_buf_joinpath(&path,
+			walk->repo->path_repository, GIT_COMMIT_GRAPH_FILE)) < 0 ||
+		(error = git_commit_graph_writer_commit(&writer, path.ptr, flags)) < 0)
+		goto cleanup;
+
+	error = commit_graph_reload(walk);
+
+cleanup:
+	git_buf_free(&path);
+	git_commit_graph_writer_free(&writer);
+	git_revwalk_reset(walk);
+	return error;
 }
 
 int git_revwalk_next(git_oid *oid, git_revwalk *walk)
@@ -896,7 +1670,9 @@ int git_revwalk_next(git_oid *oid, git_revwalk *walk)
 			return error;
 	}
 
-	error = walk->get_next(&next, walk);
+	/* commits simplified away by the pathspec are walked but not shown */
+	while ((error = walk->get_next(&next, walk)) == 0 && next->treesame)
+		/* continue */;
 
 	if (error == GIT_ITEROVER) {
 		git_revwalk_reset(walk);
@@ -921,13 +1697,21 @@ void git_revwalk_reset(git_revwalk *walk)
 		commit->in_degree = 0;
 		commit->topo_delay = 0;
 		commit->uninteresting = 0;
+		commit->bottom = 0;
+		/* which parents are relevant depends on the hidden commits */
+		commit->simplified = 0;
+		commit->treesame = 0;
+		commit->collapsed = 0;
 		});
 
 	git_pqueue_clear(&walk->iterator_time);
+	git_pqueue_clear(&walk->indegree_queue);
 	commit_list_free(&walk->iterator_topo);
 	commit_list_free(&walk->iterator_rand);
 	commit_list_free(&walk->iterator_reverse);
 	walk->walking = 0;
+	walk->did_hide = 0;
+	revwalk_set_iterators(walk);
 
 	walk->one = NULL;
 	git_vector_clear(&walk->twos);
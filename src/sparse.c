@@ -0,0 +1,483 @@
+/*
+ * Copyright (C) 2009-2012 the libgit2 contributors
+ *
+ * This file is part of libgit2, distributed under the GNU GPL v2 with
+ * a Linking Exception. For full terms see the included COPYING file.
+ */
+
+#include "sparse.h"
+#include "repository.h"
+#include "filebuf.h"
+#include "fileops.h"
+#include "vector.h"
+#include "git2/config.h"
+
+GIT__USE_STRMAP;
+
+static int sparse_config(
+	bool *out, git_repository *repo, const char *name, bool defvalue)
+{
+	git_config *cfg;
+	int val = defvalue, error;
+
+	if (git_repository_config__weakptr(&cfg, repo) < 0)
+		return -1;
+
+	if ((error = git_config_get_bool(&val, cfg, name)) == GIT_ENOTFOUND) {
+		giterr_clear();
+		val = defvalue;
+		error = 0;
+	}
+
+	*out = (val != 0);
+	return error;
+}
+
+static int dirs_add(git_strmap *dirs, const char *dir, size_t len)
+{
+	char *key;
+	int error;
+
+	key = git__strndup(dir, len);
+	GITERR_CHECK_ALLOC(key);
+
+	if (git_strmap_exists(dirs, key)) {
+		git__free(key);
+		return 0;
+	}
+
+	git_strmap_insert(dirs, key, key, error);
+	if (error < 0) {
+		git__free(key);
+		giterr_set_oom();
+		return -1;
+	}
+
+	return 0;
+}
+
+/* Add the directories that lead to `dir` */
+static int dirs_add_parents(git_strmap *dirs, const char *dir)
+{
+	const char *slash;
+
+	for (slash = strchr(dir, '/'); slash; slash = strchr(slash + 1, '/')) {
+		if (dirs_add(dirs, dir, slash - dir) < 0)
+			return -1;
+	}
+
+	return 0;
+}
+
+static void dirs_free(git_strmap *dirs)
+{
+	char *dir;
+
+	if (dirs == NULL)
+		return;
+
+	git_strmap_foreach_value(dirs, dir, {
+		git__free(dir);
+	});
+	git_strmap_free(dirs);
+}
+
+/* Whether `dir` or one of the directories it is in is in `dirs` */
+static bool dirs_contain(const git_strmap *dirs, char *dir)
+{
+	char *slash;
+	bool found = git_strmap_exists((git_strmap *)dirs, dir);
+
+	for (slash = strchr(dir, '/'); slash && !found; slash = strchr(slash + 1, '/')) {
+		*slash = '\0';
+		found = git_strmap_exists((git_strmap *)dirs, dir);
+		*slash = '/';
+	}
+
+	return found;
+}
+
+static int sparse_error_pattern(const char *line)
+{
+	giterr_set(GITERR_INVALID,
+		"Unsupported sparse-checkout pattern '%s'; only cone mode is supported",
+		line);
+	return -1;
+}
+
+/* Take the directory out of a "/dir/" or "!/dir/ *\/" pattern */
+static int sparse_parse_dir(git_buf *dir, const char *line)
+{
+	bool negative = (*line == '!');
+	const char *start = line + negative, *end = start + strlen(start);
+
+	if (*start != '/' || end - start < 3 || end[-1] != '/')
+		return sparse_error_pattern(line);
+
+	if (negative) {
+		if (end - start < 5 || strcmp(end - 3, "/*/") != 0)
+			return sparse_error_pattern(line);
+		end -= 2;
+	}
+
+	git_buf_clear(dir);
+
+	for (++start, --end; start < end; ++start) {
+		if (*start == '\\' && start + 1 < end)
+			++start;
+		else if (strchr("*?[", *start) != NULL)
+			return sparse_error_pattern(line);
+
+		git_buf_putc(dir, *start);
+	}
+
+	if (git_buf_oom(dir))
+		return -1;
+
+	return dir->size > 0 ? 0 : sparse_error_pattern(line);
+}
+
+static int sparse_parse(git_sparse *sparse, char *contents)
+{
+	git_strmap *included, *excluded;
+	git_buf dir = GIT_BUF_INIT;
+	char *line, *next, *path;
+	size_t len;
+	int error = 0;
+
+	included = git_strmap_alloc();
+	excluded = git_strmap_alloc();
+	if (!included || !excluded) {
+		giterr_set_oom();
+		error = -1;
+		goto done;
+	}
+
+	for (line = contents; line && !error; line = next) {
+		if ((next = strchr(line, '\n')) != NULL)
+			*next++ = '\0';
+
+		len = strlen(line);
+		while (len > 0 && git__isspace(line[len - 1]))
+			line[--len] = '\0';
+
+		/* the top level files, and nothing below them */
+		if (!len || *line == '#' ||
+			!strcmp(line, "/*") || !strcmp(line, "!/*/"))
+			continue;
+
+		if ((error = sparse_parse_dir(&dir, line)) == 0)
+			error = dirs_add(*line == '!' ? excluded : included,
+				dir.ptr, dir.size);
+	}
+
+	if (error < 0)
+		goto done;
+
+	/* a directory whose subdirectories are excluded is a parent */
+	git_strmap_foreach_value(included, path, {
+		if (!error && git_strmap_exists(excluded, path))
+			error = dirs_add(sparse->parents, path, strlen(path));
+		else if (!error)
+			error = dirs_add(sparse->recursive, path, strlen(path));
+
+		if (!error)
+			error = dirs_add_parents(sparse->parents, path);
+	});
+
+	git_strmap_foreach_value(excluded, path, {
+		if (!error)
+			error = dirs_add(sparse->parents, path, strlen(path));
+		if (!error)
+			error = dirs_add_parents(sparse->parents, path);
+	});
+
+done:
+	dirs_free(included);
+	dirs_free(excluded);
+	git_buf_free(&dir);
+	return error;
+}
+
+int git_sparse__load(git_sparse **out, git_repository *repo)
+{
+	git_sparse *sparse = NULL;
+	git_buf path = GIT_BUF_INIT, contents = GIT_BUF_INIT;
+	bool enabled, cone;
+	int error;
+
+	*out = NULL;
+
+	if ((error = sparse_config(&enabled, repo, "core.sparsecheckout", false)) < 0 ||
+		!enabled)
+		return error;
+
+	if ((error = sparse_config(&cone, repo, "core.sparsecheckoutcone", true)) < 0)
+		return error;
+
+	if (!cone) {
+		giterr_set(GITERR_INVALID,
+			"Only cone mode sparse checkouts are supported");
+		return -1;
+	}
+
+	if (git_buf_joinpath(&path,
+			git_repository_path(repo), GIT_SPARSE_CHECKOUT_FILE) < 0)
+		return -1;
+
+	/* without patterns, everything is checked out */
+	if (!git_path_isfile(path.ptr))
+		goto done;
+
+	if ((error = git_futils_readbuffer(&contents, path.ptr)) < 0)
+		goto done;
+
+	if ((sparse = git__calloc(1, sizeof(git_sparse))) != NULL) {
+		sparse->recursive = git_strmap_alloc();
+		sparse->parents = git_strmap_alloc();
+	}
+
+	if (!sparse || !sparse->recursive || !sparse->parents) {
+		giterr_set_oom();
+		error = -1;
+	} else
+		error = sparse_parse(sparse, contents.ptr);
+
+	if (error < 0) {
+		git_sparse__free(sparse);
+		sparse = NULL;
+	}
+
+done:
+	git_buf_free(&path);
+	git_buf_free(&contents);
+
+	*out = sparse;
+	return error;
+}
+
+bool git_sparse__contains(const git_sparse *sparse, const char *path)
+{
+	const char *slash = strrchr(path, '/');
+	char *dir;
+	bool contains;
+
+	/* the top level files are always there */
+	if (slash == NULL)
+		return true;
+
+	if ((dir = git__strndup(path, slash - path)) == NULL)
+		return true;
+
+	contains = git_strmap_exists(sparse->parents, dir) ||
+		dirs_contain(sparse->recursive, dir);
+
+	git__free(dir);
+	return contains;
+}
+
+bool git_sparse__excludes_dir(const git_sparse *sparse, const char *path)
+{
+	size_t len = strlen(path);
+	char *dir;
+	bool excludes;
+
+	if (len > 0 && path[len - 1] == '/')
+		len--;
+
+	if (len == 0 || (dir = git__strndup(path, len)) == NULL)
+		return false;
+
+	excludes = !git_strmap_exists(sparse->parents, dir) &&
+		!dirs_contain(sparse->recursive, dir);
+
+	git__free(dir);
+	return excludes;
+}
+
+void git_sparse__free(git_sparse *sparse)
+{
+	if (sparse == NULL)
+		return;
+
+	dirs_free(sparse->recursive);
+	dirs_free(sparse->parents);
+	git__free(sparse);
+}
+
+static int sparse_set_config(git_repository *repo, bool enabled)
+{
+	git_config *cfg;
+
+	if (git_repository_config__weakptr(&cfg, repo) < 0 ||
+		git_config_set_bool(cfg, "core.sparsecheckout", enabled) < 0)
+		return -1;
+
+	return enabled ?
+		git_config_set_bool(cfg, "core.sparsecheckoutcone", true) : 0;
+}
+
+/* Strip the slashes around `dir`, and refuse what is not a plain path */
+static int sparse_normalize_dir(git_buf *out, const char *dir)
+{
+	const char *start = dir, *end = dir + strlen(dir), *c, *next;
+	size_t len;
+
+	while (*start == '/')
+		start++;
+	while (end > start && end[-1] == '/')
+		end--;
+
+	for (c = start; c < end; c = next + 1) {
+		if ((next = memchr(c, '/', end - c)) == NULL)
+			next = end;
+
+		len = next - c;
+		if (!len || (len == 1 && c[0] == '.') ||
+			(len == 2 && c[0] == '.' && c[1] == '.'))
+			break;
+	}
+
+	if (start == end || c < end) {
+		giterr_set(GITERR_INVALID, "Invalid sparse checkout directory '%s'", dir);
+		return -1;
+	}
+
+	git_buf_clear(out);
+	return git_buf_put(out, start, end - start);
+}
+
+/* Whether one of the directories that `dir` is in is in `dirs` */
+static bool dirs_contain_parent(const git_strmap *dirs, const char *dir)
+{
+	char *parent, *slash;
+	bool found = false;
+
+	if ((parent = git__strdup(dir)) == NULL)
+		return false;
+
+	if ((slash = strrchr(parent, '/')) != NULL) {
+		*slash = '\0';
+		found = dirs_contain(dirs, parent);
+	}
+
+	git__free(parent);
+	return found;
+}
+
+static int sparse_write_dir(git_filebuf *file, const char *dir, bool parent)
+{
+	git_buf line = GIT_BUF_INIT;
+	size_t len;
+	int error;
+
+	git_buf_putc(&line, '/');
+
+	for (; *dir; ++dir) {
+		if (strchr("*?[\\", *dir) != NULL)
+			git_buf_putc(&line, '\\');
+		git_buf_putc(&line, *dir);
+	}
+
+	git_buf_puts(&line, "/\n");
+
+	/* "!/dir/" followed by "*\/" leaves out its subdirectories */
+	if (parent && !git_buf_oom(&line)) {
+		len = line.size - 1;
+		git_buf_putc(&line, '!');
+		if (git_buf_grow(&line, line.size + len + 1) == 0)
+			git_buf_put(&line, line.ptr, len);
+		git_buf_puts(&line, "*/\n");
+	}
+
+	if (git_buf_oom(&line))
+		error = -1;
+	else
+		error = git_filebuf_write(file, line.ptr, line.size);
+
+	git_buf_free(&line);
+	return error;
+}
+
+int git_sparse_checkout_set(git_repository *repo, const git_strarray *dirs)
+{
+	git_sparse sparse;
+	git_vector lines = GIT_VECTOR_INIT;
+	git_filebuf file = GIT_FILEBUF_INIT;
+	git_buf path = GIT_BUF_INIT, dir = GIT_BUF_INIT;
+	const char *line;
+	size_t i;
+	int error = -1;
+
+	assert(repo && dirs);
+
+	if (git_repository__ensure_not_bare(repo, "set up a sparse checkout") < 0)
+		return -1;
+
+	sparse.recursive = git_strmap_alloc();
+	sparse.parents = git_strmap_alloc();
+
+	if (!sparse.recursive || !sparse.parents) {
+		giterr_set_oom();
+		goto done;
+	}
+
+	for (i = 0; i < dirs->count; ++i) {
+		if (sparse_normalize_dir(&dir, dirs->strings[i]) < 0 ||
+			dirs_add(sparse.recursive, dir.ptr, dir.size) < 0 ||
+			dirs_add_parents(sparse.parents, dir.ptr) < 0)
+			goto done;
+	}
+
+	if (git_vector_init(&lines, 16, git__strcmp_cb) < 0)
+		goto done;
+
+	git_strmap_foreach_value(sparse.recursive, line, {
+		if (git_vector_insert(&lines, (char *)line) < 0)
+			goto done;
+	});
+
+	git_strmap_foreach_value(sparse.parents, line, {
+		if (!git_strmap_exists(sparse.recursive, line) &&
+			git_vector_insert(&lines, (char *)line) < 0)
+			goto done;
+	});
+
+	git_vector_sort(&lines);
+
+	if (git_buf_joinpath(&path,
+			git_repository_path(repo), GIT_SPARSE_CHECKOUT_FILE) < 0 ||
+		git_futils_mkpath2file(path.ptr, GIT_DIR_MODE) < 0 ||
+		git_filebuf_open(&file, path.ptr, 0) < 0)
+		goto done;
+
+	error = git_filebuf_write(&file, "/*\n!/*/\n", 8);
+
+	git_vector_foreach(&lines, i, line) {
+		/* what is below a checked out directory is already in */
+		if (error < 0 || dirs_contain_parent(sparse.recursive, line))
+			continue;
+
+		error = sparse_write_dir(&file, line,
+			!git_strmap_exists(sparse.recursive, line));
+	}
+
+	if (error < 0)
+		git_filebuf_cleanup(&file);
+	else if ((error = git_filebuf_commit(&file, GIT_SPARSE_CHECKOUT_FILE_MODE)) == 0)
+		error = sparse_set_config(repo, true);
+
+done:
+	git_vector_free(&lines);
+	dirs_free(sparse.recursive);
+	dirs_free(sparse.parents);
+	git_buf_free(&path);
+	git_buf_free(&dir);
+	return error;
+}
+
+int git_sparse_checkout_disable(git_repository *repo)
+{
+	assert(repo);
+	return sparse_set_config(repo, false);
+}
@@ -0,0 +1,44 @@
+/*
+ * Copyright (C) 2009-2012 the libgit2 contributors
+ *
+ * This file is part of libgit2, distributed under the GNU GPL v2 with
+ * a Linking Exception. For full terms see the included COPYING file.
+ */
+#ifndef INCLUDE_sparse_h__
+#define INCLUDE_sparse_h__
+
+#include "common.h"
+#include "git2/sparse.h"
+#include "strmap.h"
+
+#define GIT_SPARSE_CHECKOUT_FILE "info/sparse-checkout"
+#define GIT_SPARSE_CHECKOUT_FILE_MODE 0666
+
+/*
+ * The directories of a cone mode sparse checkout, without a trailing
+ * slash. Everything below a recursive directory is checked out, as are
+ * the files directly in a parent directory and at the top.
+ */
+typedef struct {
+	git_strmap *recursive;
+	git_strmap *parents;
+} git_sparse;
+
+/*
+ * Load the sparse checkout patterns of the repository; `out` is set to
+ * NULL if there is no sparse checkout.
+ */
+extern int git_sparse__load(git_sparse **out, git_repository *repo);
+
+/* Whether the file at `path` is checked out */
+extern bool git_sparse__contains(const git_sparse *sparse, const char *path);
+
+/*
+ * Whether nothing at all below the directory `path` is checked out, with
+ * or without a trailing slash.
+ */
+extern bool git_sparse__excludes_dir(const git_sparse *sparse, const char *path);
+
+extern void git_sparse__free(git_sparse *sparse);
+
+#endif
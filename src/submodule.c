@@ -345,6 +345,7 @@ int git_submodule_add_to_index(git_submodule *sm, int write_index)
 	git_index *index;
 	git_buf path = GIT_BUF_INIT;
 	git_commit *head;
+	const git_signature *committer;
 	git_index_entry entry;
 	struct stat st;
 
@@ -385,9 +386,16 @@ int git_submodule_add_to_index(git_submodule *sm, int write_index)
 	if ((error = git_commit_lookup(&head, sm_repo, &sm->wd_oid)) < 0)
 		goto cleanup;
 
-	entry.ctime.seconds = git_commit_time(head);
+	/* the signature is parsed on demand and may turn out to be broken */
+	if ((committer = git_commit_committer(head)) == NULL) {
+		git_commit_free(head);
+		error = -1;
+		goto cleanup;
+	}
+
+	entry.ctime.seconds = committer->when.time;
 	entry.ctime.nanoseconds = 0;
-	entry.mtime.seconds = git_commit_time(head);
+	entry.mtime.seconds = committer->when.time;
 	entry.mtime.nanoseconds = 0;
 
 	git_commit_free(head);
@@ -68,6 +68,30 @@ GIT_INLINE(int) git_atomic_dec(git_atomic *a)
 #endif
 }
 
+GIT_INLINE(int) git_atomic_get(git_atomic *a)
+{
+#if defined(GIT_WIN32)
+	return InterlockedCompareExchange(&a->val, 0, 0);
+#elif defined(__GNUC__)
+	return __sync_add_and_fetch(&a->val, 0);
+#else
+#	error "Unsupported architecture for atomic operations"
+#endif
+}
+
+/* Store `newval` in `*ptr` if it still holds `oldval`; returns the old value */
+GIT_INLINE(void *) git__compare_and_swap(
+	void * volatile *ptr, void *oldval, void *newval)
+{
+#if defined(GIT_WIN32)
+	return InterlockedCompareExchangePointer(ptr, newval, oldval);
+#elif defined(__GNUC__)
+	return __sync_val_compare_and_swap(ptr, oldval, newval);
+#else
+#	error "Unsupported architecture for atomic operations"
+#endif
+}
+
 #else
 
 #define git_thread unsigned int
@@ -101,6 +125,20 @@ GIT_INLINE(int) git_atomic_dec(git_atomic *a)
 	return --a->val;
 }
 
+GIT_INLINE(int) git_atomic_get(git_atomic *a)
+{
+	return a->val;
+}
+
+GIT_INLINE(void *) git__compare_and_swap(
+	void * volatile *ptr, void *oldval, void *newval)
+{
+	void *foundval = *ptr;
+	if (foundval == oldval)
+		*ptr = newval;
+	return foundval;
+}
+
 #endif
 
 extern int git_online_cpus(void);
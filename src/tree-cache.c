@@ -169,6 +169,83 @@ int git_tree_cache_read(git_tree_cache **tree, const char *buffer, size_t buffer
 	return 0;
 }
 
+static void write_tree_internal(git_buf *out, const git_tree_cache *tree)
+{
+	size_t i;
+
+	git_buf_put(out, tree->name, strlen(tree->name) + 1);
+	git_buf_printf(out, "%d %d\n",
+		(int)tree->entries, (int)tree->children_count);
+
+	if (tree->entries >= 0)
+		git_buf_put(out, (const char *)tree->oid.id, GIT_OID_RAWSZ);
+
+	for (i = 0; i < tree->children_count; ++i)
+		write_tree_internal(out, tree->children[i]);
+}
+
+int git_tree_cache_write(git_buf *out, const git_tree_cache *tree)
+{
+	write_tree_internal(out, tree);
+	return git_buf_oom(out) ? -1 : 0;
+}
+
+int git_tree_cache_new(git_tree_cache **out, git_tree_cache *parent, const char *name)
+{
+	git_tree_cache *tree;
+	size_t name_len = strlen(name);
+
+	tree = git__calloc(1, sizeof(git_tree_cache) + name_len + 1);
+	GITERR_CHECK_ALLOC(tree);
+
+	tree->parent = parent;
+	tree->entries = -1;
+	memcpy(tree->name, name, name_len);
+
+	*out = tree;
+	return 0;
+}
+
+/* Find the subtree `name`, or add it as an invalid one */
+int git_tree_cache_child(git_tree_cache **out, git_tree_cache *tree, const char *name)
+{
+	git_tree_cache *child, **children;
+
+	if ((*out = find_child(tree, name)) != NULL)
+		return 0;
+
+	children = git__realloc(tree->children,
+		(tree->children_count + 1) * sizeof(git_tree_cache *));
+	GITERR_CHECK_ALLOC(children);
+	tree->children = children;
+
+	if (git_tree_cache_new(&child, tree, name) < 0)
+		return -1;
+
+	tree->children[tree->children_count++] = child;
+
+	*out = child;
+	return 0;
+}
+
+/*
+ * Drop the invalid subtrees of a tree that was just written; the ones
+ * that are still there in the index were all written along with it.
+ */
+void git_tree_cache_prune(git_tree_cache *tree)
+{
+	size_t i, j;
+
+	for (i = 0, j = 0; i < tree->children_count; ++i) {
+		if (tree->children[i]->entries < 0)
+			git_tree_cache_free(tree->children[i]);
+		else
+			tree->children[j++] = tree->children[i];
+	}
+
+	tree->children_count = j;
+}
+
 void git_tree_cache_free(git_tree_cache *tree)
 {
 	unsigned int i;
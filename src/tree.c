@@ -8,6 +8,7 @@
 #include "common.h"
 #include "commit.h"
 #include "tree.h"
+#include "thread-utils.h"
 #include "git2/repository.h"
 #include "git2/object.h"
 
@@ -43,14 +44,19 @@ static git_tree_entry *alloc_entry(const char *filename)
 {
 	git_tree_entry *entry = NULL;
 	size_t filename_len = strlen(filename);
+	char *filename_ptr;
 
 	entry = git__malloc(sizeof(git_tree_entry) + filename_len + 1);
 	if (!entry)
 		return NULL;
 
 	memset(entry, 0x0, sizeof(git_tree_entry));
-	memcpy(entry->filename, filename, filename_len);
-	entry->filename[filename_len] = 0;
+
+	filename_ptr = (char *)(entry + 1);
+	memcpy(filename_ptr, filename, filename_len);
+	filename_ptr[filename_len] = 0;
+
+	entry->filename = filename_ptr;
 	entry->filename_len = filename_len;
 
 	return entry;
@@ -61,23 +67,69 @@ struct tree_key_search {
 	size_t filename_len;
 };
 
-static int homing_search_cmp(const void *key, const void *array_member)
+GIT_INLINE(int) homing_cmp(
+	const struct tree_key_search *ksearch, const char *filename, size_t filename_len)
 {
-	const struct tree_key_search *ksearch = key;
-	const git_tree_entry *entry = array_member;
-
 	const size_t len1 = ksearch->filename_len;
-	const size_t len2 = entry->filename_len;
 
 	return memcmp(
 		ksearch->filename,
-		entry->filename,
-		len1 < len2 ? len1 : len2
+		filename,
+		len1 < filename_len ? len1 : filename_len
 	);
 }
 
+static int homing_search_cmp(const void *key, const void *array_member)
+{
+	const git_tree_entry *entry = array_member;
+	return homing_cmp(key, entry->filename, entry->filename_len);
+}
+
+GIT_INLINE(const char *) tree_filename(
+	const git_tree *tree, const git_tree_entry_offset *offset)
+{
+	return (const char *)tree->odb_object->raw.data + offset->filename_offset;
+}
+
+GIT_INLINE(int) tree_homing_cmp(
+	const struct tree_key_search *ksearch, const git_tree *tree, size_t idx)
+{
+	const git_tree_entry_offset *offset = &tree->offsets[idx];
+	return homing_cmp(ksearch, tree_filename(tree, offset), offset->filename_len);
+}
+
 /*
- * Search for an entry in a given tree.
+ * Binary search for any entry of the tree that starts with the key.
+ * Returns 0 and its index in `*at_pos`, or GIT_ENOTFOUND and the
+ * position where such an entry would be inserted.
+ */
+static int tree_homing_search(
+	size_t *at_pos, const git_tree *tree, const struct tree_key_search *ksearch)
+{
+	size_t lim, base = 0;
+	int cmp;
+
+	for (lim = tree->entrycount; lim != 0; lim >>= 1) {
+		size_t idx = base + (lim >> 1);
+
+		cmp = tree_homing_cmp(ksearch, tree, idx);
+		if (cmp == 0) {
+			*at_pos = idx;
+			return 0;
+		}
+
+		if (cmp > 0) {
+			base = idx + 1;
+			lim--;
+		}
+	}
+
+	*at_pos = base;
+	return GIT_ENOTFOUND;
+}
+
+/*
+ * Search for an entry in a given treebuilder.
  *
  * Note that this search is performed in two steps because
  * of the way tree entries are sorted internally in git:
@@ -142,6 +194,87 @@ static int tree_key_search(git_vector *entries, const char *filename, size_t fil
 	return GIT_ENOTFOUND;
 }
 
+/* The same search, straight on the raw tree object */
+static int tree_offset_search(const git_tree *tree, const char *filename, size_t filename_len)
+{
+	struct tree_key_search ksearch;
+	const git_tree_entry_offset *offset;
+	size_t homing;
+	int i;
+
+	ksearch.filename = filename;
+	ksearch.filename_len = filename_len;
+
+	if (tree_homing_search(&homing, tree, &ksearch) < 0)
+		return GIT_ENOTFOUND;
+
+	for (i = (int)homing; i < (int)tree->entrycount; ++i) {
+		offset = &tree->offsets[i];
+
+		if (tree_homing_cmp(&ksearch, tree, i) < 0)
+			break;
+
+		if (offset->filename_len == filename_len &&
+			memcmp(filename, tree_filename(tree, offset), filename_len) == 0)
+			return i;
+	}
+
+	for (i = (int)homing - 1; i >= 0; --i) {
+		offset = &tree->offsets[i];
+
+		if (tree_homing_cmp(&ksearch, tree, i) > 0)
+			break;
+
+		if (offset->filename_len == filename_len &&
+			memcmp(filename, tree_filename(tree, offset), filename_len) == 0)
+			return i;
+	}
+
+	return GIT_ENOTFOUND;
+}
+
+/*
+ * Fill in the git_tree_entry for the entry at `idx`. Trees are shared
+ * through the object cache, so the entry table is installed and each
+ * entry published atomically; racing threads write the same values.
+ */
+static const git_tree_entry *tree_entry_at(git_tree *tree, size_t idx)
+{
+	git_tree_entry *entries, *entry;
+	const git_tree_entry_offset *offset;
+	const char *filename;
+
+	if (idx >= tree->entrycount)
+		return NULL;
+
+	if ((entries = tree->entries) == NULL) {
+		entries = git__calloc(tree->entrycount, sizeof(git_tree_entry));
+		if (entries == NULL)
+			return NULL;
+
+		if (git__compare_and_swap(
+				(void * volatile *)&tree->entries, NULL, entries) != NULL) {
+			git__free(entries);
+			entries = tree->entries;
+		}
+	}
+
+	entry = &entries[idx];
+	if (entry->filename != NULL)
+		return entry;
+
+	offset = &tree->offsets[idx];
+	filename = tree_filename(tree, offset);
+
+	entry->attr = offset->attr;
+	entry->filename_len = offset->filename_len;
+	git_oid_fromraw(&entry->oid,
+		(const unsigned char *)filename + offset->filename_len + 1);
+
+	git__compare_and_swap((void * volatile *)&entry->filename, NULL, (void *)filename);
+	return entry;
+}
+
 void git_tree_entry_free(git_tree_entry *entry)
 {
 	if (entry == NULL)
@@ -152,31 +285,33 @@ void git_tree_entry_free(git_tree_entry *entry)
 
 git_tree_entry *git_tree_entry_dup(const git_tree_entry *entry)
 {
-	size_t total_size;
 	git_tree_entry *copy;
+	char *filename;
 
 	assert(entry);
 
-	total_size = sizeof(git_tree_entry) + entry->filename_len + 1;
-
-	copy = git__malloc(total_size);
+	copy = git__malloc(sizeof(git_tree_entry) + entry->filename_len + 1);
 	if (!copy)
 		return NULL;
 
-	memcpy(copy, entry, total_size);
+	memcpy(copy, entry, sizeof(git_tree_entry));
+
+	filename = (char *)(copy + 1);
+	memcpy(filename, entry->filename, entry->filename_len);
+	filename[entry->filename_len] = 0;
+	copy->filename = filename;
+
 	return copy;
 }
 
 void git_tree__free(git_tree *tree)
 {
-	unsigned int i;
+	git__free(tree->entries);
+	git__free(tree->offsets);
 
-	for (i = 0; i < tree->entries.length; ++i) {
-		git_tree_entry *e = git_vector_get(&tree->entries, i);
-		git_tree_entry_free(e);
-	}
+	if (tree->odb_object != NULL)
+		git_odb_object_free(tree->odb_object);
 
-	git_vector_free(&tree->entries);
 	git__free(tree);
 }
 
@@ -223,13 +358,13 @@ int git_tree_entry_to_object(
 	return git_object_lookup(object_out, repo, &entry->oid, GIT_OBJ_ANY);
 }
 
-static git_tree_entry *entry_fromname(git_tree *tree, const char *name, size_t name_len)
+static const git_tree_entry *entry_fromname(git_tree *tree, const char *name, size_t name_len)
 {
-	int idx = tree_key_search(&tree->entries, name, name_len);
+	int idx = tree_offset_search(tree, name, name_len);
 	if (idx < 0)
 		return NULL;
 
-	return git_vector_get(&tree->entries, idx);
+	return tree_entry_at(tree, idx);
 }
 
 const git_tree_entry *git_tree_entry_byname(git_tree *tree, const char *filename)
@@ -241,19 +376,24 @@ const git_tree_entry *git_tree_entry_byname(git_tree *tree, const char *filename
 const git_tree_entry *git_tree_entry_byindex(git_tree *tree, size_t idx)
 {
 	assert(tree);
-	return git_vector_get(&tree->entries, idx);
+	return tree_entry_at(tree, idx);
 }
 
 const git_tree_entry *git_tree_entry_byoid(git_tree *tree, const git_oid *oid)
 {
-	unsigned int i;
-	git_tree_entry *e;
+	size_t i;
+	const git_tree_entry_offset *offset;
+	const unsigned char *entry_oid;
 
 	assert(tree);
 
-	git_vector_foreach(&tree->entries, i, e) {
-		if (memcmp(&e->oid.id, &oid->id, sizeof(oid->id)) == 0)
-			return e;
+	for (i = 0; i < tree->entrycount; ++i) {
+		offset = &tree->offsets[i];
+		entry_oid = (const unsigned char *)tree_filename(tree, offset) +
+			offset->filename_len + 1;
+
+		if (memcmp(entry_oid, &oid->id, sizeof(oid->id)) == 0)
+			return tree_entry_at(tree, i);
 	}
 
 	return NULL;
@@ -261,35 +401,32 @@ const git_tree_entry *git_tree_entry_byoid(git_tree *tree, const git_oid *oid)
 
 int git_tree__prefix_position(git_tree *tree, const char *path)
 {
-	git_vector *entries = &tree->entries;
 	struct tree_key_search ksearch;
-	unsigned int at_pos;
+	size_t at_pos;
 
 	ksearch.filename = path;
 	ksearch.filename_len = strlen(path);
 
 	/* Find tree entry with appropriate prefix */
-	git_vector_bsearch3(&at_pos, entries, &homing_search_cmp, &ksearch);
+	tree_homing_search(&at_pos, tree, &ksearch);
 
-	for (; at_pos < entries->length; ++at_pos) {
-		const git_tree_entry *entry = entries->contents[at_pos];
-		if (homing_search_cmp(&ksearch, entry) < 0)
+	for (; at_pos < tree->entrycount; ++at_pos) {
+		if (tree_homing_cmp(&ksearch, tree, at_pos) < 0)
 			break;
 	}
 
 	for (; at_pos > 0; --at_pos) {
-		const git_tree_entry *entry = entries->contents[at_pos - 1];
-		if (homing_search_cmp(&ksearch, entry) > 0)
+		if (tree_homing_cmp(&ksearch, tree, at_pos - 1) > 0)
 			break;
 	}
 
-	return at_pos;
+	return (int)at_pos;
 }
 
 unsigned int git_tree_entrycount(git_tree *tree)
 {
 	assert(tree);
-	return (unsigned int)tree->entries.length;
+	return (unsigned int)tree->entrycount;
 }
 
 static int tree_error(const char *str)
@@ -298,13 +435,24 @@ static int tree_error(const char *str)
 	return -1;
 }
 
+/*
+ * Index the raw tree: validate every entry and remember where its
+ * name starts. Entries are never copied out of the buffer here.
+ */
 static int tree_parse_buffer(git_tree *tree, const char *buffer, const char *buffer_end)
 {
-	if (git_vector_init(&tree->entries, DEFAULT_TREE_SIZE, entry_sort_cmp) < 0)
-		return -1;
+	const char *buffer_start = buffer;
+	size_t alloc = DEFAULT_TREE_SIZE;
+
+	if ((size_t)(buffer_end - buffer) > UINT32_MAX)
+		return tree_error("Failed to parse tree. Object is too large");
+
+	tree->offsets = git__malloc(alloc * sizeof(git_tree_entry_offset));
+	GITERR_CHECK_ALLOC(tree->offsets);
 
 	while (buffer < buffer_end) {
-		git_tree_entry *entry;
+		git_tree_entry_offset *offset;
+		const char *filename_end;
 		int attr;
 
 		if (git__strtol32(&attr, buffer, &buffer, 8) < 0 ||
@@ -314,27 +462,28 @@ static int tree_parse_buffer(git_tree *tree, const char *buffer, const char *buf
 		if (*buffer++ != ' ')
 			return tree_error("Failed to parse tree. Object is corrupted");
 
-		if (memchr(buffer, 0, buffer_end - buffer) == NULL)
+		if ((filename_end = memchr(buffer, 0, buffer_end - buffer)) == NULL ||
+			buffer_end - filename_end <= GIT_OID_RAWSZ)
 			return tree_error("Failed to parse tree. Object is corrupted");
 
-		/** Allocate the entry and store it in the entries vector */
-		{
-			entry = alloc_entry(buffer);
-			GITERR_CHECK_ALLOC(entry);
+		if (filename_end - buffer > UINT16_MAX)
+			return tree_error("Failed to parse tree. Filename is too long");
 
-			if (git_vector_insert(&tree->entries, entry) < 0)
-				return -1;
+		if (tree->entrycount == alloc) {
+			void *grown;
 
-			entry->attr = attr;
+			alloc *= 2;
+			grown = git__realloc(tree->offsets, alloc * sizeof(git_tree_entry_offset));
+			GITERR_CHECK_ALLOC(grown);
+			tree->offsets = grown;
 		}
 
-		while (buffer < buffer_end && *buffer != 0)
-			buffer++;
+		offset = &tree->offsets[tree->entrycount++];
+		offset->filename_offset = (uint32_t)(buffer - buffer_start);
+		offset->filename_len = (uint16_t)(filename_end - buffer);
+		offset->attr = (uint16_t)attr;
 
-		buffer++;
-
-		git_oid_fromraw(&entry->oid, (const unsigned char *)buffer);
-		buffer += GIT_OID_RAWSZ;
+		buffer = filename_end + 1 + GIT_OID_RAWSZ;
 	}
 
 	return 0;
@@ -343,25 +492,11 @@ static int tree_parse_buffer(git_tree *tree, const char *buffer, const char *buf
 int git_tree__parse(git_tree *tree, git_odb_object *obj)
 {
 	assert(tree);
-	return tree_parse_buffer(tree, (char *)obj->raw.data, (char *)obj->raw.data + obj->raw.len);
-}
 
-static unsigned int find_next_dir(const char *dirname, git_index *index, unsigned int start)
-{
-	unsigned int i, entries = git_index_entrycount(index);
-	size_t dirlen;
+	git_cached_obj_incref((git_cached_obj *)obj);
+	tree->odb_object = obj;
 
-	dirlen = strlen(dirname);
-	for (i = start; i < entries; ++i) {
-		git_index_entry *entry = git_index_get(index, i);
-		if (strlen(entry->path) < dirlen ||
-		    memcmp(entry->path, dirname, dirlen) ||
-			(dirlen > 0 && entry->path[dirlen] != '/')) {
-			break;
-		}
-	}
-
-	return i;
+	return tree_parse_buffer(tree, (char *)obj->raw.data, (char *)obj->raw.data + obj->raw.len);
 }
 
 static int append_entry(
@@ -384,24 +519,28 @@ static int append_entry(
 	return 0;
 }
 
+/*
+ * Write the tree for `dirname`, whose entries start at `start` in the
+ * index, and record it in `cache`. Subtrees that are still valid in the
+ * cache are not written again.
+ */
 static int write_tree(
 	git_oid *oid,
 	git_repository *repo,
 	git_index *index,
 	const char *dirname,
-	unsigned int start)
+	unsigned int start,
+	git_tree_cache *cache)
 {
 	git_treebuilder *bld = NULL;
 
 	unsigned int i, entries = git_index_entrycount(index);
 	int error;
 	size_t dirname_len = strlen(dirname);
-	const git_tree_cache *cache;
 
-	cache = git_tree_cache_get(index->tree, dirname);
-	if (cache != NULL && cache->entries >= 0){
+	if (cache->entries >= 0 && (size_t)cache->entries <= entries - start) {
 		git_oid_cpy(oid, &cache->oid);
-		return find_next_dir(dirname, index, start);
+		return start + (unsigned int)cache->entries;
 	}
 
 	error = git_treebuilder_create(&bld, NULL);
@@ -438,21 +577,13 @@ static int write_tree(
 		next_slash = strchr(filename, '/');
 		if (next_slash) {
 			git_oid sub_oid;
+			git_tree_cache *sub_cache;
 			int written;
 			char *subdir, *last_comp;
 
 			subdir = git__strndup(entry->path, next_slash - entry->path);
 			GITERR_CHECK_ALLOC(subdir);
 
-			/* Write out the subtree */
-			written = write_tree(&sub_oid, repo, index, subdir, i);
-			if (written < 0) {
-				tree_error("Failed to write subtree");
-				goto on_error;
-			} else {
-				i = written - 1; /* -1 because of the loop increment */
-			}
-
 			/*
 			 * We need to figure out what we want toinsert
 			 * into this tree. If we're traversing
@@ -465,6 +596,28 @@ static int write_tree(
 			} else {
 				last_comp = subdir;
 			}
+
+			/* Write out the subtree; a sparse directory is the tree that
+			 * it stands for */
+			if (git_tree_cache_child(&sub_cache, cache, last_comp) < 0)
+				written = -1;
+			else {
+				if (git_index__is_sparse_dir(entry) && next_slash[1] == '\0') {
+					sub_cache->entries = 1;
+					git_oid_cpy(&sub_cache->oid, &entry->oid);
+				}
+
+				written = write_tree(&sub_oid, repo, index, subdir, i, sub_cache);
+			}
+
+			if (written < 0) {
+				git__free(subdir);
+				tree_error("Failed to write subtree");
+				goto on_error;
+			} else {
+				i = written - 1; /* -1 because of the loop increment */
+			}
+
 			error = append_entry(bld, last_comp, &sub_oid, S_IFDIR);
 			git__free(subdir);
 			if (error < 0) {
@@ -484,6 +637,11 @@ static int write_tree(
 		goto on_error;
 
 	git_treebuilder_free(bld);
+
+	cache->entries = i - start;
+	git_oid_cpy(&cache->oid, oid);
+	git_tree_cache_prune(cache);
+
 	return i;
 
 on_error:
@@ -502,13 +660,13 @@ int git_tree_create_fromindex(git_oid *oid, git_index *index)
 		return tree_error("Failed to create tree. "
 		  "The index file is not backed up by an existing repository");
 
-	if (index->tree != NULL && index->tree->entries >= 0) {
-		git_oid_cpy(oid, &index->tree->oid);
-		return 0;
-	}
+	if (index->tree == NULL &&
+		git_tree_cache_new(&index->tree, NULL, "") < 0)
+		return -1;
 
-	/* The tree cache didn't help us */
-	ret = write_tree(oid, repo, index, "", 0);
+	/* the trees that are written are kept in the cache, and written
+	 * out with the index */
+	ret = write_tree(oid, repo, index, "", 0, index->tree);
 	return ret < 0 ? ret : 0;
 }
 
@@ -541,14 +699,18 @@ int git_treebuilder_create(git_treebuilder **builder_p, const git_tree *source)
 	GITERR_CHECK_ALLOC(bld);
 
 	if (source != NULL)
-		source_entries = source->entries.length;
+		source_entries = source->entrycount;
 
 	if (git_vector_init(&bld->entries, source_entries, entry_sort_cmp) < 0)
 		goto on_error;
 
 	if (source != NULL) {
-		for (i = 0; i < source->entries.length; ++i) {
-			git_tree_entry *entry_src = source->entries.contents[i];
+		for (i = 0; i < source->entrycount; ++i) {
+			const git_tree_entry *entry_src =
+				tree_entry_at((git_tree *)source, i);
+
+			if (entry_src == NULL)
+				goto on_error;
 
 			if (append_entry(
 				bld, entry_src->filename,
@@ -806,8 +968,11 @@ static int tree_walk(
 	int error = 0;
 	unsigned int i;
 
-	for (i = 0; i < tree->entries.length; ++i) {
-		git_tree_entry *entry = tree->entries.contents[i];
+	for (i = 0; i < tree->entrycount; ++i) {
+		const git_tree_entry *entry = tree_entry_at(tree, i);
+
+		if (entry == NULL)
+			return -1;
 
 		if (preorder) {
 			error = callback(path->ptr, entry, payload);
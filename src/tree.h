@@ -12,17 +12,38 @@
 #include "odb.h"
 #include "vector.h"
 
+/*
+ * The filename points either into the raw tree object (for entries of
+ * a git_tree) or to the end of the entry's own allocation (for entries
+ * of a treebuilder and duplicated entries).
+ */
 struct git_tree_entry {
 	uint16_t removed;
 	uint16_t attr;
 	git_oid oid;
 	size_t filename_len;
-	char filename[1];
+	const char *filename;
 };
 
+/* Where an entry lives in the raw tree object */
+typedef struct {
+	uint32_t filename_offset;
+	uint16_t filename_len;
+	uint16_t attr;
+} git_tree_entry_offset;
+
+/*
+ * Trees keep the raw object around and only index it while parsing;
+ * a git_tree_entry is filled in the first time an entry is requested.
+ */
 struct git_tree {
 	git_object object;
-	git_vector entries;
+
+	git_odb_object *odb_object;
+	git_tree_entry_offset *offsets;
+	size_t entrycount;
+
+	git_tree_entry *entries;
 };
 
 struct git_treebuilder {
@@ -15,6 +15,7 @@
 #endif
 
 #include <stdio.h>
+#include <sys/time.h>
 
 #define p_lstat(p,b) lstat(p,b)
 #define p_readlink(a, b, c) readlink(a, b, c)
@@ -28,5 +29,6 @@
 #define p_snprintf(b, c, f, ...) snprintf(b, c, f, __VA_ARGS__)
 #define p_mkstemp(p) mkstemp(p)
 #define p_setenv(n,v,o) setenv(n,v,o)
+#define p_utimes(f, t) utimes(f, t)
 
 #endif
@@ -0,0 +1,727 @@
+/*
+ * Copyright (C) 2009-2012 the libgit2 contributors
+ *
+ * This file is part of libgit2, distributed under the GNU GPL v2 with
+ * a Linking Exception. For full terms see the included COPYING file.
+ */
+
+#include "untracked-cache.h"
+#include "ewah.h"
+#include "varint.h"
+#include "index.h"
+#include "attr.h"
+#include "ignore.h"
+#include "repository.h"
+#include "git2/config.h"
+#include "git2/odb.h"
+
+#ifndef GIT_WIN32
+#include <sys/utsname.h>
+#endif
+
+#define STAT_DATA_SIZE (9 * 4)
+
+static int untracked_dir_cmp(const void *a, const void *b)
+{
+	const git_untracked_dir *da = a, *db = b;
+	return strcmp(da->name, db->name);
+}
+
+static git_untracked_dir *untracked_dir_alloc(const char *name, size_t name_len)
+{
+	git_untracked_dir *dir = git__calloc(1, sizeof(git_untracked_dir) + name_len + 1);
+	if (!dir)
+		return NULL;
+
+	if (git_vector_init(&dir->untracked, 0, git__strcmp_cb) < 0 ||
+		git_vector_init(&dir->dirs, 0, untracked_dir_cmp) < 0) {
+		git_vector_free(&dir->untracked);
+		git__free(dir);
+		return NULL;
+	}
+
+	memcpy(dir->name, name, name_len);
+	return dir;
+}
+
+static void untracked_dir_free(git_untracked_dir *dir)
+{
+	if (dir == NULL)
+		return;
+
+	git_untracked_dir_clear(dir, true);
+	git_vector_free(&dir->untracked);
+	git_vector_free(&dir->dirs);
+	git__free(dir);
+}
+
+void git_untracked_dir_clear(git_untracked_dir *dir, bool subdirs)
+{
+	unsigned int i;
+	char *name;
+	git_untracked_dir *sub;
+
+	dir->valid = 0;
+	dir->check_only = 0;
+
+	git_vector_foreach(&dir->untracked, i, name)
+		git__free(name);
+	git_vector_clear(&dir->untracked);
+
+	if (subdirs) {
+		git_vector_foreach(&dir->dirs, i, sub)
+			untracked_dir_free(sub);
+		git_vector_clear(&dir->dirs);
+	}
+}
+
+int git_untracked_dir_add(git_untracked_dir *dir, const char *name, size_t name_len)
+{
+	char *copy = git__strndup(name, name_len);
+	GITERR_CHECK_ALLOC(copy);
+
+	return git_vector_insert(&dir->untracked, copy);
+}
+
+static git_untracked_dir *find_subdir(
+	git_untracked_dir *dir, const char *name, size_t name_len, size_t *pos)
+{
+	size_t lo = 0, hi = dir->dirs.length;
+
+	while (lo < hi) {
+		size_t mid = lo + (hi - lo) / 2;
+		git_untracked_dir *sub = git_vector_get(&dir->dirs, mid);
+		int cmp = strncmp(sub->name, name, name_len);
+
+		if (!cmp && sub->name[name_len] != '\0')
+			cmp = 1;
+
+		if (!cmp) {
+			*pos = mid;
+			return sub;
+		} else if (cmp < 0)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	*pos = lo;
+	return NULL;
+}
+
+git_untracked_dir *git_untracked_cache_lookup(git_untracked_cache *uc, const char *path)
+{
+	git_untracked_dir *dir;
+	const char *slash;
+
+	if (!uc->root && (uc->root = untracked_dir_alloc("", 0)) == NULL)
+		return NULL;
+
+	for (dir = uc->root; (slash = strchr(path, '/')) != NULL; path = slash + 1) {
+		git_untracked_dir *sub;
+		size_t pos;
+
+		if ((sub = find_subdir(dir, path, slash - path, &pos)) == NULL) {
+			if ((sub = untracked_dir_alloc(path, slash - path)) == NULL)
+				return NULL;
+
+			if (git_vector_insert(&dir->dirs, sub) < 0) {
+				untracked_dir_free(sub);
+				return NULL;
+			}
+
+			/* keep the subdirectories sorted */
+			memmove(&dir->dirs.contents[pos + 1], &dir->dirs.contents[pos],
+				(dir->dirs.length - pos - 1) * sizeof(void *));
+			dir->dirs.contents[pos] = sub;
+		}
+
+		dir = sub;
+	}
+
+	return dir;
+}
+
+void git_untracked_cache_invalidate_path(git_untracked_cache *uc, const char *path)
+{
+	git_untracked_dir *dir;
+	const char *slash;
+
+	if (uc == NULL || (dir = uc->root) == NULL)
+		return;
+
+	/* a new or removed path changes what is untracked in every
+	 * directory leading to it */
+	git_untracked_dir_clear(dir, false);
+
+	for (; (slash = strchr(path, '/')) != NULL; path = slash + 1) {
+		size_t pos;
+
+		if ((dir = find_subdir(dir, path, slash - path, &pos)) == NULL)
+			return;
+
+		git_untracked_dir_clear(dir, false);
+	}
+}
+
+void git_untracked_stat_from(git_untracked_stat *out, const struct stat *st)
+{
+	memset(out, 0, sizeof(*out));
+
+	out->ctime = (uint32_t)st->st_ctime;
+	out->mtime = (uint32_t)st->st_mtime;
+	out->dev = (uint32_t)st->st_dev;
+	out->ino = (uint32_t)st->st_ino;
+	out->uid = (uint32_t)st->st_uid;
+	out->gid = (uint32_t)st->st_gid;
+	out->size = (uint32_t)st->st_size;
+}
+
+bool git_untracked_stat_match(const git_untracked_stat *a, const git_untracked_stat *b)
+{
+	return (a->ctime == b->ctime && a->mtime == b->mtime &&
+		a->dev == b->dev && a->ino == b->ino &&
+		a->uid == b->uid && a->gid == b->gid && a->size == b->size);
+}
+
+int git_untracked_cache_new(git_untracked_cache **out, const char *ident)
+{
+	git_untracked_cache *uc = git__calloc(1, sizeof(git_untracked_cache));
+	GITERR_CHECK_ALLOC(uc);
+
+	/* the identity is stored with its terminating NUL */
+	git_buf_put(&uc->ident, ident, strlen(ident) + 1);
+	uc->exclude_per_dir = git__strdup(".gitignore");
+	uc->dir_flags = GIT_UNTRACKED_CACHE_FLAGS;
+
+	if (git_buf_oom(&uc->ident) || !uc->exclude_per_dir) {
+		git_untracked_cache_free(uc);
+		return -1;
+	}
+
+	*out = uc;
+	return 0;
+}
+
+void git_untracked_cache_free(git_untracked_cache *uc)
+{
+	if (uc == NULL)
+		return;
+
+	untracked_dir_free(uc->root);
+	git_buf_free(&uc->ident);
+	git__free(uc->exclude_per_dir);
+	git__free(uc);
+}
+
+static uint32_t get_be32(const unsigned char *p)
+{
+	return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) |
+		((uint32_t)p[2] << 8) | (uint32_t)p[3];
+}
+
+static void read_stat(git_untracked_stat *st, const unsigned char *p)
+{
+	st->ctime = get_be32(p);
+	st->ctime_nsec = get_be32(p + 4);
+	st->mtime = get_be32(p + 8);
+	st->mtime_nsec = get_be32(p + 12);
+	st->dev = get_be32(p + 16);
+	st->ino = get_be32(p + 20);
+	st->uid = get_be32(p + 24);
+	st->gid = get_be32(p + 28);
+	st->size = get_be32(p + 32);
+}
+
+static int untracked_error_invalid(void)
+{
+	giterr_set(GITERR_INDEX, "Invalid data in untracked cache");
+	return -1;
+}
+
+typedef struct {
+	const unsigned char *data;
+	const unsigned char *end;
+	git_vector dirs; /* every directory, in the order they were read */
+} untracked_reader;
+
+static int read_varint(size_t *out, untracked_reader *r)
+{
+	size_t len;
+
+	*out = (size_t)git_decode_varint(r->data, r->end - r->data, &len);
+	if (len == 0)
+		return untracked_error_invalid();
+
+	r->data += len;
+	return 0;
+}
+
+static const char *read_string(untracked_reader *r, size_t *len)
+{
+	const unsigned char *nul = memchr(r->data, '\0', r->end - r->data);
+	const char *str = (const char *)r->data;
+
+	if (nul == NULL)
+		return NULL;
+
+	*len = nul - r->data;
+	r->data = nul + 1;
+	return str;
+}
+
+/*
+ * Directories are read depth first; every one of them is kept in the
+ * reader as well, which is how the bitmaps that follow refer to them.
+ */
+static int read_one_dir(git_untracked_dir **out, untracked_reader *r)
+{
+	git_untracked_dir *dir;
+	size_t untracked_len, dirs_len, len, i;
+	const char *name;
+
+	if (read_varint(&untracked_len, r) < 0 || read_varint(&dirs_len, r) < 0)
+		return -1;
+
+	if ((name = read_string(r, &len)) == NULL)
+		return untracked_error_invalid();
+
+	if ((dir = untracked_dir_alloc(name, len)) == NULL)
+		return -1;
+
+	if (git_vector_insert(&r->dirs, dir) < 0) {
+		untracked_dir_free(dir);
+		return -1;
+	}
+
+	for (i = 0; i < untracked_len; ++i) {
+		if ((name = read_string(r, &len)) == NULL)
+			return untracked_error_invalid();
+
+		if (git_untracked_dir_add(dir, name, len) < 0)
+			return -1;
+	}
+
+	for (i = 0; i < dirs_len; ++i) {
+		git_untracked_dir *sub;
+
+		if (read_one_dir(&sub, r) < 0 || git_vector_insert(&dir->dirs, sub) < 0)
+			return -1;
+	}
+
+	git_vector_sort(&dir->untracked);
+	git_vector_sort(&dir->dirs);
+
+	*out = dir;
+	return 0;
+}
+
+static int read_dirs(git_untracked_cache *uc, untracked_reader *r, size_t dirs_len)
+{
+	git_ewah_bitmap valid = GIT_EWAH_BITMAP_INIT,
+		check_only = GIT_EWAH_BITMAP_INIT, exclude_valid = GIT_EWAH_BITMAP_INIT;
+	git_untracked_dir *dir, *root;
+	unsigned int i;
+	int len, error = -1;
+
+	if (read_one_dir(&root, r) < 0)
+		goto done;
+
+	if (r->dirs.length != dirs_len) {
+		untracked_error_invalid();
+		goto done;
+	}
+
+	if ((len = git_ewah_read(&valid, (const char *)r->data, r->end - r->data)) < 0)
+		goto done;
+	r->data += len;
+
+	if ((len = git_ewah_read(&check_only, (const char *)r->data, r->end - r->data)) < 0)
+		goto done;
+	r->data += len;
+
+	if ((len = git_ewah_read(&exclude_valid, (const char *)r->data, r->end - r->data)) < 0)
+		goto done;
+	r->data += len;
+
+	git_vector_foreach(&r->dirs, i, dir) {
+		if (!git_ewah_get(&valid, i))
+			continue;
+
+		if ((size_t)(r->end - r->data) < STAT_DATA_SIZE) {
+			untracked_error_invalid();
+			goto done;
+		}
+
+		read_stat(&dir->st, r->data);
+		r->data += STAT_DATA_SIZE;
+		dir->valid = 1;
+		dir->check_only = git_ewah_get(&check_only, i);
+	}
+
+	git_vector_foreach(&r->dirs, i, dir) {
+		if (!git_ewah_get(&exclude_valid, i))
+			continue;
+
+		if ((size_t)(r->end - r->data) < GIT_OID_RAWSZ) {
+			untracked_error_invalid();
+			goto done;
+		}
+
+		git_oid_fromraw(&dir->exclude_oid, r->data);
+		r->data += GIT_OID_RAWSZ;
+	}
+
+	if (r->data != r->end) {
+		untracked_error_invalid();
+		goto done;
+	}
+
+	uc->root = root;
+	error = 0;
+
+done:
+	/* the tree may be incomplete, so free the directories one by one */
+	if (error < 0) {
+		git_vector_foreach(&r->dirs, i, dir) {
+			git_vector_clear(&dir->dirs);
+			untracked_dir_free(dir);
+		}
+	}
+
+	git_ewah_free(&valid);
+	git_ewah_free(&check_only);
+	git_ewah_free(&exclude_valid);
+	return error;
+}
+
+int git_untracked_cache_read(
+	git_untracked_cache **out, const char *buffer, size_t buffer_size)
+{
+	git_untracked_cache *uc;
+	untracked_reader r;
+	size_t ident_len, dirs_len, len;
+	const char *str;
+	int error = -1;
+
+	*out = NULL;
+
+	/* the data always ends in a NUL, as a safeguard for the strings */
+	if (buffer_size <= 1 || buffer[buffer_size - 1] != '\0')
+		return untracked_error_invalid();
+
+	uc = git__calloc(1, sizeof(git_untracked_cache));
+	GITERR_CHECK_ALLOC(uc);
+
+	memset(&r, 0, sizeof(r));
+	r.data = (const unsigned char *)buffer;
+	r.end = r.data + buffer_size - 1;
+
+	if (git_vector_init(&r.dirs, 32, NULL) < 0)
+		goto done;
+
+	if (read_varint(&ident_len, &r) < 0)
+		goto done;
+
+	if ((size_t)(r.end - r.data) < ident_len + 2 * STAT_DATA_SIZE + 4 +
+		2 * GIT_OID_RAWSZ) {
+		untracked_error_invalid();
+		goto done;
+	}
+
+	if (git_buf_put(&uc->ident, (const char *)r.data, ident_len) < 0)
+		goto done;
+	r.data += ident_len;
+
+	read_stat(&uc->info_exclude_st, r.data);
+	read_stat(&uc->excludes_file_st, r.data + STAT_DATA_SIZE);
+	uc->dir_flags = get_be32(r.data + 2 * STAT_DATA_SIZE);
+	r.data += 2 * STAT_DATA_SIZE + 4;
+
+	git_oid_fromraw(&uc->info_exclude_oid, r.data);
+	git_oid_fromraw(&uc->excludes_file_oid, r.data + GIT_OID_RAWSZ);
+	r.data += 2 * GIT_OID_RAWSZ;
+
+	if ((str = read_string(&r, &len)) == NULL) {
+		untracked_error_invalid();
+		goto done;
+	}
+
+	if ((uc->exclude_per_dir = git__strndup(str, len)) == NULL ||
+		read_varint(&dirs_len, &r) < 0)
+		goto done;
+
+	if (dirs_len > 0)
+		error = read_dirs(uc, &r, dirs_len);
+	else
+		error = (r.data == r.end) ? 0 : untracked_error_invalid();
+
+done:
+	git_vector_free(&r.dirs);
+
+	if (error < 0)
+		git_untracked_cache_free(uc);
+	else
+		*out = uc;
+
+	return error;
+}
+
+static int put_varint(git_buf *out, size_t value)
+{
+	unsigned char buf[16];
+	int len = git_encode_varint(buf, sizeof(buf), value);
+
+	return git_buf_put(out, (const char *)buf, len);
+}
+
+static int put_be32(git_buf *out, uint32_t value)
+{
+	value = htonl(value);
+	return git_buf_put(out, (const char *)&value, sizeof(value));
+}
+
+static void put_stat(git_buf *out, const git_untracked_stat *st)
+{
+	put_be32(out, st->ctime);
+	put_be32(out, st->ctime_nsec);
+	put_be32(out, st->mtime);
+	put_be32(out, st->mtime_nsec);
+	put_be32(out, st->dev);
+	put_be32(out, st->ino);
+	put_be32(out, st->uid);
+	put_be32(out, st->gid);
+	put_be32(out, st->size);
+}
+
+typedef struct {
+	git_buf dirs;
+	git_buf stats;
+	git_buf oids;
+	git_ewah_bitmap valid;
+	git_ewah_bitmap check_only;
+	git_ewah_bitmap exclude_valid;
+	size_t count;
+} untracked_writer;
+
+static int write_one_dir(untracked_writer *w, const git_untracked_dir *dir)
+{
+	size_t i = w->count++;
+	unsigned int j;
+	const char *name;
+	const git_untracked_dir *sub;
+	int error = 0;
+
+	if (dir->valid) {
+		error = git_ewah_set(&w->valid, i);
+		put_stat(&w->stats, &dir->st);
+
+		if (!error && dir->check_only)
+			error = git_ewah_set(&w->check_only, i);
+	}
+
+	if (!error && !git_oid_iszero(&dir->exclude_oid)) {
+		error = git_ewah_set(&w->exclude_valid, i);
+		git_buf_put(&w->oids, (const char *)dir->exclude_oid.id, GIT_OID_RAWSZ);
+	}
+
+	/* only valid directories have a list of untracked names */
+	put_varint(&w->dirs, dir->valid ? dir->untracked.length : 0);
+	put_varint(&w->dirs, dir->dirs.length);
+	git_buf_put(&w->dirs, dir->name, strlen(dir->name) + 1);
+
+	if (dir->valid)
+		git_vector_foreach(&dir->untracked, j, name)
+			git_buf_put(&w->dirs, name, strlen(name) + 1);
+
+	git_vector_foreach(&dir->dirs, j, sub) {
+		if (!error)
+			error = write_one_dir(w, sub);
+	}
+
+	return error;
+}
+
+int git_untracked_cache_write(git_buf *out, const git_untracked_cache *uc)
+{
+	untracked_writer w;
+	int error = 0;
+
+	memset(&w, 0, sizeof(w));
+
+	put_varint(out, uc->ident.size);
+	git_buf_put(out, uc->ident.ptr, uc->ident.size);
+
+	put_stat(out, &uc->info_exclude_st);
+	put_stat(out, &uc->excludes_file_st);
+	put_be32(out, uc->dir_flags);
+	git_buf_put(out, (const char *)uc->info_exclude_oid.id, GIT_OID_RAWSZ);
+	git_buf_put(out, (const char *)uc->excludes_file_oid.id, GIT_OID_RAWSZ);
+	git_buf_put(out, uc->exclude_per_dir, strlen(uc->exclude_per_dir) + 1);
+
+	if (uc->root == NULL)
+		put_varint(out, 0);
+	else if ((error = write_one_dir(&w, uc->root)) == 0) {
+		put_varint(out, w.count);
+		git_buf_put(out, w.dirs.ptr, w.dirs.size);
+
+		if ((error = git_ewah_write(out, &w.valid)) == 0 &&
+			(error = git_ewah_write(out, &w.check_only)) == 0 &&
+			(error = git_ewah_write(out, &w.exclude_valid)) == 0) {
+			git_buf_put(out, w.stats.ptr, w.stats.size);
+			git_buf_put(out, w.oids.ptr, w.oids.size);
+		}
+	}
+
+	git_buf_putc(out, '\0');
+
+	git_buf_free(&w.dirs);
+	git_buf_free(&w.stats);
+	git_buf_free(&w.oids);
+	git_ewah_free(&w.valid);
+	git_ewah_free(&w.check_only);
+	git_ewah_free(&w.exclude_valid);
+
+	if (!error && (git_buf_oom(out) || git_buf_oom(&w.dirs) ||
+		git_buf_oom(&w.stats) || git_buf_oom(&w.oids)))
+		error = -1;
+
+	return error;
+}
+
+/* The same identity as git.git's: the caches are only valid in place */
+static int untracked_ident(git_buf *out, git_repository *repo)
+{
+	const char *workdir = git_repository_workdir(repo);
+	size_t len = strlen(workdir);
+#ifdef GIT_WIN32
+	const char *system = "Windows";
+#else
+	struct utsname uts;
+	const char *system;
+
+	if (uname(&uts) < 0) {
+		giterr_set(GITERR_OS, "Failed to get the name of the system");
+		return -1;
+	}
+
+	system = uts.sysname;
+#endif
+
+	if (len > 1 && workdir[len - 1] == '/')
+		len--;
+
+	return git_buf_printf(out, "Location %.*s, system %s", (int)len, workdir, system);
+}
+
+/*
+ * Check whether a global ignore file changed since it was recorded,
+ * going by its content when the stat data differ.
+ */
+static bool exclude_file_changed(
+	git_untracked_stat *recorded_st, git_oid *recorded_oid, const char *path)
+{
+	struct stat st;
+	git_untracked_stat current_st;
+	git_oid current_oid;
+	bool changed;
+
+	memset(&current_st, 0, sizeof(current_st));
+	memset(&current_oid, 0, sizeof(current_oid));
+
+	if (path != NULL && p_stat(path, &st) == 0) {
+		git_untracked_stat_from(&current_st, &st);
+
+		if (git_untracked_stat_match(&current_st, recorded_st))
+			return false;
+
+		if (git_odb_hashfile(&current_oid, path, GIT_OBJ_BLOB) < 0) {
+			giterr_clear();
+			changed = true;
+		} else
+			changed = (git_oid_cmp(&current_oid, recorded_oid) != 0);
+	} else
+		changed = !git_oid_iszero(recorded_oid);
+
+	*recorded_st = current_st;
+	git_oid_cpy(recorded_oid, &current_oid);
+
+	return changed;
+}
+
+int git_untracked_cache_setup(
+	git_untracked_cache **out, git_repository *repo, git_index *index)
+{
+	git_untracked_cache *uc;
+	git_config *cfg;
+	git_buf ident = GIT_BUF_INIT, path = GIT_BUF_INIT;
+	int enabled, error;
+	bool changed;
+
+	*out = NULL;
+
+	if ((error = git_repository_config__weakptr(&cfg, repo)) < 0 ||
+		(error = git_attr_cache__init(repo)) < 0)
+		return error;
+
+	/* without core.untrackedCache, keep using a cache that exists */
+	if (git_config_get_bool(&enabled, cfg, "core.untrackedcache") < 0) {
+		giterr_clear();
+		enabled = -1;
+	}
+
+	if (!enabled) {
+		git_untracked_cache_free(index->untracked);
+		index->untracked = NULL;
+		return 0;
+	}
+
+	if ((error = untracked_ident(&ident, repo)) < 0)
+		goto done;
+
+	if ((uc = index->untracked) != NULL && (uc->ident.size != ident.size + 1 ||
+		memcmp(uc->ident.ptr, ident.ptr, ident.size + 1) != 0)) {
+		git_untracked_cache_free(uc);
+		index->untracked = uc = NULL;
+	}
+
+	if (uc == NULL) {
+		if (enabled < 0)
+			goto done;
+
+		if ((error = git_untracked_cache_new(&index->untracked, ident.ptr)) < 0)
+			goto done;
+
+		uc = index->untracked;
+	}
+
+	if (uc->dir_flags != GIT_UNTRACKED_CACHE_FLAGS) {
+		untracked_dir_free(uc->root);
+		uc->root = NULL;
+		uc->dir_flags = GIT_UNTRACKED_CACHE_FLAGS;
+	}
+
+	/* the global ignore rules apply to every directory */
+	if ((error = git_buf_joinpath(
+			&path, git_repository_path(repo), GIT_IGNORE_FILE_INREPO)) < 0)
+		goto done;
+
+	changed = exclude_file_changed(
+		&uc->info_exclude_st, &uc->info_exclude_oid, path.ptr);
+
+	if (exclude_file_changed(&uc->excludes_file_st, &uc->excludes_file_oid,
+			git_repository_attr_cache(repo)->cfg_excl_file))
+		changed = true;
+
+	if (changed) {
+		untracked_dir_free(uc->root);
+		uc->root = NULL;
+	}
+
+	*out = uc;
+
+done:
+	git_buf_free(&ident);
+	git_buf_free(&path);
+	return error;
+}
@@ -0,0 +1,103 @@
+/*
+ * Copyright (C) 2009-2012 the libgit2 contributors
+ *
+ * This file is part of libgit2, distributed under the GNU GPL v2 with
+ * a Linking Exception. For full terms see the included COPYING file.
+ */
+#ifndef INCLUDE_untracked_cache_h__
+#define INCLUDE_untracked_cache_h__
+
+#include "common.h"
+#include "buffer.h"
+#include "vector.h"
+#include "git2/oid.h"
+#include "git2/types.h"
+
+/*
+ * The directory flags that our records are made with. git.git only
+ * uses the low bits for its own flags, so each side discards the
+ * records of the other (they list untracked files by different rules)
+ * while the extension itself is kept.
+ */
+#define GIT_UNTRACKED_CACHE_FLAGS 0x40000000
+
+/* The stat data that the index keeps for directories and files */
+typedef struct {
+	uint32_t ctime;
+	uint32_t ctime_nsec;
+	uint32_t mtime;
+	uint32_t mtime_nsec;
+	uint32_t dev;
+	uint32_t ino;
+	uint32_t uid;
+	uint32_t gid;
+	uint32_t size;
+} git_untracked_stat;
+
+typedef struct git_untracked_dir git_untracked_dir;
+
+/*
+ * What we know about a directory of the working tree: when `valid`,
+ * its stat data was `st` when it last was read, and `untracked` lists
+ * the names in it that are neither tracked nor ignored (directories
+ * with a trailing slash). `exclude_oid` is the id of its .gitignore.
+ */
+struct git_untracked_dir {
+	git_vector untracked;
+	git_vector dirs;
+	unsigned int valid:1;
+	unsigned int check_only:1;
+	git_untracked_stat st;
+	git_oid exclude_oid;
+	char name[GIT_FLEX_ARRAY];
+};
+
+/* The index "UNTR" extension */
+typedef struct {
+	git_buf ident;
+	git_untracked_stat info_exclude_st;
+	git_untracked_stat excludes_file_st;
+	git_oid info_exclude_oid;
+	git_oid excludes_file_oid;
+	uint32_t dir_flags;
+	char *exclude_per_dir;
+	git_untracked_dir *root;
+} git_untracked_cache;
+
+extern int git_untracked_cache_new(git_untracked_cache **out, const char *ident);
+
+/*
+ * Get the untracked cache of `index` ready for a scan of the working
+ * directory of `repo`, creating or dropping it as core.untrackedCache
+ * says. `out` is set to NULL if the cache is not to be used.
+ */
+extern int git_untracked_cache_setup(
+	git_untracked_cache **out, git_repository *repo, git_index *index);
+extern void git_untracked_cache_free(git_untracked_cache *uc);
+
+extern int git_untracked_cache_read(
+	git_untracked_cache **out, const char *buffer, size_t buffer_size);
+extern int git_untracked_cache_write(git_buf *out, const git_untracked_cache *uc);
+
+/*
+ * Find the record for the directory `path` (relative to the working
+ * directory, "" or ending in a slash), creating it if needed.
+ */
+extern git_untracked_dir *git_untracked_cache_lookup(
+	git_untracked_cache *uc, const char *path);
+
+/* Forget what we know about the directories leading to `path` */
+extern void git_untracked_cache_invalidate_path(
+	git_untracked_cache *uc, const char *path);
+
+/* Forget the untracked names, and the subdirectories if asked to */
+extern void git_untracked_dir_clear(git_untracked_dir *dir, bool subdirs);
+
+extern int git_untracked_dir_add(
+	git_untracked_dir *dir, const char *name, size_t name_len);
+
+extern void git_untracked_stat_from(git_untracked_stat *out, const struct stat *st);
+extern bool git_untracked_stat_match(
+	const git_untracked_stat *a, const git_untracked_stat *b);
+
+#endif
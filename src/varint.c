@@ -0,0 +1,57 @@
+/*
+ * Copyright (C) 2009-2012 the libgit2 contributors
+ *
+ * This file is part of libgit2, distributed under the GNU GPL v2 with
+ * a Linking Exception. For full terms see the included COPYING file.
+ */
+
+#include "common.h"
+#include "varint.h"
+
+#define VARINT_MSB(x, bits) ((x) & (~(uintmax_t)0 << (sizeof(x) * 8 - (bits))))
+
+uintmax_t git_decode_varint(
+	const unsigned char *buf, size_t len, size_t *varint_len)
+{
+	const unsigned char *p = buf, *end = buf + len;
+	unsigned char c;
+	uintmax_t val;
+
+	*varint_len = 0;
+
+	if (p == end)
+		return 0;
+
+	c = *p++;
+	val = c & 127;
+
+	while (c & 128) {
+		val += 1;
+		if (!val || VARINT_MSB(val, 7) || p == end)
+			return 0; /* overflow or truncated */
+
+		c = *p++;
+		val = (val << 7) + (c & 127);
+	}
+
+	*varint_len = p - buf;
+	return val;
+}
+
+int git_encode_varint(unsigned char *buf, size_t bufsize, uintmax_t value)
+{
+	unsigned char varint[16];
+	unsigned pos = sizeof(varint) - 1;
+
+	varint[pos] = value & 127;
+	while (value >>= 7)
+		varint[--pos] = 128 | (--value & 127);
+
+	if (buf) {
+		if (bufsize < (sizeof(varint) - pos))
+			return -1;
+		memcpy(buf, varint + pos, sizeof(varint) - pos);
+	}
+
+	return (int)(sizeof(varint) - pos);
+}
@@ -0,0 +1,33 @@
+/*
+ * Copyright (C) 2009-2012 the libgit2 contributors
+ *
+ * This file is part of libgit2, distributed under the GNU GPL v2 with
+ * a Linking Exception. For full terms see the included COPYING file.
+ */
+#ifndef INCLUDE_varint_h__
+#define INCLUDE_varint_h__
+
+#include "common.h"
+
+/*
+ * The "offset" variable-length integers used by git.git for index v4
+ * path prefixes: every continuation byte implicitly adds one, so each
+ * value has exactly one encoding.
+ */
+
+/*
+ * Encode `value` into `buf`, which must be at least `bufsize` bytes.
+ * Returns the number of bytes written, or -1 if `buf` is too small.
+ * Passing a NULL `buf` returns the size of the encoding.
+ */
+extern int git_encode_varint(unsigned char *buf, size_t bufsize, uintmax_t value);
+
+/*
+ * Decode a varint from the `len` bytes at `buf`, storing the number of
+ * bytes consumed in `varint_len`. `varint_len` is set to 0 if the data
+ * is truncated or the value overflows.
+ */
+extern uintmax_t git_decode_varint(
+	const unsigned char *buf, size_t len, size_t *varint_len);
+
+#endif
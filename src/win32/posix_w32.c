@@ -11,6 +11,7 @@
 #include <errno.h>
 #include <io.h>
 #include <fcntl.h>
+#include <sys/utime.h>
 
 
 int p_unlink(const char *path)
@@ -292,6 +293,18 @@ int p_rmdir(const char* path)
 	return _wrmdir(buf);
 }
 
+int p_utimes(const char *path, const struct timeval times[2])
+{
+	wchar_t buf[GIT_WIN_PATH];
+	struct _utimbuf tb;
+
+	git__utf8_to_16(buf, GIT_WIN_PATH, path);
+	tb.actime = times[0].tv_sec;
+	tb.modtime = times[1].tv_sec;
+
+	return _wutime(buf, &tb);
+}
+
 int p_hide_directory__w32(const char *path)
 {
 	wchar_t buf[GIT_WIN_PATH];
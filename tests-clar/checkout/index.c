@@ -360,3 +360,123 @@ void test_checkout_index__wont_notify_of_expected_line_ending_changes(void)
 
 	cl_git_pass(git_checkout_index(g_repo, &g_opts, NULL));
 }
+
+static void set_checkout_workers_to(int32_t workers)
+{
+	git_config *cfg;
+
+	cl_git_pass(git_repository_config(&cfg, g_repo));
+	cl_git_pass(git_config_set_int32(cfg, "checkout.workers", workers));
+	cl_git_pass(git_config_set_int32(cfg, "checkout.thresholdForParallelism", 1));
+
+	git_config_free(cfg);
+}
+
+void test_checkout_index__can_write_files_on_several_threads(void)
+{
+	struct stat st;
+
+	cl_git_mkfile("./testrepo/.gitattributes", "branch_file.txt text eol=crlf\n");
+	set_core_autocrlf_to(false);
+	set_repo_symlink_handling_cap_to(true);
+	set_checkout_workers_to(4);
+
+	cl_git_pass(git_checkout_index(g_repo, &g_opts, NULL));
+
+	test_file_contents("./testrepo/README", "hey there\n");
+	test_file_contents("./testrepo/new.txt", "my new file\n");
+	test_file_contents("./testrepo/branch_file.txt", "hi\r\nbye!\r\n");
+#ifndef GIT_WIN32
+	cl_git_pass(p_lstat("./testrepo/link_to_new.txt", &st));
+	cl_assert(S_ISLNK(st.st_mode));
+#endif
+}
+
+void test_checkout_index__reports_errors_from_several_threads(void)
+{
+	set_checkout_workers_to(4);
+
+	/* a directory is in the way of the last file */
+	cl_git_pass(git_futils_mkdir("./testrepo/new.txt/sub", NULL, 0755, GIT_MKDIR_PATH));
+
+	cl_git_fail(git_checkout_index(g_repo, &g_opts, NULL));
+
+	test_file_contents("./testrepo/README", "hey there\n");
+	test_file_contents("./testrepo/branch_file.txt", "hi\nbye!\n");
+}
+
+void test_checkout_index__can_stream_large_files_through_the_filters(void)
+{
+	git_index *index;
+	git_buf content = GIT_BUF_INIT, expected = GIT_BUF_INIT,
+		actual = GIT_BUF_INIT;
+	int i;
+
+	/* several times as large as the chunks checkout reads */
+	for (i = 0; i < 50000; ++i) {
+		cl_git_pass(git_buf_printf(&content, "line %d\n", i));
+		cl_git_pass(git_buf_printf(&expected, "line %d\r\n", i));
+	}
+
+	cl_git_mkfile("./testrepo/large.txt", content.ptr);
+	cl_git_pass(git_repository_index(&index, g_repo));
+	cl_git_pass(git_index_add(index, "large.txt", 0));
+	cl_git_pass(git_index_write(index));
+	git_index_free(index);
+
+	cl_git_pass(p_unlink("./testrepo/large.txt"));
+	cl_git_mkfile("./testrepo/.gitattributes", "large.txt text eol=crlf\n");
+	set_core_autocrlf_to(false);
+
+	cl_git_pass(git_checkout_index(g_repo, &g_opts, NULL));
+
+	cl_git_pass(git_futils_readbuffer(&actual, "./testrepo/large.txt"));
+	cl_assert_equal_sz(expected.size, actual.size);
+	cl_assert(memcmp(expected.ptr, actual.ptr, actual.size) == 0);
+
+	git_buf_free(&content);
+	git_buf_free(&expected);
+	git_buf_free(&actual);
+}
+
+static void assert_entry_matches_file(git_index *index, const char *path)
+{
+	const git_index_entry *entry;
+	git_buf fullpath = GIT_BUF_INIT;
+	struct stat st;
+
+	cl_assert((entry = git_index_get(index, git_index_find(index, path))) != NULL);
+
+	cl_git_pass(git_buf_joinpath(&fullpath, "testrepo", path));
+	cl_git_pass(p_lstat(fullpath.ptr, &st));
+
+	cl_assert_equal_i((int)st.st_size, (int)entry->file_size);
+	cl_assert(entry->mtime.seconds == (git_time_t)st.st_mtime);
+	cl_assert(entry->ino == (unsigned int)st.st_ino);
+
+	git_buf_free(&fullpath);
+}
+
+void test_checkout_index__records_the_stat_data_of_the_files_it_writes(void)
+{
+	git_repository *repo;
+	git_index *index;
+
+	cl_git_mkfile("./testrepo/.gitattributes", "branch_file.txt text eol=crlf\n");
+	set_core_autocrlf_to(false);
+
+	cl_git_pass(git_checkout_index(g_repo, &g_opts, NULL));
+
+	/* the index on disk has it, with the size of the filtered file */
+	cl_git_pass(git_repository_open(&repo, "testrepo"));
+	cl_git_pass(git_repository_index(&index, repo));
+
+	assert_entry_matches_file(index, "README");
+	assert_entry_matches_file(index, "new.txt");
+	assert_entry_matches_file(index, "branch_file.txt");
+	cl_assert_equal_i(10, (int)git_index_get(
+		index, git_index_find(index, "branch_file.txt"))->file_size);
+
+	git_index_free(index);
+	git_repository_free(repo);
+}
@@ -0,0 +1,316 @@
+#include "clar_libgit2.h"
+
+#include "git2/checkout.h"
+#include "git2/sparse.h"
+#include "repository.h"
+#include "index.h"
+#include "diff.h"
+#include "fileops.h"
+
+static git_repository *g_repo;
+static git_checkout_opts g_opts;
+static git_oid g_tree_id;
+
+static const char *g_files[] = {
+	"top.txt",
+	"a/one.txt",
+	"b/two.txt",
+	"b/c/three.txt",
+	"d/four.txt",
+	"d/e/five.txt",
+	NULL
+};
+
+void test_checkout_sparse__initialize(void)
+{
+	git_index *index;
+	git_buf path = GIT_BUF_INIT;
+	const char **file;
+
+	memset(&g_opts, 0, sizeof(g_opts));
+	g_opts.checkout_strategy = GIT_CHECKOUT_CREATE_MISSING;
+
+	g_repo = cl_git_sandbox_init("empty_standard_repo");
+	cl_git_pass(git_repository_index(&index, g_repo));
+
+	for (file = g_files; *file; ++file) {
+		cl_git_pass(git_buf_joinpath(&path, "empty_standard_repo", *file));
+		cl_git_pass(git_futils_mkpath2file(path.ptr, 0777));
+		cl_git_mkfile(path.ptr, *file);
+		cl_git_pass(git_index_add(index, *file, 0));
+	}
+
+	cl_git_pass(git_tree_create_fromindex(&g_tree_id, index));
+	cl_git_pass(git_index_write(index));
+
+	git_index_free(index);
+	git_buf_free(&path);
+}
+
+void test_checkout_sparse__cleanup(void)
+{
+	cl_git_sandbox_cleanup();
+}
+
+static void set_cone(const char *dir)
+{
+	char *dirs[1];
+	git_strarray array;
+
+	dirs[0] = (char *)dir;
+	array.strings = dirs;
+	array.count = 1;
+
+	cl_git_pass(git_sparse_checkout_set(g_repo, &array));
+}
+
+static void set_sparse_index(int value)
+{
+	git_config *cfg;
+
+	cl_git_pass(git_repository_config(&cfg, g_repo));
+	cl_git_pass(git_config_set_bool(cfg, "index.sparse", value));
+	git_config_free(cfg);
+}
+
+static bool skips_worktree(git_index *index, const char *path)
+{
+	int pos = git_index_find(index, path);
+
+	cl_assert(pos >= 0);
+	return (git_index_get(index, pos)->flags_extended &
+		GIT_IDXENTRY_SKIP_WORKTREE) != 0;
+}
+
+static int count_worktree_changes(
+	const char *path, unsigned int status_flags, void *payload)
+{
+	GIT_UNUSED(path);
+
+	if (status_flags &
+		(GIT_STATUS_WT_NEW | GIT_STATUS_WT_MODIFIED | GIT_STATUS_WT_DELETED))
+		(*(int *)payload)++;
+
+	return 0;
+}
+
+static int worktree_changes(void)
+{
+	int count = 0;
+
+	cl_git_pass(git_status_foreach(g_repo, count_worktree_changes, &count));
+	return count;
+}
+
+void test_checkout_sparse__patterns_are_written_in_cone_mode(void)
+{
+	char *dirs[] = { "b/c/", "a", "b/c/x" };
+	git_strarray array = { dirs, 3 };
+	git_buf contents = GIT_BUF_INIT;
+	git_config *cfg;
+	int value;
+
+	cl_git_pass(git_sparse_checkout_set(g_repo, &array));
+
+	cl_git_pass(git_futils_readbuffer(
+		&contents, "empty_standard_repo/.git/info/sparse-checkout"));
+	cl_assert_equal_s(
+		"/*\n!/*/\n/a/\n/b/\n!/b/*/\n/b/c/\n", contents.ptr);
+
+	cl_git_pass(git_repository_config(&cfg, g_repo));
+	cl_git_pass(git_config_get_bool(&value, cfg, "core.sparseCheckout"));
+	cl_assert(value);
+	cl_git_pass(git_config_get_bool(&value, cfg, "core.sparseCheckoutCone"));
+	cl_assert(value);
+
+	cl_git_pass(git_sparse_checkout_disable(g_repo));
+	cl_git_pass(git_config_get_bool(&value, cfg, "core.sparseCheckout"));
+	cl_assert(!value);
+
+	git_config_free(cfg);
+	git_buf_free(&contents);
+}
+
+void test_checkout_sparse__only_cone_patterns_are_understood(void)
+{
+	git_index *index;
+
+	set_cone("b/c");
+	cl_git_rewritefile(
+		"empty_standard_repo/.git/info/sparse-checkout", "/*\n!/*/\n*.txt\n");
+
+	cl_git_fail(git_checkout_index(g_repo, &g_opts, NULL));
+
+	cl_git_pass(git_repository_index(&index, g_repo));
+	cl_assert(!skips_worktree(index, "a/one.txt"));
+	git_index_free(index);
+
+	cl_assert(git_path_exists("empty_standard_repo/a/one.txt"));
+}
+
+void test_checkout_sparse__files_outside_of_the_cone_are_removed(void)
+{
+	git_index *index;
+
+	set_cone("b/c");
+	cl_git_pass(git_checkout_index(g_repo, &g_opts, NULL));
+
+	cl_assert(git_path_exists("empty_standard_repo/top.txt"));
+	cl_assert(git_path_exists("empty_standard_repo/b/two.txt"));
+	cl_assert(git_path_exists("empty_standard_repo/b/c/three.txt"));
+	cl_assert(!git_path_exists("empty_standard_repo/a"));
+	cl_assert(!git_path_exists("empty_standard_repo/d"));
+
+	cl_git_pass(git_repository_index(&index, g_repo));
+	cl_assert_equal_i(6, (int)git_index_entrycount(index));
+	cl_assert(!skips_worktree(index, "top.txt"));
+	cl_assert(!skips_worktree(index, "b/two.txt"));
+	cl_assert(skips_worktree(index, "a/one.txt"));
+	cl_assert(skips_worktree(index, "d/e/five.txt"));
+	git_index_free(index);
+
+	cl_assert_equal_i(0, worktree_changes());
+}
+
+void test_checkout_sparse__modified_files_are_kept(void)
+{
+	git_index *index;
+
+	cl_git_rewritefile("empty_standard_repo/a/one.txt", "changed\n");
+
+	set_cone("b/c");
+	cl_git_pass(git_checkout_index(g_repo, &g_opts, NULL));
+
+	cl_assert(git_path_exists("empty_standard_repo/a/one.txt"));
+	cl_assert(!git_path_exists("empty_standard_repo/d"));
+
+	cl_git_pass(git_repository_index(&index, g_repo));
+	cl_assert(!skips_worktree(index, "a/one.txt"));
+	cl_assert(skips_worktree(index, "d/four.txt"));
+	git_index_free(index);
+
+	cl_assert_equal_i(1, worktree_changes());
+}
+
+void test_checkout_sparse__disabling_brings_the_files_back(void)
+{
+	git_index *index;
+	git_buf path = GIT_BUF_INIT;
+	const char **file;
+
+	set_cone("b/c");
+	cl_git_pass(git_checkout_index(g_repo, &g_opts, NULL));
+	cl_assert(!git_path_exists("empty_standard_repo/d/e/five.txt"));
+
+	cl_git_pass(git_sparse_checkout_disable(g_repo));
+	cl_git_pass(git_checkout_index(g_repo, &g_opts, NULL));
+
+	cl_git_pass(git_repository_index(&index, g_repo));
+	for (file = g_files; *file; ++file) {
+		cl_assert(!skips_worktree(index, *file));
+
+		cl_git_pass(git_buf_joinpath(&path, "empty_standard_repo", *file));
+		cl_assert(git_path_exists(path.ptr));
+	}
+	git_index_free(index);
+	git_buf_free(&path);
+
+	cl_assert_equal_i(0, worktree_changes());
+}
+
+void test_checkout_sparse__sparse_index_collapses_directories(void)
+{
+	git_repository *repo;
+	git_index *index;
+	const git_index_entry *entry;
+	git_oid tree_id;
+
+	set_sparse_index(true);
+	set_cone("b/c");
+	cl_git_pass(git_checkout_index(g_repo, &g_opts, NULL));
+
+	cl_git_pass(git_repository_open(&repo, "empty_standard_repo"));
+	cl_git_pass(git_repository_index(&index, repo));
+
+	cl_assert_equal_i(5, (int)git_index_entrycount(index));
+	cl_assert((entry = git_index_get(index, git_index_find(index, "a/"))) != NULL);
+	cl_assert(git_index__is_sparse_dir(entry));
+	cl_assert(entry->flags_extended & GIT_IDXENTRY_SKIP_WORKTREE);
+	cl_assert((entry = git_index_get(index, git_index_find(index, "d/"))) != NULL);
+	cl_assert(git_index__is_sparse_dir(entry));
+	cl_assert(git_index_find(index, "b/c/three.txt") >= 0);
+
+	/* the trees written from the sparse index are the same */
+	cl_git_pass(git_tree_create_fromindex(&tree_id, index));
+	cl_assert(git_oid_cmp(&g_tree_id, &tree_id) == 0);
+
+	git_index_free(index);
+	git_repository_free(repo);
+
+	cl_assert_equal_i(0, worktree_changes());
+}
+
+void test_checkout_sparse__sparse_dirs_are_expanded_on_demand(void)
+{
+	git_repository *repo;
+	git_index *index;
+	git_tree *tree;
+	git_diff_list *diff;
+
+	set_sparse_index(true);
+	set_cone("b/c");
+	cl_git_pass(git_checkout_index(g_repo, &g_opts, NULL));
+
+	cl_git_pass(git_repository_open(&repo, "empty_standard_repo"));
+
+	/* comparing with a tree sees every file */
+	cl_git_pass(git_tree_lookup(&tree, repo, &g_tree_id));
+	cl_git_pass(git_diff_index_to_tree(repo, NULL, tree, &diff));
+	cl_assert_equal_i(0, (int)diff->deltas.length);
+	git_diff_list_free(diff);
+	git_tree_free(tree);
+
+	/* adding a file below a sparse directory brings it back */
+	cl_git_pass(git_repository_index(&index, repo));
+	cl_git_pass(git_futils_mkpath2file("empty_standard_repo/d/e/six.txt", 0777));
+	cl_git_mkfile("empty_standard_repo/d/e/six.txt", "six\n");
+	cl_git_pass(git_index_add(index, "d/e/six.txt", 0));
+
+	cl_assert(git_index_find(index, "d/") < 0);
+	cl_assert(skips_worktree(index, "d/four.txt"));
+	cl_assert(skips_worktree(index, "d/e/five.txt"));
+	cl_assert(!skips_worktree(index, "d/e/six.txt"));
+	cl_assert(git_index_find(index, "a/") >= 0);
+	cl_assert_equal_i(7, (int)git_index_entrycount(index));
+
+	git_index_free(index);
+	git_repository_free(repo);
+}
+
+void test_checkout_sparse__widening_the_cone_expands_the_index(void)
+{
+	git_repository *repo;
+	git_index *index;
+
+	set_sparse_index(true);
+	set_cone("b/c");
+	cl_git_pass(git_checkout_index(g_repo, &g_opts, NULL));
+
+	set_cone("d");
+	cl_git_pass(git_checkout_index(g_repo, &g_opts, NULL));
+
+	cl_assert(git_path_exists("empty_standard_repo/d/e/five.txt"));
+	cl_assert(!git_path_exists("empty_standard_repo/b/c"));
+	cl_assert(!git_path_exists("empty_standard_repo/b"));
+
+	cl_git_pass(git_repository_open(&repo, "empty_standard_repo"));
+	cl_git_pass(git_repository_index(&index, repo));
+
+	cl_assert(git_index_find(index, "a/") >= 0);
+	cl_assert(git_index_find(index, "b/") >= 0);
+	cl_assert(!skips_worktree(index, "d/four.txt"));
+	cl_assert(!skips_worktree(index, "d/e/five.txt"));
+
+	git_index_free(index);
+	git_repository_free(repo);
+}
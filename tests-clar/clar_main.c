@@ -0,0 +1,2727 @@
+#include <assert.h>
+#include <setjmp.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <stdarg.h>
+
+/* required for sandboxing */
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#ifdef _WIN32
+#	include <windows.h>
+#	include <io.h>
+#	include <shellapi.h>
+#	include <direct.h>
+
+#	define _MAIN_CC __cdecl
+
+#	define stat(path, st) _stat(path, st)
+#	define mkdir(path, mode) _mkdir(path)
+#	define chdir(path) _chdir(path)
+#	define access(path, mode) _access(path, mode)
+#	define strdup(str) _strdup(str)
+
+#	ifndef __MINGW32__
+#		pragma comment(lib, "shell32")
+#		define strncpy(to, from, to_size) strncpy_s(to, to_size, from, _TRUNCATE)
+#		define W_OK 02
+#		define S_ISDIR(x) ((x & _S_IFDIR) != 0)
+#		define snprint_eq(buf,sz,fmt,a,b) _snprintf_s(buf,sz,_TRUNCATE,fmt,a,b)
+#	else
+#		define snprint_eq snprintf
+#	endif
+	typedef struct _stat STAT_T;
+#else
+#	include <sys/wait.h> /* waitpid(2) */
+#	include <unistd.h>
+#	define _MAIN_CC
+#	define snprint_eq snprintf
+	typedef struct stat STAT_T;
+#endif
+
+#include "clar.h"
+
+static void fs_rm(const char *_source);
+static void fs_copy(const char *_source, const char *dest);
+
+static const char *
+fixture_path(const char *base, const char *fixture_name);
+
+struct clar_error {
+	const char *test;
+	int test_number;
+	const char *suite;
+	const char *file;
+	int line_number;
+	const char *error_msg;
+	char *description;
+
+	struct clar_error *next;
+};
+
+static struct {
+	const char *active_test;
+	const char *active_suite;
+
+	int suite_errors;
+	int total_errors;
+
+	int test_count;
+
+	int report_errors_only;
+
+	struct clar_error *errors;
+	struct clar_error *last_error;
+
+	void (*local_cleanup)(void *);
+	void *local_cleanup_payload;
+
+	jmp_buf trampoline;
+	int trampoline_enabled;
+} _clar;
+
+struct clar_func {
+	const char *name;
+	void (*ptr)(void);
+};
+
+struct clar_suite {
+	int index;
+	const char *name;
+	struct clar_func initialize;
+	struct clar_func cleanup;
+	const struct clar_func *tests;
+	size_t test_count;
+};
+
+/* From clar_print_*.c */
+static void clar_print_init(int test_count, int suite_count, const char *suite_names);
+static void clar_print_shutdown(int test_count, int suite_count, int error_count);
+static void clar_print_error(int num, const struct clar_error *error);
+static void clar_print_ontest(const char *test_name, int test_number, int failed);
+static void clar_print_onsuite(const char *suite_name, int suite_index);
+static void clar_print_onabort(const char *msg, ...);
+
+/* From clar_sandbox.c */
+static void clar_unsandbox(void);
+static int clar_sandbox(void);
+
+/* Event callback overrides */
+#define clar_on_test() /* nop */
+#define clar_on_suite() /* nop */
+
+/* Autogenerated test data by clar */
+static const struct clar_func _clar_cb_attr_file[] = {
+    {"assign_variants", &test_attr_file__assign_variants},
+	{"check_attr_examples", &test_attr_file__check_attr_examples},
+	{"match_variants", &test_attr_file__match_variants},
+	{"simple_read", &test_attr_file__simple_read}
+};
+static const struct clar_func _clar_cb_attr_flags[] = {
+    {"bare", &test_attr_flags__bare},
+	{"index_vs_workdir", &test_attr_flags__index_vs_workdir},
+	{"subdir", &test_attr_flags__subdir}
+};
+static const struct clar_func _clar_cb_attr_lookup[] = {
+    {"assign_variants", &test_attr_lookup__assign_variants},
+	{"check_attr_examples", &test_attr_lookup__check_attr_examples},
+	{"from_buffer", &test_attr_lookup__from_buffer},
+	{"match_variants", &test_attr_lookup__match_variants},
+	{"simple", &test_attr_lookup__simple}
+};
+static const struct clar_func _clar_cb_attr_repo[] = {
+    {"bad_macros", &test_attr_repo__bad_macros},
+	{"foreach", &test_attr_repo__foreach},
+	{"get_many", &test_attr_repo__get_many},
+	{"get_one", &test_attr_repo__get_one},
+	{"macros", &test_attr_repo__macros},
+	{"manpage_example", &test_attr_repo__manpage_example},
+	{"staging_properly_normalizes_line_endings_according_to_gitattributes_directives", &test_attr_repo__staging_properly_normalizes_line_endings_according_to_gitattributes_directives}
+};
+static const struct clar_func _clar_cb_buf_basic[] = {
+    {"printf", &test_buf_basic__printf},
+	{"resize", &test_buf_basic__resize}
+};
+static const struct clar_func _clar_cb_checkout_index[] = {
+    {"can_create_missing_files", &test_checkout_index__can_create_missing_files},
+	{"can_notify_of_skipped_files", &test_checkout_index__can_notify_of_skipped_files},
+	{"can_overwrite_modified_file", &test_checkout_index__can_overwrite_modified_file},
+	{"can_remove_untracked_files", &test_checkout_index__can_remove_untracked_files},
+	{"can_stream_large_files_through_the_filters", &test_checkout_index__can_stream_large_files_through_the_filters},
+	{"can_write_files_on_several_threads", &test_checkout_index__can_write_files_on_several_threads},
+	{"cannot_checkout_a_bare_repository", &test_checkout_index__cannot_checkout_a_bare_repository},
+	{"donot_overwrite_modified_file_by_default", &test_checkout_index__donot_overwrite_modified_file_by_default},
+	{"honor_coreautocrlf_setting_set_to_true", &test_checkout_index__honor_coreautocrlf_setting_set_to_true},
+	{"honor_coresymlinks_setting_set_to_false", &test_checkout_index__honor_coresymlinks_setting_set_to_false},
+	{"honor_coresymlinks_setting_set_to_true", &test_checkout_index__honor_coresymlinks_setting_set_to_true},
+	{"honor_the_gitattributes_directives", &test_checkout_index__honor_the_gitattributes_directives},
+	{"honor_the_specified_pathspecs", &test_checkout_index__honor_the_specified_pathspecs},
+	{"options_dir_modes", &test_checkout_index__options_dir_modes},
+	{"options_disable_filters", &test_checkout_index__options_disable_filters},
+	{"options_open_flags", &test_checkout_index__options_open_flags},
+	{"options_override_file_modes", &test_checkout_index__options_override_file_modes},
+	{"records_the_stat_data_of_the_files_it_writes", &test_checkout_index__records_the_stat_data_of_the_files_it_writes},
+	{"reports_errors_from_several_threads", &test_checkout_index__reports_errors_from_several_threads},
+	{"wont_notify_of_expected_line_ending_changes", &test_checkout_index__wont_notify_of_expected_line_ending_changes}
+};
+static const struct clar_func _clar_cb_checkout_sparse[] = {
+    {"disabling_brings_the_files_back", &test_checkout_sparse__disabling_brings_the_files_back},
+	{"files_outside_of_the_cone_are_removed", &test_checkout_sparse__files_outside_of_the_cone_are_removed},
+	{"modified_files_are_kept", &test_checkout_sparse__modified_files_are_kept},
+	{"only_cone_patterns_are_understood", &test_checkout_sparse__only_cone_patterns_are_understood},
+	{"patterns_are_written_in_cone_mode", &test_checkout_sparse__patterns_are_written_in_cone_mode},
+	{"sparse_dirs_are_expanded_on_demand", &test_checkout_sparse__sparse_dirs_are_expanded_on_demand},
+	{"sparse_index_collapses_directories", &test_checkout_sparse__sparse_index_collapses_directories},
+	{"widening_the_cone_expands_the_index", &test_checkout_sparse__widening_the_cone_expands_the_index}
+};
+static const struct clar_func _clar_cb_checkout_tree[] = {
+    {"can_checkout_a_subdirectory_from_a_commit", &test_checkout_tree__can_checkout_a_subdirectory_from_a_commit},
+	{"can_checkout_a_subdirectory_from_a_subtree", &test_checkout_tree__can_checkout_a_subdirectory_from_a_subtree},
+	{"cannot_checkout_a_non_treeish", &test_checkout_tree__cannot_checkout_a_non_treeish}
+};
+static const struct clar_func _clar_cb_clone_clone[] = {
+    {"already_exists", &test_clone_clone__already_exists},
+	{"bad_url", &test_clone_clone__bad_url},
+	{"local", &test_clone_clone__local},
+	{"network_bare", &test_clone_clone__network_bare},
+	{"network_full", &test_clone_clone__network_full}
+};
+static const struct clar_func _clar_cb_commit_commit[] = {
+    {"create_unexisting_update_ref", &test_commit_commit__create_unexisting_update_ref}
+};
+static const struct clar_func _clar_cb_commit_parent[] = {
+    {"can_retrieve_nth_generation_parent", &test_commit_parent__can_retrieve_nth_generation_parent}
+};
+static const struct clar_func _clar_cb_commit_parse[] = {
+    {"details0", &test_commit_parse__details0},
+	{"entire_commit", &test_commit_parse__entire_commit},
+	{"header", &test_commit_parse__header},
+	{"lazy_fields", &test_commit_parse__lazy_fields},
+	{"signature", &test_commit_parse__signature}
+};
+static const struct clar_func _clar_cb_commit_signature[] = {
+    {"angle_brackets_in_email_are_not_supported", &test_commit_signature__angle_brackets_in_email_are_not_supported},
+	{"angle_brackets_in_names_are_not_supported", &test_commit_signature__angle_brackets_in_names_are_not_supported},
+	{"create_empties", &test_commit_signature__create_empties},
+	{"create_one_char", &test_commit_signature__create_one_char},
+	{"create_two_char", &test_commit_signature__create_two_char},
+	{"create_zero_char", &test_commit_signature__create_zero_char},
+	{"leading_and_trailing_spaces_are_trimmed", &test_commit_signature__leading_and_trailing_spaces_are_trimmed}
+};
+static const struct clar_func _clar_cb_commit_write[] = {
+    {"from_memory", &test_commit_write__from_memory},
+	{"root", &test_commit_write__root}
+};
+static const struct clar_func _clar_cb_config_add[] = {
+    {"to_existing_section", &test_config_add__to_existing_section},
+	{"to_new_section", &test_config_add__to_new_section}
+};
+static const struct clar_func _clar_cb_config_multivar[] = {
+    {"add", &test_config_multivar__add},
+	{"foreach", &test_config_multivar__foreach},
+	{"get", &test_config_multivar__get},
+	{"replace", &test_config_multivar__replace},
+	{"replace_multiple", &test_config_multivar__replace_multiple}
+};
+static const struct clar_func _clar_cb_config_new[] = {
+    {"write_new_config", &test_config_new__write_new_config}
+};
+static const struct clar_func _clar_cb_config_read[] = {
+    {"blank_lines", &test_config_read__blank_lines},
+	{"case_sensitive", &test_config_read__case_sensitive},
+	{"empty_files", &test_config_read__empty_files},
+	{"escaping_quotes", &test_config_read__escaping_quotes},
+	{"foreach", &test_config_read__foreach},
+	{"foreach_match", &test_config_read__foreach_match},
+	{"header_in_last_line", &test_config_read__header_in_last_line},
+	{"invalid_ext_headers", &test_config_read__invalid_ext_headers},
+	{"lone_variable", &test_config_read__lone_variable},
+	{"multiline_value", &test_config_read__multiline_value},
+	{"number_suffixes", &test_config_read__number_suffixes},
+	{"prefixes", &test_config_read__prefixes},
+	{"simple_read", &test_config_read__simple_read},
+	{"subsection_header", &test_config_read__subsection_header},
+	{"whitespace_not_required_around_assignment", &test_config_read__whitespace_not_required_around_assignment}
+};
+static const struct clar_func _clar_cb_config_stress[] = {
+    {"comments", &test_config_stress__comments},
+	{"dont_break_on_invalid_input", &test_config_stress__dont_break_on_invalid_input},
+	{"escape_subsection_names", &test_config_stress__escape_subsection_names}
+};
+static const struct clar_func _clar_cb_config_write[] = {
+    {"delete_inexistent", &test_config_write__delete_inexistent},
+	{"delete_value", &test_config_write__delete_value},
+	{"escape_value", &test_config_write__escape_value},
+	{"replace_value", &test_config_write__replace_value},
+	{"value_containing_quotes", &test_config_write__value_containing_quotes},
+	{"write_subsection", &test_config_write__write_subsection}
+};
+static const struct clar_func _clar_cb_core_buffer[] = {
+    {"0", &test_core_buffer__0},
+	{"1", &test_core_buffer__1},
+	{"10", &test_core_buffer__10},
+	{"11", &test_core_buffer__11},
+	{"2", &test_core_buffer__2},
+	{"3", &test_core_buffer__3},
+	{"4", &test_core_buffer__4},
+	{"5", &test_core_buffer__5},
+	{"6", &test_core_buffer__6},
+	{"7", &test_core_buffer__7},
+	{"8", &test_core_buffer__8},
+	{"9", &test_core_buffer__9},
+	{"puts_escaped", &test_core_buffer__puts_escaped},
+	{"rfind_variants", &test_core_buffer__rfind_variants},
+	{"unescape", &test_core_buffer__unescape}
+};
+static const struct clar_func _clar_cb_core_copy[] = {
+    {"file", &test_core_copy__file},
+	{"file_in_dir", &test_core_copy__file_in_dir},
+	{"tree", &test_core_copy__tree}
+};
+static const struct clar_func _clar_cb_core_dirent[] = {
+    {"dont_traverse_dot", &test_core_dirent__dont_traverse_dot},
+	{"dont_traverse_empty_folders", &test_core_dirent__dont_traverse_empty_folders},
+	{"length_limits", &test_core_dirent__length_limits},
+	{"traverse_slash_terminated_folder", &test_core_dirent__traverse_slash_terminated_folder},
+	{"traverse_subfolder", &test_core_dirent__traverse_subfolder},
+	{"traverse_weird_filenames", &test_core_dirent__traverse_weird_filenames}
+};
+static const struct clar_func _clar_cb_core_env[] = {
+    {"0", &test_core_env__0},
+	{"1", &test_core_env__1}
+};
+static const struct clar_func _clar_cb_core_errors[] = {
+    {"new_school", &test_core_errors__new_school}
+};
+static const struct clar_func _clar_cb_core_filebuf[] = {
+    {"0", &test_core_filebuf__0},
+	{"1", &test_core_filebuf__1},
+	{"2", &test_core_filebuf__2},
+	{"4", &test_core_filebuf__4},
+	{"5", &test_core_filebuf__5}
+};
+static const struct clar_func _clar_cb_core_hex[] = {
+    {"fromhex", &test_core_hex__fromhex}
+};
+static const struct clar_func _clar_cb_core_mkdir[] = {
+    {"basic", &test_core_mkdir__basic},
+	{"chmods", &test_core_mkdir__chmods},
+	{"with_base", &test_core_mkdir__with_base}
+};
+static const struct clar_func _clar_cb_core_oid[] = {
+    {"streq", &test_core_oid__streq}
+};
+static const struct clar_func _clar_cb_core_path[] = {
+    {"00_dirname", &test_core_path__00_dirname},
+	{"01_basename", &test_core_path__01_basename},
+	{"02_topdir", &test_core_path__02_topdir},
+	{"05_joins", &test_core_path__05_joins},
+	{"06_long_joins", &test_core_path__06_long_joins},
+	{"07_path_to_dir", &test_core_path__07_path_to_dir},
+	{"08_self_join", &test_core_path__08_self_join},
+	{"09_percent_decode", &test_core_path__09_percent_decode},
+	{"10_fromurl", &test_core_path__10_fromurl},
+	{"11_walkup", &test_core_path__11_walkup},
+	{"12_offset_to_path_root", &test_core_path__12_offset_to_path_root},
+	{"13_cannot_prettify_a_non_existing_file", &test_core_path__13_cannot_prettify_a_non_existing_file},
+	{"14_apply_relative", &test_core_path__14_apply_relative}
+};
+static const struct clar_func _clar_cb_core_pool[] = {
+    {"0", &test_core_pool__0},
+	{"1", &test_core_pool__1},
+	{"2", &test_core_pool__2}
+};
+static const struct clar_func _clar_cb_core_rmdir[] = {
+    {"can_skip__non_empty_dir", &test_core_rmdir__can_skip__non_empty_dir},
+	{"delete_recursive", &test_core_rmdir__delete_recursive},
+	{"fail_to_delete_non_empty_dir", &test_core_rmdir__fail_to_delete_non_empty_dir}
+};
+static const struct clar_func _clar_cb_core_string[] = {
+    {"0", &test_core_string__0},
+	{"1", &test_core_string__1}
+};
+static const struct clar_func _clar_cb_core_strmap[] = {
+    {"0", &test_core_strmap__0},
+	{"1", &test_core_strmap__1},
+	{"2", &test_core_strmap__2},
+	{"3", &test_core_strmap__3}
+};
+static const struct clar_func _clar_cb_core_strtol[] = {
+    {"int32", &test_core_strtol__int32},
+	{"int64", &test_core_strtol__int64}
+};
+static const struct clar_func _clar_cb_core_vector[] = {
+    {"0", &test_core_vector__0},
+	{"1", &test_core_vector__1},
+	{"2", &test_core_vector__2},
+	{"3", &test_core_vector__3},
+	{"4", &test_core_vector__4},
+	{"5", &test_core_vector__5}
+};
+static const struct clar_func _clar_cb_date_date[] = {
+    {"overflow", &test_date_date__overflow}
+};
+static const struct clar_func _clar_cb_diff_blob[] = {
+    {"can_compare_a_binary_blob_and_a_text_blob", &test_diff_blob__can_compare_a_binary_blob_and_a_text_blob},
+	{"can_compare_against_null_blobs", &test_diff_blob__can_compare_against_null_blobs},
+	{"can_compare_identical_blobs", &test_diff_blob__can_compare_identical_blobs},
+	{"can_compare_text_blobs", &test_diff_blob__can_compare_text_blobs},
+	{"can_compare_two_binary_blobs", &test_diff_blob__can_compare_two_binary_blobs},
+	{"can_use_the_patience_and_histogram_algorithms", &test_diff_blob__can_use_the_patience_and_histogram_algorithms},
+	{"comparing_two_text_blobs_honors_interhunkcontext", &test_diff_blob__comparing_two_text_blobs_honors_interhunkcontext}
+};
+static const struct clar_func _clar_cb_diff_diffiter[] = {
+    {"create", &test_diff_diffiter__create},
+	{"iterate_files", &test_diff_diffiter__iterate_files},
+	{"iterate_files_2", &test_diff_diffiter__iterate_files_2},
+	{"iterate_files_and_hunks", &test_diff_diffiter__iterate_files_and_hunks},
+	{"max_size_threshold", &test_diff_diffiter__max_size_threshold}
+};
+static const struct clar_func _clar_cb_diff_index[] = {
+    {"0", &test_diff_index__0},
+	{"1", &test_diff_index__1}
+};
+static const struct clar_func _clar_cb_diff_iterator[] = {
+    {"index_0", &test_diff_iterator__index_0},
+	{"index_1", &test_diff_iterator__index_1},
+	{"index_range", &test_diff_iterator__index_range},
+	{"index_range_empty_0", &test_diff_iterator__index_range_empty_0},
+	{"index_range_empty_1", &test_diff_iterator__index_range_empty_1},
+	{"index_range_empty_2", &test_diff_iterator__index_range_empty_2},
+	{"tree_0", &test_diff_iterator__tree_0},
+	{"tree_1", &test_diff_iterator__tree_1},
+	{"tree_2", &test_diff_iterator__tree_2},
+	{"tree_3", &test_diff_iterator__tree_3},
+	{"tree_4", &test_diff_iterator__tree_4},
+	{"tree_4_ranged", &test_diff_iterator__tree_4_ranged},
+	{"tree_range_empty_0", &test_diff_iterator__tree_range_empty_0},
+	{"tree_range_empty_1", &test_diff_iterator__tree_range_empty_1},
+	{"tree_range_empty_2", &test_diff_iterator__tree_range_empty_2},
+	{"tree_ranged_0", &test_diff_iterator__tree_ranged_0},
+	{"tree_ranged_1", &test_diff_iterator__tree_ranged_1},
+	{"tree_with_trees_enters_what_is_asked_for", &test_diff_iterator__tree_with_trees_enters_what_is_asked_for},
+	{"tree_with_trees_skips_what_is_not_entered", &test_diff_iterator__tree_with_trees_skips_what_is_not_entered},
+	{"workdir_0", &test_diff_iterator__workdir_0},
+	{"workdir_1", &test_diff_iterator__workdir_1},
+	{"workdir_1_ranged_0", &test_diff_iterator__workdir_1_ranged_0},
+	{"workdir_1_ranged_1", &test_diff_iterator__workdir_1_ranged_1},
+	{"workdir_1_ranged_3", &test_diff_iterator__workdir_1_ranged_3},
+	{"workdir_1_ranged_4", &test_diff_iterator__workdir_1_ranged_4},
+	{"workdir_1_ranged_5", &test_diff_iterator__workdir_1_ranged_5},
+	{"workdir_1_ranged_empty_0", &test_diff_iterator__workdir_1_ranged_empty_0},
+	{"workdir_1_ranged_empty_1", &test_diff_iterator__workdir_1_ranged_empty_1},
+	{"workdir_1_ranged_empty_2", &test_diff_iterator__workdir_1_ranged_empty_2}
+};
+static const struct clar_func _clar_cb_diff_patch[] = {
+    {"can_properly_display_the_removal_of_a_file", &test_diff_patch__can_properly_display_the_removal_of_a_file}
+};
+static const struct clar_func _clar_cb_diff_rename[] = {
+    {"finds_copies_of_unmodified_files", &test_diff_rename__finds_copies_of_unmodified_files},
+	{"finds_renames_by_default", &test_diff_rename__finds_renames_by_default},
+	{"honors_the_threshold", &test_diff_rename__honors_the_threshold},
+	{"only_pairs_identical_files_past_the_limit", &test_diff_rename__only_pairs_identical_files_past_the_limit},
+	{"prints_both_paths", &test_diff_rename__prints_both_paths},
+	{"prints_the_rename_in_the_patch", &test_diff_rename__prints_the_rename_in_the_patch}
+};
+static const struct clar_func _clar_cb_diff_tree[] = {
+    {"0", &test_diff_tree__0},
+	{"bare", &test_diff_tree__bare},
+	{"equal_subtrees_are_not_read", &test_diff_tree__equal_subtrees_are_not_read},
+	{"file_callbacks_do_not_read_the_blobs", &test_diff_tree__file_callbacks_do_not_read_the_blobs},
+	{"larger_hunks", &test_diff_tree__larger_hunks},
+	{"merge", &test_diff_tree__merge},
+	{"options", &test_diff_tree__options},
+	{"patches_computed_on_several_threads_come_in_order", &test_diff_tree__patches_computed_on_several_threads_come_in_order},
+	{"stats_match_the_line_counts", &test_diff_tree__stats_match_the_line_counts}
+};
+static const struct clar_func _clar_cb_diff_words[] = {
+    {"diffs_the_changed_lines_word_by_word", &test_diff_words__diffs_the_changed_lines_word_by_word},
+	{"lines_added_or_removed_whole", &test_diff_words__lines_added_or_removed_whole},
+	{"rejects_a_bad_regex", &test_diff_words__rejects_a_bad_regex},
+	{"reports_hunks_and_stops_on_request", &test_diff_words__reports_hunks_and_stops_on_request},
+	{"runs_of_whitespace_do_not_count", &test_diff_words__runs_of_whitespace_do_not_count},
+	{"uses_the_word_regex", &test_diff_words__uses_the_word_regex}
+};
+static const struct clar_func _clar_cb_diff_workdir[] = {
+    {"eof_newline_changes", &test_diff_workdir__eof_newline_changes},
+	{"filemode_changes", &test_diff_workdir__filemode_changes},
+	{"filemode_changes_with_filemode_false", &test_diff_workdir__filemode_changes_with_filemode_false},
+	{"head_index_and_workdir_all_differ", &test_diff_workdir__head_index_and_workdir_all_differ},
+	{"larger_hunks", &test_diff_workdir__larger_hunks},
+	{"to_index", &test_diff_workdir__to_index},
+	{"to_index_with_pathspec", &test_diff_workdir__to_index_with_pathspec},
+	{"to_tree", &test_diff_workdir__to_tree}
+};
+static const struct clar_func _clar_cb_index_filemodes[] = {
+    {"read", &test_index_filemodes__read},
+	{"trusted", &test_index_filemodes__trusted},
+	{"untrusted", &test_index_filemodes__untrusted}
+};
+static const struct clar_func _clar_cb_index_offsets[] = {
+    {"entries_read_from_disk_can_be_replaced", &test_index_offsets__entries_read_from_disk_can_be_replaced},
+	{"more_threads_than_blocks", &test_index_offsets__more_threads_than_blocks},
+	{"read_blocks_written_by_git", &test_index_offsets__read_blocks_written_by_git},
+	{"read_v4_blocks_written_by_git", &test_index_offsets__read_v4_blocks_written_by_git},
+	{"write_blocks", &test_index_offsets__write_blocks},
+	{"write_v4_blocks", &test_index_offsets__write_v4_blocks}
+};
+static const struct clar_func _clar_cb_index_read_tree[] = {
+    {"read_write_involution", &test_index_read_tree__read_write_involution}
+};
+static const struct clar_func _clar_cb_index_rename[] = {
+    {"single_file", &test_index_rename__single_file}
+};
+static const struct clar_func _clar_cb_index_splitindex[] = {
+    {"many_changes_write_a_new_shared_index", &test_index_splitindex__many_changes_write_a_new_shared_index},
+	{"missing_shared_index_fails", &test_index_splitindex__missing_shared_index_fails},
+	{"read", &test_index_splitindex__read},
+	{"small_changes_keep_the_shared_index", &test_index_splitindex__small_changes_keep_the_shared_index},
+	{"unsplit", &test_index_splitindex__unsplit}
+};
+static const struct clar_func _clar_cb_index_tests[] = {
+    {"add", &test_index_tests__add},
+	{"default_test_index", &test_index_tests__default_test_index},
+	{"empty_index", &test_index_tests__empty_index},
+	{"find_in_empty", &test_index_tests__find_in_empty},
+	{"find_in_existing", &test_index_tests__find_in_existing},
+	{"gitgit_index", &test_index_tests__gitgit_index},
+	{"sort0", &test_index_tests__sort0},
+	{"sort1", &test_index_tests__sort1},
+	{"write", &test_index_tests__write}
+};
+static const struct clar_func _clar_cb_index_tree_cache[] = {
+    {"is_filled_and_written_out", &test_index_tree_cache__is_filled_and_written_out},
+	{"removed_subtrees_are_dropped", &test_index_tree_cache__removed_subtrees_are_dropped},
+	{"unchanged_subtrees_are_reused", &test_index_tree_cache__unchanged_subtrees_are_reused}
+};
+static const struct clar_func _clar_cb_index_version[] = {
+    {"new_index_defaults_to_v2", &test_index_version__new_index_defaults_to_v2},
+	{"read_v4_written_by_git", &test_index_version__read_v4_written_by_git},
+	{"v4_round_trips_back_to_v2", &test_index_version__v4_round_trips_back_to_v2},
+	{"write_v4", &test_index_version__write_v4}
+};
+static const struct clar_func _clar_cb_network_createremotethenload[] = {
+    {"parsing", &test_network_createremotethenload__parsing}
+};
+static const struct clar_func _clar_cb_network_remotelocal[] = {
+    {"connected", &test_network_remotelocal__connected},
+	{"nested_tags_are_completely_peeled", &test_network_remotelocal__nested_tags_are_completely_peeled},
+	{"retrieve_advertised_references", &test_network_remotelocal__retrieve_advertised_references},
+	{"retrieve_advertised_references_from_spaced_repository", &test_network_remotelocal__retrieve_advertised_references_from_spaced_repository}
+};
+static const struct clar_func _clar_cb_network_remotes[] = {
+    {"add", &test_network_remotes__add},
+	{"fnmatch", &test_network_remotes__fnmatch},
+	{"list", &test_network_remotes__list},
+	{"loading_a_missing_remote_returns_ENOTFOUND", &test_network_remotes__loading_a_missing_remote_returns_ENOTFOUND},
+	{"missing_refspecs", &test_network_remotes__missing_refspecs},
+	{"parsing", &test_network_remotes__parsing},
+	{"parsing_local_path_fails_if_path_not_found", &test_network_remotes__parsing_local_path_fails_if_path_not_found},
+	{"parsing_ssh_remote", &test_network_remotes__parsing_ssh_remote},
+	{"pushurl", &test_network_remotes__pushurl},
+	{"refspec_parsing", &test_network_remotes__refspec_parsing},
+	{"save", &test_network_remotes__save},
+	{"set_fetchspec", &test_network_remotes__set_fetchspec},
+	{"set_pushspec", &test_network_remotes__set_pushspec},
+	{"supported_transport_methods_are_supported", &test_network_remotes__supported_transport_methods_are_supported},
+	{"transform", &test_network_remotes__transform},
+	{"transform_r", &test_network_remotes__transform_r},
+	{"unsupported_transport_methods_are_unsupported", &test_network_remotes__unsupported_transport_methods_are_unsupported}
+};
+static const struct clar_func _clar_cb_notes_notes[] = {
+    {"can_cancel_foreach", &test_notes_notes__can_cancel_foreach},
+	{"can_insert_a_note_in_an_existing_fanout", &test_notes_notes__can_insert_a_note_in_an_existing_fanout},
+	{"can_insert_a_note_with_a_custom_namespace", &test_notes_notes__can_insert_a_note_with_a_custom_namespace},
+	{"can_read_a_note_in_an_existing_fanout", &test_notes_notes__can_read_a_note_in_an_existing_fanout},
+	{"can_remove_a_note_in_an_existing_fanout", &test_notes_notes__can_remove_a_note_in_an_existing_fanout},
+	{"can_retrieve_a_list_of_notes_for_a_given_namespace", &test_notes_notes__can_retrieve_a_list_of_notes_for_a_given_namespace},
+	{"creating_a_note_on_a_target_which_already_has_one_returns_EEXISTS", &test_notes_notes__creating_a_note_on_a_target_which_already_has_one_returns_EEXISTS},
+	{"inserting_a_note_without_passing_a_namespace_uses_the_default_namespace", &test_notes_notes__inserting_a_note_without_passing_a_namespace_uses_the_default_namespace},
+	{"removing_a_note_which_doesnt_exists_returns_ENOTFOUND", &test_notes_notes__removing_a_note_which_doesnt_exists_returns_ENOTFOUND},
+	{"retrieving_a_list_of_notes_for_an_unknown_namespace_returns_ENOTFOUND", &test_notes_notes__retrieving_a_list_of_notes_for_an_unknown_namespace_returns_ENOTFOUND}
+};
+static const struct clar_func _clar_cb_notes_notesref[] = {
+    {"config_corenotesref", &test_notes_notesref__config_corenotesref}
+};
+static const struct clar_func _clar_cb_object_blob_filter[] = {
+    {"stats", &test_object_blob_filter__stats},
+	{"to_odb", &test_object_blob_filter__to_odb},
+	{"unfiltered", &test_object_blob_filter__unfiltered}
+};
+static const struct clar_func _clar_cb_object_blob_fromchunks[] = {
+    {"can_create_a_blob_from_a_in_memory_chunk_provider", &test_object_blob_fromchunks__can_create_a_blob_from_a_in_memory_chunk_provider},
+	{"creating_a_blob_from_chunks_honors_the_attributes_directives", &test_object_blob_fromchunks__creating_a_blob_from_chunks_honors_the_attributes_directives}
+};
+static const struct clar_func _clar_cb_object_blob_write[] = {
+    {"can_create_a_blob_in_a_bare_repo_from_a_absolute_filepath", &test_object_blob_write__can_create_a_blob_in_a_bare_repo_from_a_absolute_filepath},
+	{"can_create_a_blob_in_a_standard_repo_from_a_absolute_filepath_pointing_outside_of_the_working_directory", &test_object_blob_write__can_create_a_blob_in_a_standard_repo_from_a_absolute_filepath_pointing_outside_of_the_working_directory},
+	{"can_create_a_blob_in_a_standard_repo_from_a_file_located_in_the_working_directory", &test_object_blob_write__can_create_a_blob_in_a_standard_repo_from_a_file_located_in_the_working_directory}
+};
+static const struct clar_func _clar_cb_object_commit_commitstagedfile[] = {
+    {"generate_predictable_object_ids", &test_object_commit_commitstagedfile__generate_predictable_object_ids},
+	{"message_prettify", &test_object_commit_commitstagedfile__message_prettify}
+};
+static const struct clar_func _clar_cb_object_lookup[] = {
+    {"lookup_nonexisting_returns_enotfound", &test_object_lookup__lookup_nonexisting_returns_enotfound},
+	{"lookup_wrong_type_by_abbreviated_id_returns_enotfound", &test_object_lookup__lookup_wrong_type_by_abbreviated_id_returns_enotfound},
+	{"lookup_wrong_type_eventually_returns_enotfound", &test_object_lookup__lookup_wrong_type_eventually_returns_enotfound},
+	{"lookup_wrong_type_returns_enotfound", &test_object_lookup__lookup_wrong_type_returns_enotfound}
+};
+static const struct clar_func _clar_cb_object_message[] = {
+    {"consecutive_blank_lines_at_the_beginning_should_be_removed", &test_object_message__consecutive_blank_lines_at_the_beginning_should_be_removed},
+	{"consecutive_blank_lines_at_the_end_should_be_removed", &test_object_message__consecutive_blank_lines_at_the_end_should_be_removed},
+	{"consecutive_blank_lines_should_be_unified", &test_object_message__consecutive_blank_lines_should_be_unified},
+	{"consecutive_text_lines_should_be_unchanged", &test_object_message__consecutive_text_lines_should_be_unchanged},
+	{"keep_comments", &test_object_message__keep_comments},
+	{"lines_with_intermediate_spaces_should_be_unchanged", &test_object_message__lines_with_intermediate_spaces_should_be_unchanged},
+	{"lines_with_spaces_at_the_beginning_should_be_unchanged", &test_object_message__lines_with_spaces_at_the_beginning_should_be_unchanged},
+	{"long_lines_without_spaces_should_be_unchanged", &test_object_message__long_lines_without_spaces_should_be_unchanged},
+	{"only_consecutive_blank_lines_should_be_completely_removed", &test_object_message__only_consecutive_blank_lines_should_be_completely_removed},
+	{"spaces_with_newline_at_end_should_be_replaced_with_empty_string", &test_object_message__spaces_with_newline_at_end_should_be_replaced_with_empty_string},
+	{"spaces_without_newline_at_end_should_be_replaced_with_empty_string", &test_object_message__spaces_without_newline_at_end_should_be_replaced_with_empty_string},
+	{"strip_comments", &test_object_message__strip_comments},
+	{"text_plus_spaces_ending_with_newline_should_be_cleaned_and_newline_must_remain", &test_object_message__text_plus_spaces_ending_with_newline_should_be_cleaned_and_newline_must_remain},
+	{"text_plus_spaces_without_newline_should_not_show_spaces_and_end_with_newline", &test_object_message__text_plus_spaces_without_newline_should_not_show_spaces_and_end_with_newline},
+	{"text_without_newline_at_end_should_end_with_newline", &test_object_message__text_without_newline_at_end_should_end_with_newline}
+};
+static const struct clar_func _clar_cb_object_peel[] = {
+    {"can_peel_a_commit", &test_object_peel__can_peel_a_commit},
+	{"can_peel_a_tag", &test_object_peel__can_peel_a_tag},
+	{"cannot_peel_a_blob", &test_object_peel__cannot_peel_a_blob},
+	{"cannot_peel_a_tree", &test_object_peel__cannot_peel_a_tree},
+	{"peeling_an_object_into_its_own_type_returns_another_instance_of_it", &test_object_peel__peeling_an_object_into_its_own_type_returns_another_instance_of_it},
+	{"target_any_object_for_type_change", &test_object_peel__target_any_object_for_type_change}
+};
+static const struct clar_func _clar_cb_object_raw_chars[] = {
+    {"build_valid_oid_from_raw_bytes", &test_object_raw_chars__build_valid_oid_from_raw_bytes},
+	{"find_invalid_chars_in_oid", &test_object_raw_chars__find_invalid_chars_in_oid}
+};
+static const struct clar_func _clar_cb_object_raw_compare[] = {
+    {"compare_allocfmt_oids", &test_object_raw_compare__compare_allocfmt_oids},
+	{"compare_fmt_oids", &test_object_raw_compare__compare_fmt_oids},
+	{"compare_pathfmt_oids", &test_object_raw_compare__compare_pathfmt_oids},
+	{"succeed_on_copy_oid", &test_object_raw_compare__succeed_on_copy_oid},
+	{"succeed_on_oid_comparison_equal", &test_object_raw_compare__succeed_on_oid_comparison_equal},
+	{"succeed_on_oid_comparison_greater", &test_object_raw_compare__succeed_on_oid_comparison_greater},
+	{"succeed_on_oid_comparison_lesser", &test_object_raw_compare__succeed_on_oid_comparison_lesser}
+};
+static const struct clar_func _clar_cb_object_raw_convert[] = {
+    {"succeed_on_oid_to_string_conversion", &test_object_raw_convert__succeed_on_oid_to_string_conversion},
+	{"succeed_on_oid_to_string_conversion_big", &test_object_raw_convert__succeed_on_oid_to_string_conversion_big}
+};
+static const struct clar_func _clar_cb_object_raw_fromstr[] = {
+    {"fail_on_invalid_oid_string", &test_object_raw_fromstr__fail_on_invalid_oid_string},
+	{"succeed_on_valid_oid_string", &test_object_raw_fromstr__succeed_on_valid_oid_string}
+};
+static const struct clar_func _clar_cb_object_raw_hash[] = {
+    {"hash_buffer_in_single_call", &test_object_raw_hash__hash_buffer_in_single_call},
+	{"hash_by_blocks", &test_object_raw_hash__hash_by_blocks},
+	{"hash_commit_object", &test_object_raw_hash__hash_commit_object},
+	{"hash_junk_data", &test_object_raw_hash__hash_junk_data},
+	{"hash_multi_byte_object", &test_object_raw_hash__hash_multi_byte_object},
+	{"hash_one_byte_object", &test_object_raw_hash__hash_one_byte_object},
+	{"hash_tag_object", &test_object_raw_hash__hash_tag_object},
+	{"hash_tree_object", &test_object_raw_hash__hash_tree_object},
+	{"hash_two_byte_object", &test_object_raw_hash__hash_two_byte_object},
+	{"hash_vector", &test_object_raw_hash__hash_vector},
+	{"hash_zero_length_object", &test_object_raw_hash__hash_zero_length_object}
+};
+static const struct clar_func _clar_cb_object_raw_short[] = {
+    {"oid_shortener_no_duplicates", &test_object_raw_short__oid_shortener_no_duplicates},
+	{"oid_shortener_stresstest_git_oid_shorten", &test_object_raw_short__oid_shortener_stresstest_git_oid_shorten}
+};
+static const struct clar_func _clar_cb_object_raw_size[] = {
+    {"validate_oid_size", &test_object_raw_size__validate_oid_size}
+};
+static const struct clar_func _clar_cb_object_raw_type2string[] = {
+    {"check_type_is_loose", &test_object_raw_type2string__check_type_is_loose},
+	{"convert_string_to_type", &test_object_raw_type2string__convert_string_to_type},
+	{"convert_type_to_string", &test_object_raw_type2string__convert_type_to_string}
+};
+static const struct clar_func _clar_cb_object_raw_write[] = {
+    {"loose_object", &test_object_raw_write__loose_object},
+	{"loose_tag", &test_object_raw_write__loose_tag},
+	{"loose_tree", &test_object_raw_write__loose_tree},
+	{"one_byte", &test_object_raw_write__one_byte},
+	{"several_bytes", &test_object_raw_write__several_bytes},
+	{"two_byte", &test_object_raw_write__two_byte},
+	{"zero_length", &test_object_raw_write__zero_length}
+};
+static const struct clar_func _clar_cb_object_tag_peel[] = {
+    {"can_peel_several_nested_tags_to_a_commit", &test_object_tag_peel__can_peel_several_nested_tags_to_a_commit},
+	{"can_peel_to_a_commit", &test_object_tag_peel__can_peel_to_a_commit},
+	{"can_peel_to_a_non_commit", &test_object_tag_peel__can_peel_to_a_non_commit}
+};
+static const struct clar_func _clar_cb_object_tag_read[] = {
+    {"list", &test_object_tag_read__list},
+	{"list_pattern", &test_object_tag_read__list_pattern},
+	{"parse", &test_object_tag_read__parse},
+	{"parse_without_tagger", &test_object_tag_read__parse_without_tagger}
+};
+static const struct clar_func _clar_cb_object_tag_write[] = {
+    {"basic", &test_object_tag_write__basic},
+	{"delete", &test_object_tag_write__delete},
+	{"lightweight", &test_object_tag_write__lightweight},
+	{"lightweight_over_existing", &test_object_tag_write__lightweight_over_existing},
+	{"overwrite", &test_object_tag_write__overwrite},
+	{"replace", &test_object_tag_write__replace}
+};
+static const struct clar_func _clar_cb_object_tree_attributes[] = {
+    {"ensure_correctness_of_attributes_on_insertion", &test_object_tree_attributes__ensure_correctness_of_attributes_on_insertion},
+	{"group_writable_tree_entries_created_with_an_antique_git_version_can_still_be_accessed", &test_object_tree_attributes__group_writable_tree_entries_created_with_an_antique_git_version_can_still_be_accessed},
+	{"normalize_attributes_when_creating_a_tree_from_an_existing_one", &test_object_tree_attributes__normalize_attributes_when_creating_a_tree_from_an_existing_one},
+	{"normalize_attributes_when_inserting_in_a_new_tree", &test_object_tree_attributes__normalize_attributes_when_inserting_in_a_new_tree}
+};
+static const struct clar_func _clar_cb_object_tree_frompath[] = {
+    {"fail_when_processing_an_invalid_path", &test_object_tree_frompath__fail_when_processing_an_invalid_path},
+	{"retrieve_tree_from_path_to_treeentry", &test_object_tree_frompath__retrieve_tree_from_path_to_treeentry}
+};
+static const struct clar_func _clar_cb_object_tree_read[] = {
+    {"entries_are_materialized_on_demand", &test_object_tree_read__entries_are_materialized_on_demand},
+	{"loaded", &test_object_tree_read__loaded},
+	{"two", &test_object_tree_read__two}
+};
+static const struct clar_func _clar_cb_object_tree_walk[] = {
+    {"0", &test_object_tree_walk__0},
+	{"1", &test_object_tree_walk__1}
+};
+static const struct clar_func _clar_cb_object_tree_write[] = {
+    {"from_memory", &test_object_tree_write__from_memory},
+	{"sorted_subtrees", &test_object_tree_write__sorted_subtrees},
+	{"subtree", &test_object_tree_write__subtree}
+};
+static const struct clar_func _clar_cb_odb_foreach[] = {
+    {"foreach", &test_odb_foreach__foreach},
+	{"interrupt_foreach", &test_odb_foreach__interrupt_foreach},
+	{"one_pack", &test_odb_foreach__one_pack}
+};
+static const struct clar_func _clar_cb_odb_loose[] = {
+    {"exists", &test_odb_loose__exists},
+	{"simple_reads", &test_odb_loose__simple_reads}
+};
+static const struct clar_func _clar_cb_odb_mixed[] = {
+    {"dup_oid", &test_odb_mixed__dup_oid}
+};
+static const struct clar_func _clar_cb_odb_packed[] = {
+    {"mass_read", &test_odb_packed__mass_read},
+	{"read_header_0", &test_odb_packed__read_header_0},
+	{"read_header_1", &test_odb_packed__read_header_1},
+	{"read_stream_0", &test_odb_packed__read_stream_0},
+	{"read_stream_1", &test_odb_packed__read_stream_1}
+};
+static const struct clar_func _clar_cb_odb_packed_one[] = {
+    {"mass_read", &test_odb_packed_one__mass_read},
+	{"read_header_0", &test_odb_packed_one__read_header_0}
+};
+static const struct clar_func _clar_cb_odb_sorting[] = {
+    {"alternate_backends_sorting", &test_odb_sorting__alternate_backends_sorting},
+	{"basic_backends_sorting", &test_odb_sorting__basic_backends_sorting}
+};
+static const struct clar_func _clar_cb_refs_branches_create[] = {
+    {"can_create_a_local_branch", &test_refs_branches_create__can_create_a_local_branch},
+	{"can_force_create_over_an_existing_branch", &test_refs_branches_create__can_force_create_over_an_existing_branch},
+	{"can_not_create_a_branch_if_its_name_collide_with_an_existing_one", &test_refs_branches_create__can_not_create_a_branch_if_its_name_collide_with_an_existing_one},
+	{"can_not_create_a_branch_pointing_to_a_non_commit_object", &test_refs_branches_create__can_not_create_a_branch_pointing_to_a_non_commit_object},
+	{"creating_a_branch_targeting_a_tag_dereferences_it_to_its_commit", &test_refs_branches_create__creating_a_branch_targeting_a_tag_dereferences_it_to_its_commit}
+};
+static const struct clar_func _clar_cb_refs_branches_delete[] = {
+    {"can_delete_a_branch_pointed_at_by_detached_HEAD", &test_refs_branches_delete__can_delete_a_branch_pointed_at_by_detached_HEAD},
+	{"can_delete_a_local_branch", &test_refs_branches_delete__can_delete_a_local_branch},
+	{"can_delete_a_remote_branch", &test_refs_branches_delete__can_delete_a_remote_branch},
+	{"can_not_delete_a_branch_if_HEAD_is_missing", &test_refs_branches_delete__can_not_delete_a_branch_if_HEAD_is_missing},
+	{"can_not_delete_a_branch_pointed_at_by_HEAD", &test_refs_branches_delete__can_not_delete_a_branch_pointed_at_by_HEAD}
+};
+static const struct clar_func _clar_cb_refs_branches_foreach[] = {
+    {"can_cancel", &test_refs_branches_foreach__can_cancel},
+	{"retrieve_all_branches", &test_refs_branches_foreach__retrieve_all_branches},
+	{"retrieve_local_branches", &test_refs_branches_foreach__retrieve_local_branches},
+	{"retrieve_remote_branches", &test_refs_branches_foreach__retrieve_remote_branches},
+	{"retrieve_remote_symbolic_HEAD_when_present", &test_refs_branches_foreach__retrieve_remote_symbolic_HEAD_when_present}
+};
+static const struct clar_func _clar_cb_refs_branches_lookup[] = {
+    {"can_retrieve_a_local_branch", &test_refs_branches_lookup__can_retrieve_a_local_branch},
+	{"can_retrieve_a_remote_tracking_branch", &test_refs_branches_lookup__can_retrieve_a_remote_tracking_branch},
+	{"trying_to_retrieve_an_unknown_branch_returns_ENOTFOUND", &test_refs_branches_lookup__trying_to_retrieve_an_unknown_branch_returns_ENOTFOUND}
+};
+static const struct clar_func _clar_cb_refs_branches_move[] = {
+    {"can_force_move_over_an_existing_branch", &test_refs_branches_move__can_force_move_over_an_existing_branch},
+	{"can_move_a_local_branch", &test_refs_branches_move__can_move_a_local_branch},
+	{"can_move_a_local_branch_to_a_different_namespace", &test_refs_branches_move__can_move_a_local_branch_to_a_different_namespace},
+	{"can_move_a_local_branch_to_a_partially_colliding_namespace", &test_refs_branches_move__can_move_a_local_branch_to_a_partially_colliding_namespace},
+	{"can_not_move_a_branch_if_its_destination_name_collide_with_an_existing_one", &test_refs_branches_move__can_not_move_a_branch_if_its_destination_name_collide_with_an_existing_one},
+	{"can_not_move_a_non_branch", &test_refs_branches_move__can_not_move_a_non_branch}
+};
+static const struct clar_func _clar_cb_refs_branches_tracking[] = {
+    {"can_retrieve_the_local_tracking_reference_of_a_local_branch", &test_refs_branches_tracking__can_retrieve_the_local_tracking_reference_of_a_local_branch},
+	{"can_retrieve_the_remote_tracking_reference_of_a_local_branch", &test_refs_branches_tracking__can_retrieve_the_remote_tracking_reference_of_a_local_branch},
+	{"cannot_retrieve_a_remote_tracking_reference_from_a_non_branch", &test_refs_branches_tracking__cannot_retrieve_a_remote_tracking_reference_from_a_non_branch},
+	{"trying_to_retrieve_a_remote_tracking_reference_from_a_branch_with_no_fetchspec_returns_GIT_ENOTFOUND", &test_refs_branches_tracking__trying_to_retrieve_a_remote_tracking_reference_from_a_branch_with_no_fetchspec_returns_GIT_ENOTFOUND},
+	{"trying_to_retrieve_a_remote_tracking_reference_from_a_plain_local_branch_returns_GIT_ENOTFOUND", &test_refs_branches_tracking__trying_to_retrieve_a_remote_tracking_reference_from_a_plain_local_branch_returns_GIT_ENOTFOUND}
+};
+static const struct clar_func _clar_cb_refs_crashes[] = {
+    {"double_free", &test_refs_crashes__double_free}
+};
+static const struct clar_func _clar_cb_refs_create[] = {
+    {"deep_symbolic", &test_refs_create__deep_symbolic},
+	{"oid", &test_refs_create__oid},
+	{"oid_unknown", &test_refs_create__oid_unknown},
+	{"symbolic", &test_refs_create__symbolic}
+};
+static const struct clar_func _clar_cb_refs_delete[] = {
+    {"packed_loose", &test_refs_delete__packed_loose},
+	{"packed_only", &test_refs_delete__packed_only}
+};
+static const struct clar_func _clar_cb_refs_foreachglob[] = {
+    {"can_cancel", &test_refs_foreachglob__can_cancel},
+	{"retrieve_all_refs", &test_refs_foreachglob__retrieve_all_refs},
+	{"retrieve_local_branches", &test_refs_foreachglob__retrieve_local_branches},
+	{"retrieve_partially_named_references", &test_refs_foreachglob__retrieve_partially_named_references},
+	{"retrieve_remote_branches", &test_refs_foreachglob__retrieve_remote_branches}
+};
+static const struct clar_func _clar_cb_refs_list[] = {
+    {"all", &test_refs_list__all},
+	{"do_not_retrieve_references_which_name_end_with_a_lock_extension", &test_refs_list__do_not_retrieve_references_which_name_end_with_a_lock_extension},
+	{"symbolic_only", &test_refs_list__symbolic_only}
+};
+static const struct clar_func _clar_cb_refs_listall[] = {
+    {"from_repository_opened_through_gitdir_path", &test_refs_listall__from_repository_opened_through_gitdir_path},
+	{"from_repository_opened_through_workdir_path", &test_refs_listall__from_repository_opened_through_workdir_path}
+};
+static const struct clar_func _clar_cb_refs_lookup[] = {
+    {"oid", &test_refs_lookup__oid},
+	{"with_resolve", &test_refs_lookup__with_resolve}
+};
+static const struct clar_func _clar_cb_refs_normalize[] = {
+    {"buffer_has_to_be_big_enough_to_hold_the_normalized_version", &test_refs_normalize__buffer_has_to_be_big_enough_to_hold_the_normalized_version},
+	{"can_normalize_a_direct_reference_name", &test_refs_normalize__can_normalize_a_direct_reference_name},
+	{"can_normalize_some_specific_one_level_direct_reference_names", &test_refs_normalize__can_normalize_some_specific_one_level_direct_reference_names},
+	{"cannot_normalize_any_direct_reference_name", &test_refs_normalize__cannot_normalize_any_direct_reference_name},
+	{"jgit_suite", &test_refs_normalize__jgit_suite},
+	{"symbolic", &test_refs_normalize__symbolic}
+};
+static const struct clar_func _clar_cb_refs_overwrite[] = {
+    {"object_id", &test_refs_overwrite__object_id},
+	{"object_id_with_symbolic", &test_refs_overwrite__object_id_with_symbolic},
+	{"symbolic", &test_refs_overwrite__symbolic},
+	{"symbolic_with_object_id", &test_refs_overwrite__symbolic_with_object_id}
+};
+static const struct clar_func _clar_cb_refs_pack[] = {
+    {"empty", &test_refs_pack__empty},
+	{"loose", &test_refs_pack__loose}
+};
+static const struct clar_func _clar_cb_refs_peel[] = {
+    {"can_peel_a_branch", &test_refs_peel__can_peel_a_branch},
+	{"can_peel_a_symbolic_reference", &test_refs_peel__can_peel_a_symbolic_reference},
+	{"can_peel_a_tag", &test_refs_peel__can_peel_a_tag},
+	{"can_peel_into_any_non_tag_object", &test_refs_peel__can_peel_into_any_non_tag_object},
+	{"cannot_peel_into_a_non_existing_target", &test_refs_peel__cannot_peel_into_a_non_existing_target}
+};
+static const struct clar_func _clar_cb_refs_read[] = {
+    {"can_determine_if_a_reference_is_a_local_branch", &test_refs_read__can_determine_if_a_reference_is_a_local_branch},
+	{"chomped", &test_refs_read__chomped},
+	{"head_then_master", &test_refs_read__head_then_master},
+	{"loose_first", &test_refs_read__loose_first},
+	{"loose_tag", &test_refs_read__loose_tag},
+	{"master_then_head", &test_refs_read__master_then_head},
+	{"nested_symbolic", &test_refs_read__nested_symbolic},
+	{"nonexisting_tag", &test_refs_read__nonexisting_tag},
+	{"packed", &test_refs_read__packed},
+	{"symbolic", &test_refs_read__symbolic},
+	{"trailing", &test_refs_read__trailing},
+	{"unfound_return_ENOTFOUND", &test_refs_read__unfound_return_ENOTFOUND}
+};
+static const struct clar_func _clar_cb_refs_reflog_drop[] = {
+    {"can_drop_all_the_entries", &test_refs_reflog_drop__can_drop_all_the_entries},
+	{"can_drop_an_entry", &test_refs_reflog_drop__can_drop_an_entry},
+	{"can_drop_an_entry_and_rewrite_the_log_history", &test_refs_reflog_drop__can_drop_an_entry_and_rewrite_the_log_history},
+	{"can_drop_the_first_entry", &test_refs_reflog_drop__can_drop_the_first_entry},
+	{"can_drop_the_last_entry", &test_refs_reflog_drop__can_drop_the_last_entry},
+	{"can_drop_the_last_entry_and_rewrite_the_log_history", &test_refs_reflog_drop__can_drop_the_last_entry_and_rewrite_the_log_history},
+	{"can_persist_deletion_on_disk", &test_refs_reflog_drop__can_persist_deletion_on_disk},
+	{"dropping_a_non_exisiting_entry_from_the_log_returns_ENOTFOUND", &test_refs_reflog_drop__dropping_a_non_exisiting_entry_from_the_log_returns_ENOTFOUND}
+};
+static const struct clar_func _clar_cb_refs_reflog_reflog[] = {
+    {"append_then_read", &test_refs_reflog_reflog__append_then_read},
+	{"cannot_write_a_moved_reflog", &test_refs_reflog_reflog__cannot_write_a_moved_reflog},
+	{"reading_the_reflog_from_a_reference_with_no_log_returns_an_empty_one", &test_refs_reflog_reflog__reading_the_reflog_from_a_reference_with_no_log_returns_an_empty_one},
+	{"reference_has_reflog", &test_refs_reflog_reflog__reference_has_reflog},
+	{"renaming_the_reference_moves_the_reflog", &test_refs_reflog_reflog__renaming_the_reference_moves_the_reflog}
+};
+static const struct clar_func _clar_cb_refs_rename[] = {
+    {"force_loose", &test_refs_rename__force_loose},
+	{"force_loose_packed", &test_refs_rename__force_loose_packed},
+	{"invalid_name", &test_refs_rename__invalid_name},
+	{"loose", &test_refs_rename__loose},
+	{"move_up", &test_refs_rename__move_up},
+	{"name_collision", &test_refs_rename__name_collision},
+	{"overwrite", &test_refs_rename__overwrite},
+	{"packed", &test_refs_rename__packed},
+	{"packed_doesnt_pack_others", &test_refs_rename__packed_doesnt_pack_others},
+	{"prefix", &test_refs_rename__prefix}
+};
+static const struct clar_func _clar_cb_refs_revparse[] = {
+    {"a_too_short_objectid_returns_EAMBIGUOUS", &test_refs_revparse__a_too_short_objectid_returns_EAMBIGUOUS},
+	{"chaining", &test_refs_revparse__chaining},
+	{"colon", &test_refs_revparse__colon},
+	{"date", &test_refs_revparse__date},
+	{"describe_output", &test_refs_revparse__describe_output},
+	{"disambiguation", &test_refs_revparse__disambiguation},
+	{"full_refs", &test_refs_revparse__full_refs},
+	{"head", &test_refs_revparse__head},
+	{"invalid_reference_name", &test_refs_revparse__invalid_reference_name},
+	{"linear_history", &test_refs_revparse__linear_history},
+	{"nonexistant_object", &test_refs_revparse__nonexistant_object},
+	{"not_tag", &test_refs_revparse__not_tag},
+	{"nth_parent", &test_refs_revparse__nth_parent},
+	{"ordinal", &test_refs_revparse__ordinal},
+	{"partial_refs", &test_refs_revparse__partial_refs},
+	{"previous_head", &test_refs_revparse__previous_head},
+	{"reflog_of_a_ref_under_refs", &test_refs_revparse__reflog_of_a_ref_under_refs},
+	{"revwalk", &test_refs_revparse__revwalk},
+	{"shas", &test_refs_revparse__shas},
+	{"to_type", &test_refs_revparse__to_type},
+	{"upstream", &test_refs_revparse__upstream}
+};
+static const struct clar_func _clar_cb_refs_unicode[] = {
+    {"create_and_lookup", &test_refs_unicode__create_and_lookup}
+};
+static const struct clar_func _clar_cb_repo_discover[] = {
+    {"0", &test_repo_discover__0}
+};
+static const struct clar_func _clar_cb_repo_getters[] = {
+    {"empty", &test_repo_getters__empty},
+	{"retrieving_the_odb_honors_the_refcount", &test_repo_getters__retrieving_the_odb_honors_the_refcount}
+};
+static const struct clar_func _clar_cb_repo_hashfile[] = {
+    {"filtered", &test_repo_hashfile__filtered},
+	{"simple", &test_repo_hashfile__simple}
+};
+static const struct clar_func _clar_cb_repo_head[] = {
+    {"detach_head_Detaches_HEAD_and_make_it_point_to_the_peeled_commit", &test_repo_head__detach_head_Detaches_HEAD_and_make_it_point_to_the_peeled_commit},
+	{"detach_head_Fails_if_HEAD_and_point_to_a_non_commitish", &test_repo_head__detach_head_Fails_if_HEAD_and_point_to_a_non_commitish},
+	{"head_detached", &test_repo_head__head_detached},
+	{"head_orphan", &test_repo_head__head_orphan},
+	{"set_head_Attaches_HEAD_to_un_unborn_branch_when_the_branch_doesnt_exist", &test_repo_head__set_head_Attaches_HEAD_to_un_unborn_branch_when_the_branch_doesnt_exist},
+	{"set_head_Attaches_HEAD_when_the_reference_points_to_a_branch", &test_repo_head__set_head_Attaches_HEAD_when_the_reference_points_to_a_branch},
+	{"set_head_Detaches_HEAD_when_the_reference_doesnt_point_to_a_branch", &test_repo_head__set_head_Detaches_HEAD_when_the_reference_doesnt_point_to_a_branch},
+	{"set_head_Fails_when_the_reference_points_to_a_non_commitish", &test_repo_head__set_head_Fails_when_the_reference_points_to_a_non_commitish},
+	{"set_head_Returns_ENOTFOUND_when_the_reference_doesnt_exist", &test_repo_head__set_head_Returns_ENOTFOUND_when_the_reference_doesnt_exist},
+	{"set_head_detached_Detaches_HEAD_and_make_it_point_to_the_peeled_commit", &test_repo_head__set_head_detached_Detaches_HEAD_and_make_it_point_to_the_peeled_commit},
+	{"set_head_detached_Fails_when_the_object_isnt_a_commitish", &test_repo_head__set_head_detached_Fails_when_the_object_isnt_a_commitish},
+	{"set_head_detached_Return_ENOTFOUND_when_the_object_doesnt_exist", &test_repo_head__set_head_detached_Return_ENOTFOUND_when_the_object_doesnt_exist}
+};
+static const struct clar_func _clar_cb_repo_init[] = {
+    {"additional_templates", &test_repo_init__additional_templates},
+	{"bare_repo", &test_repo_init__bare_repo},
+	{"bare_repo_escaping_current_workdir", &test_repo_init__bare_repo_escaping_current_workdir},
+	{"bare_repo_noslash", &test_repo_init__bare_repo_noslash},
+	{"can_reinit_an_initialized_repository", &test_repo_init__can_reinit_an_initialized_repository},
+	{"detect_filemode", &test_repo_init__detect_filemode},
+	{"detect_ignorecase", &test_repo_init__detect_ignorecase},
+	{"extended_0", &test_repo_init__extended_0},
+	{"extended_1", &test_repo_init__extended_1},
+	{"extended_with_template", &test_repo_init__extended_with_template},
+	{"reinit_bare_repo", &test_repo_init__reinit_bare_repo},
+	{"reinit_doesnot_overwrite_ignorecase", &test_repo_init__reinit_doesnot_overwrite_ignorecase},
+	{"reinit_overwrites_filemode", &test_repo_init__reinit_overwrites_filemode},
+	{"reinit_too_recent_bare_repo", &test_repo_init__reinit_too_recent_bare_repo},
+	{"sets_logAllRefUpdates_according_to_type_of_repository", &test_repo_init__sets_logAllRefUpdates_according_to_type_of_repository},
+	{"standard_repo", &test_repo_init__standard_repo},
+	{"standard_repo_noslash", &test_repo_init__standard_repo_noslash}
+};
+static const struct clar_func _clar_cb_repo_message[] = {
+    {"message", &test_repo_message__message},
+	{"none", &test_repo_message__none}
+};
+static const struct clar_func _clar_cb_repo_open[] = {
+    {"bad_gitlinks", &test_repo_open__bad_gitlinks},
+	{"bare_empty_repo", &test_repo_open__bare_empty_repo},
+	{"failures", &test_repo_open__failures},
+	{"from_git_new_workdir", &test_repo_open__from_git_new_workdir},
+	{"gitlinked", &test_repo_open__gitlinked},
+	{"open_with_discover", &test_repo_open__open_with_discover},
+	{"opening_a_non_existing_repository_returns_ENOTFOUND", &test_repo_open__opening_a_non_existing_repository_returns_ENOTFOUND},
+	{"standard_empty_repo_through_gitdir", &test_repo_open__standard_empty_repo_through_gitdir},
+	{"standard_empty_repo_through_workdir", &test_repo_open__standard_empty_repo_through_workdir},
+	{"win32_path", &test_repo_open__win32_path}
+};
+static const struct clar_func _clar_cb_repo_setters[] = {
+    {"setting_a_new_index_on_a_repo_which_has_already_loaded_one_properly_honors_the_refcount", &test_repo_setters__setting_a_new_index_on_a_repo_which_has_already_loaded_one_properly_honors_the_refcount},
+	{"setting_a_new_odb_on_a_repo_which_already_loaded_one_properly_honors_the_refcount", &test_repo_setters__setting_a_new_odb_on_a_repo_which_already_loaded_one_properly_honors_the_refcount},
+	{"setting_a_workdir_creates_a_gitlink", &test_repo_setters__setting_a_workdir_creates_a_gitlink},
+	{"setting_a_workdir_prettifies_its_path", &test_repo_setters__setting_a_workdir_prettifies_its_path},
+	{"setting_a_workdir_turns_a_bare_repository_into_a_standard_one", &test_repo_setters__setting_a_workdir_turns_a_bare_repository_into_a_standard_one}
+};
+static const struct clar_func _clar_cb_reset_hard[] = {
+    {"resetting_culls_empty_directories", &test_reset_hard__resetting_culls_empty_directories}
+};
+static const struct clar_func _clar_cb_reset_mixed[] = {
+    {"cannot_reset_in_a_bare_repository", &test_reset_mixed__cannot_reset_in_a_bare_repository},
+	{"resetting_refreshes_the_index_to_the_commit_tree", &test_reset_mixed__resetting_refreshes_the_index_to_the_commit_tree}
+};
+static const struct clar_func _clar_cb_reset_soft[] = {
+    {"can_reset_the_detached_Head_to_the_specified_commit", &test_reset_soft__can_reset_the_detached_Head_to_the_specified_commit},
+	{"can_reset_the_non_detached_Head_to_the_specified_commit", &test_reset_soft__can_reset_the_non_detached_Head_to_the_specified_commit},
+	{"cannot_reset_to_a_tag_not_pointing_at_a_commit", &test_reset_soft__cannot_reset_to_a_tag_not_pointing_at_a_commit},
+	{"resetting_to_a_tag_sets_the_Head_to_the_peeled_commit", &test_reset_soft__resetting_to_a_tag_sets_the_Head_to_the_peeled_commit},
+	{"resetting_to_the_commit_pointed_at_by_the_Head_does_not_change_the_target_of_the_Head", &test_reset_soft__resetting_to_the_commit_pointed_at_by_the_Head_does_not_change_the_target_of_the_Head}
+};
+static const struct clar_func _clar_cb_revwalk_basic[] = {
+    {"disallow_non_commit", &test_revwalk_basic__disallow_non_commit},
+	{"glob_heads", &test_revwalk_basic__glob_heads},
+	{"push_head", &test_revwalk_basic__push_head},
+	{"push_head_hide_ref", &test_revwalk_basic__push_head_hide_ref},
+	{"push_head_hide_ref_nobase", &test_revwalk_basic__push_head_hide_ref_nobase},
+	{"sorting_modes", &test_revwalk_basic__sorting_modes}
+};
+static const struct clar_func _clar_cb_revwalk_commitgraph[] = {
+    {"graph_without_changed_paths", &test_revwalk_commitgraph__graph_without_changed_paths},
+	{"lookup", &test_revwalk_commitgraph__lookup},
+	{"reads_changed_paths_from_git", &test_revwalk_commitgraph__reads_changed_paths_from_git},
+	{"rejects_chunks_that_do_not_match", &test_revwalk_commitgraph__rejects_chunks_that_do_not_match},
+	{"topological_order", &test_revwalk_commitgraph__topological_order},
+	{"topological_order_is_reusable", &test_revwalk_commitgraph__topological_order_is_reusable},
+	{"topological_order_with_hidden_commits", &test_revwalk_commitgraph__topological_order_with_hidden_commits},
+	{"topological_walk_without_graph", &test_revwalk_commitgraph__topological_walk_without_graph},
+	{"write", &test_revwalk_commitgraph__write},
+	{"write_changed_paths", &test_revwalk_commitgraph__write_changed_paths}
+};
+static const struct clar_func _clar_cb_revwalk_mergebase[] = {
+    {"many_merge_branch", &test_revwalk_mergebase__many_merge_branch},
+	{"many_no_common_ancestor_returns_ENOTFOUND", &test_revwalk_mergebase__many_no_common_ancestor_returns_ENOTFOUND},
+	{"merged_branch", &test_revwalk_mergebase__merged_branch},
+	{"no_common_ancestor_returns_ENOTFOUND", &test_revwalk_mergebase__no_common_ancestor_returns_ENOTFOUND},
+	{"single1", &test_revwalk_mergebase__single1},
+	{"single2", &test_revwalk_mergebase__single2}
+};
+static const struct clar_func _clar_cb_revwalk_pathspec[] = {
+    {"clearing_the_pathspec", &test_revwalk_pathspec__clearing_the_pathspec},
+	{"directories", &test_revwalk_pathspec__directories},
+	{"hidden_history_is_not_simplified_into", &test_revwalk_pathspec__hidden_history_is_not_simplified_into},
+	{"merges_that_differ_from_all_parents_are_shown", &test_revwalk_pathspec__merges_that_differ_from_all_parents_are_shown},
+	{"missing_path", &test_revwalk_pathspec__missing_path},
+	{"single_file", &test_revwalk_pathspec__single_file},
+	{"sorting_modes", &test_revwalk_pathspec__sorting_modes}
+};
+static const struct clar_func _clar_cb_revwalk_signatureparsing[] = {
+    {"do_not_choke_when_name_contains_angle_brackets", &test_revwalk_signatureparsing__do_not_choke_when_name_contains_angle_brackets}
+};
+static const struct clar_func _clar_cb_status_fsmonitor[] = {
+    {"directories_stand_for_everything_below", &test_status_fsmonitor__directories_stand_for_everything_below},
+	{"inotify", &test_status_fsmonitor__inotify},
+	{"is_written_to_the_index", &test_status_fsmonitor__is_written_to_the_index},
+	{"lost_track_checks_everything", &test_status_fsmonitor__lost_track_checks_everything},
+	{"repository_frees_the_monitor", &test_status_fsmonitor__repository_frees_the_monitor},
+	{"unreported_changes_are_not_seen", &test_status_fsmonitor__unreported_changes_are_not_seen}
+};
+static const struct clar_func _clar_cb_status_ignore[] = {
+    {"0", &test_status_ignore__0},
+	{"1", &test_status_ignore__1},
+	{"add_internal_as_first_thing", &test_status_ignore__add_internal_as_first_thing},
+	{"adding_internal_ignores", &test_status_ignore__adding_internal_ignores},
+	{"empty_repo_with_gitignore_rewrite", &test_status_ignore__empty_repo_with_gitignore_rewrite},
+	{"ignore_pattern_contains_space", &test_status_ignore__ignore_pattern_contains_space}
+};
+static const struct clar_func _clar_cb_status_single[] = {
+    {"hash_single_file", &test_status_single__hash_single_file}
+};
+static const struct clar_func _clar_cb_status_submodules[] = {
+    {"0", &test_status_submodules__0},
+	{"1", &test_status_submodules__1},
+	{"api", &test_status_submodules__api},
+	{"single_file", &test_status_submodules__single_file},
+	{"workdir_iterator_finds_gitlinks", &test_status_submodules__workdir_iterator_finds_gitlinks}
+};
+static const struct clar_func _clar_cb_status_untracked_cache[] = {
+    {"ignore_changes_are_noticed", &test_status_untracked_cache__ignore_changes_are_noticed},
+	{"index_changes_invalidate_directories", &test_status_untracked_cache__index_changes_invalidate_directories},
+	{"is_written_to_the_index", &test_status_untracked_cache__is_written_to_the_index},
+	{"same_results_as_without_cache", &test_status_untracked_cache__same_results_as_without_cache},
+	{"unchanged_directories_are_not_read", &test_status_untracked_cache__unchanged_directories_are_not_read}
+};
+static const struct clar_func _clar_cb_status_worktree[] = {
+    {"bracket_in_filename", &test_status_worktree__bracket_in_filename},
+	{"cannot_retrieve_the_status_of_a_bare_repository", &test_status_worktree__cannot_retrieve_the_status_of_a_bare_repository},
+	{"disable_pathspec_match", &test_status_worktree__disable_pathspec_match},
+	{"empty_repository", &test_status_worktree__empty_repository},
+	{"filemode_changes", &test_status_worktree__filemode_changes},
+	{"first_commit_in_progress", &test_status_worktree__first_commit_in_progress},
+	{"ignores", &test_status_worktree__ignores},
+	{"interruptable_foreach", &test_status_worktree__interruptable_foreach},
+	{"issue_592", &test_status_worktree__issue_592},
+	{"issue_592_2", &test_status_worktree__issue_592_2},
+	{"issue_592_3", &test_status_worktree__issue_592_3},
+	{"issue_592_4", &test_status_worktree__issue_592_4},
+	{"issue_592_5", &test_status_worktree__issue_592_5},
+	{"issue_592_ignored_dirs_with_tracked_content", &test_status_worktree__issue_592_ignored_dirs_with_tracked_content},
+	{"issue_592_ignores_0", &test_status_worktree__issue_592_ignores_0},
+	{"line_endings_dont_count_as_changes_with_autocrlf", &test_status_worktree__line_endings_dont_count_as_changes_with_autocrlf},
+	{"new_staged_file_must_handle_crlf", &test_status_worktree__new_staged_file_must_handle_crlf},
+	{"purged_worktree", &test_status_worktree__purged_worktree},
+	{"racily_clean_entries_are_hashed", &test_status_worktree__racily_clean_entries_are_hashed},
+	{"single_file", &test_status_worktree__single_file},
+	{"single_file_empty_repo", &test_status_worktree__single_file_empty_repo},
+	{"single_folder", &test_status_worktree__single_folder},
+	{"single_nonexistent_file", &test_status_worktree__single_nonexistent_file},
+	{"single_nonexistent_file_empty_repo", &test_status_worktree__single_nonexistent_file_empty_repo},
+	{"space_in_filename", &test_status_worktree__space_in_filename},
+	{"status_file_with_clean_index_and_empty_workdir", &test_status_worktree__status_file_with_clean_index_and_empty_workdir},
+	{"status_file_without_index_or_workdir", &test_status_worktree__status_file_without_index_or_workdir},
+	{"swap_subdir_and_file", &test_status_worktree__swap_subdir_and_file},
+	{"swap_subdir_with_recurse_and_pathspec", &test_status_worktree__swap_subdir_with_recurse_and_pathspec},
+	{"update_index_leaves_a_clean_index_alone", &test_status_worktree__update_index_leaves_a_clean_index_alone},
+	{"update_index_stores_the_stat_data", &test_status_worktree__update_index_stores_the_stat_data},
+	{"whole_repository", &test_status_worktree__whole_repository},
+	{"whole_repository_on_several_threads", &test_status_worktree__whole_repository_on_several_threads}
+};
+static const struct clar_func _clar_cb_submodule_lookup[] = {
+    {"accessors", &test_submodule_lookup__accessors},
+	{"foreach", &test_submodule_lookup__foreach},
+	{"simple_lookup", &test_submodule_lookup__simple_lookup}
+};
+static const struct clar_func _clar_cb_submodule_modify[] = {
+    {"add", &test_submodule_modify__add},
+	{"edit_and_save", &test_submodule_modify__edit_and_save},
+	{"init", &test_submodule_modify__init},
+	{"sync", &test_submodule_modify__sync}
+};
+static const struct clar_func _clar_cb_submodule_status[] = {
+    {"ignore_all", &test_submodule_status__ignore_all},
+	{"ignore_dirty", &test_submodule_status__ignore_dirty},
+	{"ignore_none", &test_submodule_status__ignore_none},
+	{"ignore_untracked", &test_submodule_status__ignore_untracked},
+	{"unchanged", &test_submodule_status__unchanged}
+};
+static const struct clar_func _clar_cb_threads_basic[] = {
+    {"cache", &test_threads_basic__cache}
+};
+
+static const struct clar_suite _clar_suites[] = {
+    {
+        0,
+        "attr::file",
+        {NULL, NULL},
+        {NULL, NULL},
+        _clar_cb_attr_file, 4
+    },
+	{
+        1,
+        "attr::flags",
+        {NULL, NULL},
+        {"cleanup", &test_attr_flags__cleanup},
+        _clar_cb_attr_flags, 3
+    },
+	{
+        2,
+        "attr::lookup",
+        {NULL, NULL},
+        {NULL, NULL},
+        _clar_cb_attr_lookup, 5
+    },
+	{
+        3,
+        "attr::repo",
+        {"initialize", &test_attr_repo__initialize},
+        {"cleanup", &test_attr_repo__cleanup},
+        _clar_cb_attr_repo, 7
+    },
+	{
+        4,
+        "buf::basic",
+        {NULL, NULL},
+        {NULL, NULL},
+        _clar_cb_buf_basic, 2
+    },
+	{
+        5,
+        "checkout::index",
+        {"initialize", &test_checkout_index__initialize},
+        {"cleanup", &test_checkout_index__cleanup},
+        _clar_cb_checkout_index, 20
+    },
+	{
+        6,
+        "checkout::sparse",
+        {"initialize", &test_checkout_sparse__initialize},
+        {"cleanup", &test_checkout_sparse__cleanup},
+        _clar_cb_checkout_sparse, 8
+    },
+	{
+        7,
+        "checkout::tree",
+        {"initialize", &test_checkout_tree__initialize},
+        {"cleanup", &test_checkout_tree__cleanup},
+        _clar_cb_checkout_tree, 3
+    },
+	{
+        8,
+        "clone::clone",
+        {"initialize", &test_clone_clone__initialize},
+        {"cleanup", &test_clone_clone__cleanup},
+        _clar_cb_clone_clone, 5
+    },
+	{
+        9,
+        "commit::commit",
+        {"initialize", &test_commit_commit__initialize},
+        {"cleanup", &test_commit_commit__cleanup},
+        _clar_cb_commit_commit, 1
+    },
+	{
+        10,
+        "commit::parent",
+        {"initialize", &test_commit_parent__initialize},
+        {"cleanup", &test_commit_parent__cleanup},
+        _clar_cb_commit_parent, 1
+    },
+	{
+        11,
+        "commit::parse",
+        {"initialize", &test_commit_parse__initialize},
+        {"cleanup", &test_commit_parse__cleanup},
+        _clar_cb_commit_parse, 5
+    },
+	{
+        12,
+        "commit::signature",
+        {NULL, NULL},
+        {NULL, NULL},
+        _clar_cb_commit_signature, 7
+    },
+	{
+        13,
+        "commit::write",
+        {"initialize", &test_commit_write__initialize},
+        {"cleanup", &test_commit_write__cleanup},
+        _clar_cb_commit_write, 2
+    },
+	{
+        14,
+        "config::add",
+        {"initialize", &test_config_add__initialize},
+        {"cleanup", &test_config_add__cleanup},
+        _clar_cb_config_add, 2
+    },
+	{
+        15,
+        "config::multivar",
+        {"initialize", &test_config_multivar__initialize},
+        {"cleanup", &test_config_multivar__cleanup},
+        _clar_cb_config_multivar, 5
+    },
+	{
+        16,
+        "config::new",
+        {NULL, NULL},
+        {NULL, NULL},
+        _clar_cb_config_new, 1
+    },
+	{
+        17,
+        "config::read",
+        {NULL, NULL},
+        {NULL, NULL},
+        _clar_cb_config_read, 15
+    },
+	{
+        18,
+        "config::stress",
+        {"initialize", &test_config_stress__initialize},
+        {"cleanup", &test_config_stress__cleanup},
+        _clar_cb_config_stress, 3
+    },
+	{
+        19,
+        "config::write",
+        {"initialize", &test_config_write__initialize},
+        {"cleanup", &test_config_write__cleanup},
+        _clar_cb_config_write, 6
+    },
+	{
+        20,
+        "core::buffer",
+        {NULL, NULL},
+        {NULL, NULL},
+        _clar_cb_core_buffer, 15
+    },
+	{
+        21,
+        "core::copy",
+        {NULL, NULL},
+        {NULL, NULL},
+        _clar_cb_core_copy, 3
+    },
+	{
+        22,
+        "core::dirent",
+        {NULL, NULL},
+        {NULL, NULL},
+        _clar_cb_core_dirent, 6
+    },
+	{
+        23,
+        "core::env",
+        {"initialize", &test_core_env__initialize},
+        {"cleanup", &test_core_env__cleanup},
+        _clar_cb_core_env, 2
+    },
+	{
+        24,
+        "core::errors",
+        {NULL, NULL},
+        {NULL, NULL},
+        _clar_cb_core_errors, 1
+    },
+	{
+        25,
+        "core::filebuf",
+        {NULL, NULL},
+        {NULL, NULL},
+        _clar_cb_core_filebuf, 5
+    },
+	{
+        26,
+        "core::hex",
+        {NULL, NULL},
+        {NULL, NULL},
+        _clar_cb_core_hex, 1
+    },
+	{
+        27,
+        "core::mkdir",
+        {NULL, NULL},
+        {NULL, NULL},
+        _clar_cb_core_mkdir, 3
+    },
+	{
+        28,
+        "core::oid",
+        {"initialize", &test_core_oid__initialize},
+        {NULL, NULL},
+        _clar_cb_core_oid, 1
+    },
+	{
+        29,
+        "core::path",
+        {NULL, NULL},
+        {NULL, NULL},
+        _clar_cb_core_path, 13
+    },
+	{
+        30,
+        "core::pool",
+        {NULL, NULL},
+        {NULL, NULL},
+        _clar_cb_core_pool, 3
+    },
+	{
+        31,
+        "core::rmdir",
+        {"initialize", &test_core_rmdir__initialize},
+        {NULL, NULL},
+        _clar_cb_core_rmdir, 3
+    },
+	{
+        32,
+        "core::string",
+        {NULL, NULL},
+        {NULL, NULL},
+        _clar_cb_core_string, 2
+    },
+	{
+        33,
+        "core::strmap",
+        {NULL, NULL},
+        {NULL, NULL},
+        _clar_cb_core_strmap, 4
+    },
+	{
+        34,
+        "core::strtol",
+        {NULL, NULL},
+        {NULL, NULL},
+        _clar_cb_core_strtol, 2
+    },
+	{
+        35,
+        "core::vector",
+        {NULL, NULL},
+        {NULL, NULL},
+        _clar_cb_core_vector, 6
+    },
+	{
+        36,
+        "date::date",
+        {NULL, NULL},
+        {NULL, NULL},
+        _clar_cb_date_date, 1
+    },
+	{
+        37,
+        "diff::blob",
+        {"initialize", &test_diff_blob__initialize},
+        {"cleanup", &test_diff_blob__cleanup},
+        _clar_cb_diff_blob, 7
+    },
+	{
+        38,
+        "diff::diffiter",
+        {"initialize", &test_diff_diffiter__initialize},
+        {"cleanup", &test_diff_diffiter__cleanup},
+        _clar_cb_diff_diffiter, 5
+    },
+	{
+        39,
+        "diff::index",
+        {"initialize", &test_diff_index__initialize},
+        {"cleanup", &test_diff_index__cleanup},
+        _clar_cb_diff_index, 2
+    },
+	{
+        40,
+        "diff::iterator",
+        {"initialize", &test_diff_iterator__initialize},
+        {"cleanup", &test_diff_iterator__cleanup},
+        _clar_cb_diff_iterator, 29
+    },
+	{
+        41,
+        "diff::patch",
+        {"initialize", &test_diff_patch__initialize},
+        {"cleanup", &test_diff_patch__cleanup},
+        _clar_cb_diff_patch, 1
+    },
+	{
+        42,
+        "diff::rename",
+        {"initialize", &test_diff_rename__initialize},
+        {"cleanup", &test_diff_rename__cleanup},
+        _clar_cb_diff_rename, 6
+    },
+	{
+        43,
+        "diff::tree",
+        {"initialize", &test_diff_tree__initialize},
+        {"cleanup", &test_diff_tree__cleanup},
+        _clar_cb_diff_tree, 9
+    },
+	{
+        44,
+        "diff::words",
+        {"initialize", &test_diff_words__initialize},
+        {"cleanup", &test_diff_words__cleanup},
+        _clar_cb_diff_words, 6
+    },
+	{
+        45,
+        "diff::workdir",
+        {"initialize", &test_diff_workdir__initialize},
+        {"cleanup", &test_diff_workdir__cleanup},
+        _clar_cb_diff_workdir, 8
+    },
+	{
+        46,
+        "index::filemodes",
+        {"initialize", &test_index_filemodes__initialize},
+        {"cleanup", &test_index_filemodes__cleanup},
+        _clar_cb_index_filemodes, 3
+    },
+	{
+        47,
+        "index::offsets",
+        {NULL, NULL},
+        {"cleanup", &test_index_offsets__cleanup},
+        _clar_cb_index_offsets, 6
+    },
+	{
+        48,
+        "index::read::tree",
+        {NULL, NULL},
+        {NULL, NULL},
+        _clar_cb_index_read_tree, 1
+    },
+	{
+        49,
+        "index::rename",
+        {NULL, NULL},
+        {NULL, NULL},
+        _clar_cb_index_rename, 1
+    },
+	{
+        50,
+        "index::splitindex",
+        {"initialize", &test_index_splitindex__initialize},
+        {"cleanup", &test_index_splitindex__cleanup},
+        _clar_cb_index_splitindex, 5
+    },
+	{
+        51,
+        "index::tests",
+        {"initialize", &test_index_tests__initialize},
+        {"cleanup", &test_index_tests__cleanup},
+        _clar_cb_index_tests, 9
+    },
+	{
+        52,
+        "index::tree::cache",
+        {"initialize", &test_index_tree_cache__initialize},
+        {"cleanup", &test_index_tree_cache__cleanup},
+        _clar_cb_index_tree_cache, 3
+    },
+	{
+        53,
+        "index::version",
+        {NULL, NULL},
+        {"cleanup", &test_index_version__cleanup},
+        _clar_cb_index_version, 4
+    },
+	{
+        54,
+        "network::createremotethenload",
+        {"initialize", &test_network_createremotethenload__initialize},
+        {"cleanup", &test_network_createremotethenload__cleanup},
+        _clar_cb_network_createremotethenload, 1
+    },
+	{
+        55,
+        "network::remotelocal",
+        {"initialize", &test_network_remotelocal__initialize},
+        {"cleanup", &test_network_remotelocal__cleanup},
+        _clar_cb_network_remotelocal, 4
+    },
+	{
+        56,
+        "network::remotes",
+        {"initialize", &test_network_remotes__initialize},
+        {"cleanup", &test_network_remotes__cleanup},
+        _clar_cb_network_remotes, 17
+    },
+	{
+        57,
+        "notes::notes",
+        {"initialize", &test_notes_notes__initialize},
+        {"cleanup", &test_notes_notes__cleanup},
+        _clar_cb_notes_notes, 10
+    },
+	{
+        58,
+        "notes::notesref",
+        {"initialize", &test_notes_notesref__initialize},
+        {"cleanup", &test_notes_notesref__cleanup},
+        _clar_cb_notes_notesref, 1
+    },
+	{
+        59,
+        "object::blob::filter",
+        {"initialize", &test_object_blob_filter__initialize},
+        {"cleanup", &test_object_blob_filter__cleanup},
+        _clar_cb_object_blob_filter, 3
+    },
+	{
+        60,
+        "object::blob::fromchunks",
+        {"initialize", &test_object_blob_fromchunks__initialize},
+        {"cleanup", &test_object_blob_fromchunks__cleanup},
+        _clar_cb_object_blob_fromchunks, 2
+    },
+	{
+        61,
+        "object::blob::write",
+        {NULL, NULL},
+        {"cleanup", &test_object_blob_write__cleanup},
+        _clar_cb_object_blob_write, 3
+    },
+	{
+        62,
+        "object::commit::commitstagedfile",
+        {"initialize", &test_object_commit_commitstagedfile__initialize},
+        {"cleanup", &test_object_commit_commitstagedfile__cleanup},
+        _clar_cb_object_commit_commitstagedfile, 2
+    },
+	{
+        63,
+        "object::lookup",
+        {"initialize", &test_object_lookup__initialize},
+        {"cleanup", &test_object_lookup__cleanup},
+        _clar_cb_object_lookup, 4
+    },
+	{
+        64,
+        "object::message",
+        {NULL, NULL},
+        {NULL, NULL},
+        _clar_cb_object_message, 15
+    },
+	{
+        65,
+        "object::peel",
+        {"initialize", &test_object_peel__initialize},
+        {"cleanup", &test_object_peel__cleanup},
+        _clar_cb_object_peel, 6
+    },
+	{
+        66,
+        "object::raw::chars",
+        {NULL, NULL},
+        {NULL, NULL},
+        _clar_cb_object_raw_chars, 2
+    },
+	{
+        67,
+        "object::raw::compare",
+        {NULL, NULL},
+        {NULL, NULL},
+        _clar_cb_object_raw_compare, 7
+    },
+	{
+        68,
+        "object::raw::convert",
+        {NULL, NULL},
+        {NULL, NULL},
+        _clar_cb_object_raw_convert, 2
+    },
+	{
+        69,
+        "object::raw::fromstr",
+        {NULL, NULL},
+        {NULL, NULL},
+        _clar_cb_object_raw_fromstr, 2
+    },
+	{
+        70,
+        "object::raw::hash",
+        {NULL, NULL},
+        {NULL, NULL},
+        _clar_cb_object_raw_hash, 11
+    },
+	{
+        71,
+        "object::raw::short",
+        {NULL, NULL},
+        {NULL, NULL},
+        _clar_cb_object_raw_short, 2
+    },
+	{
+        72,
+        "object::raw::size",
+        {NULL, NULL},
+        {NULL, NULL},
+        _clar_cb_object_raw_size, 1
+    },
+	{
+        73,
+        "object::raw::type2string",
+        {NULL, NULL},
+        {NULL, NULL},
+        _clar_cb_object_raw_type2string, 3
+    },
+	{
+        74,
+        "object::raw::write",
+        {NULL, NULL},
+        {NULL, NULL},
+        _clar_cb_object_raw_write, 7
+    },
+	{
+        75,
+        "object::tag::peel",
+        {"initialize", &test_object_tag_peel__initialize},
+        {"cleanup", &test_object_tag_peel__cleanup},
+        _clar_cb_object_tag_peel, 3
+    },
+	{
+        76,
+        "object::tag::read",
+        {"initialize", &test_object_tag_read__initialize},
+        {"cleanup", &test_object_tag_read__cleanup},
+        _clar_cb_object_tag_read, 4
+    },
+	{
+        77,
+        "object::tag::write",
+        {"initialize", &test_object_tag_write__initialize},
+        {"cleanup", &test_object_tag_write__cleanup},
+        _clar_cb_object_tag_write, 6
+    },
+	{
+        78,
+        "object::tree::attributes",
+        {NULL, NULL},
+        {NULL, NULL},
+        _clar_cb_object_tree_attributes, 4
+    },
+	{
+        79,
+        "object::tree::frompath",
+        {"initialize", &test_object_tree_frompath__initialize},
+        {"cleanup", &test_object_tree_frompath__cleanup},
+        _clar_cb_object_tree_frompath, 2
+    },
+	{
+        80,
+        "object::tree::read",
+        {"initialize", &test_object_tree_read__initialize},
+        {"cleanup", &test_object_tree_read__cleanup},
+        _clar_cb_object_tree_read, 3
+    },
+	{
+        81,
+        "object::tree::walk",
+        {"initialize", &test_object_tree_walk__initialize},
+        {"cleanup", &test_object_tree_walk__cleanup},
+        _clar_cb_object_tree_walk, 2
+    },
+	{
+        82,
+        "object::tree::write",
+        {"initialize", &test_object_tree_write__initialize},
+        {"cleanup", &test_object_tree_write__cleanup},
+        _clar_cb_object_tree_write, 3
+    },
+	{
+        83,
+        "odb::foreach",
+        {NULL, NULL},
+        {"cleanup", &test_odb_foreach__cleanup},
+        _clar_cb_odb_foreach, 3
+    },
+	{
+        84,
+        "odb::loose",
+        {"initialize", &test_odb_loose__initialize},
+        {"cleanup", &test_odb_loose__cleanup},
+        _clar_cb_odb_loose, 2
+    },
+	{
+        85,
+        "odb::mixed",
+        {"initialize", &test_odb_mixed__initialize},
+        {"cleanup", &test_odb_mixed__cleanup},
+        _clar_cb_odb_mixed, 1
+    },
+	{
+        86,
+        "odb::packed",
+        {"initialize", &test_odb_packed__initialize},
+        {"cleanup", &test_odb_packed__cleanup},
+        _clar_cb_odb_packed, 5
+    },
+	{
+        87,
+        "odb::packed::one",
+        {"initialize", &test_odb_packed_one__initialize},
+        {"cleanup", &test_odb_packed_one__cleanup},
+        _clar_cb_odb_packed_one, 2
+    },
+	{
+        88,
+        "odb::sorting",
+        {"initialize", &test_odb_sorting__initialize},
+        {"cleanup", &test_odb_sorting__cleanup},
+        _clar_cb_odb_sorting, 2
+    },
+	{
+        89,
+        "refs::branches::create",
+        {"initialize", &test_refs_branches_create__initialize},
+        {"cleanup", &test_refs_branches_create__cleanup},
+        _clar_cb_refs_branches_create, 5
+    },
+	{
+        90,
+        "refs::branches::delete",
+        {"initialize", &test_refs_branches_delete__initialize},
+        {"cleanup", &test_refs_branches_delete__cleanup},
+        _clar_cb_refs_branches_delete, 5
+    },
+	{
+        91,
+        "refs::branches::foreach",
+        {"initialize", &test_refs_branches_foreach__initialize},
+        {"cleanup", &test_refs_branches_foreach__cleanup},
+        _clar_cb_refs_branches_foreach, 5
+    },
+	{
+        92,
+        "refs::branches::lookup",
+        {"initialize", &test_refs_branches_lookup__initialize},
+        {"cleanup", &test_refs_branches_lookup__cleanup},
+        _clar_cb_refs_branches_lookup, 3
+    },
+	{
+        93,
+        "refs::branches::move",
+        {"initialize", &test_refs_branches_move__initialize},
+        {"cleanup", &test_refs_branches_move__cleanup},
+        _clar_cb_refs_branches_move, 6
+    },
+	{
+        94,
+        "refs::branches::tracking",
+        {"initialize", &test_refs_branches_tracking__initialize},
+        {"cleanup", &test_refs_branches_tracking__cleanup},
+        _clar_cb_refs_branches_tracking, 5
+    },
+	{
+        95,
+        "refs::crashes",
+        {NULL, NULL},
+        {NULL, NULL},
+        _clar_cb_refs_crashes, 1
+    },
+	{
+        96,
+        "refs::create",
+        {"initialize", &test_refs_create__initialize},
+        {"cleanup", &test_refs_create__cleanup},
+        _clar_cb_refs_create, 4
+    },
+	{
+        97,
+        "refs::delete",
+        {"initialize", &test_refs_delete__initialize},
+        {"cleanup", &test_refs_delete__cleanup},
+        _clar_cb_refs_delete, 2
+    },
+	{
+        98,
+        "refs::foreachglob",
+        {"initialize", &test_refs_foreachglob__initialize},
+        {"cleanup", &test_refs_foreachglob__cleanup},
+        _clar_cb_refs_foreachglob, 5
+    },
+	{
+        99,
+        "refs::list",
+        {"initialize", &test_refs_list__initialize},
+        {"cleanup", &test_refs_list__cleanup},
+        _clar_cb_refs_list, 3
+    },
+	{
+        100,
+        "refs::listall",
+        {NULL, NULL},
+        {NULL, NULL},
+        _clar_cb_refs_listall, 2
+    },
+	{
+        101,
+        "refs::lookup",
+        {"initialize", &test_refs_lookup__initialize},
+        {"cleanup", &test_refs_lookup__cleanup},
+        _clar_cb_refs_lookup, 2
+    },
+	{
+        102,
+        "refs::normalize",
+        {NULL, NULL},
+        {NULL, NULL},
+        _clar_cb_refs_normalize, 6
+    },
+	{
+        103,
+        "refs::overwrite",
+        {"initialize", &test_refs_overwrite__initialize},
+        {"cleanup", &test_refs_overwrite__cleanup},
+        _clar_cb_refs_overwrite, 4
+    },
+	{
+        104,
+        "refs::pack",
+        {"initialize", &test_refs_pack__initialize},
+        {"cleanup", &test_refs_pack__cleanup},
+        _clar_cb_refs_pack, 2
+    },
+	{
+        105,
+        "refs::peel",
+        {"initialize", &test_refs_peel__initialize},
+        {"cleanup", &test_refs_peel__cleanup},
+        _clar_cb_refs_peel, 5
+    },
+	{
+        106,
+        "refs::read",
+        {"initialize", &test_refs_read__initialize},
+        {"cleanup", &test_refs_read__cleanup},
+        _clar_cb_refs_read, 12
+    },
+	{
+        107,
+        "refs::reflog::drop",
+        {"initialize", &test_refs_reflog_drop__initialize},
+        {"cleanup", &test_refs_reflog_drop__cleanup},
+        _clar_cb_refs_reflog_drop, 8
+    },
+	{
+        108,
+        "refs::reflog::reflog",
+        {"initialize", &test_refs_reflog_reflog__initialize},
+        {"cleanup", &test_refs_reflog_reflog__cleanup},
+        _clar_cb_refs_reflog_reflog, 5
+    },
+	{
+        109,
+        "refs::rename",
+        {"initialize", &test_refs_rename__initialize},
+        {"cleanup", &test_refs_rename__cleanup},
+        _clar_cb_refs_rename, 10
+    },
+	{
+        110,
+        "refs::revparse",
+        {"initialize", &test_refs_revparse__initialize},
+        {"cleanup", &test_refs_revparse__cleanup},
+        _clar_cb_refs_revparse, 21
+    },
+	{
+        111,
+        "refs::unicode",
+        {"initialize", &test_refs_unicode__initialize},
+        {"cleanup", &test_refs_unicode__cleanup},
+        _clar_cb_refs_unicode, 1
+    },
+	{
+        112,
+        "repo::discover",
+        {NULL, NULL},
+        {NULL, NULL},
+        _clar_cb_repo_discover, 1
+    },
+	{
+        113,
+        "repo::getters",
+        {"initialize", &test_repo_getters__initialize},
+        {"cleanup", &test_repo_getters__cleanup},
+        _clar_cb_repo_getters, 2
+    },
+	{
+        114,
+        "repo::hashfile",
+        {"initialize", &test_repo_hashfile__initialize},
+        {"cleanup", &test_repo_hashfile__cleanup},
+        _clar_cb_repo_hashfile, 2
+    },
+	{
+        115,
+        "repo::head",
+        {"initialize", &test_repo_head__initialize},
+        {"cleanup", &test_repo_head__cleanup},
+        _clar_cb_repo_head, 12
+    },
+	{
+        116,
+        "repo::init",
+        {"initialize", &test_repo_init__initialize},
+        {NULL, NULL},
+        _clar_cb_repo_init, 17
+    },
+	{
+        117,
+        "repo::message",
+        {"initialize", &test_repo_message__initialize},
+        {"cleanup", &test_repo_message__cleanup},
+        _clar_cb_repo_message, 2
+    },
+	{
+        118,
+        "repo::open",
+        {NULL, NULL},
+        {"cleanup", &test_repo_open__cleanup},
+        _clar_cb_repo_open, 10
+    },
+	{
+        119,
+        "repo::setters",
+        {"initialize", &test_repo_setters__initialize},
+        {"cleanup", &test_repo_setters__cleanup},
+        _clar_cb_repo_setters, 5
+    },
+	{
+        120,
+        "reset::hard",
+        {"initialize", &test_reset_hard__initialize},
+        {"cleanup", &test_reset_hard__cleanup},
+        _clar_cb_reset_hard, 1
+    },
+	{
+        121,
+        "reset::mixed",
+        {"initialize", &test_reset_mixed__initialize},
+        {"cleanup", &test_reset_mixed__cleanup},
+        _clar_cb_reset_mixed, 2
+    },
+	{
+        122,
+        "reset::soft",
+        {"initialize", &test_reset_soft__initialize},
+        {"cleanup", &test_reset_soft__cleanup},
+        _clar_cb_reset_soft, 5
+    },
+	{
+        123,
+        "revwalk::basic",
+        {"initialize", &test_revwalk_basic__initialize},
+        {"cleanup", &test_revwalk_basic__cleanup},
+        _clar_cb_revwalk_basic, 6
+    },
+	{
+        124,
+        "revwalk::commitgraph",
+        {"initialize", &test_revwalk_commitgraph__initialize},
+        {"cleanup", &test_revwalk_commitgraph__cleanup},
+        _clar_cb_revwalk_commitgraph, 10
+    },
+	{
+        125,
+        "revwalk::mergebase",
+        {"initialize", &test_revwalk_mergebase__initialize},
+        {"cleanup", &test_revwalk_mergebase__cleanup},
+        _clar_cb_revwalk_mergebase, 6
+    },
+	{
+        126,
+        "revwalk::pathspec",
+        {"initialize", &test_revwalk_pathspec__initialize},
+        {"cleanup", &test_revwalk_pathspec__cleanup},
+        _clar_cb_revwalk_pathspec, 7
+    },
+	{
+        127,
+        "revwalk::signatureparsing",
+        {"initialize", &test_revwalk_signatureparsing__initialize},
+        {"cleanup", &test_revwalk_signatureparsing__cleanup},
+        _clar_cb_revwalk_signatureparsing, 1
+    },
+	{
+        128,
+        "status::fsmonitor",
+        {"initialize", &test_status_fsmonitor__initialize},
+        {"cleanup", &test_status_fsmonitor__cleanup},
+        _clar_cb_status_fsmonitor, 6
+    },
+	{
+        129,
+        "status::ignore",
+        {"initialize", &test_status_ignore__initialize},
+        {"cleanup", &test_status_ignore__cleanup},
+        _clar_cb_status_ignore, 6
+    },
+	{
+        130,
+        "status::single",
+        {NULL, NULL},
+        {NULL, NULL},
+        _clar_cb_status_single, 1
+    },
+	{
+        131,
+        "status::submodules",
+        {"initialize", &test_status_submodules__initialize},
+        {"cleanup", &test_status_submodules__cleanup},
+        _clar_cb_status_submodules, 5
+    },
+	{
+        132,
+        "status::untracked::cache",
+        {"initialize", &test_status_untracked_cache__initialize},
+        {"cleanup", &test_status_untracked_cache__cleanup},
+        _clar_cb_status_untracked_cache, 5
+    },
+	{
+        133,
+        "status::worktree",
+        {"initialize", &test_status_worktree__initialize},
+        {"cleanup", &test_status_worktree__cleanup},
+        _clar_cb_status_worktree, 33
+    },
+	{
+        134,
+        "submodule::lookup",
+        {"initialize", &test_submodule_lookup__initialize},
+        {"cleanup", &test_submodule_lookup__cleanup},
+        _clar_cb_submodule_lookup, 3
+    },
+	{
+        135,
+        "submodule::modify",
+        {"initialize", &test_submodule_modify__initialize},
+        {"cleanup", &test_submodule_modify__cleanup},
+        _clar_cb_submodule_modify, 4
+    },
+	{
+        136,
+        "submodule::status",
+        {"initialize", &test_submodule_status__initialize},
+        {"cleanup", &test_submodule_status__cleanup},
+        _clar_cb_submodule_status, 5
+    },
+	{
+        137,
+        "threads::basic",
+        {"initialize", &test_threads_basic__initialize},
+        {"cleanup", &test_threads_basic__cleanup},
+        _clar_cb_threads_basic, 1
+    }
+};
+
+static size_t _clar_suite_count = 138;
+static size_t _clar_callback_count = 708;
+
+/* Core test functions */
+static void
+clar_report_errors(void)
+{
+	int i = 1;
+	struct clar_error *error, *next;
+
+	error = _clar.errors;
+	while (error != NULL) {
+		next = error->next;
+		clar_print_error(i++, error);
+		free(error->description);
+		free(error);
+		error = next;
+	}
+
+	_clar.errors = _clar.last_error = NULL;
+}
+
+static void
+clar_run_test(
+	const struct clar_func *test,
+	const struct clar_func *initialize,
+	const struct clar_func *cleanup)
+{
+	int error_st = _clar.suite_errors;
+
+	clar_on_test();
+	_clar.trampoline_enabled = 1;
+
+	if (setjmp(_clar.trampoline) == 0) {
+		if (initialize->ptr != NULL)
+			initialize->ptr();
+
+		test->ptr();
+	}
+
+	_clar.trampoline_enabled = 0;
+
+	if (_clar.local_cleanup != NULL)
+		_clar.local_cleanup(_clar.local_cleanup_payload);
+
+	if (cleanup->ptr != NULL)
+		cleanup->ptr();
+
+	_clar.test_count++;
+
+	/* remove any local-set cleanup methods */
+	_clar.local_cleanup = NULL;
+	_clar.local_cleanup_payload = NULL;
+
+	if (_clar.report_errors_only)
+		clar_report_errors();
+	else
+		clar_print_ontest(
+			test->name,
+			_clar.test_count,
+			(_clar.suite_errors > error_st)
+			);
+}
+
+static void
+clar_run_suite(const struct clar_suite *suite)
+{
+	const struct clar_func *test = suite->tests;
+	size_t i;
+
+	if (!_clar.report_errors_only)
+		clar_print_onsuite(suite->name, suite->index);
+	clar_on_suite();
+
+	_clar.active_suite = suite->name;
+	_clar.suite_errors = 0;
+
+	for (i = 0; i < suite->test_count; ++i) {
+		_clar.active_test = test[i].name;
+		clar_run_test(&test[i], &suite->initialize, &suite->cleanup);
+	}
+}
+
+#if 0 /* temporarily disabled */
+static void
+clar_run_single(const struct clar_func *test,
+	const struct clar_suite *suite)
+{
+	_clar.suite_errors = 0;
+	_clar.active_suite = suite->name;
+	_clar.active_test = test->name;
+
+	clar_run_test(test, &suite->initialize, &suite->cleanup);
+}
+#endif
+
+static void
+clar_usage(const char *arg)
+{
+	printf("Usage: %s [options]\n\n", arg);
+	printf("Options:\n");
+	printf("  -sXX\t\tRun only the suite number or name XX\n");
+	printf("  -q  \t\tOnly report tests that had an error\n");
+	exit(-1);
+}
+
+static void
+clar_parse_args(int argc, char **argv)
+{
+	int i;
+
+	for (i = 1; i < argc; ++i) {
+		char *argument = argv[i];
+
+		if (argument[0] != '-')
+			clar_usage(argv[0]);
+
+		switch (argument[1]) {
+		case 's': {
+			int num = (int)strtol(argument + 2, &argument, 10);
+			if (argument == argv[i] + 2) {
+				size_t j;
+				num = -1;
+				for (j = 0; j < _clar_suite_count; ++j)
+					if (strcmp(argument, _clar_suites[j].name) == 0) {
+						num = j;
+						break;
+					}
+			}
+			if (num < 0)
+				clar_usage(argv[0]);
+			if ((size_t)num >= _clar_suite_count) {
+				clar_print_onabort("Suite number %d does not exist.\n", num);
+				exit(-1);
+			}
+			clar_run_suite(&_clar_suites[num]);
+			break;
+		}
+
+		case 'q':
+			_clar.report_errors_only = 1;
+			break;
+
+		default:
+			clar_usage(argv[0]);
+		}
+	}
+}
+
+static int
+clar_test(int argc, char **argv)
+{
+	clar_print_init(
+		(int)_clar_callback_count,
+		(int)_clar_suite_count,
+		""
+	);
+
+	if (clar_sandbox() < 0) {
+		clar_print_onabort("Failed to sandbox the test runner.\n");
+		exit(-1);
+	}
+
+	clar_on_init();
+
+	if (argc > 1)
+		clar_parse_args(argc, argv);
+
+	if (_clar.active_suite == NULL) {
+		size_t i;
+		for (i = 0; i < _clar_suite_count; ++i)
+			clar_run_suite(&_clar_suites[i]);
+	}
+
+	clar_print_shutdown(
+		_clar.test_count,
+		(int)_clar_suite_count,
+		_clar.total_errors
+	);
+
+	clar_on_shutdown();
+
+	clar_unsandbox();
+	return _clar.total_errors;
+}
+
+void
+clar__assert(
+	int condition,
+	const char *file,
+	int line,
+	const char *error_msg,
+	const char *description,
+	int should_abort)
+{
+	struct clar_error *error;
+
+	if (condition)
+		return;
+
+	error = calloc(1, sizeof(struct clar_error));
+
+	if (_clar.errors == NULL)
+		_clar.errors = error;
+
+	if (_clar.last_error != NULL)
+		_clar.last_error->next = error;
+
+	_clar.last_error = error;
+
+	error->test = _clar.active_test;
+	error->test_number = _clar.test_count;
+	error->suite = _clar.active_suite;
+	error->file = file;
+	error->line_number = line;
+	error->error_msg = error_msg;
+
+	if (description != NULL)
+		error->description = strdup(description);
+
+	_clar.suite_errors++;
+	_clar.total_errors++;
+
+	if (should_abort) {
+		if (!_clar.trampoline_enabled) {
+			clar_print_onabort(
+				"Fatal error: a cleanup method raised an exception.");
+			exit(-1);
+		}
+
+		longjmp(_clar.trampoline, -1);
+	}
+}
+
+void clar__assert_equal_s(
+	const char *s1,
+	const char *s2,
+	const char *file,
+	int line,
+	const char *err,
+	int should_abort)
+{
+	int match = (s1 == NULL || s2 == NULL) ? (s1 == s2) : (strcmp(s1, s2) == 0);
+
+	if (!match) {
+		char buf[4096];
+		snprint_eq(buf, 4096, "'%s' != '%s'", s1, s2);
+		clar__assert(0, file, line, err, buf, should_abort);
+	}
+}
+
+void clar__assert_equal_i(
+	int i1,
+	int i2,
+	const char *file,
+	int line,
+	const char *err,
+	int should_abort)
+{
+	if (i1 != i2) {
+		char buf[128];
+		snprint_eq(buf, 128, "%d != %d", i1, i2);
+		clar__assert(0, file, line, err, buf, should_abort);
+	}
+}
+
+void cl_set_cleanup(void (*cleanup)(void *), void *opaque)
+{
+	_clar.local_cleanup = cleanup;
+	_clar.local_cleanup_payload = opaque;
+}
+
+static char _clar_path[4096];
+
+static int
+is_valid_tmp_path(const char *path)
+{
+	STAT_T st;
+
+	if (stat(path, &st) != 0)
+		return 0;
+
+	if (!S_ISDIR(st.st_mode))
+		return 0;
+
+	return (access(path, W_OK) == 0);
+}
+
+static int
+find_tmp_path(char *buffer, size_t length)
+{
+#ifndef _WIN32
+	static const size_t var_count = 4;
+	static const char *env_vars[] = {
+		"TMPDIR", "TMP", "TEMP", "USERPROFILE"
+ 	};
+
+ 	size_t i;
+
+	for (i = 0; i < var_count; ++i) {
+		const char *env = getenv(env_vars[i]);
+		if (!env)
+			continue;
+
+		if (is_valid_tmp_path(env)) {
+			strncpy(buffer, env, length);
+			return 0;
+		}
+	}
+
+	/* If the environment doesn't say anything, try to use /tmp */
+	if (is_valid_tmp_path("/tmp")) {
+		strncpy(buffer, "/tmp", length);
+		return 0;
+	}
+
+#else
+	if (GetTempPath((DWORD)length, buffer))
+		return 0;
+#endif
+
+	/* This system doesn't like us, try to use the current directory */
+	if (is_valid_tmp_path(".")) {
+		strncpy(buffer, ".", length);
+		return 0;
+	}
+
+	return -1;
+}
+
+static void clar_unsandbox(void)
+{
+	if (_clar_path[0] == '\0')
+		return;
+
+#ifdef _WIN32
+	chdir("..");
+#endif
+
+	fs_rm(_clar_path);
+}
+
+static int build_sandbox_path(void)
+{
+	const char path_tail[] = "clar_tmp_XXXXXX";
+	size_t len;
+
+	if (find_tmp_path(_clar_path, sizeof(_clar_path)) < 0)
+		return -1;
+
+	len = strlen(_clar_path);
+
+#ifdef _WIN32
+	{ /* normalize path to POSIX forward slashes */
+		size_t i;
+		for (i = 0; i < len; ++i) {
+			if (_clar_path[i] == '\\')
+				_clar_path[i] = '/';
+		}
+	}
+#endif
+
+	if (_clar_path[len - 1] != '/') {
+		_clar_path[len++] = '/';
+	}
+
+	strncpy(_clar_path + len, path_tail, sizeof(_clar_path) - len);
+
+#if defined(__MINGW32__)
+	if (_mktemp(_clar_path) == NULL)
+		return -1;
+
+	if (mkdir(_clar_path, 0700) != 0)
+		return -1;
+#elif defined(_WIN32)
+	if (_mktemp_s(_clar_path, sizeof(_clar_path)) != 0)
+		return -1;
+
+	if (mkdir(_clar_path, 0700) != 0)
+		return -1;
+#else
+	if (mkdtemp(_clar_path) == NULL)
+		return -1;
+#endif
+
+	return 0;
+}
+
+static int clar_sandbox(void)
+{
+	if (_clar_path[0] == '\0' && build_sandbox_path() < 0)
+		return -1;
+
+	if (chdir(_clar_path) != 0)
+		return -1;
+
+	return 0;
+}
+
+
+static const char *
+fixture_path(const char *base, const char *fixture_name)
+{
+	static char _path[4096];
+	size_t root_len;
+
+	root_len = strlen(base);
+	strncpy(_path, base, sizeof(_path));
+
+	if (_path[root_len - 1] != '/')
+		_path[root_len++] = '/';
+
+	if (fixture_name[0] == '/')
+		fixture_name++;
+
+	strncpy(_path + root_len,
+		fixture_name,
+		sizeof(_path) - root_len);
+
+	return _path;
+}
+
+#ifdef CLAR_FIXTURE_PATH
+const char *cl_fixture(const char *fixture_name)
+{
+	return fixture_path(CLAR_FIXTURE_PATH, fixture_name);
+}
+
+void cl_fixture_sandbox(const char *fixture_name)
+{
+	fs_copy(cl_fixture(fixture_name), _clar_path);
+}
+
+void cl_fixture_cleanup(const char *fixture_name)
+{
+	fs_rm(fixture_path(_clar_path, fixture_name));
+}
+#endif
+
+#ifdef _WIN32
+
+#define FOF_FLAGS (FOF_SILENT | FOF_NOCONFIRMATION | FOF_NOERRORUI | FOF_NOCONFIRMMKDIR)
+
+static char *
+fileops_path(const char *_path)
+{
+	char *path = NULL;
+	size_t length, i;
+
+	if (_path == NULL)
+		return NULL;
+
+	length = strlen(_path);
+	path = malloc(length + 2);
+
+	if (path == NULL)
+		return NULL;
+
+	memcpy(path, _path, length);
+	path[length] = 0;
+	path[length + 1] = 0;
+
+	for (i = 0; i < length; ++i) {
+		if (path[i] == '/')
+			path[i] = '\\';
+	}
+
+	return path;
+}
+
+static void
+fileops(int mode, const char *_source, const char *_dest)
+{
+	SHFILEOPSTRUCT fops;
+
+	char *source = fileops_path(_source);
+	char *dest = fileops_path(_dest);
+
+	ZeroMemory(&fops, sizeof(SHFILEOPSTRUCT));
+
+	fops.wFunc = mode;
+	fops.pFrom = source;
+	fops.pTo = dest;
+	fops.fFlags = FOF_FLAGS;
+
+	cl_assert_(
+		SHFileOperation(&fops) == 0,
+		"Windows SHFileOperation failed"
+	);
+
+	free(source);
+	free(dest);
+}
+
+static void
+fs_rm(const char *_source)
+{
+	fileops(FO_DELETE, _source, NULL);
+}
+
+static void
+fs_copy(const char *_source, const char *_dest)
+{
+	fileops(FO_COPY, _source, _dest);
+}
+
+void
+cl_fs_cleanup(void)
+{
+	fs_rm(fixture_path(_clar_path, "*"));
+}
+
+#else
+static int
+shell_out(char * const argv[])
+{
+	int status;
+	pid_t pid;
+
+	pid = fork();
+
+	if (pid < 0) {
+		fprintf(stderr,
+			"System error: `fork()` call failed.\n");
+		exit(-1);
+	}
+
+	if (pid == 0) {
+		execv(argv[0], argv);
+	}
+
+	waitpid(pid, &status, 0);
+	return WEXITSTATUS(status);
+}
+
+static void
+fs_copy(const char *_source, const char *dest)
+{
+	char *argv[5];
+	char *source;
+	size_t source_len;
+
+	source = strdup(_source);
+	source_len = strlen(source);
+
+	if (source[source_len - 1] == '/')
+		source[source_len - 1] = 0;
+
+	argv[0] = "/bin/cp";
+	argv[1] = "-R";
+	argv[2] = source;
+	argv[3] = (char *)dest;
+	argv[4] = NULL;
+
+	cl_must_pass_(
+		shell_out(argv),
+		"Failed to copy test fixtures to sandbox"
+	);
+
+	free(source);
+}
+
+static void
+fs_rm(const char *source)
+{
+	char *argv[4];
+
+	argv[0] = "/bin/rm";
+	argv[1] = "-Rf";
+	argv[2] = (char *)source;
+	argv[3] = NULL;
+
+	cl_must_pass_(
+		shell_out(argv),
+		"Failed to cleanup the sandbox"
+	);
+}
+
+void
+cl_fs_cleanup(void)
+{
+	clar_unsandbox();
+	clar_sandbox();
+}
+#endif
+
+
+static void clar_print_init(int test_count, int suite_count, const char *suite_names)
+{
+	(void)test_count;
+	(void)suite_names;
+	(void)suite_count;
+	printf("TAP version 13\n");
+}
+
+static void clar_print_shutdown(int test_count, int suite_count, int error_count)
+{
+	(void)test_count;
+	(void)suite_count;
+	(void)error_count;
+
+	if (!error_count)
+		printf("# passed all %d test(s)\n", test_count);
+	else
+		printf("# failed %d among %d test(s)\n", error_count,
+			test_count);
+	printf("1..%d\n", test_count);
+}
+
+static void clar_print_error(int num, const struct clar_error *error)
+{
+	(void)num;
+
+	printf("  ---\n");
+	printf("  message : %s\n", error->error_msg);
+	printf("  severity: fail\n");
+	printf("  suite   : %s\n", error->suite);
+	printf("  test    : %s\n", error->test);
+	printf("  file    : %s\n", error->file);
+	printf("  line    : %d\n", error->line_number);
+
+	if (error->description != NULL)
+		printf("  description: %s\n", error->description);
+
+	printf("  ...\n");
+}
+
+static void clar_print_ontest(const char *test_name, int test_number, int failed)
+{
+	printf("%s %d - %s\n",
+		failed ? "not ok" : "ok",
+		test_number,
+		test_name
+	);
+
+	clar_report_errors();
+}
+
+static void clar_print_onsuite(const char *suite_name, int suite_index)
+{
+	printf("# *** %s (#%d) ***\n", suite_name, suite_index);
+}
+
+static void clar_print_onabort(const char *msg, ...)
+{
+	va_list argp;
+	va_start(argp, msg);
+	fprintf(stdout, "Bail out! ");
+	vfprintf(stdout, msg, argp);
+	va_end(argp);
+}
+
+
+int _MAIN_CC main(int argc, char *argv[])
+{
+    return clar_test(argc, argv);
+}
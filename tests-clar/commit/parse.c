@@ -348,3 +348,43 @@ void test_commit_parse__details0(void) {
 	}
 }
 
+
+// signatures and the encoding are only parsed when they are asked for
+void test_commit_parse__lazy_fields(void)
+{
+	static const char *data =
+		"tree 1810dff58d8a660512d4832e740f692884338ccd\n\
+parent e90810b8df3e80c413d903f631643c716887138d\n\
+parent 9fd738e8f7967c078dceed8190330fc8648ee56a\n\
+author Vicent Marti tanoku@gmail.com> 1273848544 +0200\n\
+committer Vicent Marti <tanoku@gmail.com> 1273848544 +0200\n\
+encoding ISO-8859-1\n\
+\n\
+a commit with a broken author\n";
+
+	git_commit *commit;
+	git_oid oid;
+
+	commit = (git_commit*)git__malloc(sizeof(git_commit));
+	memset(commit, 0x0, sizeof(git_commit));
+	commit->object.repo = g_repo;
+
+	cl_git_pass(git_commit__parse_buffer(commit, data, strlen(data)));
+
+	cl_assert_equal_i(2, git_commit_parentcount(commit));
+	cl_git_pass(git_oid_fromstr(&oid, "9fd738e8f7967c078dceed8190330fc8648ee56a"));
+	cl_assert(git_oid_cmp(&oid, git_commit_parent_oid(commit, 1)) == 0);
+	cl_assert(git_commit_parent_oid(commit, 2) == NULL);
+
+	cl_assert(commit->author == NULL && commit->committer == NULL);
+	cl_assert_equal_s("a commit with a broken author\n", git_commit_message(commit));
+
+	cl_assert(git_commit_author(commit) == NULL);
+	cl_assert_equal_s("Vicent Marti", git_commit_committer(commit)->name);
+	cl_assert(git_commit_committer(commit) == commit->committer);
+	cl_assert_equal_i(1273848544, (int)git_commit_time(commit));
+	cl_assert_equal_i(120, git_commit_time_offset(commit));
+	cl_assert_equal_s("ISO-8859-1", git_commit_message_encoding(commit));
+
+	git_commit__free(commit);
+}
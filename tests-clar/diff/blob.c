@@ -312,3 +312,105 @@ void test_diff_blob__comparing_two_text_blobs_honors_interhunkcontext(void)
 
 	git_blob_free(old_d);
 }
+
+static git_blob *blob_from_string(const char *content)
+{
+	git_oid oid;
+	git_blob *blob;
+
+	cl_git_pass(git_blob_create_frombuffer(
+		&oid, g_repo, content, strlen(content)));
+	cl_git_pass(git_blob_lookup(&blob, g_repo, &oid));
+
+	return blob;
+}
+
+void test_diff_blob__can_use_the_patience_and_histogram_algorithms(void)
+{
+	git_blob *old_blob, *new_blob;
+
+	old_blob = blob_from_string(
+		"#include <stdio.h>\n"
+		"\n"
+		"// Frobs foo heartily\n"
+		"int frobnitz(int foo)\n"
+		"{\n"
+		"    int i;\n"
+		"    for(i = 0; i < 10; i++)\n"
+		"    {\n"
+		"        printf(\"Your answer is: \");\n"
+		"        printf(\"%d\\n\", foo);\n"
+		"    }\n"
+		"}\n"
+		"\n"
+		"int fact(int n)\n"
+		"{\n"
+		"    if(n > 1)\n"
+		"    {\n"
+		"        return fact(n-1) * n;\n"
+		"    }\n"
+		"    return 1;\n"
+		"}\n"
+		"\n"
+		"int main(int argc, char **argv)\n"
+		"{\n"
+		"    frobnitz(fact(10));\n"
+		"}\n");
+	new_blob = blob_from_string(
+		"#include <stdio.h>\n"
+		"\n"
+		"int fib(int n)\n"
+		"{\n"
+		"    if(n > 2)\n"
+		"    {\n"
+		"        return fib(n-1) + fib(n-2);\n"
+		"    }\n"
+		"    return 1;\n"
+		"}\n"
+		"\n"
+		"// Frobs foo heartily\n"
+		"int frobnitz(int foo)\n"
+		"{\n"
+		"    int i;\n"
+		"    for(i = 0; i < 10; i++)\n"
+		"    {\n"
+		"        printf(\"%d\\n\", foo);\n"
+		"    }\n"
+		"}\n"
+		"\n"
+		"int main(int argc, char **argv)\n"
+		"{\n"
+		"    frobnitz(fib(10));\n"
+		"}\n");
+
+	/* Myers matches the braces of unrelated functions */
+	cl_git_pass(git_diff_blobs(old_blob, new_blob, &opts,
+		&expected, diff_file_fn, diff_hunk_fn, diff_line_fn));
+	cl_assert_equal_i(2, expected.hunks);
+	cl_assert_equal_i(12, expected.line_ctxt);
+	cl_assert_equal_i(10, expected.line_adds);
+	cl_assert_equal_i(11, expected.line_dels);
+
+	/* the same as `git diff -U1 --patience` */
+	opts.flags = GIT_DIFF_PATIENCE;
+	memset(&expected, 0, sizeof(expected));
+	cl_git_pass(git_diff_blobs(old_blob, new_blob, &opts,
+		&expected, diff_file_fn, diff_hunk_fn, diff_line_fn));
+	cl_assert_equal_i(3, expected.hunks);
+	cl_assert_equal_i(8, expected.line_ctxt);
+	cl_assert_equal_i(10, expected.line_adds);
+	cl_assert_equal_i(11, expected.line_dels);
+
+	/* the same as `git diff -U1 --histogram` */
+	opts.flags = GIT_DIFF_HISTOGRAM;
+	memset(&expected, 0, sizeof(expected));
+	cl_git_pass(git_diff_blobs(old_blob, new_blob, &opts,
+		&expected, diff_file_fn, diff_hunk_fn, diff_line_fn));
+	cl_assert_equal_i(3, expected.hunks);
+	cl_assert_equal_i(8, expected.line_ctxt);
+	cl_assert_equal_i(10, expected.line_adds);
+	cl_assert_equal_i(11, expected.line_dels);
+
+	git_blob_free(old_blob);
+	git_blob_free(new_blob);
+}
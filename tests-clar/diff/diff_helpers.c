@@ -41,6 +41,8 @@ int diff_file_fn(
 	case GIT_DELTA_IGNORED: e->file_ignored++; break;
 	case GIT_DELTA_UNTRACKED: e->file_untracked++; break;
 	case GIT_DELTA_UNMODIFIED: e->file_unmodified++; break;
+	case GIT_DELTA_RENAMED: e->file_renames++; break;
+	case GIT_DELTA_COPIED: e->file_copies++; break;
 	default: break;
 	}
 	return 0;
@@ -173,3 +175,46 @@ abort:
 
 	return GIT_EUSER;
 }
+
+git_tree *diff_make_tree(git_repository *repo, const char **files)
+{
+	git_index *index;
+	git_buf path = GIT_BUF_INIT;
+	git_oid tree_id;
+	git_tree *tree;
+
+	cl_git_pass(git_repository_index(&index, repo));
+	git_index_clear(index);
+
+	for (; *files; files += 2) {
+		cl_git_pass(git_buf_joinpath(
+			&path, git_repository_workdir(repo), files[0]));
+		cl_git_pass(git_futils_mkpath2file(path.ptr, 0777));
+		cl_git_mkfile(path.ptr, files[1]);
+		cl_git_pass(git_index_add(index, files[0], 0));
+		cl_git_pass(p_unlink(path.ptr));
+	}
+
+	cl_git_pass(git_tree_create_fromindex(&tree_id, index));
+	cl_git_pass(git_tree_lookup(&tree, repo, &tree_id));
+
+	git_index_free(index);
+	git_buf_free(&path);
+
+	return tree;
+}
+
+int diff_collect_output(
+	void *cb_data,
+	git_diff_delta *delta,
+	git_diff_range *range,
+	char line_origin,
+	const char *content,
+	size_t content_len)
+{
+	GIT_UNUSED(delta);
+	GIT_UNUSED(range);
+	GIT_UNUSED(line_origin);
+
+	return git_buf_put((git_buf *)cb_data, content, content_len);
+}
@@ -23,6 +23,9 @@ typedef struct {
 	int line_dels;
 
 	bool at_least_one_of_them_is_binary;
+
+	int file_renames;
+	int file_copies;
 } diff_expects;
 
 extern int diff_file_fn(
@@ -51,3 +54,16 @@ extern int diff_foreach_via_iterator(
 	git_diff_file_fn file_cb,
 	git_diff_hunk_fn hunk_cb,
 	git_diff_data_fn line_cb);
+
+/* Build a tree out of NULL terminated pairs of paths and contents; the
+ * files only pass through the working directory of `repo` */
+extern git_tree *diff_make_tree(git_repository *repo, const char **files);
+
+/* Append the printed diff to the git_buf passed as `cb_data` */
+extern int diff_collect_output(
+	void *cb_data,
+	git_diff_delta *delta,
+	git_diff_range *range,
+	char line_origin,
+	const char *content,
+	size_t content_len);
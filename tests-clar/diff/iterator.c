@@ -237,6 +237,70 @@ void test_diff_iterator__tree_range_empty_2(void)
 		NULL, ".aaa_empty_before", 0, NULL);
 }
 
+static void tree_iterator_with_trees_test(
+	const char *sandbox,
+	const char *treeish,
+	bool enter_trees,
+	int expected_count,
+	const char **expected_values)
+{
+	git_tree *t;
+	git_iterator *i;
+	const git_index_entry *entry;
+	int count = 0;
+	git_repository *repo = cl_git_sandbox_init(sandbox);
+
+	cl_assert(t = resolve_commit_oid_to_tree(repo, treeish));
+	cl_git_pass(git_iterator_for_tree_ext(
+		&i, repo, t, NULL, NULL, GIT_ITERATOR_INCLUDE_TREES));
+	cl_git_pass(git_iterator_current(i, &entry));
+
+	while (entry != NULL) {
+		cl_assert_equal_s(expected_values[count], entry->path);
+		count++;
+
+		if (enter_trees && S_ISDIR(entry->mode))
+			cl_git_pass(git_iterator_advance_into_directory(i, &entry));
+		else
+			cl_git_pass(git_iterator_advance(i, &entry));
+	}
+
+	git_iterator_free(i);
+
+	cl_assert_equal_i(expected_count, count);
+
+	git_tree_free(t);
+}
+
+const char *expected_tree_2_with_trees[] = {
+	"current_file",
+	"file_deleted",
+	"modified_file",
+	"staged_changes",
+	"staged_changes_file_deleted",
+	"staged_changes_modified_file",
+	"staged_delete_file_deleted",
+	"staged_delete_modified_file",
+	"subdir.txt",
+	"subdir/",
+	"subdir/current_file",
+	"subdir/deleted_file",
+	"subdir/modified_file",
+	NULL
+};
+
+void test_diff_iterator__tree_with_trees_skips_what_is_not_entered(void)
+{
+	tree_iterator_with_trees_test(
+		"status", "26a125ee1", false, 10, expected_tree_2_with_trees);
+}
+
+void test_diff_iterator__tree_with_trees_enters_what_is_asked_for(void)
+{
+	tree_iterator_with_trees_test(
+		"status", "26a125ee1", true, 13, expected_tree_2_with_trees);
+}
+
 /* -- INDEX ITERATOR TESTS -- */
 
 static void index_iterator_test(
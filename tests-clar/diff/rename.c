@@ -0,0 +1,247 @@
+#include "clar_libgit2.h"
+#include "diff_helpers.h"
+
+static git_repository *g_repo = NULL;
+static git_tree *g_old_tree = NULL;
+static git_tree *g_new_tree = NULL;
+
+static void write_lines(git_buf *buf, const char *what, int changed_line)
+{
+	int i;
+
+	git_buf_clear(buf);
+	for (i = 0; i < 20; ++i) {
+		if (i == changed_line)
+			cl_git_pass(git_buf_printf(buf, "something else entirely\n"));
+		else
+			cl_git_pass(git_buf_printf(buf, "line %d of the %s\n", i, what));
+	}
+}
+
+void test_diff_rename__initialize(void)
+{
+	git_buf longer = GIT_BUF_INIT, story = GIT_BUF_INIT,
+		tale = GIT_BUF_INIT, keep = GIT_BUF_INIT, copy = GIT_BUF_INIT;
+	const char *old_files[11], *new_files[13];
+
+	g_repo = cl_git_sandbox_init("empty_standard_repo");
+
+	write_lines(&longer, "long file", -1);
+	write_lines(&story, "story", -1);
+	write_lines(&tale, "story", 10);
+	write_lines(&keep, "kept file", -1);
+	write_lines(&copy, "kept file", -1);
+	cl_git_pass(git_buf_puts(&copy, "and one more line\n"));
+
+	old_files[0] = "long.txt"; old_files[1] = longer.ptr;
+	old_files[2] = "story.txt"; old_files[3] = story.ptr;
+	old_files[4] = "keep.txt"; old_files[5] = keep.ptr;
+	old_files[6] = "gone.txt"; old_files[7] = "nothing like the others\n";
+	old_files[8] = "old_empty.txt"; old_files[9] = "";
+	old_files[10] = NULL;
+
+	new_files[0] = "moved.txt"; new_files[1] = longer.ptr;
+	new_files[2] = "tale.txt"; new_files[3] = tale.ptr;
+	new_files[4] = "keep.txt"; new_files[5] = keep.ptr;
+	new_files[6] = "copy.txt"; new_files[7] = copy.ptr;
+	new_files[8] = "fresh.txt"; new_files[9] = "all new\n";
+	new_files[10] = "new_empty.txt"; new_files[11] = "";
+	new_files[12] = NULL;
+
+	g_old_tree = diff_make_tree(g_repo, old_files);
+	g_new_tree = diff_make_tree(g_repo, new_files);
+
+	git_buf_free(&longer);
+	git_buf_free(&story);
+	git_buf_free(&tale);
+	git_buf_free(&keep);
+	git_buf_free(&copy);
+}
+
+void test_diff_rename__cleanup(void)
+{
+	git_tree_free(g_old_tree);
+	git_tree_free(g_new_tree);
+	g_old_tree = g_new_tree = NULL;
+
+	cl_git_sandbox_cleanup();
+}
+
+static git_diff_list *diff_trees(uint32_t flags, git_diff_find_options *find_opts)
+{
+	git_diff_options opts = {0};
+	git_diff_list *diff;
+
+	opts.flags = flags;
+
+	cl_git_pass(git_diff_tree_to_tree(g_repo, &opts, g_old_tree, g_new_tree, &diff));
+	cl_git_pass(git_diff_find_similar(diff, find_opts));
+
+	return diff;
+}
+
+static git_diff_delta *find_delta(git_diff_list *diff, const char *new_path)
+{
+	git_diff_iterator *iter;
+	git_diff_delta *delta, *found = NULL;
+
+	cl_git_pass(git_diff_iterator_new(&iter, diff));
+	while (git_diff_iterator_next_file(&delta, iter) == 0) {
+		if (strcmp(delta->new_file.path, new_path) == 0)
+			found = delta;
+	}
+	git_diff_iterator_free(iter);
+
+	cl_assert(found != NULL);
+	return found;
+}
+
+void test_diff_rename__finds_renames_by_default(void)
+{
+	git_diff_list *diff = diff_trees(0, NULL);
+	git_diff_delta *delta;
+	diff_expects exp;
+
+	memset(&exp, 0, sizeof(exp));
+	cl_git_pass(git_diff_foreach(diff, &exp, diff_file_fn, NULL, NULL));
+
+	cl_assert_equal_i(7, exp.files);
+	cl_assert_equal_i(2, exp.file_renames);
+	cl_assert_equal_i(3, exp.file_adds);
+	cl_assert_equal_i(2, exp.file_dels);
+	cl_assert_equal_i(0, exp.file_copies);
+
+	delta = find_delta(diff, "moved.txt");
+	cl_assert_equal_i(GIT_DELTA_RENAMED, delta->status);
+	cl_assert_equal_s("long.txt", delta->old_file.path);
+	cl_assert_equal_i(100, delta->similarity);
+
+	delta = find_delta(diff, "tale.txt");
+	cl_assert_equal_i(GIT_DELTA_RENAMED, delta->status);
+	cl_assert_equal_s("story.txt", delta->old_file.path);
+	cl_assert(delta->similarity >= 50 && delta->similarity < 100);
+
+	/* empty files are never paired */
+	cl_assert_equal_i(GIT_DELTA_ADDED, find_delta(diff, "new_empty.txt")->status);
+	cl_assert_equal_i(GIT_DELTA_DELETED, find_delta(diff, "old_empty.txt")->status);
+
+	git_diff_list_free(diff);
+}
+
+void test_diff_rename__finds_copies_of_unmodified_files(void)
+{
+	git_diff_find_options opts = {0};
+	git_diff_list *diff;
+	git_diff_delta *delta;
+	diff_expects exp;
+
+	opts.flags = GIT_DIFF_FIND_RENAMES | GIT_DIFF_FIND_COPIES_FROM_UNMODIFIED;
+	diff = diff_trees(GIT_DIFF_INCLUDE_UNMODIFIED, &opts);
+
+	memset(&exp, 0, sizeof(exp));
+	cl_git_pass(git_diff_foreach(diff, &exp, diff_file_fn, NULL, NULL));
+
+	cl_assert_equal_i(2, exp.file_renames);
+	cl_assert_equal_i(1, exp.file_copies);
+	cl_assert_equal_i(1, exp.file_unmodified);
+	cl_assert_equal_i(2, exp.file_adds);
+	cl_assert_equal_i(2, exp.file_dels);
+
+	delta = find_delta(diff, "copy.txt");
+	cl_assert_equal_i(GIT_DELTA_COPIED, delta->status);
+	cl_assert_equal_s("keep.txt", delta->old_file.path);
+
+	git_diff_list_free(diff);
+}
+
+void test_diff_rename__honors_the_threshold(void)
+{
+	git_diff_find_options opts = {0};
+	git_diff_list *diff;
+	diff_expects exp;
+
+	opts.flags = GIT_DIFF_FIND_RENAMES;
+	opts.rename_threshold = 100;
+	diff = diff_trees(0, &opts);
+
+	memset(&exp, 0, sizeof(exp));
+	cl_git_pass(git_diff_foreach(diff, &exp, diff_file_fn, NULL, NULL));
+
+	cl_assert_equal_i(1, exp.file_renames);
+	cl_assert_equal_i(4, exp.file_adds);
+	cl_assert_equal_i(3, exp.file_dels);
+
+	git_diff_list_free(diff);
+}
+
+void test_diff_rename__only_pairs_identical_files_past_the_limit(void)
+{
+	git_diff_find_options opts = {0};
+	git_diff_list *diff;
+	diff_expects exp;
+
+	opts.flags = GIT_DIFF_FIND_RENAMES;
+	opts.rename_limit = 1;
+	diff = diff_trees(0, &opts);
+
+	memset(&exp, 0, sizeof(exp));
+	cl_git_pass(git_diff_foreach(diff, &exp, diff_file_fn, NULL, NULL));
+
+	cl_assert_equal_i(1, exp.file_renames);
+	cl_assert_equal_i(GIT_DELTA_RENAMED, find_delta(diff, "moved.txt")->status);
+	cl_assert_equal_i(GIT_DELTA_ADDED, find_delta(diff, "tale.txt")->status);
+
+	git_diff_list_free(diff);
+
+	opts.rename_limit = 0;
+	opts.flags = GIT_DIFF_FIND_RENAMES | GIT_DIFF_FIND_EXACT_MATCH_ONLY;
+	diff = diff_trees(0, &opts);
+
+	memset(&exp, 0, sizeof(exp));
+	cl_git_pass(git_diff_foreach(diff, &exp, diff_file_fn, NULL, NULL));
+	cl_assert_equal_i(1, exp.file_renames);
+
+	git_diff_list_free(diff);
+}
+
+void test_diff_rename__prints_both_paths(void)
+{
+	git_diff_list *diff = diff_trees(0, NULL);
+	git_buf out = GIT_BUF_INIT;
+
+	cl_git_pass(git_diff_print_compact(diff, &out, diff_collect_output));
+
+	cl_assert_equal_s(
+		"A\tcopy.txt\n"
+		"A\tfresh.txt\n"
+		"D\tgone.txt\n"
+		"R\tlong.txt -> moved.txt\n"
+		"A\tnew_empty.txt\n"
+		"D\told_empty.txt\n"
+		"R\tstory.txt -> tale.txt\n", out.ptr);
+
+	git_buf_free(&out);
+	git_diff_list_free(diff);
+}
+
+void test_diff_rename__prints_the_rename_in_the_patch(void)
+{
+	git_diff_list *diff = diff_trees(0, NULL);
+	git_buf out = GIT_BUF_INIT;
+
+	cl_git_pass(git_diff_print_patch(diff, &out, diff_collect_output));
+
+	cl_assert(strstr(out.ptr,
+		"diff --git a/long.txt b/moved.txt\n"
+		"similarity index 100%\n"
+		"rename from long.txt\n"
+		"rename to moved.txt\n") != NULL);
+	cl_assert(strstr(out.ptr,
+		"rename from story.txt\n"
+		"rename to tale.txt\n") != NULL);
+	cl_assert(strstr(out.ptr, "-line 10 of the story\n") != NULL);
+	cl_assert(strstr(out.ptr, "+something else entirely\n") != NULL);
+
+	git_buf_free(&out);
+	git_diff_list_free(diff);
+}
@@ -80,6 +80,94 @@ void test_diff_tree__0(void)
 	git_tree_free(c);
 }
 
+static int count_stats(
+	void *cb_data,
+	git_diff_delta *delta,
+	size_t insertions,
+	size_t deletions)
+{
+	diff_expects *exp = cb_data;
+
+	GIT_UNUSED(delta);
+
+	exp->files++;
+	exp->line_adds += (int)insertions;
+	exp->line_dels += (int)deletions;
+
+	return 0;
+}
+
+static int stop_after_one_file(
+	void *cb_data,
+	git_diff_delta *delta,
+	size_t insertions,
+	size_t deletions)
+{
+	GIT_UNUSED(delta);
+	GIT_UNUSED(insertions);
+	GIT_UNUSED(deletions);
+
+	(*(int *)cb_data)++;
+	return 1;
+}
+
+static void assert_stats_match_the_lines(git_diff_list *diff)
+{
+	diff_expects lines, stats;
+	size_t insertions, deletions;
+	int files = 0;
+
+	memset(&lines, 0, sizeof(lines));
+	cl_git_pass(git_diff_foreach(
+		diff, &lines, diff_file_fn, NULL, diff_line_fn));
+
+	memset(&stats, 0, sizeof(stats));
+	cl_git_pass(git_diff_stats(
+		&insertions, &deletions, diff, &stats, count_stats));
+
+	cl_assert_equal_i(lines.files, stats.files);
+	cl_assert_equal_i(lines.line_adds, (int)insertions);
+	cl_assert_equal_i(lines.line_dels, (int)deletions);
+	cl_assert_equal_i(lines.line_adds, stats.line_adds);
+	cl_assert_equal_i(lines.line_dels, stats.line_dels);
+
+	cl_assert_equal_i(GIT_EUSER, git_diff_stats(
+		NULL, NULL, diff, &files, stop_after_one_file));
+	cl_assert_equal_i(1, files);
+}
+
+void test_diff_tree__stats_match_the_line_counts(void)
+{
+	git_tree *a, *b, *c;
+	git_diff_options opts = {0};
+	git_diff_list *diff = NULL;
+	size_t insertions, deletions;
+
+	g_repo = cl_git_sandbox_init("attr");
+
+	cl_assert((a = resolve_commit_oid_to_tree(g_repo, "605812a")) != NULL);
+	cl_assert((b = resolve_commit_oid_to_tree(g_repo, "370fe9ec22")) != NULL);
+	cl_assert((c = resolve_commit_oid_to_tree(g_repo, "f5b0af1fb4f5c")) != NULL);
+
+	cl_git_pass(git_diff_tree_to_tree(g_repo, &opts, a, b, &diff));
+	cl_git_pass(git_diff_stats(&insertions, &deletions, diff, NULL, NULL));
+	cl_assert_equal_i(24 + 1 + 5 + 5, (int)insertions);
+	cl_assert_equal_i(7 + 1, (int)deletions);
+	assert_stats_match_the_lines(diff);
+	git_diff_list_free(diff);
+
+	cl_git_pass(git_diff_tree_to_tree(g_repo, &opts, c, b, &diff));
+	cl_git_pass(git_diff_stats(&insertions, &deletions, diff, NULL, NULL));
+	cl_assert_equal_i(1, (int)insertions);
+	cl_assert_equal_i(7 + 14, (int)deletions);
+	assert_stats_match_the_lines(diff);
+	git_diff_list_free(diff);
+
+	git_tree_free(a);
+	git_tree_free(b);
+	git_tree_free(c);
+}
+
 void test_diff_tree__options(void)
 {
 	/* grabbed a couple of commit oids from the history of the attr repo */
@@ -338,3 +426,278 @@ void test_diff_tree__larger_hunks(void)
 	git_tree_free(a);
 	git_tree_free(b);
 }
+
+typedef struct {
+	git_odb_backend base;
+	int reads;
+	int header_reads;
+	git_oid watched;
+	int watched_reads;
+} counting_backend;
+
+static int counting_backend__read(
+	void **buffer_p, size_t *len_p, git_otype *type_p,
+	git_odb_backend *backend, const git_oid *oid)
+{
+	counting_backend *counter = (counting_backend *)backend;
+
+	GIT_UNUSED(buffer_p); GIT_UNUSED(len_p); GIT_UNUSED(type_p);
+
+	counter->reads++;
+	if (git_oid_cmp(oid, &counter->watched) == 0)
+		counter->watched_reads++;
+
+	return GIT_ENOTFOUND;
+}
+
+static int counting_backend__read_header(
+	size_t *len_p, git_otype *type_p,
+	git_odb_backend *backend, const git_oid *oid)
+{
+	GIT_UNUSED(len_p); GIT_UNUSED(type_p); GIT_UNUSED(oid);
+
+	((counting_backend *)backend)->header_reads++;
+	return GIT_ENOTFOUND;
+}
+
+static void counting_backend__free(git_odb_backend *backend)
+{
+	git__free(backend);
+}
+
+static int count_output(
+	void *cb_data,
+	git_diff_delta *delta,
+	git_diff_range *range,
+	char line_origin,
+	const char *content,
+	size_t content_len)
+{
+	GIT_UNUSED(delta); GIT_UNUSED(range); GIT_UNUSED(line_origin);
+	GIT_UNUSED(content); GIT_UNUSED(content_len);
+
+	(*(int *)cb_data)++;
+	return 0;
+}
+
+static counting_backend *add_counting_backend(git_odb **odb)
+{
+	counting_backend *counter = git__calloc(1, sizeof(counting_backend));
+
+	cl_assert(counter != NULL);
+	counter->base.read = counting_backend__read;
+	counter->base.read_header = counting_backend__read_header;
+	counter->base.free = counting_backend__free;
+
+	cl_git_pass(git_repository_odb(odb, g_repo));
+	cl_git_pass(git_odb_add_backend(*odb, (git_odb_backend *)counter, 100));
+
+	return counter;
+}
+
+void test_diff_tree__file_callbacks_do_not_read_the_blobs(void)
+{
+	git_tree *a, *b;
+	git_diff_options opts = {0};
+	git_diff_list *diff = NULL;
+	git_odb *odb;
+	counting_backend *counter;
+	diff_expects exp;
+	int printed = 0;
+
+	g_repo = cl_git_sandbox_init("attr");
+
+	cl_assert((a = resolve_commit_oid_to_tree(g_repo, "605812a")) != NULL);
+	cl_assert((b = resolve_commit_oid_to_tree(g_repo, "370fe9ec22")) != NULL);
+
+	counter = add_counting_backend(&odb);
+
+	opts.max_size = 1;
+	cl_git_pass(git_diff_tree_to_tree(g_repo, &opts, a, b, &diff));
+	counter->reads = counter->header_reads = 0;
+
+	memset(&exp, 0, sizeof(exp));
+	cl_git_pass(git_diff_foreach(diff, &exp, diff_file_fn, NULL, NULL));
+	cl_assert_equal_i(5, exp.files);
+	cl_assert_equal_i(2, exp.file_mods);
+
+	/* the sizes come from the object headers and make them binary */
+	cl_assert(exp.at_least_one_of_them_is_binary);
+	cl_assert(counter->header_reads > 0);
+	cl_assert_equal_i(0, counter->reads);
+
+	cl_git_pass(git_diff_print_compact(diff, &printed, count_output));
+	cl_assert_equal_i(5, printed);
+	cl_assert_equal_i(0, counter->reads);
+
+	git_diff_list_free(diff);
+
+	/* with a line callback, the content is needed */
+	opts.max_size = 0;
+	cl_git_pass(git_diff_tree_to_tree(g_repo, &opts, a, b, &diff));
+
+	memset(&exp, 0, sizeof(exp));
+	cl_git_pass(git_diff_foreach(
+		diff, &exp, diff_file_fn, NULL, diff_line_fn));
+	cl_assert(exp.lines > 0);
+	cl_assert(counter->reads > 0);
+
+	git_diff_list_free(diff);
+	git_odb_free(odb);
+	git_tree_free(a);
+	git_tree_free(b);
+}
+
+/* Build a tree of `count` files of ten lines, changing one line of each
+ * file if `changed` is set */
+static git_tree *make_numbered_tree(int count, int changed)
+{
+	git_buf contents[50];
+	char names[50][16];
+	const char *files[2 * 50 + 1];
+	git_tree *tree;
+	int i, j;
+
+	cl_assert(count <= 50);
+
+	for (i = 0; i < count; ++i) {
+		git_buf_init(&contents[i], 0);
+		for (j = 0; j < 10; ++j) {
+			if (changed && j == i % 10)
+				cl_git_pass(git_buf_printf(&contents[i], "changed line %d\n", j));
+			else
+				cl_git_pass(git_buf_printf(
+					&contents[i], "line %d of file %d\n", j, i));
+		}
+
+		p_snprintf(names[i], sizeof(names[i]), "file%02d.txt", i);
+		files[2 * i] = names[i];
+		files[2 * i + 1] = contents[i].ptr;
+	}
+	files[2 * count] = NULL;
+
+	tree = diff_make_tree(g_repo, files);
+
+	for (i = 0; i < count; ++i)
+		git_buf_free(&contents[i]);
+
+	return tree;
+}
+
+static int stop_after_ten_lines(
+	void *cb_data,
+	git_diff_delta *delta,
+	git_diff_range *range,
+	char line_origin,
+	const char *content,
+	size_t content_len)
+{
+	GIT_UNUSED(delta); GIT_UNUSED(range); GIT_UNUSED(line_origin);
+	GIT_UNUSED(content); GIT_UNUSED(content_len);
+
+	return ++(*(int *)cb_data) == 10;
+}
+
+void test_diff_tree__patches_computed_on_several_threads_come_in_order(void)
+{
+	git_tree *a, *b;
+	git_diff_list *diff = NULL;
+	git_config *cfg;
+	git_buf serial = GIT_BUF_INIT, parallel = GIT_BUF_INIT;
+	int lines = 0;
+
+	g_repo = cl_git_sandbox_init("empty_standard_repo");
+
+	/* several windows of files, with some added and some deleted */
+	a = make_numbered_tree(50, 0);
+	b = make_numbered_tree(45, 1);
+
+	cl_git_pass(git_diff_tree_to_tree(g_repo, NULL, a, b, &diff));
+	cl_git_pass(git_diff_print_patch(diff, &serial, diff_collect_output));
+	git_diff_list_free(diff);
+
+	cl_git_pass(git_repository_config(&cfg, g_repo));
+	cl_git_pass(git_config_set_int32(cfg, "diff.workers", 3));
+	cl_git_pass(git_config_set_int32(cfg, "diff.thresholdForParallelism", 1));
+	git_config_free(cfg);
+
+	cl_git_pass(git_diff_tree_to_tree(g_repo, NULL, a, b, &diff));
+	cl_git_pass(git_diff_print_patch(diff, &parallel, diff_collect_output));
+
+	cl_assert(strstr(serial.ptr, "+changed line 9\n") != NULL);
+	cl_assert(strstr(serial.ptr, "deleted file mode 100644\n") != NULL);
+	cl_assert_equal_s(serial.ptr, parallel.ptr);
+
+	cl_assert_equal_i(GIT_EUSER, git_diff_foreach(
+		diff, &lines, NULL, NULL, stop_after_ten_lines));
+	cl_assert_equal_i(10, lines);
+
+	git_diff_list_free(diff);
+	git_buf_free(&serial);
+	git_buf_free(&parallel);
+	git_tree_free(a);
+	git_tree_free(b);
+}
+
+void test_diff_tree__equal_subtrees_are_not_read(void)
+{
+	const char *old_files[] = {
+		"top.txt", "top\n",
+		"same/a.txt", "a\n",
+		"same/deep/b.txt", "b\n",
+		"changed/c.txt", "c\n",
+		"changed/same/d.txt", "d\n",
+		NULL
+	};
+	const char *new_files[] = {
+		"top.txt", "top\n",
+		"same/a.txt", "a\n",
+		"same/deep/b.txt", "b\n",
+		"changed/c.txt", "c was changed\n",
+		"changed/same/d.txt", "d\n",
+		"changed/new/e.txt", "e\n",
+		NULL
+	};
+	git_tree *a, *b;
+	git_diff_options opts = {0};
+	git_diff_list *diff = NULL;
+	git_odb *odb;
+	counting_backend *counter;
+	diff_expects exp;
+
+	g_repo = cl_git_sandbox_init("empty_standard_repo");
+
+	a = diff_make_tree(g_repo, old_files);
+	b = diff_make_tree(g_repo, new_files);
+
+	counter = add_counting_backend(&odb);
+	git_oid_cpy(&counter->watched, git_tree_entry_id(
+		git_tree_entry_byname(a, "same")));
+
+	cl_git_pass(git_diff_tree_to_tree(g_repo, &opts, a, b, &diff));
+
+	memset(&exp, 0, sizeof(exp));
+	cl_git_pass(git_diff_foreach(diff, &exp, diff_file_fn, NULL, NULL));
+	cl_assert_equal_i(2, exp.files);
+	cl_assert_equal_i(1, exp.file_mods);
+	cl_assert_equal_i(1, exp.file_adds);
+
+	cl_assert_equal_i(0, counter->watched_reads);
+	git_diff_list_free(diff);
+
+	/* the unmodified files are only found by reading the subtree */
+	opts.flags = GIT_DIFF_INCLUDE_UNMODIFIED;
+	cl_git_pass(git_diff_tree_to_tree(g_repo, &opts, a, b, &diff));
+
+	memset(&exp, 0, sizeof(exp));
+	cl_git_pass(git_diff_foreach(diff, &exp, diff_file_fn, NULL, NULL));
+	cl_assert_equal_i(6, exp.files);
+	cl_assert_equal_i(4, exp.file_unmodified);
+
+	cl_assert(counter->watched_reads > 0);
+	git_diff_list_free(diff);
+
+	git_odb_free(odb);
+	git_tree_free(a);
+	git_tree_free(b);
+}
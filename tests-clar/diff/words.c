@@ -0,0 +1,208 @@
+#include "clar_libgit2.h"
+#include "diff_helpers.h"
+
+static git_repository *g_repo = NULL;
+
+void test_diff_words__initialize(void)
+{
+	g_repo = cl_git_sandbox_init("empty_standard_repo");
+}
+
+void test_diff_words__cleanup(void)
+{
+	cl_git_sandbox_cleanup();
+}
+
+/* Render the spans like `git diff --word-diff=plain` */
+static int render_words(
+	void *cb_data,
+	git_diff_delta *delta,
+	git_diff_range *range,
+	char span_origin,
+	const char *content,
+	size_t content_len)
+{
+	git_buf *out = cb_data;
+
+	GIT_UNUSED(delta);
+	cl_assert(range != NULL);
+
+	switch (span_origin) {
+	case GIT_DIFF_WORD_CONTEXT:
+		return git_buf_put(out, content, content_len);
+	case GIT_DIFF_WORD_DELETION:
+		return git_buf_printf(out, "[-%.*s-]", (int)content_len, content);
+	case GIT_DIFF_WORD_ADDITION:
+		return git_buf_printf(out, "{+%.*s+}", (int)content_len, content);
+	case GIT_DIFF_WORD_NEWLINE:
+		cl_assert_equal_i(1, (int)content_len);
+		return git_buf_putc(out, '\n');
+	}
+
+	cl_fail("unexpected span origin");
+	return -1;
+}
+
+static int stop_after_three_spans(
+	void *cb_data,
+	git_diff_delta *delta,
+	git_diff_range *range,
+	char span_origin,
+	const char *content,
+	size_t content_len)
+{
+	int *count = cb_data;
+
+	GIT_UNUSED(delta);
+	GIT_UNUSED(range);
+	GIT_UNUSED(span_origin);
+	GIT_UNUSED(content);
+	GIT_UNUSED(content_len);
+
+	return (++*count == 3);
+}
+
+static int count_spans(
+	void *cb_data,
+	git_diff_delta *delta,
+	git_diff_range *range,
+	char span_origin,
+	const char *content,
+	size_t content_len)
+{
+	diff_expects *exp = cb_data;
+
+	GIT_UNUSED(delta);
+	GIT_UNUSED(range);
+	GIT_UNUSED(content);
+	GIT_UNUSED(content_len);
+
+	exp->lines++;
+	if (span_origin == GIT_DIFF_WORD_ADDITION)
+		exp->line_adds++;
+	else if (span_origin == GIT_DIFF_WORD_DELETION)
+		exp->line_dels++;
+
+	return 0;
+}
+
+static git_diff_list *diff_file(
+	const char *word_regex, const char *old_text, const char *new_text)
+{
+	git_diff_options opts = {0};
+	git_index *index;
+	git_diff_list *diff;
+
+	cl_git_mkfile("empty_standard_repo/file.txt", old_text);
+	cl_git_pass(git_repository_index(&index, g_repo));
+	cl_git_pass(git_index_add(index, "file.txt", 0));
+	cl_git_pass(git_index_write(index));
+	git_index_free(index);
+
+	cl_git_mkfile("empty_standard_repo/file.txt", new_text);
+	opts.word_regex = (char *)word_regex;
+	cl_git_pass(git_diff_workdir_to_index(g_repo, &opts, &diff));
+
+	return diff;
+}
+
+static void assert_word_diff(
+	const char *expected,
+	const char *word_regex,
+	const char *old_text,
+	const char *new_text)
+{
+	git_diff_list *diff = diff_file(word_regex, old_text, new_text);
+	git_buf out = GIT_BUF_INIT;
+
+	cl_git_pass(git_diff_foreach_words(
+		diff, &out, NULL, NULL, render_words));
+	cl_assert_equal_s(expected, out.ptr);
+
+	git_buf_free(&out);
+	git_diff_list_free(diff);
+}
+
+void test_diff_words__diffs_the_changed_lines_word_by_word(void)
+{
+	assert_word_diff(
+		"the quick [-brown-]{+red+} fox\n"
+		"jumps over\n"
+		"the {+very+} lazy dog\n",
+		NULL,
+		"the quick brown fox\njumps over\nthe lazy dog\n",
+		"the quick red fox\njumps over\nthe very lazy dog\n");
+}
+
+void test_diff_words__runs_of_whitespace_do_not_count(void)
+{
+	assert_word_diff(
+		"  one\ttwo    [-three-]{+four+}\n",
+		NULL,
+		"one two three\n",
+		"  one\ttwo    four\n");
+}
+
+void test_diff_words__lines_added_or_removed_whole(void)
+{
+	assert_word_diff(
+		"first\n"
+		"[-removed\n-]"
+		"middle\n"
+		"{+added+}\n"
+		"{+more+}\n"
+		"last\n",
+		NULL,
+		"first\nremoved\nmiddle\nlast\n",
+		"first\nmiddle\nadded\nmore\nlast\n");
+}
+
+void test_diff_words__uses_the_word_regex(void)
+{
+	assert_word_diff(
+		"The colo{+u+}r of the sea\n",
+		".",
+		"The color of the sea\n",
+		"The colour of the sea\n");
+
+	assert_word_diff(
+		"call(a, [-b-]{+c+})\n",
+		"[a-z]+|[^[:space:]]",
+		"call(a,b)\n",
+		"call(a, c)\n");
+}
+
+void test_diff_words__reports_hunks_and_stops_on_request(void)
+{
+	git_diff_list *diff = diff_file(NULL,
+		"the quick brown fox\njumps over\nthe lazy dog\n",
+		"the quick red fox\njumps over\nthe very lazy dog\n");
+	diff_expects exp;
+	int count = 0;
+
+	memset(&exp, 0, sizeof(exp));
+	cl_git_pass(git_diff_foreach_words(
+		diff, &exp, diff_file_fn, diff_hunk_fn, count_spans));
+	cl_assert_equal_i(1, exp.files);
+	cl_assert_equal_i(1, exp.hunks);
+	cl_assert_equal_i(2, exp.line_adds);
+	cl_assert_equal_i(1, exp.line_dels);
+
+	cl_assert_equal_i(GIT_EUSER, git_diff_foreach_words(
+		diff, &count, NULL, NULL, stop_after_three_spans));
+	cl_assert_equal_i(3, count);
+
+	git_diff_list_free(diff);
+}
+
+void test_diff_words__rejects_a_bad_regex(void)
+{
+	git_diff_list *diff = diff_file("(unclosed", "one\n", "two\n");
+	git_buf out = GIT_BUF_INIT;
+
+	cl_git_fail(git_diff_foreach_words(diff, &out, NULL, NULL, render_words));
+	cl_assert(giterr_last() != NULL);
+
+	git_buf_free(&out);
+	git_diff_list_free(diff);
+}
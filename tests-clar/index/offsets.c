@@ -0,0 +1,163 @@
+#include "clar_libgit2.h"
+#include "index.h"
+
+/*
+ * 240 entries in four directories, with a TREE extension, written by
+ * $ git -c index.threads=4 -c index.recordOffsetTable=true \
+ *       -c index.recordEndOfIndexEntries=true update-index --force-write-index
+ * (and again with --index-version 4 for the v4 fixture)
+ */
+#define TEST_INDEX_IEOT cl_fixture("ieot.index")
+#define TEST_INDEX_IEOT_V4 cl_fixture("ieot-v4.index")
+
+static git_index *open_index(const char *path, unsigned int threads)
+{
+	git_index *index;
+
+	cl_git_pass(git_index_open(&index, path));
+
+	/* read it again, now split up between threads */
+	index->threads = threads;
+	index->last_modified = 0;
+	cl_git_pass(git_index_read(index));
+
+	return index;
+}
+
+static void assert_same_entries(git_index *a, git_index *b)
+{
+	unsigned int i;
+
+	cl_assert_equal_i(git_index_entrycount(a), git_index_entrycount(b));
+
+	for (i = 0; i < git_index_entrycount(a); ++i) {
+		git_index_entry *entry_a = git_index_get(a, i);
+		git_index_entry *entry_b = git_index_get(b, i);
+
+		cl_assert_equal_s(entry_a->path, entry_b->path);
+		cl_assert(git_oid_cmp(&entry_a->oid, &entry_b->oid) == 0);
+		cl_assert(entry_a->file_size == entry_b->file_size);
+	}
+}
+
+static bool has_end_of_entries(const char *path)
+{
+	git_buf buf = GIT_BUF_INIT;
+	bool found;
+
+	cl_git_pass(git_futils_readbuffer(&buf, path));
+	cl_assert(buf.size > 52);
+
+	/* EOIE header and payload right before the checksum */
+	found = (memcmp(buf.ptr + buf.size - 52, "EOIE", 4) == 0);
+
+	git_buf_free(&buf);
+	return found;
+}
+
+void test_index_offsets__cleanup(void)
+{
+	p_unlink("index_offsets");
+}
+
+static void assert_reads_in_blocks(const char *path)
+{
+	git_index *serial, *parallel;
+
+	serial = open_index(path, 1);
+	parallel = open_index(path, 4);
+
+	cl_assert_equal_i(240, git_index_entrycount(parallel));
+	cl_assert_equal_s("dir1/file1.txt", git_index_get(parallel, 0)->path);
+	cl_assert_equal_s("dir4/file9.txt", git_index_get(parallel, 239)->path);
+	cl_assert(parallel->tree != NULL);
+
+	assert_same_entries(serial, parallel);
+
+	git_index_free(serial);
+	git_index_free(parallel);
+}
+
+void test_index_offsets__read_blocks_written_by_git(void)
+{
+	assert_reads_in_blocks(TEST_INDEX_IEOT);
+}
+
+void test_index_offsets__read_v4_blocks_written_by_git(void)
+{
+	assert_reads_in_blocks(TEST_INDEX_IEOT_V4);
+}
+
+void test_index_offsets__more_threads_than_blocks(void)
+{
+	git_index *serial, *parallel;
+
+	serial = open_index(TEST_INDEX_IEOT, 1);
+	parallel = open_index(TEST_INDEX_IEOT, 16);
+
+	assert_same_entries(serial, parallel);
+
+	git_index_free(serial);
+	git_index_free(parallel);
+}
+
+static void assert_writes_blocks(unsigned int version)
+{
+	git_index *expected, *index;
+
+	p_unlink("index_offsets");
+	cl_git_pass(git_futils_cp(TEST_INDEX_IEOT, "index_offsets", 0666));
+
+	index = open_index("index_offsets", 1);
+	cl_git_pass(git_index_set_version(index, version));
+	cl_git_pass(git_index_write(index));
+	git_index_free(index);
+
+	cl_assert(!has_end_of_entries("index_offsets"));
+
+	index = open_index("index_offsets", 3);
+	cl_git_pass(git_index_write(index));
+	git_index_free(index);
+
+	cl_assert(has_end_of_entries("index_offsets"));
+
+	expected = open_index(TEST_INDEX_IEOT, 1);
+	index = open_index("index_offsets", 3);
+
+	cl_assert_equal_i(version, git_index_version(index));
+	assert_same_entries(expected, index);
+
+	git_index_free(expected);
+	git_index_free(index);
+}
+
+void test_index_offsets__write_blocks(void)
+{
+	assert_writes_blocks(2);
+}
+
+void test_index_offsets__write_v4_blocks(void)
+{
+	assert_writes_blocks(4);
+}
+
+void test_index_offsets__entries_read_from_disk_can_be_replaced(void)
+{
+	git_index *index;
+	git_index_entry entry;
+
+	index = open_index(TEST_INDEX_IEOT, 4);
+
+	memcpy(&entry, git_index_get(index, 10), sizeof(entry));
+	entry.file_size = 12345;
+	cl_git_pass(git_index_add2(index, &entry));
+	cl_assert(git_index_get(index, 10)->file_size == 12345);
+
+	cl_git_pass(git_index_remove(index, 0));
+	cl_assert_equal_i(239, git_index_entrycount(index));
+
+	git_index_clear(index);
+	cl_assert_equal_i(0, git_index_entrycount(index));
+
+	git_index_free(index);
+}
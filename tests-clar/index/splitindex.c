@@ -0,0 +1,202 @@
+#include "clar_libgit2.h"
+#include "index.h"
+#include "posix.h"
+
+/*
+ * 30 entries a/f1 .. c/f10 in the shared index, written by
+ * $ git config core.splitIndex true
+ * $ git update-index --split-index
+ * after which a/f3 and new.txt were added and b/f5 removed, which
+ * git records in the split index.
+ */
+#define SHARED_INDEX "splitindex/sharedindex.db93f1c3f7623eb1a9dea24cbad86c08ee838657"
+
+void test_index_splitindex__initialize(void)
+{
+	cl_fixture_sandbox("splitindex");
+}
+
+void test_index_splitindex__cleanup(void)
+{
+	cl_fixture_cleanup("splitindex");
+}
+
+static size_t count_shared_indexes(void)
+{
+	git_vector files = GIT_VECTOR_INIT;
+	char *file;
+	size_t i, count = 0;
+
+	cl_git_pass(git_vector_init(&files, 4, NULL));
+	cl_git_pass(git_path_dirload("splitindex", 0, 0, &files));
+
+	git_vector_foreach(&files, i, file) {
+		if (strstr(file, "sharedindex.") != NULL)
+			count++;
+		git__free(file);
+	}
+
+	git_vector_free(&files);
+	return count;
+}
+
+static void assert_entry(git_index *index, const char *path, const char *sha)
+{
+	git_index_entry *entry;
+	git_oid oid;
+	int pos;
+
+	cl_assert((pos = git_index_find(index, path)) >= 0);
+	entry = git_index_get(index, pos);
+
+	cl_git_pass(git_oid_fromstr(&oid, sha));
+	cl_assert(git_oid_cmp(&oid, &entry->oid) == 0);
+	cl_assert_equal_i(strlen(path), entry->flags & GIT_IDXENTRY_NAMEMASK);
+}
+
+static void assert_git_changes(git_index *index)
+{
+	cl_assert_equal_i(30, git_index_entrycount(index));
+
+	assert_entry(index, "a/f3", "5ea2ed416fbd4a4cbe227b75fe255dd7fa6bd4d6");
+	assert_entry(index, "new.txt", "3e757656cf36eca53338e520d134963a44f793f8");
+	assert_entry(index, "b/f4", "8e953e84d803f13fd06416a1bd8161dcd93cfd00");
+	assert_entry(index, "b/f6", "07eb61d36f49569a2b0649af299f9f00013d0969");
+	assert_entry(index, "c/f9", "f899bd1761a5ca5978799bc3189a04d3c52d8435");
+
+	cl_assert(git_index_find(index, "b/f5") < 0);
+}
+
+static void change_entry(git_index *index, const char *path)
+{
+	git_index_entry entry, *existing;
+
+	existing = git_index_get(index, git_index_find(index, path));
+	memcpy(&entry, existing, sizeof(entry));
+
+	entry.path = (char *)path;
+	entry.file_size++;
+	cl_git_pass(git_oid_fromstr(&entry.oid, "45b983be36b73c0788dc9cbcb76cbb80fc7bb057"));
+
+	cl_git_pass(git_index_add2(index, &entry));
+}
+
+void test_index_splitindex__read(void)
+{
+	git_index *index;
+
+	cl_git_pass(git_index_open(&index, "splitindex/index"));
+	cl_assert(git_index_is_split(index));
+
+	assert_git_changes(index);
+
+	git_index_free(index);
+}
+
+void test_index_splitindex__missing_shared_index_fails(void)
+{
+	git_index *index;
+
+	cl_git_pass(p_unlink(SHARED_INDEX));
+	cl_git_fail(git_index_open(&index, "splitindex/index"));
+}
+
+void test_index_splitindex__small_changes_keep_the_shared_index(void)
+{
+	git_index *index;
+	struct stat before, after;
+
+	cl_git_pass(p_stat(SHARED_INDEX, &before));
+	cl_git_pass(p_stat("splitindex/index", &after));
+
+	cl_git_pass(git_index_open(&index, "splitindex/index"));
+	change_entry(index, "c/f9");
+	cl_git_pass(git_index_write(index));
+	git_index_free(index);
+
+	/* only the changed entries are written to the index */
+	cl_assert_equal_i(1, count_shared_indexes());
+	cl_assert(git_path_exists(SHARED_INDEX));
+	cl_git_pass(p_stat("splitindex/index", &after));
+	cl_assert(after.st_size < before.st_size / 4);
+
+	cl_git_pass(git_index_open(&index, "splitindex/index"));
+	cl_assert(git_index_is_split(index));
+	cl_assert_equal_i(30, git_index_entrycount(index));
+	assert_entry(index, "c/f9", "45b983be36b73c0788dc9cbcb76cbb80fc7bb057");
+	assert_entry(index, "a/f3", "5ea2ed416fbd4a4cbe227b75fe255dd7fa6bd4d6");
+	assert_entry(index, "new.txt", "3e757656cf36eca53338e520d134963a44f793f8");
+	cl_assert(git_index_find(index, "b/f5") < 0);
+
+	cl_git_pass(git_index_remove(index, git_index_find(index, "new.txt")));
+	cl_git_pass(git_index_write(index));
+	git_index_free(index);
+
+	cl_git_pass(git_index_open(&index, "splitindex/index"));
+	cl_assert_equal_i(29, git_index_entrycount(index));
+	cl_assert(git_index_find(index, "new.txt") < 0);
+	cl_assert_equal_i(1, count_shared_indexes());
+	git_index_free(index);
+}
+
+void test_index_splitindex__many_changes_write_a_new_shared_index(void)
+{
+	git_index *index;
+	const char *paths[] = {
+		"a/f1", "a/f2", "a/f4", "a/f5", "a/f6", "a/f7", "a/f8"
+	};
+	size_t i;
+
+	cl_git_pass(git_index_open(&index, "splitindex/index"));
+
+	for (i = 0; i < ARRAY_SIZE(paths); ++i)
+		change_entry(index, paths[i]);
+
+	cl_git_pass(git_index_write(index));
+
+	/* the old shared index is still fresh enough to be kept */
+	cl_assert_equal_i(2, count_shared_indexes());
+
+	for (i = 0; i < ARRAY_SIZE(paths); ++i)
+		assert_entry(index, paths[i], "45b983be36b73c0788dc9cbcb76cbb80fc7bb057");
+
+	git_index_free(index);
+
+	cl_git_pass(p_unlink(SHARED_INDEX));
+
+	cl_git_pass(git_index_open(&index, "splitindex/index"));
+	cl_assert_equal_i(30, git_index_entrycount(index));
+
+	for (i = 0; i < ARRAY_SIZE(paths); ++i)
+		assert_entry(index, paths[i], "45b983be36b73c0788dc9cbcb76cbb80fc7bb057");
+	assert_entry(index, "new.txt", "3e757656cf36eca53338e520d134963a44f793f8");
+
+	git_index_free(index);
+}
+
+void test_index_splitindex__unsplit(void)
+{
+	git_index *index;
+
+	cl_git_pass(git_index_open(&index, "splitindex/index"));
+	cl_git_pass(git_index_set_split(index, 0));
+	cl_git_pass(git_index_write(index));
+	git_index_free(index);
+
+	cl_git_pass(p_unlink(SHARED_INDEX));
+
+	cl_git_pass(git_index_open(&index, "splitindex/index"));
+	cl_assert(!git_index_is_split(index));
+	assert_git_changes(index);
+
+	/* and split it up again */
+	cl_git_pass(git_index_set_split(index, 1));
+	cl_git_pass(git_index_write(index));
+	cl_assert_equal_i(1, count_shared_indexes());
+	git_index_free(index);
+
+	cl_git_pass(git_index_open(&index, "splitindex/index"));
+	cl_assert(git_index_is_split(index));
+	assert_git_changes(index);
+	git_index_free(index);
+}
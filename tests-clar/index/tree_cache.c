@@ -0,0 +1,118 @@
+#include "clar_libgit2.h"
+#include "index.h"
+#include "tree-cache.h"
+
+static git_repository *g_repo;
+static git_index *g_index;
+
+void test_index_tree_cache__initialize(void)
+{
+	g_repo = cl_git_sandbox_init("status");
+	cl_git_pass(git_repository_index(&g_index, g_repo));
+}
+
+void test_index_tree_cache__cleanup(void)
+{
+	git_index_free(g_index);
+	cl_git_sandbox_cleanup();
+}
+
+static const git_tree_cache *cached_tree(git_index *index, const char *path)
+{
+	const git_tree_cache *tree = index->tree;
+
+	cl_assert(tree != NULL);
+	if (*path)
+		tree = git_tree_cache_get(tree, path);
+
+	return tree;
+}
+
+static void tree_entry_oid(git_oid *out, const git_oid *tree_id, const char *name)
+{
+	git_tree *tree;
+	const git_tree_entry *entry;
+
+	cl_git_pass(git_tree_lookup(&tree, g_repo, tree_id));
+	cl_assert((entry = git_tree_entry_byname(tree, name)) != NULL);
+	git_oid_cpy(out, git_tree_entry_id(entry));
+	git_tree_free(tree);
+}
+
+void test_index_tree_cache__is_filled_and_written_out(void)
+{
+	git_repository *repo;
+	git_index *index;
+	const git_tree_cache *root, *subdir;
+	git_oid tree_id, subdir_id;
+
+	cl_git_pass(git_tree_create_fromindex(&tree_id, g_index));
+	tree_entry_oid(&subdir_id, &tree_id, "subdir");
+
+	root = cached_tree(g_index, "");
+	cl_assert_equal_i(git_index_entrycount(g_index), (int)root->entries);
+	cl_assert(git_oid_cmp(&tree_id, &root->oid) == 0);
+
+	cl_git_pass(git_index_write(g_index));
+
+	cl_git_pass(git_repository_open(&repo, "status"));
+	cl_git_pass(git_repository_index(&index, repo));
+
+	root = cached_tree(index, "");
+	cl_assert(git_oid_cmp(&tree_id, &root->oid) == 0);
+
+	cl_assert((subdir = cached_tree(index, "subdir")) != NULL);
+	cl_assert(subdir->entries > 0);
+	cl_assert(git_oid_cmp(&subdir_id, &subdir->oid) == 0);
+
+	git_index_free(index);
+	git_repository_free(repo);
+}
+
+void test_index_tree_cache__unchanged_subtrees_are_reused(void)
+{
+	git_tree_cache *subdir;
+	git_oid tree_id, bogus, subdir_id;
+
+	cl_git_pass(git_tree_create_fromindex(&tree_id, g_index));
+
+	/* a subtree that is not written again keeps what the cache says */
+	cl_git_pass(git_oid_fromstr(&bogus, "0123456789012345678901234567890123456789"));
+	subdir = (git_tree_cache *)cached_tree(g_index, "subdir");
+	git_oid_cpy(&subdir->oid, &bogus);
+
+	cl_git_rewritefile("status/current_file", "changed\n");
+	cl_git_pass(git_index_add(g_index, "current_file", 0));
+	cl_assert(cached_tree(g_index, "")->entries < 0);
+
+	cl_git_pass(git_tree_create_fromindex(&tree_id, g_index));
+	tree_entry_oid(&subdir_id, &tree_id, "subdir");
+	cl_assert(git_oid_cmp(&bogus, &subdir_id) == 0);
+
+	/* and one with a changed entry is written again */
+	cl_git_pass(git_index_add(g_index, "subdir/current_file", 0));
+	cl_assert(cached_tree(g_index, "subdir")->entries < 0);
+
+	cl_git_pass(git_tree_create_fromindex(&tree_id, g_index));
+	tree_entry_oid(&subdir_id, &tree_id, "subdir");
+	cl_assert(git_oid_cmp(&bogus, &subdir_id) != 0);
+	cl_assert(git_oid_cmp(&subdir_id, &cached_tree(g_index, "subdir")->oid) == 0);
+}
+
+void test_index_tree_cache__removed_subtrees_are_dropped(void)
+{
+	git_oid tree_id;
+	int pos;
+
+	cl_git_pass(git_tree_create_fromindex(&tree_id, g_index));
+	cl_assert(cached_tree(g_index, "subdir") != NULL);
+
+	while ((pos = git_index__prefix_position(g_index, "subdir/")) <
+		(int)git_index_entrycount(g_index) &&
+		!git__prefixcmp(git_index_get(g_index, pos)->path, "subdir/"))
+		cl_git_pass(git_index_remove(g_index, pos));
+
+	cl_git_pass(git_tree_create_fromindex(&tree_id, g_index));
+	cl_assert(cached_tree(g_index, "subdir") == NULL);
+	cl_assert_equal_i(git_index_entrycount(g_index), (int)cached_tree(g_index, "")->entries);
+}
@@ -0,0 +1,125 @@
+#include "clar_libgit2.h"
+#include "index.h"
+
+#define TEST_INDEX2_PATH cl_fixture("gitgit.index")
+#define TEST_INDEX2_V4_PATH cl_fixture("gitgit-v4.index")
+#define TEST_INDEXBIG_PATH cl_fixture("big.index")
+
+static void copy_file(const char *src, const char *dst)
+{
+	p_unlink(dst);
+	cl_git_pass(git_futils_cp(src, dst, 0666));
+}
+
+static void assert_same_entries(git_index *a, git_index *b)
+{
+	unsigned int i;
+
+	cl_assert_equal_i(git_index_entrycount(a), git_index_entrycount(b));
+
+	for (i = 0; i < git_index_entrycount(a); ++i) {
+		git_index_entry *entry_a = git_index_get(a, i);
+		git_index_entry *entry_b = git_index_get(b, i);
+
+		cl_assert_equal_s(entry_a->path, entry_b->path);
+		cl_assert(git_oid_cmp(&entry_a->oid, &entry_b->oid) == 0);
+		cl_assert(entry_a->mode == entry_b->mode);
+		cl_assert(entry_a->flags == entry_b->flags);
+		cl_assert(entry_a->file_size == entry_b->file_size);
+		cl_assert(entry_a->mtime.seconds == entry_b->mtime.seconds);
+	}
+}
+
+static git_off_t file_size(const char *path)
+{
+	struct stat st;
+
+	cl_git_pass(p_stat(path, &st));
+	return st.st_size;
+}
+
+void test_index_version__cleanup(void)
+{
+	p_unlink("index_v4");
+}
+
+void test_index_version__new_index_defaults_to_v2(void)
+{
+	git_index *index;
+
+	cl_git_pass(git_index_open(&index, "in-memory-index"));
+	cl_assert_equal_i(2, git_index_version(index));
+
+	cl_git_fail(git_index_set_version(index, 1));
+	cl_git_fail(git_index_set_version(index, 5));
+	cl_assert_equal_i(2, git_index_version(index));
+
+	git_index_free(index);
+}
+
+void test_index_version__read_v4_written_by_git(void)
+{
+	git_index *index, *v4;
+
+	cl_git_pass(git_index_open(&index, TEST_INDEX2_PATH));
+	cl_git_pass(git_index_open(&v4, TEST_INDEX2_V4_PATH));
+
+	cl_assert_equal_i(2, git_index_version(index));
+	cl_assert_equal_i(4, git_index_version(v4));
+	cl_assert(v4->tree != NULL);
+
+	assert_same_entries(index, v4);
+
+	git_index_free(index);
+	git_index_free(v4);
+}
+
+void test_index_version__write_v4(void)
+{
+	git_index *index, *v4;
+
+	copy_file(TEST_INDEX2_PATH, "index_v4");
+
+	cl_git_pass(git_index_open(&v4, "index_v4"));
+	cl_git_pass(git_index_set_version(v4, 4));
+	cl_git_pass(git_index_write(v4));
+	git_index_free(v4);
+
+	cl_assert(file_size("index_v4") < file_size(TEST_INDEX2_PATH));
+
+	cl_git_pass(git_index_open(&index, TEST_INDEX2_PATH));
+	cl_git_pass(git_index_open(&v4, "index_v4"));
+	cl_assert_equal_i(4, git_index_version(v4));
+
+	assert_same_entries(index, v4);
+
+	git_index_free(index);
+	git_index_free(v4);
+}
+
+void test_index_version__v4_round_trips_back_to_v2(void)
+{
+	git_index *index;
+	git_buf expected = GIT_BUF_INIT, actual = GIT_BUF_INIT;
+
+	copy_file(TEST_INDEXBIG_PATH, "index_v4");
+
+	cl_git_pass(git_index_open(&index, "index_v4"));
+	cl_git_pass(git_index_set_version(index, 4));
+	cl_git_pass(git_index_write(index));
+	git_index_free(index);
+
+	cl_git_pass(git_index_open(&index, "index_v4"));
+	cl_assert_equal_i(4, git_index_version(index));
+	cl_git_pass(git_index_set_version(index, 2));
+	cl_git_pass(git_index_write(index));
+	git_index_free(index);
+
+	cl_git_pass(git_futils_readbuffer(&expected, TEST_INDEXBIG_PATH));
+	cl_git_pass(git_futils_readbuffer(&actual, "index_v4"));
+	cl_assert(expected.size == actual.size);
+	cl_assert(memcmp(expected.ptr, actual.ptr, expected.size) == 0);
+
+	git_buf_free(&expected);
+	git_buf_free(&actual);
+}
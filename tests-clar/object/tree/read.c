@@ -73,3 +73,35 @@ void test_object_tree_read__two(void)
 	git_object_free(obj);
 	git_tree_free(tree);
 }
+
+void test_object_tree_read__entries_are_materialized_on_demand(void)
+{
+	git_oid id;
+	git_tree *tree;
+	const git_tree_entry *entry;
+	git_tree_entry *copy;
+	char oid_str[GIT_OID_HEXSZ + 1];
+
+	git_oid_fromstr(&id, tree_oid);
+
+	cl_git_pass(git_tree_lookup(&tree, g_repo, &id));
+	cl_assert(tree->entries == NULL);
+
+	entry = git_tree_entry_byname(tree, "new.txt");
+	cl_assert(entry != NULL);
+	cl_assert(tree->entries != NULL);
+
+	/* the same entry is handed out however it is looked up */
+	cl_assert(git_tree_entry_byindex(tree, 2) == entry);
+	cl_assert(git_tree_entry_byoid(tree, &entry->oid) == entry);
+	cl_assert_equal_i(GIT_FILEMODE_BLOB, git_tree_entry_filemode(entry));
+
+	/* duplicated entries outlive their tree */
+	copy = git_tree_entry_dup(entry);
+	git_tree_free(tree);
+
+	cl_assert_equal_s("new.txt", git_tree_entry_name(copy));
+	git_oid_tostr(oid_str, sizeof(oid_str), git_tree_entry_id(copy));
+	cl_assert_equal_s("a71586c1dfe8a71c6cbf6c129f404c5642ff31bd", oid_str);
+	git_tree_entry_free(copy);
+}
@@ -1,5 +1,6 @@
 #include "clar_libgit2.h"
 #include "odb.h"
+#include "buffer.h"
 #include "pack_data.h"
 
 static git_odb *_odb;
@@ -76,3 +77,45 @@ void test_odb_packed__read_header_1(void)
 	}
 }
 
+
+static void assert_stream_reads_object(const char *sha)
+{
+	git_oid id;
+	git_odb_object *obj;
+	git_odb_stream *stream;
+	git_buf contents = GIT_BUF_INIT;
+	char buffer[7];
+	int read_bytes;
+
+	cl_git_pass(git_oid_fromstr(&id, sha));
+	cl_git_pass(git_odb_read(&obj, _odb, &id));
+	cl_git_pass(git_odb_open_rstream(&stream, _odb, &id));
+
+	/* read in small pieces to go across the buffers */
+	while ((read_bytes = stream->read(stream, buffer, sizeof(buffer))) > 0)
+		cl_git_pass(git_buf_put(&contents, buffer, read_bytes));
+
+	cl_assert(read_bytes == 0);
+	cl_assert(obj->raw.len == contents.size);
+	cl_assert(memcmp(obj->raw.data, contents.ptr, contents.size) == 0);
+
+	stream->free(stream);
+	git_buf_free(&contents);
+	git_odb_object_free(obj);
+}
+
+void test_odb_packed__read_stream_0(void)
+{
+	unsigned int i;
+
+	for (i = 0; i < ARRAY_SIZE(packed_objects); ++i)
+		assert_stream_reads_object(packed_objects[i]);
+}
+
+void test_odb_packed__read_stream_1(void)
+{
+	unsigned int i;
+
+	for (i = 0; i < ARRAY_SIZE(loose_objects); ++i)
+		assert_stream_reads_object(loose_objects[i]);
+}
@@ -0,0 +1,343 @@
+#include "clar_libgit2.h"
+#include "commit_graph.h"
+#include "fileops.h"
+
+/*
+	$ git log --oneline --graph --decorate
+	*   a4a7dce (HEAD, br2) Merge branch 'master' into br2
+	|\
+	| * 9fd738e (master) a fourth commit
+	| * 4a202b3 a third commit
+	* | c47800c branch commit one
+	|/
+	* 5b5b025 another commit
+	* 8496071 testing
+
+	The graph was written with
+	$ git -c commitGraph.generationVersion=1 commit-graph write --reachable
+*/
+
+static git_repository *_repo;
+static git_revwalk *_walk;
+
+void test_revwalk_commitgraph__initialize(void)
+{
+	_repo = cl_git_sandbox_init("testrepo.git");
+
+	cl_git_pass(git_futils_mkdir_r("testrepo.git/objects/info", NULL, 0777));
+	cl_git_pass(git_futils_cp(cl_fixture("commit-graph/testrepo"),
+		"testrepo.git/" GIT_COMMIT_GRAPH_FILE, 0644));
+
+	cl_git_pass(git_revwalk_new(&_walk, _repo));
+}
+
+void test_revwalk_commitgraph__cleanup(void)
+{
+	git_revwalk_free(_walk);
+	_walk = NULL;
+
+	cl_git_sandbox_cleanup();
+}
+
+void test_revwalk_commitgraph__lookup(void)
+{
+	git_commit_graph *graph;
+	git_commit_graph_entry entry, parent;
+	git_oid oid, expected;
+
+	cl_git_pass(git_commit_graph_open(&graph, "testrepo.git/" GIT_COMMIT_GRAPH_FILE));
+
+	cl_git_pass(git_oid_fromstr(&oid, "a4a7dce85cf63874e984719f4fdd239f5145052f"));
+	cl_git_pass(git_commit_graph_find(&entry, graph, &oid));
+	cl_assert_equal_i(2, entry.parent_count);
+	cl_assert_equal_i(5, entry.generation);
+
+	cl_git_pass(git_commit_graph_entry_parent(&parent, graph, &entry, 0));
+	cl_git_pass(git_oid_fromstr(&expected, "c47800c7266a2be04c571c04d5a6614691ea99bd"));
+	cl_assert(git_oid_cmp(&expected, git_commit_graph_oid(graph, parent.graph_pos)) == 0);
+	cl_assert_equal_i(3, parent.generation);
+
+	cl_git_pass(git_commit_graph_entry_parent(&parent, graph, &entry, 1));
+	cl_git_pass(git_oid_fromstr(&expected, "9fd738e8f7967c078dceed8190330fc8648ee56a"));
+	cl_assert(git_oid_cmp(&expected, git_commit_graph_oid(graph, parent.graph_pos)) == 0);
+	cl_assert_equal_i(4, parent.generation);
+
+	cl_git_pass(git_oid_fromstr(&oid, "8496071c1b46c854b31185ea97743be6a8774479"));
+	cl_git_pass(git_commit_graph_find(&entry, graph, &oid));
+	cl_assert_equal_i(0, entry.parent_count);
+	cl_assert_equal_i(1, entry.generation);
+
+	/* trees and blobs are never part of the graph */
+	cl_git_pass(git_oid_fromstr(&oid, "181037049a54a1eb5fab404658a3a250b44335d7"));
+	cl_assert_equal_i(GIT_ENOTFOUND, git_commit_graph_find(&entry, graph, &oid));
+
+	git_commit_graph_free(graph);
+}
+
+static void assert_topological(const char *tip, const char *hide, size_t expected_count)
+{
+	git_oid oid, seen[16];
+	git_commit *commit;
+	size_t count = 0, i, j;
+
+	git_revwalk_sorting(_walk, GIT_SORT_TOPOLOGICAL);
+
+	cl_git_pass(git_oid_fromstr(&oid, tip));
+	cl_git_pass(git_revwalk_push(_walk, &oid));
+
+	if (hide) {
+		cl_git_pass(git_oid_fromstr(&oid, hide));
+		cl_git_pass(git_revwalk_hide(_walk, &oid));
+	}
+
+	while (git_revwalk_next(&oid, _walk) == 0) {
+		cl_assert(count < ARRAY_SIZE(seen));
+		git_oid_cpy(&seen[count++], &oid);
+	}
+
+	cl_assert_equal_i(expected_count, count);
+
+	/* no commit may show up before any of its children */
+	for (i = 0; i < count; ++i) {
+		cl_git_pass(git_commit_lookup(&commit, _repo, &seen[i]));
+
+		for (j = 0; j < git_commit_parentcount(commit); ++j) {
+			size_t k;
+
+			for (k = 0; k < i; ++k)
+				cl_assert(git_oid_cmp(&seen[k], git_commit_parent_oid(commit, j)) != 0);
+		}
+
+		git_commit_free(commit);
+	}
+}
+
+void test_revwalk_commitgraph__topological_order(void)
+{
+	assert_topological("a4a7dce85cf63874e984719f4fdd239f5145052f", NULL, 6);
+	assert_topological("a65fedf39aefe402d3bb6e24df4d4f5fe4547750", NULL, 7);
+	assert_topological("e90810b8df3e80c413d903f631643c716887138d", NULL, 2);
+}
+
+void test_revwalk_commitgraph__topological_order_with_hidden_commits(void)
+{
+	assert_topological("a4a7dce85cf63874e984719f4fdd239f5145052f",
+		"9fd738e8f7967c078dceed8190330fc8648ee56a", 2);
+}
+
+void test_revwalk_commitgraph__topological_order_is_reusable(void)
+{
+	assert_topological("a65fedf39aefe402d3bb6e24df4d4f5fe4547750",
+		"c47800c7266a2be04c571c04d5a6614691ea99bd", 4);
+	assert_topological("a65fedf39aefe402d3bb6e24df4d4f5fe4547750", NULL, 7);
+}
+
+void test_revwalk_commitgraph__topological_walk_without_graph(void)
+{
+	git_revwalk_free(_walk);
+	cl_git_pass(p_unlink("testrepo.git/" GIT_COMMIT_GRAPH_FILE));
+	cl_git_pass(git_revwalk_new(&_walk, _repo));
+
+	assert_topological("a65fedf39aefe402d3bb6e24df4d4f5fe4547750", NULL, 7);
+	assert_topological("a4a7dce85cf63874e984719f4fdd239f5145052f",
+		"9fd738e8f7967c078dceed8190330fc8648ee56a", 2);
+}
+
+static void assert_bloom(
+	git_commit_graph *graph, const char *commit, const char *path, int expected)
+{
+	git_commit_graph_entry entry;
+	git_commit_graph_bloom_key key;
+	git_oid oid;
+
+	cl_git_pass(git_oid_fromstr(&oid, commit));
+	cl_git_pass(git_commit_graph_find(&entry, graph, &oid));
+
+	git_commit_graph_bloom_key_init(&key, graph, path, strlen(path));
+	cl_assert_equal_i(expected,
+		git_commit_graph_bloom_contains(graph, entry.graph_pos, &key));
+}
+
+static void assert_changed_paths(git_commit_graph *graph)
+{
+	cl_assert(git_commit_graph_has_bloom(graph));
+
+	/* 4a202b3 "a third commit" changes README */
+	assert_bloom(graph, "4a202b346bb0fb0db7eff3cffeb3c70babbd2045", "README", 1);
+	assert_bloom(graph, "4a202b346bb0fb0db7eff3cffeb3c70babbd2045", "new.txt", 0);
+
+	/* 9fd738e "a fourth commit" changes new.txt */
+	assert_bloom(graph, "9fd738e8f7967c078dceed8190330fc8648ee56a", "new.txt", 1);
+	assert_bloom(graph, "9fd738e8f7967c078dceed8190330fc8648ee56a", "README", 0);
+
+	/* 763d71a adds ab/de/fgh/1.txt, and all of its leading directories */
+	assert_bloom(graph, "763d71aadf09a7951596c9746c024e7eece7c7af", "ab/de/fgh/1.txt", 1);
+	assert_bloom(graph, "763d71aadf09a7951596c9746c024e7eece7c7af", "ab/de", 1);
+	assert_bloom(graph, "763d71aadf09a7951596c9746c024e7eece7c7af", "ab", 1);
+}
+
+static void assert_pathspec_walk(const char *path, const char **expected)
+{
+	git_strarray pathspec;
+	git_oid oid, expected_oid;
+	size_t i = 0;
+
+	pathspec.strings = (char **)&path;
+	pathspec.count = 1;
+	cl_git_pass(git_revwalk_set_pathspec(_walk, &pathspec));
+
+	git_revwalk_sorting(_walk, GIT_SORT_TIME);
+	cl_git_pass(git_revwalk_push_glob(_walk, "heads/*"));
+
+	while (git_revwalk_next(&oid, _walk) == 0) {
+		cl_assert(expected[i] != NULL);
+		cl_git_pass(git_oid_fromstr(&expected_oid, expected[i++]));
+		cl_assert(git_oid_cmp(&expected_oid, &oid) == 0);
+	}
+
+	cl_assert(expected[i] == NULL);
+}
+
+static void assert_pathspec_walks(void)
+{
+	/* git log --format=%H --branches -- <path> */
+	static const char *readme[] = {
+		"4a202b346bb0fb0db7eff3cffeb3c70babbd2045",
+		"8496071c1b46c854b31185ea97743be6a8774479",
+		NULL
+	};
+	static const char *subdirectory[] = {
+		"763d71aadf09a7951596c9746c024e7eece7c7af",
+		NULL
+	};
+
+	assert_pathspec_walk("README", readme);
+	assert_pathspec_walk("ab/de", subdirectory);
+}
+
+void test_revwalk_commitgraph__reads_changed_paths_from_git(void)
+{
+	git_commit_graph *graph;
+
+	git_revwalk_free(_walk);
+	_walk = NULL;
+
+	cl_git_pass(p_unlink("testrepo.git/" GIT_COMMIT_GRAPH_FILE));
+	cl_git_pass(git_futils_cp(cl_fixture("commit-graph/testrepo-changed-paths"),
+		"testrepo.git/" GIT_COMMIT_GRAPH_FILE, 0644));
+	cl_git_pass(git_revwalk_new(&_walk, _repo));
+
+	cl_git_pass(git_commit_graph_open(&graph, "testrepo.git/" GIT_COMMIT_GRAPH_FILE));
+	assert_changed_paths(graph);
+	git_commit_graph_free(graph);
+
+	assert_pathspec_walks();
+}
+
+void test_revwalk_commitgraph__graph_without_changed_paths(void)
+{
+	git_commit_graph *graph;
+	git_commit_graph_bloom_key key;
+
+	cl_git_pass(git_commit_graph_open(&graph, "testrepo.git/" GIT_COMMIT_GRAPH_FILE));
+	cl_assert(!git_commit_graph_has_bloom(graph));
+
+	git_commit_graph_bloom_key_init(&key, graph, "README", strlen("README"));
+	cl_assert_equal_i(GIT_ENOTFOUND, git_commit_graph_bloom_contains(graph, 0, &key));
+
+	git_commit_graph_free(graph);
+}
+
+void test_revwalk_commitgraph__write(void)
+{
+	git_commit_graph *graph;
+	git_commit_graph_entry entry;
+	git_oid oid;
+
+	cl_git_pass(p_unlink("testrepo.git/" GIT_COMMIT_GRAPH_FILE));
+
+	cl_git_pass(git_revwalk_push_glob(_walk, "heads/*"));
+	cl_git_pass(git_revwalk_write_commit_graph(_walk, 0));
+
+	cl_git_pass(git_commit_graph_open(&graph, "testrepo.git/" GIT_COMMIT_GRAPH_FILE));
+	cl_assert(!git_commit_graph_has_bloom(graph));
+
+	cl_git_pass(git_oid_fromstr(&oid, "a4a7dce85cf63874e984719f4fdd239f5145052f"));
+	cl_git_pass(git_commit_graph_find(&entry, graph, &oid));
+	cl_assert_equal_i(2, entry.parent_count);
+	cl_assert_equal_i(5, entry.generation);
+
+	git_commit_graph_free(graph);
+
+	assert_topological("a4a7dce85cf63874e984719f4fdd239f5145052f", NULL, 6);
+	assert_topological("a65fedf39aefe402d3bb6e24df4d4f5fe4547750", NULL, 7);
+}
+
+void test_revwalk_commitgraph__write_changed_paths(void)
+{
+	git_commit_graph *graph;
+
+	cl_git_pass(git_revwalk_push_glob(_walk, "heads/*"));
+	cl_git_pass(git_revwalk_write_commit_graph(_walk, GIT_COMMIT_GRAPH_CHANGED_PATHS));
+
+	cl_git_pass(git_commit_graph_open(&graph, "testrepo.git/" GIT_COMMIT_GRAPH_FILE));
+	assert_changed_paths(graph);
+	git_commit_graph_free(graph);
+
+	/* the walker has switched over to the new graph */
+	assert_pathspec_walks();
+}
+
+/* Move the end of the chunk with the given id by `shift` bytes */
+static void move_chunk_end(uint32_t id, int shift)
+{
+	git_buf graph = GIT_BUF_INIT;
+	unsigned char *chunk;
+	uint32_t offset;
+	int fd;
+
+	cl_git_pass(git_futils_readbuffer(&graph, "testrepo.git/" GIT_COMMIT_GRAPH_FILE));
+
+	for (chunk = (unsigned char *)graph.ptr + 8; ; chunk += 12) {
+		cl_assert((char *)chunk < graph.ptr + graph.size);
+		if (((uint32_t)chunk[0] << 24 | chunk[1] << 16 | chunk[2] << 8 | chunk[3]) == id)
+			break;
+	}
+
+	/* the chunk ends where the next one starts */
+	chunk += 12 + 8;
+	offset = ((uint32_t)chunk[0] << 24 | chunk[1] << 16 | chunk[2] << 8 | chunk[3]) + shift;
+	chunk[0] = (unsigned char)(offset >> 24);
+	chunk[1] = (unsigned char)(offset >> 16);
+	chunk[2] = (unsigned char)(offset >> 8);
+	chunk[3] = (unsigned char)offset;
+
+	cl_assert((fd = p_creat("testrepo.git/" GIT_COMMIT_GRAPH_FILE, 0644)) >= 0);
+	cl_git_pass(p_write(fd, graph.ptr, graph.size));
+	p_close(fd);
+
+	git_buf_free(&graph);
+}
+
+void test_revwalk_commitgraph__rejects_chunks_that_do_not_match(void)
+{
+	git_commit_graph *graph;
+
+	git_revwalk_free(_walk);
+	_walk = NULL;
+
+	/* a lookup table that ends in the middle of an object id */
+	move_chunk_end(GIT_COMMIT_GRAPH_CHUNK_OIDLOOKUP, -4);
+	cl_git_fail(git_commit_graph_open(&graph, "testrepo.git/" GIT_COMMIT_GRAPH_FILE));
+
+	/* commit data for one commit less than there are in the lookup */
+	cl_git_pass(p_unlink("testrepo.git/" GIT_COMMIT_GRAPH_FILE));
+	cl_git_pass(git_futils_cp(cl_fixture("commit-graph/testrepo"),
+		"testrepo.git/" GIT_COMMIT_GRAPH_FILE, 0644));
+	move_chunk_end(GIT_COMMIT_GRAPH_CHUNK_DATA, -(GIT_OID_RAWSZ + 16));
+	cl_git_fail(git_commit_graph_open(&graph, "testrepo.git/" GIT_COMMIT_GRAPH_FILE));
+
+	/* walks fall back to reading the commits */
+	cl_git_pass(git_revwalk_new(&_walk, _repo));
+	assert_topological("a4a7dce85cf63874e984719f4fdd239f5145052f", NULL, 6);
+}
@@ -0,0 +1,221 @@
+#include "clar_libgit2.h"
+
+static git_repository *_repo;
+static git_revwalk *_walk;
+
+void test_revwalk_pathspec__initialize(void)
+{
+	cl_git_pass(git_repository_open(&_repo, cl_fixture("testrepo.git")));
+	cl_git_pass(git_revwalk_new(&_walk, _repo));
+}
+
+void test_revwalk_pathspec__cleanup(void)
+{
+	git_revwalk_free(_walk);
+	git_repository_free(_repo);
+}
+
+static void set_pathspec(const char *path1, const char *path2)
+{
+	char *strings[2];
+	git_strarray pathspec;
+
+	strings[0] = (char *)path1;
+	strings[1] = (char *)path2;
+	pathspec.strings = strings;
+	pathspec.count = path2 ? 2 : 1;
+
+	cl_git_pass(git_revwalk_set_pathspec(_walk, &pathspec));
+}
+
+/* expected is a NULL-terminated list of commit ids, in output order */
+static void assert_walk(
+	unsigned int sorting, const char *tip, const char *hide, const char **expected)
+{
+	git_oid oid, expected_oid;
+	size_t i = 0;
+
+	git_revwalk_sorting(_walk, sorting);
+
+	cl_git_pass(git_oid_fromstr(&oid, tip));
+	cl_git_pass(git_revwalk_push(_walk, &oid));
+
+	if (hide) {
+		cl_git_pass(git_oid_fromstr(&oid, hide));
+		cl_git_pass(git_revwalk_hide(_walk, &oid));
+	}
+
+	while (git_revwalk_next(&oid, _walk) == 0) {
+		cl_assert(expected[i] != NULL);
+		cl_git_pass(git_oid_fromstr(&expected_oid, expected[i++]));
+		cl_assert(git_oid_cmp(&expected_oid, &oid) == 0);
+	}
+
+	cl_assert(expected[i] == NULL);
+}
+
+static const char *readme[] = {
+	"4a202b346bb0fb0db7eff3cffeb3c70babbd2045",
+	"8496071c1b46c854b31185ea97743be6a8774479",
+	NULL
+};
+
+static const char *new_txt[] = {
+	"9fd738e8f7967c078dceed8190330fc8648ee56a",
+	"5b5b025afb0b4c913b4c338a42934a3863bf3644",
+	NULL
+};
+
+static const char *branch_file[] = {
+	"a65fedf39aefe402d3bb6e24df4d4f5fe4547750",
+	"c47800c7266a2be04c571c04d5a6614691ea99bd",
+	NULL
+};
+
+static const char *subdirectories[] = {
+	"763d71aadf09a7951596c9746c024e7eece7c7af",
+	NULL
+};
+
+static const char *nothing[] = {
+	NULL
+};
+
+void test_revwalk_pathspec__single_file(void)
+{
+	set_pathspec("README", NULL);
+	assert_walk(GIT_SORT_TIME, "a65fedf39aefe402d3bb6e24df4d4f5fe4547750", NULL, readme);
+
+	set_pathspec("new.txt", NULL);
+	assert_walk(GIT_SORT_TIME, "a65fedf39aefe402d3bb6e24df4d4f5fe4547750", NULL, new_txt);
+
+	set_pathspec("branch_file.txt", NULL);
+	assert_walk(GIT_SORT_TIME, "a65fedf39aefe402d3bb6e24df4d4f5fe4547750", NULL, branch_file);
+}
+
+void test_revwalk_pathspec__sorting_modes(void)
+{
+	set_pathspec("README", NULL);
+	assert_walk(GIT_SORT_NONE, "a65fedf39aefe402d3bb6e24df4d4f5fe4547750", NULL, readme);
+	assert_walk(GIT_SORT_TOPOLOGICAL, "a65fedf39aefe402d3bb6e24df4d4f5fe4547750", NULL, readme);
+	assert_walk(GIT_SORT_TOPOLOGICAL | GIT_SORT_TIME,
+		"a65fedf39aefe402d3bb6e24df4d4f5fe4547750", NULL, readme);
+}
+
+void test_revwalk_pathspec__merges_that_differ_from_all_parents_are_shown(void)
+{
+	/* git log --format=%H a65fedf -- new.txt branch_file.txt */
+	static const char *expected[] = {
+		"a65fedf39aefe402d3bb6e24df4d4f5fe4547750",
+		"be3563ae3f795b2b4353bcce3a527ad0a4f7f644",
+		"c47800c7266a2be04c571c04d5a6614691ea99bd",
+		"9fd738e8f7967c078dceed8190330fc8648ee56a",
+		"5b5b025afb0b4c913b4c338a42934a3863bf3644",
+		NULL
+	};
+
+	static const char *hidden[] = {
+		"a65fedf39aefe402d3bb6e24df4d4f5fe4547750",
+		"be3563ae3f795b2b4353bcce3a527ad0a4f7f644",
+		"9fd738e8f7967c078dceed8190330fc8648ee56a",
+		NULL
+	};
+
+	set_pathspec("new.txt", "branch_file.txt");
+	assert_walk(GIT_SORT_TIME, "a65fedf39aefe402d3bb6e24df4d4f5fe4547750", NULL, expected);
+	assert_walk(GIT_SORT_TIME, "a65fedf39aefe402d3bb6e24df4d4f5fe4547750",
+		"c47800c7266a2be04c571c04d5a6614691ea99bd", hidden);
+}
+
+void test_revwalk_pathspec__directories(void)
+{
+	set_pathspec("ab", NULL);
+	assert_walk(GIT_SORT_TIME, "763d71aadf09a7951596c9746c024e7eece7c7af", NULL, subdirectories);
+
+	set_pathspec("ab/de/", NULL);
+	assert_walk(GIT_SORT_TIME, "763d71aadf09a7951596c9746c024e7eece7c7af", NULL, subdirectories);
+
+	set_pathspec("ab/de/fgh/1.txt", NULL);
+	assert_walk(GIT_SORT_TIME, "763d71aadf09a7951596c9746c024e7eece7c7af", NULL, subdirectories);
+
+	/* a path below a file never exists */
+	set_pathspec("README/nope", NULL);
+	assert_walk(GIT_SORT_TIME, "763d71aadf09a7951596c9746c024e7eece7c7af", NULL, nothing);
+}
+
+void test_revwalk_pathspec__missing_path(void)
+{
+	set_pathspec("nope", NULL);
+	assert_walk(GIT_SORT_TIME, "a65fedf39aefe402d3bb6e24df4d4f5fe4547750", NULL, nothing);
+}
+
+void test_revwalk_pathspec__clearing_the_pathspec(void)
+{
+	git_oid oid;
+	int i = 0;
+
+	set_pathspec("README", NULL);
+	assert_walk(GIT_SORT_TIME, "a65fedf39aefe402d3bb6e24df4d4f5fe4547750", NULL, readme);
+
+	cl_git_pass(git_revwalk_set_pathspec(_walk, NULL));
+
+	cl_git_pass(git_oid_fromstr(&oid, "a65fedf39aefe402d3bb6e24df4d4f5fe4547750"));
+	cl_git_pass(git_revwalk_push(_walk, &oid));
+
+	while (git_revwalk_next(&oid, _walk) == 0)
+		i++;
+
+	/* git log --oneline a65fedf | wc -l => 7 */
+	cl_assert_equal_i(7, i);
+}
+
+void test_revwalk_pathspec__hidden_history_is_not_simplified_into(void)
+{
+	/* git rev-list a65fedf ^763d71a -- branch_file.txt */
+	static const char *merge_shown[] = {
+		"a65fedf39aefe402d3bb6e24df4d4f5fe4547750",
+		"be3563ae3f795b2b4353bcce3a527ad0a4f7f644",
+		NULL
+	};
+
+	/* git rev-list a65fedf ^c47800c -- branch_file.txt */
+	static const char *merge_hidden[] = {
+		"a65fedf39aefe402d3bb6e24df4d4f5fe4547750",
+		NULL
+	};
+
+	/* git rev-list a65fedf ^9fd738e -- branch_file.txt */
+	static const char *side_branch[] = {
+		"a65fedf39aefe402d3bb6e24df4d4f5fe4547750",
+		"c47800c7266a2be04c571c04d5a6614691ea99bd",
+		NULL
+	};
+
+	/* git rev-list a65fedf ^763d71a -- README */
+	static const char *readme_hidden[] = {
+		"4a202b346bb0fb0db7eff3cffeb3c70babbd2045",
+		NULL
+	};
+
+	set_pathspec("branch_file.txt", NULL);
+
+	/* be3563a is only the same as c47800c, which was reached from 763d71a */
+	assert_walk(GIT_SORT_TIME, "a65fedf39aefe402d3bb6e24df4d4f5fe4547750",
+		"763d71aadf09a7951596c9746c024e7eece7c7af", merge_shown);
+	assert_walk(GIT_SORT_TOPOLOGICAL, "a65fedf39aefe402d3bb6e24df4d4f5fe4547750",
+		"763d71aadf09a7951596c9746c024e7eece7c7af", merge_shown);
+
+	/* but the hidden commits themselves still count */
+	assert_walk(GIT_SORT_TIME, "a65fedf39aefe402d3bb6e24df4d4f5fe4547750",
+		"c47800c7266a2be04c571c04d5a6614691ea99bd", merge_hidden);
+	assert_walk(GIT_SORT_TIME, "a65fedf39aefe402d3bb6e24df4d4f5fe4547750",
+		"9fd738e8f7967c078dceed8190330fc8648ee56a", side_branch);
+
+	/* the same walk without hidden commits simplifies the merge again */
+	assert_walk(GIT_SORT_TIME, "a65fedf39aefe402d3bb6e24df4d4f5fe4547750",
+		NULL, branch_file);
+
+	set_pathspec("README", NULL);
+	assert_walk(GIT_SORT_TIME, "a65fedf39aefe402d3bb6e24df4d4f5fe4547750",
+		"763d71aadf09a7951596c9746c024e7eece7c7af", readme_hidden);
+}
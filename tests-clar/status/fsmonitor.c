@@ -0,0 +1,223 @@
+#include "clar_libgit2.h"
+#include "fileops.h"
+#include "index.h"
+
+static git_repository *g_repo;
+static git_buf g_status;
+
+typedef struct {
+	git_fsmonitor parent;
+	const char *changed[4];
+	int queries;
+	char token[16];
+	int *freed;
+} fake_fsmonitor;
+
+static int fake_query(
+	git_fsmonitor *fsmonitor,
+	const char **token,
+	const char *since,
+	git_fsmonitor_changed_cb changed,
+	void *payload)
+{
+	fake_fsmonitor *fake = (fake_fsmonitor *)fsmonitor;
+	bool known = (since != NULL && strcmp(since, fake->token) == 0);
+	size_t i;
+
+	p_snprintf(fake->token, sizeof(fake->token), "fake:%d", ++fake->queries);
+	*token = fake->token;
+
+	if (!known)
+		return GIT_ENOTFOUND;
+
+	for (i = 0; i < ARRAY_SIZE(fake->changed) && fake->changed[i]; ++i)
+		cl_git_pass(changed(fake->changed[i], payload));
+
+	memset(fake->changed, 0, sizeof(fake->changed));
+	return 0;
+}
+
+static void fake_free(git_fsmonitor *fsmonitor)
+{
+	fake_fsmonitor *fake = (fake_fsmonitor *)fsmonitor;
+
+	if (fake->freed)
+		(*fake->freed)++;
+	git__free(fake);
+}
+
+static fake_fsmonitor *fake_fsmonitor_new(void)
+{
+	fake_fsmonitor *fake = git__calloc(1, sizeof(fake_fsmonitor));
+
+	cl_assert(fake != NULL);
+	fake->parent.query = fake_query;
+	fake->parent.free = fake_free;
+
+	cl_git_pass(git_repository_set_fsmonitor(g_repo, &fake->parent));
+	return fake;
+}
+
+void test_status_fsmonitor__initialize(void)
+{
+	g_repo = cl_git_sandbox_init("status");
+}
+
+void test_status_fsmonitor__cleanup(void)
+{
+	git_buf_free(&g_status);
+	cl_git_sandbox_cleanup();
+}
+
+static int collect_status(const char *path, unsigned int status, void *payload)
+{
+	return git_buf_printf((git_buf *)payload, "%s:%u\n", path, status);
+}
+
+static const char *status_list(void)
+{
+	git_status_options opts;
+
+	memset(&opts, 0, sizeof(opts));
+	opts.show = GIT_STATUS_SHOW_INDEX_AND_WORKDIR;
+	opts.flags = GIT_STATUS_OPT_INCLUDE_UNTRACKED |
+		GIT_STATUS_OPT_RECURSE_UNTRACKED_DIRS;
+
+	/* so that every path follows a newline */
+	git_buf_sets(&g_status, "\n");
+	cl_git_pass(git_status_foreach_ext(g_repo, &opts, collect_status, &g_status));
+
+	return g_status.ptr;
+}
+
+static bool is_valid(git_repository *repo, const char *path)
+{
+	git_index *index;
+	git_index_entry *entry;
+	bool valid;
+
+	cl_git_pass(git_repository_index(&index, repo));
+	cl_assert((entry = git_index_get(index, git_index_find(index, path))) != NULL);
+	valid = ((entry->flags_extended & GIT_IDXENTRY_FSMONITOR_VALID) != 0);
+	git_index_free(index);
+
+	return valid;
+}
+
+void test_status_fsmonitor__unreported_changes_are_not_seen(void)
+{
+	fake_fsmonitor *fake = fake_fsmonitor_new();
+	char *expected;
+
+	cl_assert((expected = git__strdup(status_list())) != NULL);
+	cl_assert_equal_i(1, fake->queries);
+	cl_assert(is_valid(g_repo, "current_file"));
+	cl_assert(!is_valid(g_repo, "modified_file"));
+
+	cl_git_rewritefile("status/current_file", "changed behind our back\n");
+	cl_assert_equal_s(expected, status_list());
+
+	fake->changed[0] = "current_file";
+	cl_assert(strstr(status_list(), "\ncurrent_file:") != NULL);
+	cl_assert(!is_valid(g_repo, "current_file"));
+
+	git__free(expected);
+}
+
+void test_status_fsmonitor__directories_stand_for_everything_below(void)
+{
+	fake_fsmonitor *fake = fake_fsmonitor_new();
+
+	cl_assert(strstr(status_list(), "subdir/current_file:") == NULL);
+	cl_assert(is_valid(g_repo, "subdir/current_file"));
+
+	cl_git_rewritefile("status/subdir/current_file", "changed behind our back\n");
+	cl_assert(strstr(status_list(), "subdir/current_file:") == NULL);
+
+	fake->changed[0] = "subdir/";
+	cl_assert(strstr(status_list(), "subdir/current_file:") != NULL);
+}
+
+void test_status_fsmonitor__lost_track_checks_everything(void)
+{
+	fake_fsmonitor *fake = fake_fsmonitor_new();
+	git_index *index;
+
+	status_list();
+	cl_git_rewritefile("status/current_file", "changed behind our back\n");
+
+	/* a token the monitor does not know about */
+	cl_git_pass(git_repository_index(&index, g_repo));
+	git__free(index->fsmonitor_token);
+	index->fsmonitor_token = git__strdup("somebody else");
+	git_index_free(index);
+
+	cl_assert(strstr(status_list(), "\ncurrent_file:") != NULL);
+	cl_assert_equal_i(2, fake->queries);
+}
+
+void test_status_fsmonitor__is_written_to_the_index(void)
+{
+	git_repository *repo;
+	git_index *index;
+
+	fake_fsmonitor_new();
+	status_list();
+
+	cl_git_pass(git_repository_index(&index, g_repo));
+	cl_git_pass(git_index_write(index));
+	git_index_free(index);
+
+	cl_git_pass(git_repository_open(&repo, "status"));
+	cl_git_pass(git_repository_index(&index, repo));
+
+	cl_assert_equal_s("fake:1", index->fsmonitor_token);
+	cl_assert(is_valid(repo, "current_file"));
+	cl_assert(is_valid(repo, "subdir/current_file"));
+	cl_assert(!is_valid(repo, "modified_file"));
+
+	git_index_free(index);
+	git_repository_free(repo);
+}
+
+void test_status_fsmonitor__repository_frees_the_monitor(void)
+{
+	fake_fsmonitor *fake = fake_fsmonitor_new();
+	int freed = 0;
+
+	fake->freed = &freed;
+	cl_git_pass(git_repository_set_fsmonitor(g_repo, &fake->parent));
+	cl_assert_equal_i(0, freed);
+
+	cl_git_pass(git_repository_set_fsmonitor(g_repo, NULL));
+	cl_assert_equal_i(1, freed);
+}
+
+void test_status_fsmonitor__inotify(void)
+{
+#ifdef __linux__
+	git_fsmonitor *fsmonitor;
+
+	cl_git_pass(git_fsmonitor_inotify_new(&fsmonitor, g_repo));
+	cl_git_pass(git_repository_set_fsmonitor(g_repo, fsmonitor));
+
+	cl_assert(strstr(status_list(), "\ncurrent_file:") == NULL);
+	cl_assert(is_valid(g_repo, "current_file"));
+	cl_assert(is_valid(g_repo, "subdir/current_file"));
+
+	cl_git_rewritefile("status/current_file", "changed behind our back\n");
+	cl_assert(strstr(status_list(), "\ncurrent_file:") != NULL);
+
+	cl_git_pass(p_rename("status/subdir", "status/moved"));
+	cl_assert(strstr(status_list(), "moved/current_file:") != NULL);
+	cl_assert(strstr(g_status.ptr, "subdir/current_file:") != NULL);
+
+	cl_git_pass(p_rename("status/moved", "status/subdir"));
+	cl_git_rewritefile("status/subdir/current_file", "changed behind our back\n");
+	cl_assert(strstr(status_list(), "subdir/current_file:") != NULL);
+	cl_assert(strstr(g_status.ptr, "moved/") == NULL);
+#else
+	git_fsmonitor *fsmonitor;
+	cl_git_fail(git_fsmonitor_inotify_new(&fsmonitor, g_repo));
+#endif
+}
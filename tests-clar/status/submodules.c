@@ -2,6 +2,7 @@
 #include "buffer.h"
 #include "path.h"
 #include "posix.h"
+#include "iterator.h"
 #include "status_helpers.h"
 #include "../submodule/submodule_helpers.h"
 
@@ -104,3 +105,34 @@ void test_status_submodules__single_file(void)
 	cl_git_pass( git_status_file(&status, g_repo, "testrepo") );
 	cl_assert(!status);
 }
+
+void test_status_submodules__workdir_iterator_finds_gitlinks(void)
+{
+	git_iterator *i;
+	const git_index_entry *entry;
+	bool found = false;
+
+	/* looks like a submodule, but is not one */
+	cl_git_pass(p_mkdir("submodules/plain", 0777));
+	cl_git_pass(p_mkdir("submodules/plain/.git", 0777));
+	cl_git_mkfile("submodules/plain/file", "file\n");
+
+	cl_git_pass(git_iterator_for_workdir(&i, g_repo));
+	cl_git_pass(git_iterator_current(i, &entry));
+
+	while (entry != NULL) {
+		if (strcmp(entry->path, "testrepo") == 0) {
+			cl_assert(S_ISGITLINK(entry->mode));
+			found = true;
+		} else
+			cl_assert(!S_ISGITLINK(entry->mode));
+
+		if (strcmp(entry->path, "plain/") == 0)
+			cl_assert(S_ISDIR(entry->mode));
+
+		cl_git_pass(git_iterator_advance(i, &entry));
+	}
+
+	git_iterator_free(i);
+	cl_assert(found);
+}
@@ -0,0 +1,173 @@
+#include "clar_libgit2.h"
+#include "fileops.h"
+#include "index.h"
+#include "posix.h"
+
+static git_repository *g_repo;
+static git_buf g_status;
+
+void test_status_untracked_cache__initialize(void)
+{
+	git_config *cfg;
+
+	g_repo = cl_git_sandbox_init("status");
+
+	cl_git_pass(git_repository_config(&cfg, g_repo));
+	cl_git_pass(git_config_set_bool(cfg, "core.untrackedcache", 1));
+	git_config_free(cfg);
+}
+
+void test_status_untracked_cache__cleanup(void)
+{
+	git_buf_free(&g_status);
+	cl_git_sandbox_cleanup();
+}
+
+static int collect_status(const char *path, unsigned int status, void *payload)
+{
+	return git_buf_printf((git_buf *)payload, "%s:%u\n", path, status);
+}
+
+static const char *status_list(void)
+{
+	git_status_options opts;
+
+	memset(&opts, 0, sizeof(opts));
+	opts.show = GIT_STATUS_SHOW_INDEX_AND_WORKDIR;
+	opts.flags = GIT_STATUS_OPT_INCLUDE_UNTRACKED |
+		GIT_STATUS_OPT_RECURSE_UNTRACKED_DIRS;
+
+	git_buf_clear(&g_status);
+	cl_git_pass(git_status_foreach_ext(g_repo, &opts, collect_status, &g_status));
+
+	return g_status.ptr;
+}
+
+static git_untracked_dir *cached_dir(git_repository *repo, const char *path)
+{
+	git_index *index;
+	git_untracked_dir *dir;
+
+	cl_git_pass(git_repository_index(&index, repo));
+	cl_assert(index->untracked != NULL);
+	cl_assert((dir = git_untracked_cache_lookup(index->untracked, path)) != NULL);
+	git_index_free(index);
+
+	return dir;
+}
+
+/*
+ * Directories that were just read are not trusted until their mtime
+ * is in the past; pretend that this one has been left alone since.
+ */
+static void settle(const char *path)
+{
+	git_untracked_dir *dir = cached_dir(g_repo, path);
+	git_buf full = GIT_BUF_INIT;
+	struct stat st;
+
+	cl_git_pass(git_buf_joinpath(&full, "status", path));
+	cl_git_pass(p_stat(full.ptr, &st));
+	git_buf_free(&full);
+
+	git_untracked_stat_from(&dir->st, &st);
+	dir->valid = 1;
+}
+
+static bool is_untracked(git_untracked_dir *dir, const char *name)
+{
+	return (git_vector_bsearch(&dir->untracked, name) >= 0);
+}
+
+void test_status_untracked_cache__same_results_as_without_cache(void)
+{
+	git_config *cfg;
+	char *expected;
+
+	cl_assert((expected = git__strdup(status_list())) != NULL);
+
+	settle("");
+	settle("subdir/");
+	cl_assert_equal_s(expected, status_list());
+
+	cl_git_pass(git_repository_config(&cfg, g_repo));
+	cl_git_pass(git_config_set_bool(cfg, "core.untrackedcache", 0));
+	git_config_free(cfg);
+
+	cl_assert_equal_s(expected, status_list());
+	git__free(expected);
+}
+
+void test_status_untracked_cache__unchanged_directories_are_not_read(void)
+{
+	cl_assert(strstr(status_list(), "subdir/new_file:") != NULL);
+
+	cl_git_mkfile("status/subdir/sneaky", "sneaky\n");
+	settle("subdir/");
+
+	cl_assert(strstr(status_list(), "subdir/sneaky") == NULL);
+	cl_assert(strstr(g_status.ptr, "subdir/new_file:") != NULL);
+}
+
+void test_status_untracked_cache__index_changes_invalidate_directories(void)
+{
+	git_index *index;
+
+	cl_assert(strstr(status_list(), "subdir/current_file:") == NULL);
+	settle("");
+	settle("subdir/");
+
+	cl_git_pass(git_repository_index(&index, g_repo));
+	cl_git_pass(git_index_remove(index, git_index_find(index, "subdir/current_file")));
+	git_index_free(index);
+
+	cl_assert(!cached_dir(g_repo, "subdir/")->valid);
+	cl_assert(strstr(status_list(), "subdir/current_file:") != NULL);
+}
+
+void test_status_untracked_cache__ignore_changes_are_noticed(void)
+{
+	cl_git_mkfile("status/subdir/.gitignore", "nothing\n");
+
+	cl_assert(strstr(status_list(), "subdir/new_file:") != NULL);
+	settle("");
+	settle("subdir/");
+
+	cl_git_rewritefile("status/subdir/.gitignore", "new_file\n");
+	cl_assert(strstr(status_list(), "subdir/new_file:") == NULL);
+
+	cl_assert(strstr(g_status.ptr, "\nnew_file:") != NULL);
+	settle("");
+
+	cl_git_append2file("status/.git/info/exclude", "\nnew_file\n");
+	cl_assert(strstr(status_list(), "\nnew_file:") == NULL);
+}
+
+void test_status_untracked_cache__is_written_to_the_index(void)
+{
+	git_repository *repo;
+	git_index *index;
+	git_untracked_dir *root, *subdir;
+
+	status_list();
+	settle("");
+	settle("subdir/");
+
+	cl_git_pass(git_repository_index(&index, g_repo));
+	cl_git_pass(git_index_write(index));
+	git_index_free(index);
+
+	cl_git_pass(git_repository_open(&repo, "status"));
+
+	root = cached_dir(repo, "");
+	cl_assert(root->valid);
+	cl_assert(is_untracked(root, "new_file"));
+	cl_assert(!is_untracked(root, "ignored_file"));
+	cl_assert(!is_untracked(root, "current_file"));
+
+	subdir = cached_dir(repo, "subdir/");
+	cl_assert(is_untracked(subdir, "new_file"));
+	cl_assert(!is_untracked(subdir, "current_file"));
+
+	git_repository_free(repo);
+}
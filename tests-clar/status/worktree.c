@@ -5,6 +5,8 @@
 #include "posix.h"
 #include "util.h"
 #include "path.h"
+#include "index.h"
+#include "repository.h"
 
 /**
  * Initializer
@@ -841,3 +843,211 @@ void test_status_worktree__line_endings_dont_count_as_changes_with_autocrlf(void
 
 	cl_assert_equal_i(GIT_STATUS_CURRENT, status);
 }
+
+void test_status_worktree__whole_repository_on_several_threads(void)
+{
+	status_entry_counts counts;
+	git_repository *repo = cl_git_sandbox_init("status");
+	git_config *config;
+	git_index *index;
+	unsigned int status;
+
+	cl_git_pass(git_repository_index(&index, repo));
+	index->threads = 4;
+
+	memset(&counts, 0x0, sizeof(status_entry_counts));
+	counts.expected_entry_count = entry_count0;
+	counts.expected_paths = entry_paths0;
+	counts.expected_statuses = entry_statuses0;
+
+	cl_git_pass(
+		git_status_foreach(repo, cb_status__normal, &counts)
+	);
+
+	cl_assert_equal_i(counts.expected_entry_count, counts.entry_count);
+	cl_assert_equal_i(0, counts.wrong_status_flags_count);
+	cl_assert_equal_i(0, counts.wrong_sorted_path);
+
+	/* files that look just like their entry are not hashed again */
+	cl_git_pass(git_index_add(index, "current_file", 0));
+	cl_git_pass(git_status_file(&status, repo, "current_file"));
+	cl_assert_equal_i(GIT_STATUS_CURRENT, status);
+
+	cl_git_rewritefile("status/current_file", "different\n");
+	cl_git_pass(git_status_file(&status, repo, "current_file"));
+	cl_assert_equal_i(GIT_STATUS_WT_MODIFIED, status);
+
+	/* the filters are applied on the other threads too */
+	cl_git_pass(git_repository_config(&config, repo));
+	cl_git_pass(git_config_set_bool(config, "core.autocrlf", true));
+	git_config_free(config);
+	git_repository__cvar_cache_clear(repo);
+
+	cl_git_rewritefile("status/current_file", "current_file\r\n");
+	cl_git_rewritefile("status/subdir/current_file", "subdir/current_file\r\n");
+
+	cl_git_pass(git_status_file(&status, repo, "current_file"));
+	cl_assert_equal_i(GIT_STATUS_CURRENT, status);
+	cl_git_pass(git_status_file(&status, repo, "subdir/current_file"));
+	cl_assert_equal_i(GIT_STATUS_CURRENT, status);
+
+	git_index_free(index);
+}
+
+static void set_mtime(const char *path, time_t mtime)
+{
+	struct timeval times[2];
+
+	times[0].tv_sec = mtime;
+	times[0].tv_usec = 0;
+	times[1].tv_sec = mtime;
+	times[1].tv_usec = 0;
+
+	cl_git_pass(p_utimes(path, times));
+}
+
+static void trust_ctime(git_repository *repo, bool value)
+{
+	git_config *config;
+
+	cl_git_pass(git_repository_config(&config, repo));
+	cl_git_pass(git_config_set_bool(config, "core.trustctime", value));
+	git_config_free(config);
+}
+
+void test_status_worktree__racily_clean_entries_are_hashed(void)
+{
+	git_repository *repo = cl_git_sandbox_init("status");
+	time_t then = time(NULL) - 100;
+	git_index *index;
+	unsigned int status;
+
+	trust_ctime(repo, false);
+
+	/* the file and the index were written in the same second */
+	set_mtime("status/current_file", then);
+	cl_git_pass(git_repository_index(&index, repo));
+	cl_git_pass(git_index_add(index, "current_file", 0));
+	cl_git_pass(git_index_write(index));
+	git_index_free(index);
+	set_mtime("status/.git/index", then);
+
+	cl_git_pass(git_repository_open(&repo, "status"));
+	cl_git_pass(git_status_file(&status, repo, "current_file"));
+	cl_assert_equal_i(GIT_STATUS_CURRENT, status);
+
+	/* and the file changed again after that, in that same second */
+	cl_git_rewritefile("status/current_file", "CURRENT_FILE\n");
+	set_mtime("status/current_file", then);
+
+	cl_git_pass(git_status_file(&status, repo, "current_file"));
+	cl_assert_equal_i(GIT_STATUS_WT_MODIFIED, status);
+
+	git_repository_free(repo);
+}
+
+static const git_index_entry *entry_in_new_repo(
+	git_repository **repo, git_index **index, const char *path)
+{
+	cl_git_pass(git_repository_open(repo, "status"));
+	cl_git_pass(git_repository_index(index, *repo));
+
+	return git_index_get(*index, git_index_find(*index, path));
+}
+
+void test_status_worktree__update_index_stores_the_stat_data(void)
+{
+	git_repository *repo = cl_git_sandbox_init("status"), *reopened;
+	time_t then = time(NULL) - 100;
+	git_status_options opts;
+	const git_index_entry *entry;
+	git_index *index;
+	struct stat st;
+	unsigned int status;
+	int count = 0;
+
+	set_mtime("status/current_file", then);
+	cl_git_rewritefile("status/subdir/current_file", "subdir/current_file\n");
+
+	memset(&opts, 0, sizeof(opts));
+	opts.show = GIT_STATUS_SHOW_INDEX_AND_WORKDIR;
+	opts.flags = GIT_STATUS_OPT_UPDATE_INDEX;
+	cl_git_pass(git_status_foreach_ext(repo, &opts, cb_status__count, &count));
+
+	cl_git_pass(p_lstat("status/current_file", &st));
+	entry = entry_in_new_repo(&reopened, &index, "current_file");
+	cl_assert(entry != NULL);
+	cl_assert_equal_i((int)st.st_mtime, (int)entry->mtime.seconds);
+	cl_assert_equal_i((int)st.st_ino, (int)entry->ino);
+	cl_assert_equal_i((int)st.st_size, (int)entry->file_size);
+
+	/* what might still change within this second is left alone */
+	cl_git_pass(p_lstat("status/subdir/current_file", &st));
+	entry = git_index_get(index, git_index_find(index, "subdir/current_file"));
+	cl_assert(entry != NULL);
+	cl_assert((int)st.st_mtime != (int)entry->mtime.seconds);
+
+	git_index_free(index);
+	git_repository_free(reopened);
+
+	/* from now on the file is only looked at through its stat data */
+	trust_ctime(repo, false);
+	cl_git_rewritefile("status/current_file", "CURRENT_FILE\n");
+	set_mtime("status/current_file", then);
+
+	cl_git_pass(git_status_file(&status, repo, "current_file"));
+	cl_assert_equal_i(GIT_STATUS_CURRENT, status);
+}
+
+static void age_workdir_file(const char *path, time_t mtime)
+{
+	git_buf full = GIT_BUF_INIT;
+	struct stat st;
+
+	cl_git_pass(git_buf_joinpath(&full, "status", path));
+	if (p_lstat(full.ptr, &st) == 0)
+		set_mtime(full.ptr, mtime);
+
+	git_buf_free(&full);
+}
+
+void test_status_worktree__update_index_leaves_a_clean_index_alone(void)
+{
+	git_repository *repo = cl_git_sandbox_init("status");
+	time_t then = time(NULL) - 100;
+	git_buf before = GIT_BUF_INIT, after = GIT_BUF_INIT;
+	git_status_options opts;
+	git_index *index;
+	struct stat st;
+	unsigned int i;
+	int count = 0;
+
+	/* old enough for every unchanged file to be stored on the first run */
+	cl_git_pass(git_repository_index(&index, repo));
+	for (i = 0; i < git_index_entrycount(index); ++i)
+		age_workdir_file(git_index_get(index, i)->path, then);
+	git_index_free(index);
+
+	memset(&opts, 0, sizeof(opts));
+	opts.show = GIT_STATUS_SHOW_INDEX_AND_WORKDIR;
+	opts.flags = GIT_STATUS_OPT_UPDATE_INDEX;
+	cl_git_pass(git_status_foreach_ext(repo, &opts, cb_status__count, &count));
+
+	/* later than the files, so that none of them is racy */
+	set_mtime("status/.git/index", then + 50);
+	cl_git_pass(git_futils_readbuffer(&before, "status/.git/index"));
+
+	/* nothing is hashed the second time, so there is nothing to store */
+	cl_git_pass(git_repository_open(&repo, "status"));
+	cl_git_pass(git_status_foreach_ext(repo, &opts, cb_status__count, &count));
+	git_repository_free(repo);
+
+	cl_git_pass(p_stat("status/.git/index", &st));
+	cl_assert_equal_i((int)then + 50, (int)st.st_mtime);
+	cl_git_pass(git_futils_readbuffer(&after, "status/.git/index"));
+	cl_assert_equal_i((int)before.size, (int)after.size);
+	cl_assert(memcmp(before.ptr, after.ptr, before.size) == 0);
+
+	git_buf_free(&before);
+	git_buf_free(&after);
+}